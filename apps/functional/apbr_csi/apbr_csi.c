@@ -1,16 +1,470 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "apbr_csi"
+#define LOG_TAG "CSI"
+
+#define MAX_SIZES       16
+#define FRAME_TIMEOUT   2000
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct csi_info {
+    int         case_id;
+    char        *devname;
+    char        *card;
+    uint32_t    fourcc;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    nbufs;
+    int         frames;
+    int         warmup;
+    int         touch;
+    int         max_dropped;
+};
 
-void usage()
+struct csi_result {
+    uint32_t            frames;
+    uint32_t            dropped;
+    uint64_t            bytes;
+    uint64_t            elapsed_ns;
+    uint64_t            cpu_ns;
+    uint32_t            checksum;
+    struct test_stats   interval_us;
+    struct test_stats   latency_us;
+};
+
+/**
+ * @brief Print usage of this CSI bandwidth test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] [-d device] [-f fourcc] [-s WxH]"
+           " [-b bufs]\n"
+           "          [-D drm-card] [-n frames] [-w warmup] [-t]"
+           " [-x max-dropped]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: V4L2 capture device behind the bridge CSI-2 receiver\n"
+           "        (default /dev/video0).\n");
+    printf("    -f: pixel format (default the first enumerated).\n");
+    printf("    -s: frame size (default the largest enumerated).\n");
+    printf("    -b: buffers in the queue (default 4).\n");
+    printf("    -D: capture into dumb buffers of this DRM card, imported as\n"
+           "        DMABUF, instead of MMAP buffers of the capture device.\n");
+    printf("    -n: frames measured (default 600).\n");
+    printf("    -w: frames discarded before measuring (default 10).\n");
+    printf("    -t: read every frame to include memory cost in CPU time.\n");
+    printf("    -x: fail if more frames are dropped.\n");
+    printf("Example : vivid into vkms buffers\n");
+    printf("     ./%s -d /dev/video0 -D /dev/dri/card0 -f YUYV\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct csi_info *info, int argc, char **argv)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:f:s:b:D:n:w:tx:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'd':
+            info->devname = optarg;
+            break;
+        case 'f':
+            if (strlen(optarg) != 4) {
+                return -EINVAL;
+            }
+            info->fourcc = v4l2_fourcc(optarg[0], optarg[1], optarg[2],
+                                       optarg[3]);
+            break;
+        case 's':
+            if (sscanf(optarg, "%ux%u", &info->width, &info->height) != 2) {
+                return -EINVAL;
+            }
+            break;
+        case 'b':
+            info->nbufs = atoi(optarg);
+            break;
+        case 'D':
+            info->card = optarg;
+            break;
+        case 'n':
+            info->frames = atoi(optarg);
+            break;
+        case 'w':
+            info->warmup = atoi(optarg);
+            break;
+        case 't':
+            info->touch = 1;
+            break;
+        case 'x':
+            info->max_dropped = atoi(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (info->nbufs < 1 || info->nbufs > V4L2_MAX_BUFFERS ||
+        info->frames < 2 || info->warmup < 0) {
+        return -EINVAL;
+    }
+
     return 0;
 }
+
+/**
+ * @brief Pick the format and the largest frame size, then apply them
+ *
+ * @param info The test parameters
+ * @param stream The opened stream
+ * @return 0 on success, negative errno on failure
+ */
+static int select_format(struct csi_info *info, struct v4l2_stream *stream)
+{
+    uint32_t width[MAX_SIZES], height[MAX_SIZES];
+    int n, i;
+
+    if (!info->fourcc && v4l2_enum_formats(stream, &info->fourcc, 1) != 1) {
+        return -ENODEV;
+    }
+
+    if (!info->width) {
+        n = v4l2_enum_sizes(stream, info->fourcc, width, height, MAX_SIZES);
+        for (i = 0; i < n; i++) {
+            if ((uint64_t)width[i] * height[i] >
+                (uint64_t)info->width * info->height) {
+                info->width = width[i];
+                info->height = height[i];
+            }
+        }
+        if (!info->width) {
+            return -ENODEV;
+        }
+    }
+
+    return v4l2_set_format(stream, info->fourcc, info->width, info->height);
+}
+
+/**
+ * @brief Sum frame data so that the CPU cost includes reading the pixels
+ *
+ * @param data Frame data
+ * @param len Frame size in bytes
+ * @return Checksum of the frame
+ */
+static uint32_t touch_frame(const void *data, uint32_t len)
+{
+    const uint32_t *p = data;
+    uint32_t sum = 0, i;
+
+    for (i = 0; p && i < len / sizeof(*p); i++) {
+        sum += p[i];
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Start streaming into dumb buffers of a DRM card
+ *
+ * @param info The test parameters
+ * @param stream The stream with its format set
+ * @param disp The display device, opened here
+ * @param bufs The dumb buffers, created here
+ * @param fds The exported dma-buf descriptors
+ * @return 0 on success, negative errno on failure
+ */
+static int start_dmabuf(struct csi_info *info, struct v4l2_stream *stream,
+                        struct kms_display *disp, struct kms_buffer *bufs,
+                        int *fds)
+{
+    void *maps[V4L2_MAX_BUFFERS];
+    uint32_t i, width;
+    int ret;
+
+    /* A capture device does not need a connected output */
+    disp->fd = open(info->card, O_RDWR | O_CLOEXEC);
+    if (disp->fd < 0) {
+        return -errno;
+    }
+
+    /* 8 bpp dumb buffers of the image height, wide enough for sizeimage */
+    width = (stream->sizeimage + stream->height - 1) / stream->height;
+    for (i = 0; i < info->nbufs; i++) {
+        ret = kms_buffer_create(disp, &bufs[i], width, stream->height, 8, 0);
+        if (ret) {
+            return ret;
+        }
+        fds[i] = kms_buffer_export(disp, &bufs[i]);
+        if (fds[i] < 0) {
+            return fds[i];
+        }
+        maps[i] = bufs[i].map;
+    }
+
+    return v4l2_stream_start_dmabuf(stream, fds, maps,
+                                    (uint32_t)bufs[0].size, info->nbufs);
+}
+
+/**
+ * @brief Capture at full rate and measure
+ *
+ * @param info The test parameters
+ * @param stream The streaming stream
+ * @param result Output measurements
+ * @return 0 on success, negative errno on failure
+ */
+static int capture(struct csi_info *info, struct v4l2_stream *stream,
+                   struct csi_result *result)
+{
+    struct v4l2_frame frame;
+    uint64_t first_ts = 0, prev_ts = 0, ts, now, cpu_start;
+    uint32_t prev_seq = 0;
+    int i, ret;
+
+    for (i = 0; i < info->warmup; i++) {
+        ret = v4l2_stream_dequeue(stream, &frame, FRAME_TIMEOUT);
+        if (!ret) {
+            ret = v4l2_stream_queue(stream, &frame);
+        }
+        if (ret) {
+            return ret;
+        }
+    }
+
+    cpu_start = get_cpu_time_ns();
+
+    for (i = 0; i < info->frames; i++) {
+        ret = v4l2_stream_dequeue(stream, &frame, FRAME_TIMEOUT);
+        if (ret) {
+            return ret;
+        }
+        now = get_time_ns();
+
+        if ((frame.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+            V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC && frame.timestamp_ns) {
+            ts = frame.timestamp_ns;
+            if (now > ts) {
+                stats_add(&result->latency_us, (now - ts) / 1000);
+            }
+        } else {
+            ts = now;
+        }
+
+        if (i == 0) {
+            first_ts = ts;
+        } else {
+            stats_add(&result->interval_us, (ts - prev_ts) / 1000);
+            if (frame.sequence > prev_seq + 1) {
+                result->dropped += frame.sequence - prev_seq - 1;
+            }
+            result->bytes += frame.bytesused;
+        }
+        prev_ts = ts;
+        prev_seq = frame.sequence;
+
+        if (info->touch) {
+            result->checksum += touch_frame(frame.data, frame.bytesused);
+        }
+
+        ret = v4l2_stream_queue(stream, &frame);
+        if (ret) {
+            return ret;
+        }
+        result->frames++;
+    }
+
+    result->cpu_ns = get_cpu_time_ns() - cpu_start;
+    result->elapsed_ns = prev_ts - first_ts;
+
+    return 0;
+}
+
+/**
+ * @brief Print fps, line rate, bandwidth, drops and CPU cost
+ *
+ * Rates are over the frames after the first, timed between the first and
+ * last frame timestamps.
+ *
+ * @param info The test parameters
+ * @param stream The stream with the applied format
+ * @param result The measurements
+ * @return None
+ */
+static void print_result(struct csi_info *info, struct v4l2_stream *stream,
+                         struct csi_result *result)
+{
+    char fourcc[5], interval[128], latency[128], buf[640];
+    uint64_t intervals = result->frames - 1, fps_x100 = 0, bps = 0;
+
+    if (result->elapsed_ns) {
+        fps_x100 = intervals * 100000000000ULL / result->elapsed_ns;
+        bps = result->bytes * 1000000000ULL / result->elapsed_ns;
+    }
+
+    v4l2_fourcc_str(stream->pixfmt, fourcc);
+    stats_format(&result->interval_us, interval, sizeof(interval));
+    stats_format(&result->latency_us, latency, sizeof(latency));
+
+    snprintf(buf, sizeof(buf), "memory=%s fmt=%s size=%ux%u bufs=%u "
+             "frames=%u fps=%llu.%02llu lines_per_s=%llu bytes_per_s=%llu "
+             "dropped=%u cpu_us_per_frame=%llu interval_us(%s) "
+             "latency_us(%s)", info->card ? "dmabuf" : "mmap", fourcc,
+             stream->width, stream->height, stream->nbufs, result->frames,
+             (unsigned long long)(fps_x100 / 100),
+             (unsigned long long)(fps_x100 % 100),
+             (unsigned long long)(fps_x100 * stream->height / 100),
+             (unsigned long long)bps, result->dropped,
+             (unsigned long long)(result->cpu_ns / 1000 / result->frames),
+             interval, latency);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+}
+
+/**
+ * @brief Set up the stream, capture and report
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int apbr_csi_run(struct csi_info *info)
+{
+    struct kms_buffer bufs[V4L2_MAX_BUFFERS];
+    int fds[V4L2_MAX_BUFFERS];
+    struct kms_display disp;
+    struct v4l2_stream stream;
+    struct csi_result result;
+    uint32_t i;
+    int ret;
+
+    memset(bufs, 0, sizeof(bufs));
+    memset(&result, 0, sizeof(result));
+    stats_reset(&result.interval_us);
+    stats_reset(&result.latency_us);
+    memset(&disp, 0, sizeof(disp));
+    disp.fd = -1;
+    for (i = 0; i < V4L2_MAX_BUFFERS; i++) {
+        fds[i] = -1;
+    }
+
+    ret = v4l2_open(&stream, info->devname);
+    if (ret) {
+        return ret;
+    }
+
+    ret = select_format(info, &stream);
+    if (!ret) {
+        if (info->card) {
+            ret = start_dmabuf(info, &stream, &disp, bufs, fds);
+        } else {
+            ret = v4l2_stream_start(&stream, info->nbufs);
+        }
+    }
+
+    if (!ret) {
+        ret = capture(info, &stream, &result);
+        if (result.frames > 1) {
+            print_result(info, &stream, &result);
+        }
+    }
+
+    v4l2_close(&stream);
+    for (i = 0; i < V4L2_MAX_BUFFERS; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+        if (disp.fd >= 0) {
+            kms_buffer_destroy(&disp, &bufs[i]);
+        }
+    }
+    if (disp.fd >= 0) {
+        close(disp.fd);
+    }
+
+    if (!ret && info->max_dropped >= 0 &&
+        result.dropped > (uint32_t)info->max_dropped) {
+        ret = -EPIPE;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief The apbr_csi main function
+ *
+ * @param argc The apbr_csi main arguments count
+ * @param argv The apbr_csi main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct csi_info info;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.devname = "/dev/video0";
+    info.nbufs = 4;
+    info.frames = 600;
+    info.warmup = 10;
+    info.max_dropped = -1;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    ret = apbr_csi_run(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
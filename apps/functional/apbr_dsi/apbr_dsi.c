@@ -1,16 +1,341 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "apbr_dsi"
+#define LOG_TAG "DSI"
 
-#include "stdio.h"
-#include "libfwtest.h"
+#define MAX_BUFFERS     4
+#define FLIP_TIMEOUT    1000
 
-void usage()
+struct dsi_info {
+    int         case_id;
+    char        *card;
+    uint32_t    width;
+    uint32_t    height;
+    int         nbufs;
+    int         frames;
+    int         draw;
+    int         max_dropped;
+};
+
+struct dsi_result {
+    uint32_t            frames;
+    uint32_t            dropped;
+    uint64_t            elapsed_ns;
+    uint64_t            cpu_ns;
+    struct test_stats   interval_us;
+    struct test_stats   flip_us;
+};
+
+/**
+ * @brief Print usage of this DSI bandwidth test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] [-D drm-card] [-s WxH] [-b bufs]"
+           " [-n frames] [-R]\n"
+           "          [-x max-dropped]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -D: DRM card driving the bridge DSI output "
+           "(default /dev/dri/card0).\n");
+    printf("    -s: mode size (default the preferred mode).\n");
+    printf("    -b: XRGB8888 dumb buffers flipped through, 2 to %d "
+           "(default 2).\n", MAX_BUFFERS);
+    printf("    -n: frames measured (default 600).\n");
+    printf("    -R: do not redraw the frames, flip only.\n");
+    printf("    -x: fail if more vblanks are missed.\n");
+    printf("Example : 1000 page flips on vkms\n");
+    printf("     ./%s -D /dev/dri/card0 -n 1000\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct dsi_info *info, int argc, char **argv)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "c:D:s:b:n:Rx:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'D':
+            info->card = optarg;
+            break;
+        case 's':
+            if (sscanf(optarg, "%ux%u", &info->width, &info->height) != 2) {
+                return -EINVAL;
+            }
+            break;
+        case 'b':
+            info->nbufs = atoi(optarg);
+            break;
+        case 'n':
+            info->frames = atoi(optarg);
+            break;
+        case 'R':
+            info->draw = 0;
+            break;
+        case 'x':
+            info->max_dropped = atoi(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (info->nbufs < 2 || info->nbufs > MAX_BUFFERS || info->frames < 2) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Draw a synthetic frame, a gradient with a moving bar
+ *
+ * Every pixel is written so each frame costs a full frame of memory
+ * bandwidth, as a real producer would.
+ *
+ * @param buf The buffer
+ * @param frame Frame number, moves the bar
+ * @return None
+ */
+static void draw_frame(struct kms_buffer *buf, uint32_t frame)
+{
+    uint32_t bar = (frame * 8) % buf->width, x, y, *line;
+
+    for (y = 0; y < buf->height; y++) {
+        line = (uint32_t *)((uint8_t *)buf->map + y * buf->pitch);
+        for (x = 0; x < buf->width; x++) {
+            line[x] = (x >= bar && x < bar + 16) ? 0xffffff :
+                      ((x & 0xff) << 16) | ((y & 0xff) << 8) | (frame & 0xff);
+        }
+    }
+}
+
+/**
+ * @brief Flip through the buffers as fast as the display takes them
+ *
+ * Only one flip can be pending, so each frame is drawn once the previous
+ * flip completed. A frame not ready for the next vblank shows up as a
+ * gap in the vblank sequence and is counted as dropped.
+ *
+ * @param info The test parameters
+ * @param disp The display
+ * @param bufs The buffers
+ * @param result Output measurements
+ * @return 0 on success, negative errno on failure
+ */
+static int flip_frames(struct dsi_info *info, struct kms_display *disp,
+                       struct kms_buffer *bufs, struct dsi_result *result)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    uint64_t first_ts = 0, prev_ts = 0, ts, start, cpu_start;
+    uint32_t seq, prev_seq = 0;
+    int i, ret, next = 1;
+
+    ret = kms_set_crtc(disp, &bufs[0]);
+    if (ret) {
+        return ret;
+    }
+
+    cpu_start = get_cpu_time_ns();
+
+    for (i = 0; i < info->frames; i++) {
+        if (info->draw) {
+            draw_frame(&bufs[next], i);
+        }
+
+        start = get_time_ns();
+        ret = kms_page_flip(disp, &bufs[next]);
+        if (!ret) {
+            ret = kms_wait_flip(disp, FLIP_TIMEOUT, &ts, &seq);
+        }
+        if (ret) {
+            return ret;
+        }
+        stats_add(&result->flip_us, (get_time_ns() - start) / 1000);
+
+        if (i == 0) {
+            first_ts = ts;
+        } else {
+            stats_add(&result->interval_us, (ts - prev_ts) / 1000);
+            if (seq > prev_seq + 1) {
+                result->dropped += seq - prev_seq - 1;
+            }
+        }
+        prev_ts = ts;
+        prev_seq = seq;
+        result->frames++;
+        next = (next + 1) % info->nbufs;
+    }
+
+    result->cpu_ns = get_cpu_time_ns() - cpu_start;
+    result->elapsed_ns = prev_ts - first_ts;
+
     return 0;
 }
+
+/**
+ * @brief Print fps, line rate, bandwidth, drops and CPU cost
+ *
+ * The line rate counts the total lines of the mode, blanking included,
+ * since that is what the DSI link carries.
+ *
+ * @param info The test parameters
+ * @param disp The display
+ * @param result The measurements
+ * @return None
+ */
+static void print_result(struct dsi_info *info, struct kms_display *disp,
+                         struct dsi_result *result)
+{
+    char interval[128], flip[128], buf[640];
+    uint64_t fps_x100 = 0;
+
+    if (result->elapsed_ns) {
+        fps_x100 = (uint64_t)(result->frames - 1) * 100000000000ULL /
+                   result->elapsed_ns;
+    }
+
+    stats_format(&result->interval_us, interval, sizeof(interval));
+    stats_format(&result->flip_us, flip, sizeof(flip));
+
+    snprintf(buf, sizeof(buf), "mode=%ux%u@%u htotal=%u vtotal=%u "
+             "clock_khz=%u bufs=%d draw=%d frames=%u fps=%llu.%02llu "
+             "lines_per_s=%llu active_bytes_per_s=%llu dropped=%u "
+             "cpu_us_per_frame=%llu interval_us(%s) flip_us(%s)",
+             disp->width, disp->height, disp->refresh, disp->htotal,
+             disp->vtotal, disp->clock_khz, info->nbufs, info->draw,
+             result->frames, (unsigned long long)(fps_x100 / 100),
+             (unsigned long long)(fps_x100 % 100),
+             (unsigned long long)(fps_x100 * disp->vtotal / 100),
+             (unsigned long long)(fps_x100 * disp->width * disp->height *
+                                  4 / 100),
+             result->dropped,
+             (unsigned long long)(result->cpu_ns / 1000 / result->frames),
+             interval, flip);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+}
+
+/**
+ * @brief Set up the display, flip and report
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int apbr_dsi_run(struct dsi_info *info)
+{
+    struct kms_buffer bufs[MAX_BUFFERS];
+    struct kms_display disp;
+    struct dsi_result result;
+    int i, ret = 0;
+
+    memset(bufs, 0, sizeof(bufs));
+    memset(&result, 0, sizeof(result));
+    stats_reset(&result.interval_us);
+    stats_reset(&result.flip_us);
+
+    ret = kms_open(&disp, info->card, info->width, info->height);
+    if (ret) {
+        return ret;
+    }
+
+    for (i = 0; i < info->nbufs && !ret; i++) {
+        ret = kms_buffer_create(&disp, &bufs[i], disp.width, disp.height,
+                                32, 1);
+        if (!ret) {
+            draw_frame(&bufs[i], 0);
+        }
+    }
+
+    if (!ret) {
+        ret = flip_frames(info, &disp, bufs, &result);
+        if (result.frames > 1) {
+            print_result(info, &disp, &result);
+        }
+    }
+
+    /* kms_close() brings back the console mode once ours are gone */
+    for (i = 0; i < info->nbufs; i++) {
+        kms_buffer_destroy(&disp, &bufs[i]);
+    }
+    kms_close(&disp);
+
+    if (!ret && info->max_dropped >= 0 &&
+        result.dropped > (uint32_t)info->max_dropped) {
+        ret = -EPIPE;
+    }
+
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    struct dsi_info info;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.card = "/dev/dri/card0";
+    info.nbufs = 2;
+    info.frames = 600;
+    info.draw = 1;
+    info.max_dropped = -1;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    ret = apbr_dsi_run(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
@@ -1,16 +1,841 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/usbdevice_fs.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "apbr_hsic"
+#define LOG_TAG "APBR"
+
+#define MAX_SIZES       16
+#define MAX_DEPTH       64
+/* fake link gap taken as idle, well above the sleep overshoot */
+#define FAKE_IDLE_NS    1000000ULL
+#define MAX_XFER_SIZE   (256 * 1024)
+
+enum xfer_dir {
+    DIR_OUT,
+    DIR_IN,
+    DIR_LOOP,
+};
+
+struct xfer {
+    int                     slot;
+    /** DIR_OUT or DIR_IN stage in flight */
+    int                     stage;
+    int                     len;
+    uint8_t                 *buf;
+    uint64_t                start;
+    struct usbdevfs_urb     urb;
+};
+
+struct endpoint;
+struct fake_state;
+
+/**
+ * Transfer backend. submit() queues one stage of a transfer without
+ * waiting, reap() returns the next completed one.
+ */
+struct endpoint_ops {
+    const char  *name;
+    int         (*open)(struct endpoint *ep);
+    int         (*submit)(struct endpoint *ep, struct xfer *xfer);
+    int         (*reap)(struct endpoint *ep, struct xfer **xfer,
+                        int timeout_ms);
+    void        (*close)(struct endpoint *ep);
+};
+
+struct endpoint {
+    const struct endpoint_ops   *ops;
+    char                        *devname;
+    int                         intf;
+    int                         ep_out;
+    int                         ep_in;
+    int                         fd;
+    /** fake endpoint only */
+    int                         peer;
+    uint64_t                    link_bps;
+    pthread_t                   thread;
+    struct fake_state           *fake;
+    struct xfer                 *xfers;
+    /** largest transfer and depth of the sweep */
+    int                         max_len;
+    int                         max_depth;
+};
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct hsic_info {
+    int             case_id;
+    int             dir;
+    int             nsizes;
+    int             sizes[MAX_SIZES];
+    int             ndepths;
+    int             depths[MAX_SIZES];
+    int             count;
+    int             verify;
+    int             timeout_ms;
+    struct endpoint ep;
+};
 
-void usage()
+struct hsic_result {
+    struct test_stats   latency_us;
+    uint64_t            bytes;
+    uint64_t            elapsed_ns;
+    int                 mismatches;
+};
+
+/**
+ * @brief Print usage of this HSIC throughput test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] (-u usbfs-node -i intf -e out,in | -f)"
+           " [-S link-bps]\n"
+           "          [-m out|in|loop] [-s sizes] [-q depths] [-n count]"
+           " [-V] [-t timeout-ms]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -u: usbfs node of the bridge, e.g. /dev/bus/usb/001/002.\n");
+    printf("    -i: USB interface to claim.\n");
+    printf("    -e: bulk OUT and IN endpoint addresses, e.g. 0x02,0x83.\n");
+    printf("    -f: use the socketpair fake endpoint instead of usbfs.\n");
+    printf("    -S: fake endpoint link rate in bytes/s (default unlimited).\n");
+    printf("    -m: out, in, or loop for OUT followed by IN of the same "
+           "size (default loop).\n");
+    printf("    -s: transfer sizes in bytes (default 512,4096,16384,65536).\n");
+    printf("    -q: transfers kept in flight (default 1,2,4,8).\n");
+    printf("    -n: transfers per size and depth (default 1000).\n");
+    printf("    -V: verify looped back data.\n");
+    printf("    -t: timeout of one transfer in ms (default 1000).\n");
+    printf("Example : off-board run with a 60 MB/s link\n");
+    printf("     ./%s -f -S 60000000 -q 1,4,16\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/* usbfs backend, asynchronous URBs on a claimed interface */
+
+static int usbfs_open(struct endpoint *ep)
+{
+    ep->fd = open(ep->devname, O_RDWR | O_CLOEXEC);
+    if (ep->fd < 0) {
+        return -errno;
+    }
+
+    if (ioctl(ep->fd, USBDEVFS_CLAIMINTERFACE, &ep->intf) < 0) {
+        close(ep->fd);
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int usbfs_submit(struct endpoint *ep, struct xfer *xfer)
+{
+    struct usbdevfs_urb *urb = &xfer->urb;
+
+    memset(urb, 0, sizeof(*urb));
+    urb->type = USBDEVFS_URB_TYPE_BULK;
+    urb->endpoint = xfer->stage == DIR_OUT ? ep->ep_out : ep->ep_in;
+    urb->buffer = xfer->buf;
+    urb->buffer_length = xfer->len;
+    urb->usercontext = xfer;
+
+    return ioctl(ep->fd, USBDEVFS_SUBMITURB, urb) < 0 ? -errno : 0;
+}
+
+static int usbfs_reap(struct endpoint *ep, struct xfer **xfer, int timeout_ms)
+{
+    struct usbdevfs_urb *urb;
+    struct pollfd pfd;
+    int ret;
+
+    for (;;) {
+        if (!ioctl(ep->fd, USBDEVFS_REAPURBNDELAY, &urb)) {
+            break;
+        }
+        if (errno != EAGAIN) {
+            return -errno;
+        }
+
+        /* usbfs flags completed URBs as POLLOUT */
+        pfd.fd = ep->fd;
+        pfd.events = POLLOUT;
+        ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0 && errno != EINTR) {
+            return -errno;
+        }
+        if (!ret) {
+            return -ETIMEDOUT;
+        }
+    }
+
+    *xfer = urb->usercontext;
+    if (urb->status) {
+        return urb->status < 0 ? urb->status : -EIO;
+    }
+
+    return urb->actual_length == (*xfer)->len ? 0 : -EMSGSIZE;
+}
+
+static void usbfs_close(struct endpoint *ep)
+{
+    struct usbdevfs_urb *urb;
+    int i;
+
+    /* Cancel what is still queued before the buffers go away */
+    for (i = 0; i < ep->max_depth; i++) {
+        ioctl(ep->fd, USBDEVFS_DISCARDURB, &ep->xfers[i].urb);
+    }
+    while (!ioctl(ep->fd, USBDEVFS_REAPURBNDELAY, &urb))
+        ;
+
+    ioctl(ep->fd, USBDEVFS_RELEASEINTERFACE, &ep->intf);
+    close(ep->fd);
+}
+
+static const struct endpoint_ops usbfs_ops = {
+    .name   = "usbfs",
+    .open   = usbfs_open,
+    .submit = usbfs_submit,
+    .reap   = usbfs_reap,
+    .close  = usbfs_close,
+};
+
+/*
+ * Fake backend. Every stage is one SEQPACKET message to an echo thread:
+ * OUT carries the data, IN only the header. The thread answers with the
+ * header, plus the data last written by the same slot for IN, so loop
+ * mode can be verified. With a link rate the thread delays each message
+ * by its wire time.
+ *
+ * The app queues up to depth stages before it reaps, so the thread never
+ * blocks on its replies: they wait in a queue, one per slot at most,
+ * while it keeps reading requests.
+ */
+struct fake_hdr {
+    uint32_t    slot;
+    uint32_t    stage;
+    uint32_t    len;
+};
+
+struct fake_state {
+    /** last OUT data of every slot */
+    uint8_t         *data;
+    uint8_t         *rx;
+    /** replies not sent yet, a ring of max_depth */
+    struct fake_hdr *reply;
+    int             head;
+    int             count;
+};
+
+/**
+ * @brief Send the queued replies until the socket is full
+ *
+ * @param ep The endpoint
+ * @return 0 on success, negative errno on failure
+ */
+static int fake_flush(struct endpoint *ep)
+{
+    struct fake_state *fake = ep->fake;
+    struct fake_hdr *hdr;
+    struct iovec iov[2];
+    int n;
+
+    while (fake->count) {
+        hdr = &fake->reply[fake->head];
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = sizeof(*hdr);
+        n = 1;
+        if (hdr->stage != DIR_OUT) {
+            iov[1].iov_base = fake->data + (size_t)hdr->slot * ep->max_len;
+            iov[1].iov_len = hdr->len;
+            n = 2;
+        }
+        if (writev(ep->peer, iov, n) < 0) {
+            return errno == EAGAIN ? 0 : -errno;
+        }
+        fake->head = (fake->head + 1) % ep->max_depth;
+        fake->count--;
+    }
+
+    return 0;
+}
+
+/*
+ * Hold a message for its time on the simulated link. The deadline runs on
+ * from the previous message so sleep overshoot doesn't add up, and only
+ * restarts from now when the link sat idle for longer than an overshoot.
+ */
+static void fake_link_wait(struct endpoint *ep, uint64_t *next, uint32_t len)
+{
+    struct timespec ts;
+    uint64_t now = get_time_ns();
+
+    if (*next + FAKE_IDLE_NS < now) {
+        *next = now;
+    }
+    *next += (uint64_t)len * 1000000000ULL / ep->link_bps;
+    ts.tv_sec = (time_t)(*next / 1000000000ULL);
+    ts.tv_nsec = (long)(*next % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR)
+        ;
+}
+
+static void *fake_thread(void *arg)
+{
+    struct endpoint *ep = arg;
+    struct fake_state *fake = ep->fake;
+    struct fake_hdr hdr;
+    struct iovec iov[2];
+    struct pollfd pfd;
+    uint64_t next = 0;
+    ssize_t len;
+
+    for (;;) {
+        if (fake_flush(ep)) {
+            break;
+        }
+
+        pfd.fd = ep->peer;
+        pfd.events = POLLIN | (fake->count ? POLLOUT : 0);
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (!(pfd.revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+
+        iov[0].iov_base = &hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = fake->rx;
+        iov[1].iov_len = ep->max_len;
+        len = readv(ep->peer, iov, 2);
+        if (len < 0 && errno == EAGAIN) {
+            continue;
+        }
+        /* EOF, or a request outside the sweep */
+        if (len < (ssize_t)sizeof(hdr) || hdr.slot >= (uint32_t)ep->max_depth ||
+            hdr.len > (uint32_t)ep->max_len || fake->count >= ep->max_depth) {
+            break;
+        }
+
+        if (ep->link_bps) {
+            fake_link_wait(ep, &next, hdr.len);
+        }
+
+        if (hdr.stage == DIR_OUT) {
+            memcpy(fake->data + (size_t)hdr.slot * ep->max_len, fake->rx,
+                   hdr.len);
+        }
+        fake->reply[(fake->head + fake->count) % ep->max_depth] = hdr;
+        fake->count++;
+    }
+
+    return NULL;
+}
+
+static void fake_free(struct endpoint *ep)
+{
+    if (ep->fake) {
+        free(ep->fake->data);
+        free(ep->fake->rx);
+        free(ep->fake->reply);
+        free(ep->fake);
+        ep->fake = NULL;
+    }
+}
+
+static int fake_open(struct endpoint *ep)
+{
+    int sv[2], size = 4 * MAX_XFER_SIZE, got;
+    socklen_t optlen = sizeof(got);
+    struct fake_state *fake;
+
+    fake = calloc(1, sizeof(*fake));
+    if (!fake) {
+        return -ENOMEM;
+    }
+    ep->fake = fake;
+    fake->data = malloc((size_t)ep->max_depth * ep->max_len);
+    fake->rx = malloc(ep->max_len);
+    fake->reply = calloc(ep->max_depth, sizeof(*fake->reply));
+    if (!fake->data || !fake->rx || !fake->reply) {
+        fake_free(ep);
+        return -ENOMEM;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        fake_free(ep);
+        return -errno;
+    }
+
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    ep->fd = sv[0];
+    ep->peer = sv[1];
+
+    /* A message has to fit the send buffer the kernel actually gave */
+    if (getsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &got, &optlen) < 0 ||
+        (size_t)got < sizeof(struct fake_hdr) + ep->max_len) {
+        close(sv[0]);
+        close(sv[1]);
+        fake_free(ep);
+        return -EMSGSIZE;
+    }
+
+    fcntl(ep->peer, F_SETFL, fcntl(ep->peer, F_GETFL) | O_NONBLOCK);
+
+    if (pthread_create(&ep->thread, NULL, fake_thread, ep)) {
+        close(sv[0]);
+        close(sv[1]);
+        fake_free(ep);
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+static int fake_submit(struct endpoint *ep, struct xfer *xfer)
+{
+    struct fake_hdr hdr;
+    struct iovec iov[2];
+
+    hdr.slot = xfer->slot;
+    hdr.stage = xfer->stage;
+    hdr.len = xfer->len;
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = xfer->buf;
+    iov[1].iov_len = xfer->len;
+
+    return writev(ep->fd, iov, xfer->stage == DIR_OUT ? 2 : 1) < 0 ?
+           -errno : 0;
+}
+
+static int fake_reap(struct endpoint *ep, struct xfer **xfer, int timeout_ms)
+{
+    struct fake_hdr hdr;
+    struct iovec iov[2];
+    struct pollfd pfd;
+    ssize_t len;
+    int ret;
+
+    pfd.fd = ep->fd;
+    pfd.events = POLLIN;
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret <= 0) {
+        return ret ? -errno : -ETIMEDOUT;
+    }
+
+    /* Peek at the header to find the slot buffer to receive into */
+    if (recv(ep->fd, &hdr, sizeof(hdr), MSG_PEEK) != sizeof(hdr) ||
+        hdr.slot >= (uint32_t)ep->max_depth) {
+        return -EPROTO;
+    }
+
+    *xfer = &ep->xfers[hdr.slot];
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (*xfer)->buf;
+    iov[1].iov_len = (*xfer)->len;
+    len = readv(ep->fd, iov, 2);
+    if (len < 0) {
+        return -errno;
+    }
+
+    return hdr.stage == DIR_OUT || len == (ssize_t)(sizeof(hdr) + hdr.len) ?
+           0 : -EIO;
+}
+
+static void fake_close(struct endpoint *ep)
+{
+    /* The echo thread exits when its socket end sees EOF */
+    shutdown(ep->fd, SHUT_RDWR);
+    pthread_join(ep->thread, NULL);
+    close(ep->fd);
+    close(ep->peer);
+    fake_free(ep);
+}
+
+static const struct endpoint_ops fake_ops = {
+    .name   = "fake",
+    .open   = fake_open,
+    .submit = fake_submit,
+    .reap   = fake_reap,
+    .close  = fake_close,
+};
+
+static int parse_list(char *str, int *out, int max)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    char *tok, *save = NULL;
+    int n = 0;
+
+    for (tok = strtok_r(str, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (n >= max || atoi(tok) < 1) {
+            return -EINVAL;
+        }
+        out[n++] = atoi(tok);
+    }
+
+    return n;
+}
+
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct hsic_info *info, int argc, char **argv)
+{
+    int option, i;
+
+    while ((option = getopt(argc, argv, "c:u:i:e:fS:m:s:q:n:Vt:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'u':
+            info->ep.ops = &usbfs_ops;
+            info->ep.devname = optarg;
+            break;
+        case 'i':
+            info->ep.intf = atoi(optarg);
+            break;
+        case 'e':
+            if (sscanf(optarg, "%i,%i", &info->ep.ep_out,
+                       &info->ep.ep_in) != 2) {
+                return -EINVAL;
+            }
+            break;
+        case 'f':
+            info->ep.ops = &fake_ops;
+            break;
+        case 'S':
+            info->ep.link_bps = strtoull(optarg, NULL, 0);
+            break;
+        case 'm':
+            if (!strcmp(optarg, "out")) {
+                info->dir = DIR_OUT;
+            } else if (!strcmp(optarg, "in")) {
+                info->dir = DIR_IN;
+            } else if (!strcmp(optarg, "loop")) {
+                info->dir = DIR_LOOP;
+            } else {
+                return -EINVAL;
+            }
+            break;
+        case 's':
+            info->nsizes = parse_list(optarg, info->sizes, MAX_SIZES);
+            if (info->nsizes <= 0) {
+                return -EINVAL;
+            }
+            break;
+        case 'q':
+            info->ndepths = parse_list(optarg, info->depths, MAX_SIZES);
+            if (info->ndepths <= 0) {
+                return -EINVAL;
+            }
+            break;
+        case 'n':
+            info->count = atoi(optarg);
+            break;
+        case 'V':
+            info->verify = 1;
+            break;
+        case 't':
+            info->timeout_ms = atoi(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (!info->ep.ops || info->count < 1 || info->timeout_ms < 1 ||
+        (info->ep.ops == &usbfs_ops &&
+         (!(info->ep.ep_out & 0x80) == !(info->ep.ep_in & 0x80)))) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < info->nsizes; i++) {
+        if (info->sizes[i] > MAX_XFER_SIZE) {
+            return -EINVAL;
+        }
+    }
+    for (i = 0; i < info->ndepths; i++) {
+        if (info->depths[i] > MAX_DEPTH) {
+            return -EINVAL;
+        }
+    }
+
     return 0;
 }
+
+/**
+ * @brief Start the first stage of a transfer in a slot
+ *
+ * @param info The test parameters
+ * @param xfer The slot
+ * @param seq Transfer sequence number, seeds the verify pattern
+ * @return 0 on success, negative errno on failure
+ */
+static int start_xfer(struct hsic_info *info, struct xfer *xfer, int seq)
+{
+    int i;
+
+    xfer->stage = info->dir == DIR_IN ? DIR_IN : DIR_OUT;
+    if (info->verify && info->dir == DIR_LOOP) {
+        for (i = 0; i < xfer->len; i++) {
+            xfer->buf[i] = (uint8_t)(seq + i * 7);
+        }
+    }
+    xfer->start = get_time_ns();
+
+    return info->ep.ops->submit(&info->ep, xfer);
+}
+
+static int check_xfer(struct xfer *xfer, int seq)
+{
+    int i;
+
+    for (i = 0; i < xfer->len; i++) {
+        if (xfer->buf[i] != (uint8_t)(seq + i * 7)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Run count transfers of one size keeping depth of them in flight
+ *
+ * Latency is from the submission of the first stage to the completion
+ * of the last one, so a loop transfer covers OUT and IN.
+ *
+ * @param info The test parameters
+ * @param size Transfer size in bytes
+ * @param depth Transfers in flight
+ * @param result Output results
+ * @return 0 on success, negative errno on failure
+ */
+static int run_point(struct hsic_info *info, int size, int depth,
+                     struct hsic_result *result)
+{
+    int seq[MAX_DEPTH];
+    struct xfer *xfer;
+    uint64_t start, now;
+    int submitted = 0, completed = 0, i, ret = 0;
+
+    memset(result, 0, sizeof(*result));
+    stats_reset(&result->latency_us);
+
+    start = get_time_ns();
+    for (i = 0; i < depth && submitted < info->count && !ret; i++) {
+        info->ep.xfers[i].len = size;
+        seq[i] = submitted++;
+        ret = start_xfer(info, &info->ep.xfers[i], seq[i]);
+    }
+
+    while (completed < submitted && !ret) {
+        ret = info->ep.ops->reap(&info->ep, &xfer, info->timeout_ms);
+        if (ret) {
+            break;
+        }
+
+        if (info->dir == DIR_LOOP && xfer->stage == DIR_OUT) {
+            xfer->stage = DIR_IN;
+            if (info->verify) {
+                memset(xfer->buf, 0, xfer->len);
+            }
+            ret = info->ep.ops->submit(&info->ep, xfer);
+            continue;
+        }
+
+        now = get_time_ns();
+        stats_add(&result->latency_us, (now - xfer->start) / 1000);
+        result->bytes += info->dir == DIR_LOOP ? 2 * size : size;
+        if (info->verify && info->dir == DIR_LOOP &&
+            check_xfer(xfer, seq[xfer->slot])) {
+            result->mismatches++;
+        }
+        completed++;
+
+        if (submitted < info->count) {
+            seq[xfer->slot] = submitted++;
+            ret = start_xfer(info, xfer, seq[xfer->slot]);
+        }
+    }
+
+    result->elapsed_ns = get_time_ns() - start;
+    return ret;
+}
+
+/**
+ * @brief Sweep transfer sizes and queue depths
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int apbr_hsic_sweep(struct hsic_info *info)
+{
+    static const char * const dir_names[] = { "out", "in", "loop" };
+    struct hsic_result result;
+    struct xfer xfers[MAX_DEPTH];
+    char stats[128], buf[320];
+    int s, q, i, ret;
+
+    /* Buffers are sized for the largest point of the sweep */
+    info->ep.max_len = 0;
+    info->ep.max_depth = 0;
+    for (s = 0; s < info->nsizes; s++) {
+        if (info->sizes[s] > info->ep.max_len) {
+            info->ep.max_len = info->sizes[s];
+        }
+    }
+    for (q = 0; q < info->ndepths; q++) {
+        if (info->depths[q] > info->ep.max_depth) {
+            info->ep.max_depth = info->depths[q];
+        }
+    }
+
+    memset(xfers, 0, sizeof(xfers));
+    for (i = 0; i < info->ep.max_depth; i++) {
+        xfers[i].slot = i;
+        xfers[i].buf = malloc(info->ep.max_len);
+        if (!xfers[i].buf) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+    info->ep.xfers = xfers;
+
+    ret = info->ep.ops->open(&info->ep);
+    if (ret) {
+        goto out;
+    }
+
+    for (s = 0; s < info->nsizes && !ret; s++) {
+        for (q = 0; q < info->ndepths && !ret; q++) {
+            ret = run_point(info, info->sizes[s], info->depths[q], &result);
+
+            stats_format(&result.latency_us, stats, sizeof(stats));
+            snprintf(buf, sizeof(buf), "backend=%s dir=%s size=%d depth=%d "
+                     "xfers=%llu mb_per_s=%llu.%02llu latency_us(%s) "
+                     "mismatches=%d", info->ep.ops->name,
+                     dir_names[info->dir], info->sizes[s], info->depths[q],
+                     (unsigned long long)result.latency_us.count,
+                     (unsigned long long)(result.bytes * 1000 /
+                                          result.elapsed_ns),
+                     (unsigned long long)(result.bytes * 100000 /
+                                          result.elapsed_ns % 100),
+                     stats, result.mismatches);
+            print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+            if (ret) {
+                snprintf(buf, sizeof(buf), "size %d depth %d: %s",
+                         info->sizes[s], info->depths[q], strerror(-ret));
+                print_test_case_log(LOG_TAG, info->case_id, buf);
+            } else if (result.mismatches) {
+                ret = -EBADMSG;
+            }
+        }
+    }
+
+    info->ep.ops->close(&info->ep);
+
+out:
+    for (i = 0; i < info->ep.max_depth; i++) {
+        free(xfers[i].buf);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief The apbr_hsic main function
+ *
+ * @param argc The apbr_hsic main arguments count
+ * @param argv The apbr_hsic main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    static const int default_sizes[] = { 512, 4096, 16384, 65536 };
+    static const int default_depths[] = { 1, 2, 4, 8 };
+    static struct hsic_info info;
+    int ret;
+
+    info.dir = DIR_LOOP;
+    info.count = 1000;
+    info.timeout_ms = 1000;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    if (!info.nsizes) {
+        memcpy(info.sizes, default_sizes, sizeof(default_sizes));
+        info.nsizes = sizeof(default_sizes) / sizeof(int);
+    }
+    if (!info.ndepths) {
+        memcpy(info.depths, default_depths, sizeof(default_depths));
+        info.ndepths = sizeof(default_depths) / sizeof(int);
+    }
+
+    ret = apbr_hsic_sweep(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
@@ -1,16 +1,758 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sound/asound.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "apbr_i2s"
+#define LOG_TAG "I2S"
+
+#define TAG_MAGIC       0x49325354
+#define WARMUP_NS       1000000000ULL
+
+/** Written at the start of every period, the rest of the period is silence */
+struct period_tag {
+    uint32_t    magic;
+    uint32_t    index;
+    uint64_t    written_ns;
+};
+
+struct sink;
+
+/**
+ * Sink backend. The writer fills periods in place in the sink ring and
+ * publishes its position with position(), which also returns how far the
+ * sink has consumed.
+ */
+struct sink_ops {
+    const char  *name;
+    int         (*open)(struct sink *sink);
+    int         (*start)(struct sink *sink);
+    int         (*position)(struct sink *sink, uint64_t appl, uint64_t *hw);
+    int         (*wait)(struct sink *sink, int timeout_ms);
+    void        (*close)(struct sink *sink);
+};
+
+struct sink {
+    const struct sink_ops   *ops;
+    char                    *path;
+    int                     fd;
+    uint8_t                 *ring;
+    uint32_t                rate;
+    uint32_t                channels;
+    uint32_t                frame_bytes;
+    uint32_t                period_frames;
+    uint32_t                periods;
+    /* simulated sinks */
+    int                     ppm;
+    int                     event;
+    pthread_t               thread;
+    volatile int            stop;
+    uint64_t                hw;
+    uint64_t                appl;
+    uint64_t                tag_dups;
+    struct test_stats       latency_us;
+    /* ALSA */
+    uint64_t                boundary;
+    uint64_t                hw_pos;
+    uint64_t                last_hw;
+};
+
+struct drift_fit {
+    double      n;
+    double      sx;
+    double      sy;
+    double      sxx;
+    double      sxy;
+};
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct i2s_info {
+    int         case_id;
+    int         duration_s;
+    int         interval_s;
+    int         stall_ms;
+    int         stall_every_s;
+    struct sink sink;
+};
 
-void usage()
+struct i2s_result {
+    uint64_t            written;
+    uint64_t            dup_periods;
+    uint64_t            gap_periods;
+    struct drift_fit    fit;
+};
+
+/**
+ * @brief Print usage of this I2S streaming test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] (-P pcm-node | -N | -F file) [-S ppm]\n"
+           "          [-R rate] [-C channels] [-p period-frames]"
+           " [-n periods]\n"
+           "          [-d seconds] [-i seconds] [-j stall-ms,every-s]\n",
+           APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -P: ALSA playback node of the bridge, e.g. "
+           "/dev/snd/pcmC1D0p.\n");
+    printf("    -N: null sink consuming at a simulated clock.\n");
+    printf("    -F: like -N, consumed periods are also written to file.\n");
+    printf("    -S: simulated sink clock error in ppm (default 0).\n");
+    printf("    -R: sample rate (default 48000), S16_LE samples.\n");
+    printf("    -C: channels (default 2).\n");
+    printf("    -p: frames per period (default 240).\n");
+    printf("    -n: periods in the ring (default 4).\n");
+    printf("    -d: streaming time in seconds (default 60).\n");
+    printf("    -i: progress report period in seconds (default 10).\n");
+    printf("    -j: stall the writer stall-ms every every-s seconds.\n");
+    printf("Example : check the math with a sink 50 ppm fast and stalls\n");
+    printf("     ./%s -N -S 50 -d 30 -j 30,5\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/* Simulated sinks, a thread consuming periods at rate * (1 + ppm) */
+
+static void *sim_thread(void *arg)
+{
+    struct sink *sink = arg;
+    uint32_t period_bytes = sink->period_frames * sink->frame_bytes;
+    const struct period_tag *tag;
+    double period_ns, next;
+    struct timespec ts;
+    uint64_t hw, index, one = 1, now;
+
+    period_ns = (double)sink->period_frames * 1e9 /
+                (sink->rate * (1.0 + sink->ppm / 1e6));
+    next = (double)get_time_ns();
+
+    while (!sink->stop) {
+        next += period_ns;
+        ts.tv_sec = (time_t)(next / 1e9);
+        ts.tv_nsec = (long)(next - (double)ts.tv_sec * 1e9);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        hw = __atomic_load_n(&sink->hw, __ATOMIC_ACQUIRE);
+        index = hw / sink->period_frames;
+        tag = (const struct period_tag *)(sink->ring +
+              (index % sink->periods) * period_bytes);
+
+        /* A tag other than the expected period is a replayed old period */
+        now = get_time_ns();
+        if (tag->magic != TAG_MAGIC || tag->index != (uint32_t)index) {
+            sink->tag_dups++;
+        } else if (now > tag->written_ns) {
+            stats_add(&sink->latency_us, (now - tag->written_ns) / 1000);
+        }
+
+        if (sink->fd >= 0 && write(sink->fd, tag, period_bytes) < 0) {
+            break;
+        }
+
+        __atomic_store_n(&sink->hw, hw + sink->period_frames,
+                         __ATOMIC_RELEASE);
+        if (write(sink->event, &one, sizeof(one)) < 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int sim_open(struct sink *sink)
+{
+    sink->fd = -1;
+    if (sink->path) {
+        sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (sink->fd < 0) {
+            return -errno;
+        }
+    }
+
+    sink->ring = calloc(sink->periods, sink->period_frames *
+                        sink->frame_bytes);
+    sink->event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!sink->ring || sink->event < 0) {
+        return -ENOMEM;
+    }
+
+    stats_reset(&sink->latency_us);
+    return 0;
+}
+
+static int sim_start(struct sink *sink)
+{
+    return pthread_create(&sink->thread, NULL, sim_thread, sink) ?
+           -EAGAIN : 0;
+}
+
+static int sim_position(struct sink *sink, uint64_t appl, uint64_t *hw)
+{
+    __atomic_store_n(&sink->appl, appl, __ATOMIC_RELEASE);
+    *hw = __atomic_load_n(&sink->hw, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+static int sim_wait(struct sink *sink, int timeout_ms)
+{
+    struct pollfd pfd;
+    uint64_t count;
+
+    pfd.fd = sink->event;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return -ETIMEDOUT;
+    }
+
+    return read(sink->event, &count, sizeof(count)) < 0 ? -errno : 0;
+}
+
+static void sim_close(struct sink *sink)
+{
+    if (sink->thread) {
+        sink->stop = 1;
+        pthread_join(sink->thread, NULL);
+    }
+    if (sink->fd >= 0) {
+        close(sink->fd);
+    }
+    if (sink->event >= 0) {
+        close(sink->event);
+    }
+    free(sink->ring);
+}
+
+static const struct sink_ops sim_ops = {
+    .name       = "sim",
+    .open       = sim_open,
+    .start      = sim_start,
+    .position   = sim_position,
+    .wait       = sim_wait,
+    .close      = sim_close,
+};
+
+/*
+ * ALSA sink, raw PCM ioctls on the playback node with the DMA ring mapped
+ * so periods are written in place. Positions go through SYNC_PTR, which
+ * works whether or not the status/control pages can be mapped. The stop
+ * threshold is the boundary, so an underrun does not stop the stream:
+ * the device replays old periods, which is what the test counts.
+ */
+static void param_set_mask(struct snd_pcm_hw_params *params, int param,
+                           unsigned int bit)
+{
+    struct snd_mask *mask;
+
+    mask = &params->masks[param - SNDRV_PCM_HW_PARAM_FIRST_MASK];
+    memset(mask, 0, sizeof(*mask));
+    mask->bits[bit >> 5] |= 1 << (bit & 31);
+}
+
+static void param_set_int(struct snd_pcm_hw_params *params, int param,
+                          unsigned int value)
+{
+    struct snd_interval *interval;
+
+    interval = &params->intervals[param - SNDRV_PCM_HW_PARAM_FIRST_INTERVAL];
+    interval->min = value;
+    interval->max = value;
+    interval->integer = 1;
+}
+
+static void param_init(struct snd_pcm_hw_params *params)
+{
+    int i;
+
+    memset(params, 0, sizeof(*params));
+    for (i = 0; i <= SNDRV_PCM_HW_PARAM_LAST_MASK -
+                SNDRV_PCM_HW_PARAM_FIRST_MASK; i++) {
+        memset(&params->masks[i], 0xff, sizeof(params->masks[i]));
+    }
+    for (i = 0; i <= SNDRV_PCM_HW_PARAM_LAST_INTERVAL -
+                SNDRV_PCM_HW_PARAM_FIRST_INTERVAL; i++) {
+        params->intervals[i].max = ~0U;
+    }
+    params->rmask = ~0U;
+    params->info = ~0U;
+}
+
+static int alsa_sync(struct sink *sink, uint64_t appl, uint64_t *hw)
+{
+    struct snd_pcm_sync_ptr sync;
+    uint64_t ptr;
+
+    memset(&sync, 0, sizeof(sync));
+    sync.flags = SNDRV_PCM_SYNC_PTR_HWSYNC;
+    sync.c.control.appl_ptr = appl % sink->boundary;
+    sync.c.control.avail_min = sink->period_frames;
+    if (ioctl(sink->fd, SNDRV_PCM_IOCTL_SYNC_PTR, &sync) < 0) {
+        return -errno;
+    }
+
+    /* hw_ptr wraps at the boundary, keep a 64-bit position */
+    ptr = sync.s.status.hw_ptr;
+    sink->hw_pos += (ptr + sink->boundary - sink->last_hw) % sink->boundary;
+    sink->last_hw = ptr;
+    *hw = sink->hw_pos;
+
+    return 0;
+}
+
+static int alsa_open(struct sink *sink)
+{
+    struct snd_pcm_hw_params params;
+    struct snd_pcm_sw_params sw;
+    uint32_t frames = sink->period_frames * sink->periods;
+    uint64_t hw;
+
+    sink->fd = open(sink->path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (sink->fd < 0) {
+        return -errno;
+    }
+
+    param_init(&params);
+    param_set_mask(&params, SNDRV_PCM_HW_PARAM_ACCESS,
+                   SNDRV_PCM_ACCESS_MMAP_INTERLEAVED);
+    param_set_mask(&params, SNDRV_PCM_HW_PARAM_FORMAT,
+                   SNDRV_PCM_FORMAT_S16_LE);
+    param_set_mask(&params, SNDRV_PCM_HW_PARAM_SUBFORMAT,
+                   SNDRV_PCM_SUBFORMAT_STD);
+    param_set_int(&params, SNDRV_PCM_HW_PARAM_CHANNELS, sink->channels);
+    param_set_int(&params, SNDRV_PCM_HW_PARAM_RATE, sink->rate);
+    param_set_int(&params, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+                  sink->period_frames);
+    param_set_int(&params, SNDRV_PCM_HW_PARAM_PERIODS, sink->periods);
+    if (ioctl(sink->fd, SNDRV_PCM_IOCTL_HW_PARAMS, &params) < 0) {
+        return -errno;
+    }
+
+    /*
+     * The kernel picks the boundary in HW_PARAMS and only reports it back
+     * from SW_PARAMS, so set the params once to learn it, then again with
+     * the stop threshold at the boundary.
+     */
+    memset(&sw, 0, sizeof(sw));
+    sw.tstamp_mode = SNDRV_PCM_TSTAMP_ENABLE;
+    sw.period_step = 1;
+    sw.avail_min = sink->period_frames;
+    sw.start_threshold = frames;
+    sw.stop_threshold = frames;
+    if (ioctl(sink->fd, SNDRV_PCM_IOCTL_SW_PARAMS, &sw) < 0) {
+        return -errno;
+    }
+    if (sw.boundary < frames) {
+        return -EINVAL;
+    }
+    sink->boundary = sw.boundary;
+
+    sw.stop_threshold = sw.boundary;
+    if (ioctl(sink->fd, SNDRV_PCM_IOCTL_SW_PARAMS, &sw) < 0) {
+        return -errno;
+    }
+
+    sink->ring = mmap(NULL, frames * sink->frame_bytes,
+                      PROT_READ | PROT_WRITE, MAP_SHARED, sink->fd,
+                      SNDRV_PCM_MMAP_OFFSET_DATA);
+    if (sink->ring == MAP_FAILED) {
+        sink->ring = NULL;
+        return -errno;
+    }
+    memset(sink->ring, 0, frames * sink->frame_bytes);
+
+    if (ioctl(sink->fd, SNDRV_PCM_IOCTL_PREPARE) < 0) {
+        return -errno;
+    }
+
+    return alsa_sync(sink, 0, &hw);
+}
+
+static int alsa_start(struct sink *sink)
+{
+    return ioctl(sink->fd, SNDRV_PCM_IOCTL_START) < 0 ? -errno : 0;
+}
+
+static int alsa_wait(struct sink *sink, int timeout_ms)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = sink->fd;
+    pfd.events = POLLOUT;
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) {
+        return -errno;
+    }
+
+    return ret ? 0 : -ETIMEDOUT;
+}
+
+static void alsa_close(struct sink *sink)
+{
+    if (sink->ring) {
+        munmap(sink->ring, sink->period_frames * sink->periods *
+               sink->frame_bytes);
+    }
+    if (sink->fd >= 0) {
+        ioctl(sink->fd, SNDRV_PCM_IOCTL_DROP);
+        close(sink->fd);
+    }
+}
+
+static const struct sink_ops alsa_ops = {
+    .name       = "alsa",
+    .open       = alsa_open,
+    .start      = alsa_start,
+    .position   = alsa_sync,
+    .wait       = alsa_wait,
+    .close      = alsa_close,
+};
+
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct i2s_info *info, int argc, char **argv)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    struct sink *sink = &info->sink;
+    int option;
+
+    while ((option = getopt(argc, argv, "c:P:NF:S:R:C:p:n:d:i:j:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'P':
+            sink->ops = &alsa_ops;
+            sink->path = optarg;
+            break;
+        case 'N':
+            sink->ops = &sim_ops;
+            sink->path = NULL;
+            break;
+        case 'F':
+            sink->ops = &sim_ops;
+            sink->path = optarg;
+            break;
+        case 'S':
+            sink->ppm = atoi(optarg);
+            break;
+        case 'R':
+            sink->rate = atoi(optarg);
+            break;
+        case 'C':
+            sink->channels = atoi(optarg);
+            break;
+        case 'p':
+            sink->period_frames = atoi(optarg);
+            break;
+        case 'n':
+            sink->periods = atoi(optarg);
+            break;
+        case 'd':
+            info->duration_s = atoi(optarg);
+            break;
+        case 'i':
+            info->interval_s = atoi(optarg);
+            break;
+        case 'j':
+            if (sscanf(optarg, "%d,%d", &info->stall_ms,
+                       &info->stall_every_s) != 2 ||
+                info->stall_ms < 0 || info->stall_every_s < 1) {
+                return -EINVAL;
+            }
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (!sink->ops || sink->rate < 1 || sink->channels < 1 ||
+        sink->periods < 2 || info->duration_s < 1 || info->interval_s < 1 ||
+        sink->ppm <= -1000000) {
+        return -EINVAL;
+    }
+
+    sink->frame_bytes = sink->channels * 2;
+    if (sink->period_frames * sink->frame_bytes < sizeof(struct period_tag)) {
+        return -EINVAL;
+    }
+
     return 0;
 }
+
+/**
+ * @brief Add one consumed-position sample to the drift fit
+ *
+ * Least squares of frames over seconds, kept as running sums so memory
+ * stays constant however long the stream runs.
+ *
+ * @param fit The fit
+ * @param t_ns Time since the stream start
+ * @param frames Frames consumed by the sink
+ * @return None
+ */
+static void drift_add(struct drift_fit *fit, uint64_t t_ns, uint64_t frames)
+{
+    double x = t_ns / 1e9, y = (double)frames;
+
+    fit->n += 1;
+    fit->sx += x;
+    fit->sy += y;
+    fit->sxx += x * x;
+    fit->sxy += x * y;
+}
+
+/**
+ * @brief Drift of the sink clock against the monotonic clock
+ *
+ * @param fit The fit
+ * @param rate Nominal sample rate
+ * @return Drift in ppm, positive when the sink runs fast
+ */
+static double drift_ppm(const struct drift_fit *fit, uint32_t rate)
+{
+    double den = fit->n * fit->sxx - fit->sx * fit->sx;
+
+    if (fit->n < 2 || den <= 0) {
+        return 0;
+    }
+
+    return ((fit->n * fit->sxy - fit->sx * fit->sy) / den / rate - 1) * 1e6;
+}
+
+/**
+ * @brief Write the tag of the period at a position
+ *
+ * @param sink The sink
+ * @param appl Position of the period start in frames
+ * @return None
+ */
+static void write_period(struct sink *sink, uint64_t appl)
+{
+    uint64_t index = appl / sink->period_frames;
+    struct period_tag *tag;
+
+    tag = (struct period_tag *)(sink->ring + (index % sink->periods) *
+          sink->period_frames * sink->frame_bytes);
+    tag->index = (uint32_t)index;
+    tag->written_ns = get_time_ns();
+    tag->magic = TAG_MAGIC;
+}
+
+static void print_progress(struct i2s_info *info, struct i2s_result *result,
+                           uint64_t elapsed_ns, uint64_t hw)
+{
+    char buf[256];
+
+    snprintf(buf, sizeof(buf), "elapsed_s=%llu frames=%llu "
+             "frames_per_s=%llu drift_ppm=%.2f dup_periods=%llu "
+             "gap_periods=%llu", (unsigned long long)(elapsed_ns / 1000000000),
+             (unsigned long long)hw,
+             (unsigned long long)(elapsed_ns ? hw * 1000000000 / elapsed_ns :
+                                  0),
+             drift_ppm(&result->fit, info->sink.rate),
+             (unsigned long long)result->dup_periods,
+             (unsigned long long)result->gap_periods);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+}
+
+/**
+ * @brief Stream periods until the duration is over
+ *
+ * When the sink overtakes the writer it replays old periods: those are
+ * counted as duplicated, and the writer skips the periods it missed,
+ * counted as gaps.
+ *
+ * @param info The test parameters
+ * @param result Output results
+ * @return 0 on success, negative errno on failure
+ */
+static int stream(struct i2s_info *info, struct i2s_result *result)
+{
+    struct sink *sink = &info->sink;
+    uint64_t ring = (uint64_t)sink->period_frames * sink->periods;
+    uint64_t start, now, appl = 0, hw = 0, skip, report, stall;
+    int ret;
+
+    for (appl = 0; appl < ring; appl += sink->period_frames) {
+        write_period(sink, appl);
+    }
+    ret = sink->ops->position(sink, appl, &hw);
+    if (!ret) {
+        ret = sink->ops->start(sink);
+    }
+    if (ret) {
+        return ret;
+    }
+
+    start = get_time_ns();
+    report = start + (uint64_t)info->interval_s * 1000000000;
+    stall = start + (uint64_t)info->stall_every_s * 1000000000;
+
+    for (;;) {
+        ret = sink->ops->wait(sink, 1000);
+        if (ret) {
+            return ret;
+        }
+
+        now = get_time_ns();
+        ret = sink->ops->position(sink, appl, &hw);
+        if (ret) {
+            return ret;
+        }
+        if (now - start >= WARMUP_NS) {
+            drift_add(&result->fit, now - start, hw);
+        }
+
+        if (hw > appl) {
+            result->dup_periods += (hw - appl + sink->period_frames - 1) /
+                                   sink->period_frames;
+            skip = (hw + sink->period_frames - 1) / sink->period_frames *
+                   sink->period_frames;
+            result->gap_periods += (skip - appl) / sink->period_frames;
+            appl = skip;
+        }
+
+        while (appl + sink->period_frames <= hw + ring) {
+            write_period(sink, appl);
+            appl += sink->period_frames;
+            result->written++;
+        }
+        ret = sink->ops->position(sink, appl, &hw);
+        if (ret) {
+            return ret;
+        }
+
+        if (now - start >= (uint64_t)info->duration_s * 1000000000) {
+            break;
+        }
+        if (now >= report) {
+            print_progress(info, result, now - start, hw);
+            report += (uint64_t)info->interval_s * 1000000000;
+        }
+        if (info->stall_ms && now >= stall) {
+            usleep(info->stall_ms * 1000);
+            stall += (uint64_t)info->stall_every_s * 1000000000;
+        }
+    }
+
+    print_progress(info, result, get_time_ns() - start, hw);
+    return 0;
+}
+
+/**
+ * @brief Run the stream and report drift, gaps and duplicates
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int apbr_i2s_run(struct i2s_info *info)
+{
+    struct sink *sink = &info->sink;
+    struct i2s_result result;
+    char stats[128], buf[320];
+    int ret;
+
+    memset(&result, 0, sizeof(result));
+
+    ret = sink->ops->open(sink);
+    if (!ret) {
+        ret = stream(info, &result);
+    }
+    sink->ops->close(sink);
+
+    if (sink->ops == &sim_ops) {
+        /* The sink view must agree with the writer accounting */
+        stats_format(&sink->latency_us, stats, sizeof(stats));
+        snprintf(buf, sizeof(buf), "sink=%s sim_ppm=%d tag_dups=%llu "
+                 "latency_us(%s)", sink->path ? sink->path : "null",
+                 sink->ppm, (unsigned long long)sink->tag_dups, stats);
+        print_test_case_perf(LOG_TAG, info->case_id, buf);
+    }
+
+    if (!ret && (result.dup_periods || result.gap_periods)) {
+        ret = -EPIPE;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief The apbr_i2s main function
+ *
+ * @param argc The apbr_i2s main arguments count
+ * @param argv The apbr_i2s main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    static struct i2s_info info;
+    int ret;
+
+    info.sink.fd = -1;
+    info.sink.event = -1;
+    info.sink.rate = 48000;
+    info.sink.channels = 2;
+    info.sink.period_frames = 240;
+    info.sink.periods = 4;
+    info.duration_s = 60;
+    info.interval_s = 10;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    ret = apbr_i2s_run(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
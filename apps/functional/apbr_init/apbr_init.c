@@ -1,16 +1,422 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "apbr_init"
+#define LOG_TAG "APBR"
+
+#define USB_DEVICES     "/bus/usb/devices"
+#define GB_DEVICES      "/bus/greybus/devices"
+#define RECHECK_MS      10
 
-#include "stdio.h"
-#include "libfwtest.h"
+enum phase {
+    PHASE_USB,
+    PHASE_USB_BOUND,
+    PHASE_HD,
+    PHASE_SVC,
+    PHASE_INTF,
+    PHASE_COUNT,
+};
 
-void usage()
+static const char * const phase_names[PHASE_COUNT] = {
+    "usb", "usb_bound", "hd", "svc", "intf",
+};
+
+struct init_info {
+    int                 case_id;
+    char                *usbdev;
+    char                *build;
+    int                 cycles;
+    int                 timeout_ms;
+    int                 verbose;
+    struct test_stats   phase_us[PHASE_COUNT];
+};
+
+/**
+ * @brief Print usage of this AP bridge init test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] [-u usb-device] [-n cycles]"
+           " [-t timeout-ms]\n"
+           "          [-B build] [-r sysfs-root] [-v]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -u: USB device of the bridge, e.g. 1-1. It is de-authorized\n"
+           "        and authorized again to restart the bring-up. Without\n"
+           "        it the app only watches one bring-up, e.g. at boot,\n"
+           "        and fails if the bridge is already up.\n");
+    printf("    -n: bring-up cycles, needs -u (default 1).\n");
+    printf("    -t: timeout of every phase in ms (default 10000).\n");
+    printf("    -B: firmware build label copied to the results.\n");
+    printf("    -r: sysfs root directory (default /sys).\n");
+    printf("    -v: print the timeline of every cycle.\n");
+    printf("Example : 20 bring-ups of the bridge on 1-1\n");
+    printf("     ./%s -u 1-1 -n 20 -B es3-1234\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct init_info *info, int argc, char **argv)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "c:u:n:t:B:r:v")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'u':
+            info->usbdev = optarg;
+            break;
+        case 'n':
+            info->cycles = atoi(optarg);
+            break;
+        case 't':
+            info->timeout_ms = atoi(optarg);
+            break;
+        case 'B':
+            info->build = optarg;
+            break;
+        case 'r':
+            set_sysfs_root(optarg);
+            break;
+        case 'v':
+            info->verbose = 1;
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (info->cycles < 1 || (info->cycles > 1 && !info->usbdev) ||
+        info->timeout_ms < 1) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Look for a Greybus device of a given kind
+ *
+ * @param phase PHASE_HD for a host device (greybusN), PHASE_SVC for an
+ *              SVC (N-svc), PHASE_INTF for an interface (N-M)
+ * @return 1 if one exists, 0 otherwise
+ */
+static int greybus_has(int phase)
+{
+    char path[PATH_MAX];
+    struct dirent *ptr;
+    const char *name, *dash;
+    int found = 0;
+    DIR *dir;
+
+    sysfs_path(path, sizeof(path), GB_DEVICES);
+    dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+
+    while (!found && (ptr = readdir(dir)) != NULL) {
+        name = ptr->d_name;
+        dash = strchr(name, '-');
+        switch (phase) {
+        case PHASE_HD:
+            found = !strncmp(name, "greybus", 7) && isdigit(name[7]);
+            break;
+        case PHASE_SVC:
+            found = dash && !strcmp(dash, "-svc");
+            break;
+        case PHASE_INTF:
+            found = dash && isdigit(dash[1]) &&
+                    strspn(dash + 1, "0123456789") == strlen(dash + 1);
+            break;
+        }
+    }
+    closedir(dir);
+
+    return found;
+}
+
+/**
+ * @brief Check whether a bring-up phase has been reached
+ *
+ * Without a USB device the USB phases are taken as reached together with
+ * the host device, which cannot exist without them. The USB device itself
+ * stays while de-authorized, "usb" is its interface coming back once the
+ * device is configured again.
+ *
+ * @param info The test parameters
+ * @param phase The phase
+ * @return 1 if reached, 0 otherwise
+ */
+static int phase_reached(struct init_info *info, int phase)
+{
+    char path[PATH_MAX];
+
+    switch (phase) {
+    case PHASE_USB:
+    case PHASE_USB_BOUND:
+        if (!info->usbdev) {
+            return greybus_has(PHASE_HD);
+        }
+        if (phase == PHASE_USB) {
+            sysfs_path(path, sizeof(path), "%s/%s/%s:1.0", USB_DEVICES,
+                       info->usbdev, info->usbdev);
+        } else {
+            sysfs_path(path, sizeof(path), "%s/%s/%s:1.0/driver",
+                       USB_DEVICES, info->usbdev, info->usbdev);
+        }
+        return !access(path, F_OK);
+    default:
+        return greybus_has(phase);
+    }
+}
+
+/**
+ * @brief Write the authorized attribute of the bridge USB device
+ *
+ * @param info The test parameters
+ * @param value "0" or "1"
+ * @return 0 on success, negative errno on failure
+ */
+static int usb_authorize(struct init_info *info, char *value)
+{
+    char path[PATH_MAX];
+
+    sysfs_path(path, sizeof(path), "%s/%s", USB_DEVICES, info->usbdev);
+    return debugfs_set_attr(path, "authorized", value, 1);
+}
+
+/**
+ * @brief Wait for a condition, waking up on events and every RECHECK_MS
+ *
+ * sysfs entries of the Greybus bus do not all raise a uevent, so the
+ * condition is also re-checked periodically.
+ *
+ * @param info The test parameters
+ * @param mon The event monitor
+ * @param phase The phase to wait for
+ * @param reached 1 to wait for the phase, 0 to wait for it to go away
+ * @param when Output time the condition was seen
+ * @return 0 on success, -ETIMEDOUT on timeout, negative errno on failure
+ */
+static int wait_phase(struct init_info *info, struct uevent_monitor *mon,
+                      int phase, int reached, uint64_t *when)
+{
+    uint64_t deadline = get_time_ns() + (uint64_t)info->timeout_ms * 1000000;
+    struct uevent event;
+    int ret;
+
+    while (phase_reached(info, phase) != reached) {
+        if (get_time_ns() >= deadline) {
+            return -ETIMEDOUT;
+        }
+
+        ret = uevent_monitor_next(mon, &event, RECHECK_MS);
+        if (ret && ret != -ETIMEDOUT) {
+            return ret;
+        }
+    }
+
+    *when = get_time_ns();
+    return 0;
+}
+
+/**
+ * @brief Run one bring-up and record the time of every phase
+ *
+ * @param info The test parameters
+ * @param mon The event monitor
+ * @param cycle The cycle number
+ * @return 0 on success, negative errno on failure
+ */
+static int run_cycle(struct init_info *info, struct uevent_monitor *mon,
+                     int cycle)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    uint64_t start, t[PHASE_COUNT];
+    char buf[256];
+    int i, n, ret;
+
+    if (info->usbdev) {
+        ret = usb_authorize(info, "0");
+        if (!ret) {
+            ret = wait_phase(info, mon, PHASE_HD, 0, &start);
+        }
+        if (!ret) {
+            ret = wait_phase(info, mon, PHASE_USB, 0, &start);
+        }
+        if (ret) {
+            snprintf(buf, sizeof(buf), "cycle %d: shutdown: %s", cycle,
+                     strerror(-ret));
+            print_test_case_log(LOG_TAG, info->case_id, buf);
+            return ret;
+        }
+    }
+
+    start = get_time_ns();
+    if (info->usbdev) {
+        ret = usb_authorize(info, "1");
+        if (ret) {
+            return ret;
+        }
+    }
+
+    for (i = 0; i < PHASE_COUNT; i++) {
+        ret = wait_phase(info, mon, i, 1, &t[i]);
+        if (ret) {
+            snprintf(buf, sizeof(buf), "cycle %d: %s: %s", cycle,
+                     phase_names[i], strerror(-ret));
+            print_test_case_log(LOG_TAG, info->case_id, buf);
+            return ret;
+        }
+        stats_add(&info->phase_us[i], (t[i] - start) / 1000);
+    }
+
+    if (info->verbose) {
+        n = snprintf(buf, sizeof(buf), "cycle %d:", cycle);
+        for (i = 0; i < PHASE_COUNT; i++) {
+            n += snprintf(buf + n, sizeof(buf) - n, " %s=%llu",
+                          phase_names[i],
+                          (unsigned long long)(t[i] - start) / 1000);
+        }
+        print_test_case_log(LOG_TAG, info->case_id, buf);
+    }
+
     return 0;
 }
+
+/**
+ * @brief Time all bring-up cycles and print the timeline
+ *
+ * Every phase is timed from the start of the cycle: the authorize write,
+ * or the app start when only watching.
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int apbr_init_run(struct init_info *info)
+{
+    struct uevent_monitor mon;
+    char path[PATH_MAX], stats[128], buf[256];
+    int i, n, ret;
+
+    /* only watching, a bridge that is already up would time as all 0 */
+    if (!info->usbdev && phase_reached(info, PHASE_HD)) {
+        print_test_case_log(LOG_TAG, info->case_id,
+                            "bridge already up, use -u to restart it");
+        return -EALREADY;
+    }
+
+    ret = uevent_monitor_open(&mon);
+    if (ret) {
+        return ret;
+    }
+
+    sysfs_path(path, sizeof(path), GB_DEVICES);
+    uevent_monitor_watch(&mon, path);
+    sysfs_path(path, sizeof(path), USB_DEVICES);
+    uevent_monitor_watch(&mon, path);
+
+    for (i = 0; i < PHASE_COUNT; i++) {
+        stats_reset(&info->phase_us[i]);
+    }
+
+    for (i = 0; i < info->cycles && !ret; i++) {
+        ret = run_cycle(info, &mon, i);
+    }
+
+    uevent_monitor_close(&mon);
+
+    n = snprintf(buf, sizeof(buf), "build=%s cycles=%llu timeline_us:",
+                 info->build ? info->build : "-",
+                 (unsigned long long)info->phase_us[PHASE_COUNT - 1].count);
+    for (i = 0; i < PHASE_COUNT; i++) {
+        n += snprintf(buf + n, sizeof(buf) - n, " %s=%llu", phase_names[i],
+                      (unsigned long long)stats_mean(&info->phase_us[i]));
+    }
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+    for (i = 0; i < PHASE_COUNT; i++) {
+        stats_format(&info->phase_us[i], stats, sizeof(stats));
+        snprintf(buf, sizeof(buf), "phase=%s us(%s)", phase_names[i], stats);
+        print_test_case_perf(LOG_TAG, info->case_id, buf);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief The apbr_init main function
+ *
+ * @param argc The apbr_init main arguments count
+ * @param argv The apbr_init main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    static struct init_info info;
+    int ret;
+
+    info.cycles = 1;
+    info.timeout_ms = 10000;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    ret = apbr_init_run(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
@@ -1,16 +1,449 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "apbr_power"
+#define LOG_TAG "APBR"
+
+#define MAX_DELAYS          16
+#define DEV_DEFAULT         "/bus/usb/devices/1-1"
+
+struct power_info {
+    int                 case_id;
+    char                *dev;
+    char                *io_path;
+    int                 ndelays;
+    int                 delays[MAX_DELAYS];
+    int                 cycles;
+    int                 dwell_ms;
+    int                 poll_us;
+    int                 timeout_ms;
+    /** <sysfs root><dev>/power */
+    char                power[PATH_MAX];
+};
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct power_result {
+    struct test_stats   suspend_us;
+    struct test_stats   resume_us;
+    uint64_t            active_ns;
+    uint64_t            suspended_ns;
+    long                kernel_active_ms;
+    long                kernel_suspended_ms;
+};
 
-void usage()
+/**
+ * @brief Print usage of this AP bridge power test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] [-d device] [-a delays] [-n cycles]"
+           " [-w dwell-ms]\n"
+           "          [-I io-path] [-p poll-us] [-t timeout-ms]"
+           " [-r sysfs-root]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: bridge device, relative to the sysfs root "
+           "(default %s).\n", DEV_DEFAULT);
+    printf("    -a: autosuspend_delay_ms values (default 0,50,200).\n");
+    printf("    -n: suspend/resume cycles per delay (default 20).\n");
+    printf("    -w: time to stay suspended before resuming (default 100).\n");
+    printf("    -I: file read to resume the bridge, e.g. a device node\n"
+           "        behind it. Without it power/control is set to on.\n");
+    printf("    -p: runtime_status poll period in us (default 1000).\n");
+    printf("    -t: timeout of every transition in ms (default 5000).\n");
+    printf("    -r: sysfs root directory (default /sys).\n");
+    printf("Example : resume through the first Greybus i2c adapter\n");
+    printf("     ./%s -d /bus/usb/devices/1-1 -a 0,100 -I /dev/i2c-3\n",
+           APP_NAME);
 }
 
-int main(int argc, char **argv)
+static int parse_list(char *str, int *out, int max)
+{
+    char *tok, *save = NULL;
+    int n = 0;
+
+    for (tok = strtok_r(str, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (n >= max || atoi(tok) < 0) {
+            return -EINVAL;
+        }
+        out[n++] = atoi(tok);
+    }
+
+    return n;
+}
+
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct power_info *info, int argc, char **argv)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:a:n:w:I:p:t:r:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'd':
+            info->dev = optarg;
+            break;
+        case 'a':
+            info->ndelays = parse_list(optarg, info->delays, MAX_DELAYS);
+            if (info->ndelays <= 0) {
+                return -EINVAL;
+            }
+            break;
+        case 'n':
+            info->cycles = atoi(optarg);
+            break;
+        case 'w':
+            info->dwell_ms = atoi(optarg);
+            break;
+        case 'I':
+            info->io_path = optarg;
+            break;
+        case 'p':
+            info->poll_us = atoi(optarg);
+            break;
+        case 't':
+            info->timeout_ms = atoi(optarg);
+            break;
+        case 'r':
+            set_sysfs_root(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (info->cycles < 1 || info->dwell_ms < 0 || info->poll_us < 1 ||
+        info->timeout_ms < 1) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int power_get(struct power_info *info, const char *attr, char *value,
+                     int len)
+{
+    return debugfs_get_attr(info->power, attr, value, len);
+}
+
+static int power_set(struct power_info *info, const char *attr,
+                     const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static int power_set(struct power_info *info, const char *attr,
+                     const char *fmt, ...)
+{
+    char value[32];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(value, sizeof(value), fmt, ap);
+    va_end(ap);
+
+    return debugfs_set_attr(info->power, attr, value, strlen(value));
+}
+
+static long power_get_ms(struct power_info *info, const char *attr)
+{
+    char value[32];
+
+    if (power_get(info, attr, value, sizeof(value))) {
+        return -1;
+    }
+
+    return atol(value);
+}
+
+/**
+ * @brief Poll runtime_status until it reads the wanted state
+ *
+ * runtime_status does not support poll(), so it is read every poll_us.
+ *
+ * @param info The test parameters
+ * @param state "active" or "suspended"
+ * @param when Output time the state was seen
+ * @return 0 on success, -ETIMEDOUT on timeout, negative errno on failure
+ */
+static int wait_status(struct power_info *info, const char *state,
+                       uint64_t *when)
+{
+    uint64_t deadline = get_time_ns() + (uint64_t)info->timeout_ms * 1000000;
+    char value[32];
+    int ret;
+
+    for (;;) {
+        ret = power_get(info, "runtime_status", value, sizeof(value));
+        *when = get_time_ns();
+        if (ret) {
+            return ret;
+        }
+        if (!strcmp(value, state)) {
+            return 0;
+        }
+        if (*when >= deadline) {
+            return -ETIMEDOUT;
+        }
+        usleep(info->poll_us);
+    }
+}
+
+/**
+ * @brief Wake the bridge up with an I/O
+ *
+ * Only opening the I/O path has to work. The read's result doesn't
+ * matter: a read of /dev/i2c-N without a slave address NAKs, yet it
+ * still wakes the bridge. Whether the bridge resumed is judged by
+ * runtime_status alone.
+ *
+ * @param info The test parameters
+ * @return 0 on success, negative errno on failure
+ */
+static int resume_io(struct power_info *info)
+{
+    char buf[64];
+    int fd;
+
+    if (!info->io_path) {
+        return power_set(info, "control", "on");
+    }
+
+    fd = open(info->io_path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (read(fd, buf, sizeof(buf)) < 0) {
+        /* Ignored, see above */
+    }
+    close(fd);
+
+    return 0;
+}
+
+/**
+ * @brief Run all suspend/resume cycles with one autosuspend delay
+ *
+ * Suspend entry is timed from the end of the last I/O to runtime_status
+ * reading "suspended", so it includes the autosuspend delay. Resume is
+ * timed from the start of the waking I/O to the bridge reading "active"
+ * with the I/O completed.
+ *
+ * @param info The test parameters
+ * @param delay The autosuspend delay in ms
+ * @param result Output results
+ * @return 0 on success, negative errno on failure
+ */
+static int run_delay(struct power_info *info, int delay,
+                     struct power_result *result)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    uint64_t idle, suspended, start, active;
+    long active_ms, suspended_ms;
+    char buf[128];
+    int i, ret;
+
+    memset(result, 0, sizeof(*result));
+    stats_reset(&result->suspend_us);
+    stats_reset(&result->resume_us);
+
+    ret = power_set(info, "autosuspend_delay_ms", "%d", delay);
+    if (!ret) {
+        ret = power_set(info, "control", "auto");
+    }
+    if (ret) {
+        return ret;
+    }
+
+    active_ms = power_get_ms(info, "runtime_active_time");
+    suspended_ms = power_get_ms(info, "runtime_suspended_time");
+
+    idle = get_time_ns();
+    for (i = 0; i < info->cycles; i++) {
+        ret = wait_status(info, "suspended", &suspended);
+        if (ret) {
+            snprintf(buf, sizeof(buf), "delay %d cycle %d: no suspend: %s",
+                     delay, i, strerror(-ret));
+            print_test_case_log(LOG_TAG, info->case_id, buf);
+            return ret;
+        }
+        stats_add(&result->suspend_us, (suspended - idle) / 1000);
+        result->active_ns += suspended - idle;
+
+        usleep(info->dwell_ms * 1000);
+
+        start = get_time_ns();
+        result->suspended_ns += start - suspended;
+        ret = resume_io(info);
+        if (!ret) {
+            ret = wait_status(info, "active", &active);
+        }
+        if (ret) {
+            snprintf(buf, sizeof(buf), "delay %d cycle %d: no resume: %s",
+                     delay, i, strerror(-ret));
+            print_test_case_log(LOG_TAG, info->case_id, buf);
+            return ret;
+        }
+        stats_add(&result->resume_us, (active - start) / 1000);
+        result->active_ns += active - start;
+
+        if (!info->io_path) {
+            ret = power_set(info, "control", "auto");
+            if (ret) {
+                return ret;
+            }
+        }
+        idle = get_time_ns();
+    }
+
+    /* The kernel counters are only there with CONFIG_PM_RUNTIME */
+    result->kernel_active_ms = -1;
+    result->kernel_suspended_ms = -1;
+    if (active_ms >= 0 && suspended_ms >= 0) {
+        result->kernel_active_ms =
+            power_get_ms(info, "runtime_active_time") - active_ms;
+        result->kernel_suspended_ms =
+            power_get_ms(info, "runtime_suspended_time") - suspended_ms;
+    }
+
     return 0;
 }
+
+/**
+ * @brief Print the results of one autosuspend delay
+ *
+ * @param info The test parameters
+ * @param delay The autosuspend delay in ms
+ * @param result The results
+ * @return None
+ */
+static void print_delay(struct power_info *info, int delay,
+                        struct power_result *result)
+{
+    char suspend[128], resume[128], buf[512];
+
+    stats_format(&result->suspend_us, suspend, sizeof(suspend));
+    stats_format(&result->resume_us, resume, sizeof(resume));
+
+    snprintf(buf, sizeof(buf), "autosuspend_ms=%d suspend_us(%s) "
+             "resume_us(%s) active_ms=%llu suspended_ms=%llu "
+             "kernel_active_ms=%ld kernel_suspended_ms=%ld", delay, suspend,
+             resume, (unsigned long long)(result->active_ns / 1000000),
+             (unsigned long long)(result->suspended_ns / 1000000),
+             result->kernel_active_ms, result->kernel_suspended_ms);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+}
+
+/**
+ * @brief Sweep the autosuspend delays and restore the power settings
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int apbr_power_sweep(struct power_info *info)
+{
+    struct power_result result;
+    char control[16], delay[16];
+    int i, ret = 0;
+
+    sysfs_path(info->power, sizeof(info->power), "%s/power", info->dev);
+
+    if (power_get(info, "control", control, sizeof(control)) ||
+        power_get(info, "autosuspend_delay_ms", delay, sizeof(delay))) {
+        return -ENODEV;
+    }
+
+    for (i = 0; i < info->ndelays && !ret; i++) {
+        ret = run_delay(info, info->delays[i], &result);
+        print_delay(info, info->delays[i], &result);
+    }
+
+    power_set(info, "autosuspend_delay_ms", "%s", delay);
+    power_set(info, "control", "%s", control);
+
+    return ret;
+}
+
+/**
+ * @brief The apbr_power main function
+ *
+ * @param argc The apbr_power main arguments count
+ * @param argv The apbr_power main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    static const int default_delays[] = { 0, 50, 200 };
+    static struct power_info info;
+    int ret;
+
+    info.dev = DEV_DEFAULT;
+    info.cycles = 20;
+    info.dwell_ms = 100;
+    info.poll_us = 1000;
+    info.timeout_ms = 5000;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    if (!info.ndelays) {
+        memcpy(info.delays, default_delays, sizeof(default_delays));
+        info.ndelays = sizeof(default_delays) / sizeof(int);
+    }
+
+    ret = apbr_power_sweep(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
@@ -1,16 +1,453 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/videodev2.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "cam_test"
+#define LOG_TAG "CAM"
+
+#define MAX_FORMATS     16
+#define MAX_SIZES       16
+#define MAX_BUFCOUNTS   8
+#define FRAME_TIMEOUT   2000
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct cam_test_info {
+    int         case_id;
+    char        *devname;
+    int         nformats;
+    uint32_t    formats[MAX_FORMATS];
+    int         nsizes;
+    uint32_t    width[MAX_SIZES];
+    uint32_t    height[MAX_SIZES];
+    int         nbufcounts;
+    uint32_t    bufcounts[MAX_BUFCOUNTS];
+    int         frames;
+    int         warmup;
+    int         touch;
+    int         max_dropped;
+};
 
-void usage()
+struct cam_result {
+    uint32_t            frames;
+    uint32_t            dropped;
+    uint64_t            elapsed_ns;
+    uint64_t            cpu_ns;
+    uint32_t            checksum;
+    struct test_stats   interval;
+    struct test_stats   latency;
+};
+
+/**
+ * @brief Print usage of this camera test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] [-d device] [-f fourcc[,fourcc...]]\n"
+           "          [-s WxH[,WxH...]] [-b bufs[,bufs...]] [-n frames]\n"
+           "          [-w warmup] [-t] [-x max-dropped]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: V4L2 capture device (default /dev/video0).\n");
+    printf("    -f: pixel formats to test (default all enumerated).\n");
+    printf("    -s: frame sizes to test (default all enumerated).\n");
+    printf("    -b: MMAP buffer counts to test (default 2,4,8).\n");
+    printf("    -n: frames measured per configuration (default 120).\n");
+    printf("    -w: frames discarded before measuring (default 10).\n");
+    printf("    -t: read every frame to include memory cost in CPU time.\n");
+    printf("    -x: fail if a configuration drops more frames.\n");
+    printf("Example : sweep all YUYV sizes of the vivid driver\n");
+    printf("     ./%s -d /dev/video0 -f YUYV -b 3,6\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Parse a comma separated list of unsigned integers
+ *
+ * @param str The list string
+ * @param out Output array
+ * @param max Size of the output array
+ * @return Number of values parsed, -EINVAL on error
+ */
+static int parse_uint_list(char *str, uint32_t *out, int max)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    char *tok, *save = NULL;
+    int n = 0;
+
+    for (tok = strtok_r(str, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (n >= max || atoi(tok) <= 0) {
+            return -EINVAL;
+        }
+        out[n++] = (uint32_t)atoi(tok);
+    }
+
+    return n;
+}
+
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct cam_test_info *info, int argc, char **argv)
+{
+    char *tok, *save = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:f:s:b:n:w:tx:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'd':
+            info->devname = optarg;
+            break;
+        case 'f':
+            for (tok = strtok_r(optarg, ",", &save); tok;
+                 tok = strtok_r(NULL, ",", &save)) {
+                if (strlen(tok) != 4 || info->nformats >= MAX_FORMATS) {
+                    return -EINVAL;
+                }
+                info->formats[info->nformats++] =
+                    v4l2_fourcc(tok[0], tok[1], tok[2], tok[3]);
+            }
+            break;
+        case 's':
+            for (tok = strtok_r(optarg, ",", &save); tok;
+                 tok = strtok_r(NULL, ",", &save)) {
+                if (info->nsizes >= MAX_SIZES ||
+                    sscanf(tok, "%ux%u", &info->width[info->nsizes],
+                           &info->height[info->nsizes]) != 2) {
+                    return -EINVAL;
+                }
+                info->nsizes++;
+            }
+            break;
+        case 'b':
+            info->nbufcounts = parse_uint_list(optarg, info->bufcounts,
+                                               MAX_BUFCOUNTS);
+            if (info->nbufcounts < 0) {
+                return -EINVAL;
+            }
+            break;
+        case 'n':
+            info->frames = atoi(optarg);
+            break;
+        case 'w':
+            info->warmup = atoi(optarg);
+            break;
+        case 't':
+            info->touch = 1;
+            break;
+        case 'x':
+            info->max_dropped = atoi(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (info->frames < 2 || info->warmup < 0) {
+        return -EINVAL;
+    }
+
     return 0;
 }
+
+/**
+ * @brief Sum frame data so that the CPU cost includes reading the pixels
+ *
+ * @param data Frame data
+ * @param len Frame size in bytes
+ * @return Checksum of the frame
+ */
+static uint32_t touch_frame(const void *data, uint32_t len)
+{
+    const uint32_t *p = data;
+    uint32_t sum = 0, i;
+
+    for (i = 0; i < len / sizeof(*p); i++) {
+        sum += p[i];
+    }
+
+    return sum;
+}
+
+/**
+ * @brief Stream one format/size/buffer-count configuration
+ *
+ * @param info The test parameters
+ * @param stream The opened stream, format already applied
+ * @param nbufs Number of MMAP buffers to queue
+ * @param result Output measurements
+ * @return 0 on success, negative errno on failure
+ */
+static int capture_config(struct cam_test_info *info,
+                          struct v4l2_stream *stream, uint32_t nbufs,
+                          struct cam_result *result)
+{
+    struct v4l2_frame frame;
+    uint64_t first_ts = 0, prev_ts = 0, ts, now, cpu_start;
+    uint32_t prev_seq = 0;
+    int i, ret;
+
+    memset(result, 0, sizeof(*result));
+    stats_reset(&result->interval);
+    stats_reset(&result->latency);
+
+    ret = v4l2_stream_start(stream, nbufs);
+    if (ret) {
+        return ret;
+    }
+
+    for (i = 0; i < info->warmup; i++) {
+        ret = v4l2_stream_dequeue(stream, &frame, FRAME_TIMEOUT);
+        if (ret) {
+            goto out;
+        }
+        ret = v4l2_stream_queue(stream, &frame);
+        if (ret) {
+            goto out;
+        }
+    }
+
+    cpu_start = get_cpu_time_ns();
+
+    for (i = 0; i < info->frames; i++) {
+        ret = v4l2_stream_dequeue(stream, &frame, FRAME_TIMEOUT);
+        if (ret) {
+            goto out;
+        }
+        now = get_time_ns();
+
+        /*
+         * Prefer the driver timestamp so that the intervals measure the
+         * capture path and not our scheduling; fall back to the dequeue time
+         * for drivers without monotonic timestamps.
+         */
+        if ((frame.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+            V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC && frame.timestamp_ns) {
+            ts = frame.timestamp_ns;
+            if (now > ts) {
+                stats_add(&result->latency, (now - ts) / 1000);
+            }
+        } else {
+            ts = now;
+        }
+
+        if (i == 0) {
+            first_ts = ts;
+        } else {
+            stats_add(&result->interval, (ts - prev_ts) / 1000);
+            if (frame.sequence > prev_seq + 1) {
+                result->dropped += frame.sequence - prev_seq - 1;
+            }
+        }
+        prev_ts = ts;
+        prev_seq = frame.sequence;
+
+        if (info->touch) {
+            result->checksum += touch_frame(frame.data, frame.bytesused);
+        }
+
+        ret = v4l2_stream_queue(stream, &frame);
+        if (ret) {
+            goto out;
+        }
+        result->frames++;
+    }
+
+    result->cpu_ns = get_cpu_time_ns() - cpu_start;
+    result->elapsed_ns = prev_ts - first_ts;
+
+out:
+    v4l2_stream_stop(stream);
+    return ret;
+}
+
+/**
+ * @brief Print the measurements of one configuration
+ *
+ * @param info The test parameters
+ * @param stream The stream with the applied format
+ * @param nbufs Number of buffers requested
+ * @param result The measurements
+ * @return None
+ */
+static void print_config_result(struct cam_test_info *info,
+                                struct v4l2_stream *stream, uint32_t nbufs,
+                                struct cam_result *result)
+{
+    char fourcc[5], interval[128], latency[128], buf[512];
+    uint64_t fps_x100 = 0;
+
+    if (result->elapsed_ns) {
+        fps_x100 = (uint64_t)(result->frames - 1) * 100000000000ULL /
+                   result->elapsed_ns;
+    }
+
+    v4l2_fourcc_str(stream->pixfmt, fourcc);
+    stats_format(&result->interval, interval, sizeof(interval));
+    stats_format(&result->latency, latency, sizeof(latency));
+
+    snprintf(buf, sizeof(buf), "fmt=%s size=%ux%u bufs=%u frames=%u "
+             "fps=%llu.%02llu dropped=%u cpu_us_per_frame=%llu "
+             "interval_us(%s) latency_us(%s)", fourcc, stream->width,
+             stream->height, nbufs, result->frames,
+             (unsigned long long)(fps_x100 / 100),
+             (unsigned long long)(fps_x100 % 100), result->dropped,
+             (unsigned long long)(result->cpu_ns / 1000 / result->frames),
+             interval, latency);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+}
+
+/**
+ * @brief Sweep all requested formats, sizes and buffer counts
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int cam_capture_sweep(struct cam_test_info *info)
+{
+    struct v4l2_stream stream;
+    struct cam_result result;
+    uint32_t width[MAX_SIZES], height[MAX_SIZES];
+    char fourcc[5], buf[128];
+    int f, s, b, nsizes, ret, status = 0, configs = 0;
+
+    ret = v4l2_open(&stream, info->devname);
+    if (ret) {
+        return ret;
+    }
+
+    if (!info->nformats) {
+        info->nformats = v4l2_enum_formats(&stream, info->formats,
+                                           MAX_FORMATS);
+    }
+
+    for (f = 0; f < info->nformats; f++) {
+        if (info->nsizes) {
+            nsizes = info->nsizes;
+            memcpy(width, info->width, sizeof(width));
+            memcpy(height, info->height, sizeof(height));
+        } else {
+            nsizes = v4l2_enum_sizes(&stream, info->formats[f], width,
+                                     height, MAX_SIZES);
+        }
+
+        for (s = 0; s < nsizes; s++) {
+            ret = v4l2_set_format(&stream, info->formats[f], width[s],
+                                  height[s]);
+            if (ret) {
+                v4l2_fourcc_str(info->formats[f], fourcc);
+                snprintf(buf, sizeof(buf), "Set format %s %ux%u: %s",
+                         fourcc, width[s], height[s], strerror(-ret));
+                print_test_case_log(LOG_TAG, info->case_id, buf);
+                status = ret;
+                continue;
+            }
+
+            for (b = 0; b < info->nbufcounts; b++) {
+                configs++;
+                ret = capture_config(info, &stream, info->bufcounts[b],
+                                     &result);
+                if (ret) {
+                    v4l2_fourcc_str(stream.pixfmt, fourcc);
+                    snprintf(buf, sizeof(buf), "Capture %s %ux%u bufs=%u: %s",
+                             fourcc, stream.width, stream.height,
+                             info->bufcounts[b], strerror(-ret));
+                    print_test_case_log(LOG_TAG, info->case_id, buf);
+                    status = ret;
+                    continue;
+                }
+
+                print_config_result(info, &stream, info->bufcounts[b],
+                                    &result);
+                if (info->max_dropped >= 0 &&
+                    result.dropped > (uint32_t)info->max_dropped) {
+                    status = -EIO;
+                }
+            }
+        }
+    }
+
+    v4l2_close(&stream);
+
+    return configs ? status : -ENODEV;
+}
+
+/**
+ * @brief The cam_test main function
+ *
+ * @param argc The cam_test main arguments count
+ * @param argv The cam_test main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct cam_test_info info;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.devname = "/dev/video0";
+    info.frames = 120;
+    info.warmup = 10;
+    info.max_dropped = -1;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    if (!info.nbufcounts) {
+        info.bufcounts[0] = 2;
+        info.bufcounts[1] = 4;
+        info.bufcounts[2] = 8;
+        info.nbufcounts = 3;
+    }
+
+    ret = cam_capture_sweep(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
@@ -1,16 +1,492 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "i2c_timeout"
+#define LOG_TAG "I2C"
+
+#define MAX_SETTINGS        16
+#define RECOVERY_LIMIT_NS   2000000000ULL
+
+struct timeout_info {
+    int     case_id;
+    int     busid;
+    int     absent_addr;
+    int     good_addr;
+    int     offset;
+    int     ntimeouts;
+    int     timeouts[MAX_SETTINGS];
+    int     nretries;
+    int     retries[MAX_SETTINGS];
+    int     iterations;
+    int     restore_timeout;
+    int     restore_retries;
+    /** adapter has no I2C_FUNC_I2C, probe with SMBus reads */
+    int     smbus;
+};
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct timeout_result {
+    struct test_stats   good_us;
+    struct test_stats   fail_us;
+    struct test_stats   recover_us;
+    struct test_stats   recover_tries;
+    int                 acked;
+    int                 unrecovered;
+    int                 err_nxio;
+    int                 err_remoteio;
+    int                 err_timedout;
+    int                 err_other;
+};
 
-void usage()
+/**
+ * @brief Print usage of this I2C timeout test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] -b bus-id -a absent-address "
+           "-g good-address\n"
+           "          [-o offset] [-t timeouts] [-r retries] [-n iterations]\n"
+           "          [-T timeout,retries]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -b: I2C bus number.\n");
+    printf("    -a: address with no device, or a device that NAKs.\n");
+    printf("    -g: address of a responding device.\n");
+    printf("    -o: register offset read from the good device "
+           "(default: plain read).\n");
+    printf("    -t: I2C_TIMEOUT values in 10 ms units (default 1,5,10,50).\n");
+    printf("    -r: I2C_RETRIES values (default 0,1,3).\n");
+    printf("    -n: failing transfers per setting (default 50).\n");
+    printf("    -T: adapter timeout and retries to restore at the end.\n");
+    printf("    Addresses and offset accept decimal or 0x-prefixed hex.\n");
+    printf("    Adapters without I2C_FUNC_I2C are read with SMBus "
+           "commands.\n");
+    printf("Example : i2c-stub with a chip at 0x50 and nothing at 0x51\n");
+    printf("     ./%s -b 0 -a 0x51 -g 0x50 -o 0 -T 100,0\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+static int parse_list(char *str, int *out, int max)
+{
+    char *tok, *save = NULL;
+    int n = 0;
+
+    for (tok = strtok_r(str, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (n >= max || atoi(tok) < 0) {
+            return -EINVAL;
+        }
+        out[n++] = atoi(tok);
+    }
+
+    return n;
+}
+
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct timeout_info *info, int argc, char **argv)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    int option;
+
+    while ((option = getopt(argc, argv, "c:b:a:g:o:t:r:n:T:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'b':
+            info->busid = atoi(optarg);
+            break;
+        case 'a':
+            info->absent_addr = (int)strtol(optarg, NULL, 0);
+            break;
+        case 'g':
+            info->good_addr = (int)strtol(optarg, NULL, 0);
+            break;
+        case 'o':
+            info->offset = (int)strtol(optarg, NULL, 0);
+            break;
+        case 't':
+            info->ntimeouts = parse_list(optarg, info->timeouts,
+                                         MAX_SETTINGS);
+            if (info->ntimeouts <= 0) {
+                return -EINVAL;
+            }
+            break;
+        case 'r':
+            info->nretries = parse_list(optarg, info->retries, MAX_SETTINGS);
+            if (info->nretries <= 0) {
+                return -EINVAL;
+            }
+            break;
+        case 'n':
+            info->iterations = atoi(optarg);
+            break;
+        case 'T':
+            if (sscanf(optarg, "%d,%d", &info->restore_timeout,
+                       &info->restore_retries) != 2) {
+                return -EINVAL;
+            }
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (info->busid < 0 || info->absent_addr < 0 || info->good_addr < 0 ||
+        info->iterations < 1) {
+        return -EINVAL;
+    }
+
     return 0;
 }
+
+/**
+ * @brief Run one SMBus read byte, or read byte data with an offset
+ *
+ * @param file The adapter file descriptor
+ * @param addr The 7-bit slave address
+ * @param offset Register offset, negative for a plain read
+ * @return 0 on success, negative errno on failure
+ */
+static int i2c_smbus_probe_read(int file, int addr, int offset)
+{
+    struct i2c_smbus_ioctl_data args;
+    union i2c_smbus_data data;
+
+    /* Force: a bound client driver does not matter for a read */
+    if (ioctl(file, I2C_SLAVE_FORCE, addr) < 0) {
+        return -errno;
+    }
+
+    args.read_write = I2C_SMBUS_READ;
+    args.command = offset >= 0 ? (uint8_t)offset : 0;
+    args.size = offset >= 0 ? I2C_SMBUS_BYTE_DATA : I2C_SMBUS_BYTE;
+    args.data = &data;
+
+    return ioctl(file, I2C_SMBUS, &args) < 0 ? -errno : 0;
+}
+
+/**
+ * @brief Run one read transaction
+ *
+ * I2C_RDWR is used when the adapter does plain I2C transfers, SMBus reads
+ * otherwise (i2c-stub, SMBus-only controllers).
+ *
+ * @param info The test parameters
+ * @param file The adapter file descriptor
+ * @param addr The 7-bit slave address
+ * @return 0 on success, negative errno on failure
+ */
+static int i2c_probe_read(struct timeout_info *info, int file, int addr)
+{
+    struct i2c_rdwr_ioctl_data data;
+    struct i2c_msg msgs[2];
+    int offset = info->offset;
+    uint8_t reg = (uint8_t)offset, value;
+    int n = 0;
+
+    if (info->smbus) {
+        return i2c_smbus_probe_read(file, addr, offset);
+    }
+
+    if (offset >= 0) {
+        msgs[n].addr = addr;
+        msgs[n].flags = 0;
+        msgs[n].len = 1;
+        msgs[n].buf = &reg;
+        n++;
+    }
+    msgs[n].addr = addr;
+    msgs[n].flags = I2C_M_RD;
+    msgs[n].len = 1;
+    msgs[n].buf = &value;
+    n++;
+
+    data.msgs = msgs;
+    data.nmsgs = n;
+
+    return ioctl(file, I2C_RDWR, &data) < 0 ? -errno : 0;
+}
+
+/**
+ * @brief Measure failure and recovery times for one timeout/retries setting
+ *
+ * @param info The test parameters
+ * @param file The adapter file descriptor
+ * @param result Output measurements
+ * @return 0 on success, negative errno if the adapter rejects the setting
+ */
+static int run_setting(struct timeout_info *info, int file, int timeout,
+                       int retries, struct timeout_result *result)
+{
+    uint64_t start, fail_end, now;
+    int i, tries, ret;
+
+    memset(result, 0, sizeof(*result));
+    stats_reset(&result->good_us);
+    stats_reset(&result->fail_us);
+    stats_reset(&result->recover_us);
+    stats_reset(&result->recover_tries);
+
+    if (ioctl(file, I2C_TIMEOUT, timeout) < 0 ||
+        ioctl(file, I2C_RETRIES, retries) < 0) {
+        return -errno;
+    }
+
+    for (i = 0; i < info->iterations; i++) {
+        /* Reference: a good transaction on an idle bus */
+        start = get_time_ns();
+        ret = i2c_probe_read(info, file, info->good_addr);
+        if (ret) {
+            return ret;
+        }
+        stats_add(&result->good_us, (get_time_ns() - start) / 1000);
+
+        /* The failing transaction */
+        start = get_time_ns();
+        ret = i2c_probe_read(info, file, info->absent_addr);
+        fail_end = get_time_ns();
+
+        switch (ret) {
+        case 0:
+            result->acked++;
+            continue;
+        case -ENXIO:
+            result->err_nxio++;
+            break;
+        case -EREMOTEIO:
+            result->err_remoteio++;
+            break;
+        case -ETIMEDOUT:
+            result->err_timedout++;
+            break;
+        default:
+            result->err_other++;
+            break;
+        }
+        stats_add(&result->fail_us, (fail_end - start) / 1000);
+
+        /* Recovery: first good transaction after the failure */
+        tries = 0;
+        do {
+            tries++;
+            ret = i2c_probe_read(info, file, info->good_addr);
+            now = get_time_ns();
+        } while (ret && now - fail_end < RECOVERY_LIMIT_NS);
+
+        if (ret) {
+            result->unrecovered++;
+        } else {
+            stats_add(&result->recover_us, (now - fail_end) / 1000);
+            stats_add(&result->recover_tries, tries);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Print the measurements of one setting
+ *
+ * @param info The test parameters
+ * @param timeout I2C_TIMEOUT value
+ * @param retries I2C_RETRIES value
+ * @param result The measurements
+ * @return None
+ */
+static void print_setting(struct timeout_info *info, int timeout,
+                          int retries, struct timeout_result *result)
+{
+    char good[128], fail[128], recover[128], tries[128], buf[768];
+
+    stats_format(&result->good_us, good, sizeof(good));
+    stats_format(&result->fail_us, fail, sizeof(fail));
+    stats_format(&result->recover_us, recover, sizeof(recover));
+    stats_format(&result->recover_tries, tries, sizeof(tries));
+
+    snprintf(buf, sizeof(buf), "timeout_ms=%d retries=%d acked=%d "
+             "unrecovered=%d errors(nxio=%d remoteio=%d timedout=%d other=%d) "
+             "good_us(%s) fail_us(%s) recover_us(%s) recover_tries(%s)",
+             timeout * 10, retries, result->acked, result->unrecovered,
+             result->err_nxio, result->err_remoteio, result->err_timedout,
+             result->err_other, good, fail, recover, tries);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+}
+
+/**
+ * @brief Pick I2C_RDWR or SMBus reads from the adapter functionality
+ *
+ * @param info The test parameters
+ * @param file The adapter file descriptor
+ * @return 0 on success, -EOPNOTSUPP if the adapter can do neither
+ */
+static int select_probe(struct timeout_info *info, int file)
+{
+    unsigned long funcs, need;
+
+    if (ioctl(file, I2C_FUNCS, &funcs) < 0) {
+        return -errno;
+    }
+
+    info->smbus = !(funcs & I2C_FUNC_I2C);
+    if (info->smbus) {
+        need = info->offset >= 0 ? I2C_FUNC_SMBUS_READ_BYTE_DATA :
+               I2C_FUNC_SMBUS_READ_BYTE;
+        if (!(funcs & need)) {
+            return -EOPNOTSUPP;
+        }
+        print_test_case_log(LOG_TAG, info->case_id,
+                            "Adapter has no I2C_FUNC_I2C, using SMBus reads");
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Sweep all timeout and retries settings
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int i2c_timeout_sweep(struct timeout_info *info)
+{
+    struct timeout_result result;
+    char buf[128];
+    int file, t, r, ret = 0;
+
+    file = open_i2c_dev(info->busid);
+    if (file < 0) {
+        return -errno;
+    }
+
+    ret = select_probe(info, file);
+    if (ret) {
+        close(file);
+        return ret;
+    }
+
+    for (t = 0; t < info->ntimeouts && !ret; t++) {
+        for (r = 0; r < info->nretries && !ret; r++) {
+            ret = run_setting(info, file, info->timeouts[t],
+                              info->retries[r], &result);
+            if (ret) {
+                snprintf(buf, sizeof(buf), "timeout=%d retries=%d: %s",
+                         info->timeouts[t], info->retries[r],
+                         strerror(-ret));
+                print_test_case_log(LOG_TAG, info->case_id, buf);
+                break;
+            }
+
+            print_setting(info, info->timeouts[t], info->retries[r],
+                          &result);
+            if (result.acked == info->iterations) {
+                /* Something answers at the "absent" address */
+                ret = -EEXIST;
+            } else if (result.unrecovered) {
+                ret = -EIO;
+            }
+        }
+    }
+
+    /* I2C_TIMEOUT and I2C_RETRIES are adapter wide and outlive this fd */
+    if (info->restore_timeout >= 0) {
+        ioctl(file, I2C_TIMEOUT, info->restore_timeout);
+        ioctl(file, I2C_RETRIES, info->restore_retries);
+    } else {
+        print_test_case_log(LOG_TAG, info->case_id,
+                            "Adapter keeps the last timeout/retries, "
+                            "use -T to restore");
+    }
+
+    close(file);
+    return ret;
+}
+
+/**
+ * @brief The i2c_timeout main function
+ *
+ * @param argc The i2c_timeout main arguments count
+ * @param argv The i2c_timeout main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    static const int default_timeouts[] = { 1, 5, 10, 50 };
+    static const int default_retries[] = { 0, 1, 3 };
+    struct timeout_info info;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.busid = -1;
+    info.absent_addr = -1;
+    info.good_addr = -1;
+    info.offset = -1;
+    info.iterations = 50;
+    info.restore_timeout = -1;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    if (!info.ntimeouts) {
+        memcpy(info.timeouts, default_timeouts, sizeof(default_timeouts));
+        info.ntimeouts = sizeof(default_timeouts) / sizeof(int);
+    }
+    if (!info.nretries) {
+        memcpy(info.retries, default_retries, sizeof(default_retries));
+        info.nretries = sizeof(default_retries) / sizeof(int);
+    }
+
+    ret = i2c_timeout_sweep(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
@@ -1,16 +1,594 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "i2c_transfer"
+#define LOG_TAG "I2C"
 
-#include "stdio.h"
-#include "libfwtest.h"
+#define MAX_BATCHES     64
+#define MAX_MSGS        I2C_RDWR_IOCTL_MAX_MSGS
+#define MAX_MSG_LEN     8192
+#define MAX_TOKENS      (MAX_MSGS * 16)
+#define MAX_LINE        4096
 
-void usage()
+struct xfer_batch {
+    int                 nmsgs;
+    struct i2c_msg      msgs[MAX_MSGS];
+    /** expected read data, NULL if the message is not verified */
+    uint8_t             *expect[MAX_MSGS];
+    uint64_t            bytes;
+    struct test_stats   batch_us;
+    struct test_stats   msg_us[MAX_MSGS];
+    int                 errors;
+    int                 last_error;
+    int                 mismatches;
+};
+
+struct xfer_info {
+    int                 case_id;
+    int                 busid;
+    char                *script;
+    int                 loops;
+    int                 per_msg;
+    int                 nbatches;
+    struct xfer_batch   *batches[MAX_BATCHES];
+};
+
+/**
+ * @brief Print usage of this I2C transfer test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] -b bus-id [-f script] [-l loops] [-m]"
+           " [msg [data...]]...\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -b: I2C bus number.\n");
+    printf("    -f: script file, one batch of messages per line.\n");
+    printf("    -l: run all batches this many times (default 1).\n");
+    printf("    -m: also time every message as its own transfer.\n");
+    printf("  A message is {r|w}LENGTH[@address]. A write is followed by\n");
+    printf("  LENGTH data bytes, a read may be followed by LENGTH expected\n");
+    printf("  bytes. The address carries over to the following messages.\n");
+    printf("  A batch holds up to %d messages and runs as one I2C_RDWR.\n",
+           MAX_MSGS);
+    printf("Example : write register 0x10, read it back and verify\n");
+    printf("     ./%s -b 0 -l 1000 w2@0x50 0x10 0xa5 w1 0x10 r1 0xa5\n",
+           APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Release a batch and its message buffers
+ *
+ * @param batch The batch to free
+ * @return None
+ */
+static void free_batch(struct xfer_batch *batch)
+{
+    int i;
+
+    for (i = 0; i < batch->nmsgs; i++) {
+        free(batch->msgs[i].buf);
+        free(batch->expect[i]);
+    }
+    free(batch);
+}
+
+/**
+ * @brief Close the message being parsed and check its data count
+ *
+ * A read without expected bytes is not verified, a write must carry
+ * exactly LENGTH bytes.
+ *
+ * @param batch The batch being parsed
+ * @param ndata Number of data bytes given for the last message
+ * @return 0 on success, -EINVAL on error
+ */
+static int finish_msg(struct xfer_batch *batch, int ndata)
+{
+    int last = batch->nmsgs - 1;
+
+    if (last < 0) {
+        return 0;
+    }
+
+    if (batch->msgs[last].flags & I2C_M_RD) {
+        if (!ndata) {
+            free(batch->expect[last]);
+            batch->expect[last] = NULL;
+            return 0;
+        }
+    }
+
+    return ndata == batch->msgs[last].len ? 0 : -EINVAL;
+}
+
+/**
+ * @brief Parse one batch from a list of tokens
+ *
+ * @param tokens The message and data tokens
+ * @param ntokens Number of tokens
+ * @param batch Output batch, zeroed by the caller
+ * @return 0 on success, negative errno on error
+ */
+static int parse_batch(char **tokens, int ntokens, struct xfer_batch *batch)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    struct i2c_msg *msg = NULL;
+    uint8_t *data = NULL;
+    int addr = -1, ndata = 0, len, n, i, ret;
+    char *end, dir;
+    long value;
+
+    for (i = 0; i < ntokens; i++) {
+        dir = tokens[i][0];
+        if (dir == 'r' || dir == 'w') {
+            ret = finish_msg(batch, ndata);
+            if (ret) {
+                return ret;
+            }
+            if (batch->nmsgs >= MAX_MSGS) {
+                return -E2BIG;
+            }
+
+            n = 0;
+            if (sscanf(tokens[i] + 1, "%d%n", &len, &n) != 1 ||
+                len < 1 || len > MAX_MSG_LEN) {
+                return -EINVAL;
+            }
+            if (tokens[i][1 + n] == '@') {
+                addr = (int)strtol(tokens[i] + 2 + n, &end, 0);
+                if (*end || addr < 0 || addr > 0x7f) {
+                    return -EINVAL;
+                }
+            } else if (tokens[i][1 + n]) {
+                return -EINVAL;
+            }
+            if (addr < 0) {
+                return -EINVAL;
+            }
+
+            msg = &batch->msgs[batch->nmsgs];
+            msg->addr = addr;
+            msg->flags = dir == 'r' ? I2C_M_RD : 0;
+            msg->len = len;
+            msg->buf = calloc(1, len);
+            if (!msg->buf) {
+                return -ENOMEM;
+            }
+            data = msg->buf;
+            if (dir == 'r') {
+                batch->expect[batch->nmsgs] = calloc(1, len);
+                if (!batch->expect[batch->nmsgs]) {
+                    /* not counted in nmsgs yet, free_batch() misses it */
+                    free(msg->buf);
+                    return -ENOMEM;
+                }
+                data = batch->expect[batch->nmsgs];
+            }
+            batch->bytes += len;
+            batch->nmsgs++;
+            ndata = 0;
+            continue;
+        }
+
+        value = strtol(tokens[i], &end, 0);
+        if (!msg || *end || value < 0 || value > 0xff) {
+            return -EINVAL;
+        }
+        if (ndata >= msg->len) {
+            return -E2BIG;
+        }
+        data[ndata++] = (uint8_t)value;
+    }
+
+    if (!msg) {
+        return -EINVAL;
+    }
+
+    return finish_msg(batch, ndata);
+}
+
+/**
+ * @brief Allocate, parse and append one batch
+ *
+ * @param info The test parameters
+ * @param tokens The message and data tokens
+ * @param ntokens Number of tokens
+ * @return 0 on success, negative errno on error
+ */
+static int add_batch(struct xfer_info *info, char **tokens, int ntokens)
+{
+    struct xfer_batch *batch;
+    int ret;
+
+    if (info->nbatches >= MAX_BATCHES) {
+        return -E2BIG;
+    }
+
+    batch = calloc(1, sizeof(*batch));
+    if (!batch) {
+        return -ENOMEM;
+    }
+
+    ret = parse_batch(tokens, ntokens, batch);
+    if (ret) {
+        free_batch(batch);
+        return ret;
+    }
+
+    info->batches[info->nbatches++] = batch;
     return 0;
 }
+
+/**
+ * @brief Load batches from a script file
+ *
+ * Every non-empty line is one batch, '#' starts a comment. A line longer
+ * than MAX_LINE or with more than MAX_TOKENS tokens is rejected rather
+ * than cut.
+ *
+ * @param info The test parameters
+ * @return 0 on success, negative errno on error
+ */
+static int load_script(struct xfer_info *info)
+{
+    char line[MAX_LINE], buf[MAX_LINE + 64], *tokens[MAX_TOKENS], *p;
+    int lineno = 0, ntokens, ret = 0;
+    FILE *fp;
+
+    fp = fopen(info->script, "r");
+    if (!fp) {
+        return -errno;
+    }
+
+    while (!ret && fgets(line, sizeof(line), fp)) {
+        lineno++;
+        if (!strchr(line, '\n') && !feof(fp)) {
+            ret = -E2BIG;
+            break;
+        }
+        p = strchr(line, '#');
+        if (p) {
+            *p = '\0';
+        }
+
+        ntokens = 0;
+        for (p = strtok(line, " \t\r\n"); p;
+             p = strtok(NULL, " \t\r\n")) {
+            if (ntokens >= MAX_TOKENS) {
+                ret = -E2BIG;
+                break;
+            }
+            tokens[ntokens++] = p;
+        }
+        if (!ret && ntokens) {
+            ret = add_batch(info, tokens, ntokens);
+        }
+    }
+
+    if (ret) {
+        snprintf(buf, sizeof(buf), "%s:%d: %s", info->script, lineno,
+                 strerror(-ret));
+        print_test_case_log(LOG_TAG, info->case_id, buf);
+    }
+    fclose(fp);
+    return ret;
+}
+
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct xfer_info *info, int argc, char **argv)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "c:b:f:l:m")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'b':
+            info->busid = atoi(optarg);
+            break;
+        case 'f':
+            info->script = optarg;
+            break;
+        case 'l':
+            info->loops = atoi(optarg);
+            break;
+        case 'm':
+            info->per_msg = 1;
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (info->busid < 0 || info->loops < 1) {
+        return -EINVAL;
+    }
+
+    if (info->script && load_script(info)) {
+        return -EINVAL;
+    }
+
+    if (optind < argc && add_batch(info, &argv[optind], argc - optind)) {
+        return -EINVAL;
+    }
+
+    return info->nbatches ? 0 : -EINVAL;
+}
+
+/**
+ * @brief Compare the read messages of a batch against the expected data
+ *
+ * Only the first mismatch of each batch is logged.
+ *
+ * @param info The test parameters
+ * @param index The batch index
+ * @param batch The batch just transferred
+ * @return Number of mismatching messages
+ */
+static int verify_batch(struct xfer_info *info, int index,
+                        struct xfer_batch *batch)
+{
+    char buf[128];
+    int i, n, mismatches = 0;
+
+    for (i = 0; i < batch->nmsgs; i++) {
+        if (!batch->expect[i] ||
+            !memcmp(batch->msgs[i].buf, batch->expect[i],
+                    batch->msgs[i].len)) {
+            continue;
+        }
+
+        if (!batch->mismatches && !mismatches) {
+            for (n = 0; batch->msgs[i].buf[n] == batch->expect[i][n]; n++)
+                ;
+            snprintf(buf, sizeof(buf), "batch %d msg %d byte %d: "
+                     "read 0x%02x expected 0x%02x", index, i, n,
+                     batch->msgs[i].buf[n], batch->expect[i][n]);
+            print_test_case_log(LOG_TAG, info->case_id, buf);
+        }
+        mismatches++;
+    }
+
+    return mismatches;
+}
+
+/**
+ * @brief Run one batch as a single combined transfer
+ *
+ * @param info The test parameters
+ * @param file The adapter file descriptor
+ * @param index The batch index
+ * @param batch The batch to run
+ * @return None, errors are counted in the batch
+ */
+static void run_batch(struct xfer_info *info, int file, int index,
+                      struct xfer_batch *batch)
+{
+    struct i2c_rdwr_ioctl_data data;
+    uint64_t start;
+    int i, ret;
+
+    data.msgs = batch->msgs;
+    data.nmsgs = batch->nmsgs;
+
+    start = get_time_ns();
+    ret = ioctl(file, I2C_RDWR, &data);
+    if (ret != batch->nmsgs) {
+        batch->errors++;
+        batch->last_error = ret < 0 ? errno : EIO;
+        return;
+    }
+    stats_add(&batch->batch_us, (get_time_ns() - start) / 1000);
+
+    ret = verify_batch(info, index, batch);
+    batch->mismatches += ret;
+    if (ret || !info->per_msg) {
+        return;
+    }
+
+    /* Each message alone, with its own START and STOP */
+    for (i = 0; i < batch->nmsgs; i++) {
+        data.msgs = &batch->msgs[i];
+        data.nmsgs = 1;
+
+        start = get_time_ns();
+        if (ioctl(file, I2C_RDWR, &data) != 1) {
+            batch->errors++;
+            batch->last_error = errno;
+            return;
+        }
+        stats_add(&batch->msg_us[i], (get_time_ns() - start) / 1000);
+    }
+}
+
+/**
+ * @brief Print the latency and throughput figures of one batch
+ *
+ * @param info The test parameters
+ * @param index The batch index
+ * @param batch The batch
+ * @return None
+ */
+static void print_batch(struct xfer_info *info, int index,
+                        struct xfer_batch *batch)
+{
+    char stats[128], buf[384];
+    uint64_t rate = 0;
+    int i;
+
+    stats_format(&batch->batch_us, stats, sizeof(stats));
+    if (batch->batch_us.sum) {
+        rate = batch->bytes * batch->batch_us.count * 1000000 /
+               batch->batch_us.sum;
+    }
+
+    snprintf(buf, sizeof(buf), "batch=%d msgs=%d bytes=%llu ok=%llu "
+             "errors=%d mismatches=%d batch_us(%s) bytes_per_s=%llu",
+             index, batch->nmsgs, (unsigned long long)batch->bytes,
+             (unsigned long long)batch->batch_us.count, batch->errors,
+             batch->mismatches, stats, (unsigned long long)rate);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+    for (i = 0; info->per_msg && i < batch->nmsgs; i++) {
+        stats_format(&batch->msg_us[i], stats, sizeof(stats));
+        snprintf(buf, sizeof(buf), "batch=%d msg=%d %c%d@0x%02x us(%s)",
+                 index, i, batch->msgs[i].flags & I2C_M_RD ? 'r' : 'w',
+                 batch->msgs[i].len, batch->msgs[i].addr, stats);
+        print_test_case_perf(LOG_TAG, info->case_id, buf);
+    }
+
+    if (batch->errors) {
+        snprintf(buf, sizeof(buf), "batch %d: %d failed transfers, last %s",
+                 index, batch->errors, strerror(batch->last_error));
+        print_test_case_log(LOG_TAG, info->case_id, buf);
+    }
+}
+
+/**
+ * @brief Run all batches for the requested number of loops
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int i2c_transfer_run(struct xfer_info *info)
+{
+    struct xfer_batch *batch;
+    uint64_t start, elapsed, bytes = 0, msgs = 0;
+    char buf[256];
+    int file, loop, i, ret = 0;
+
+    file = open_i2c_dev(info->busid);
+    if (file < 0) {
+        return -errno;
+    }
+
+    for (i = 0; i < info->nbatches; i++) {
+        stats_reset(&info->batches[i]->batch_us);
+        for (loop = 0; loop < MAX_MSGS; loop++) {
+            stats_reset(&info->batches[i]->msg_us[loop]);
+        }
+    }
+
+    start = get_time_ns();
+    for (loop = 0; loop < info->loops; loop++) {
+        for (i = 0; i < info->nbatches; i++) {
+            run_batch(info, file, i, info->batches[i]);
+        }
+    }
+    elapsed = get_time_ns() - start;
+
+    close(file);
+
+    for (i = 0; i < info->nbatches; i++) {
+        batch = info->batches[i];
+        print_batch(info, i, batch);
+
+        bytes += batch->bytes * batch->batch_us.count;
+        msgs += (uint64_t)batch->nmsgs * batch->batch_us.count;
+        if (batch->mismatches) {
+            ret = -EBADMSG;
+        } else if (batch->errors && !ret) {
+            ret = -batch->last_error;
+        }
+    }
+
+    /* Aggregate figures include the -m single transfers */
+    if (elapsed) {
+        snprintf(buf, sizeof(buf), "loops=%d batches=%d elapsed_us=%llu "
+                 "batches_per_s=%llu msgs_per_s=%llu bytes_per_s=%llu",
+                 info->loops, info->nbatches,
+                 (unsigned long long)(elapsed / 1000),
+                 (unsigned long long)((uint64_t)info->loops *
+                                      info->nbatches * 1000000000ULL /
+                                      elapsed),
+                 (unsigned long long)(msgs * 1000000000ULL / elapsed),
+                 (unsigned long long)(bytes * 1000000000ULL / elapsed));
+        print_test_case_perf(LOG_TAG, info->case_id, buf);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief The i2c_transfer main function
+ *
+ * @param argc The i2c_transfer main arguments count
+ * @param argv The i2c_transfer main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct xfer_info info;
+    int ret, i;
+
+    memset(&info, 0, sizeof(info));
+    info.busid = -1;
+    info.loops = 1;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        ret = -EINVAL;
+        goto out;
+    }
+
+    ret = i2c_transfer_run(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+out:
+    for (i = 0; i < info.nbatches; i++) {
+        free_batch(info.batches[i]);
+    }
+
+    return ret;
+}
@@ -1,16 +1,542 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "mod_release"
+#define LOG_TAG "MOD"
+
+#define MAX_TARGETS         64
+#define IO_RETRY_MS         5
+/* re-check period without a uevent socket or while a watched dir is gone */
+#define SYSFS_RETRY_MS      10
+#define EJECT_CTRL_DEFAULT  "/bus/greybus/devices/1-svc/intf_eject"
+#define GB_DEVICES          "/bus/greybus/devices"
+
+enum phase {
+    PHASE_TEARDOWN,
+    PHASE_NODES_GONE,
+    PHASE_REENUM,
+    PHASE_BOUND,
+    PHASE_FIRST_IO,
+    PHASE_CYCLE,
+    PHASE_COUNT,
+};
+
+static const char * const phase_names[PHASE_COUNT] = {
+    "teardown", "nodes_gone", "reenum", "bound", "first_io", "cycle",
+};
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct release_info {
+    int                 case_id;
+    char                *intf;
+    char                *eject_ctrl;
+    char                *attach_ctrl;
+    char                *attach_value;
+    int                 cycles;
+    int                 timeout_ms;
+    int                 verbose;
+    /** sysfs directories of the interface, its bundles and class devices */
+    int                 nsys;
+    char                sys[MAX_TARGETS][DEV_PATH_LEN];
+    /** sys[] entry used for the first I/O when there is no device node */
+    int                 io_sys;
+    /** device nodes owned by the interface */
+    int                 ndev;
+    char                dev[MAX_TARGETS][DEV_NODE_LEN];
+    struct test_stats   phase_us[PHASE_COUNT];
+};
 
-void usage()
+/**
+ * @brief Print usage of this module release test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] -i interface [-e eject-ctrl]"
+           " [-a ctrl=value]\n"
+           "          [-n cycles] [-t timeout-ms] [-r sysfs-root] [-v]\n",
+           APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -i: Greybus interface to release, e.g. 1-2.\n");
+    printf("    -e: control the interface id is written to, relative to the"
+           " sysfs root\n"
+           "        (default %s).\n", EJECT_CTRL_DEFAULT);
+    printf("    -a: control written to re-attach the module, relative to the"
+           " sysfs\n"
+           "        root. Without it the module must come back by itself.\n");
+    printf("    -n: release/re-attach cycles (default 100).\n");
+    printf("    -t: timeout of every phase in ms (default 10000).\n");
+    printf("    -r: sysfs root directory (default /sys).\n");
+    printf("    -v: print every cycle and event.\n");
+    printf("Example : 200 cycles of module 1-2\n");
+    printf("     ./%s -i 1-2 -n 200\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct release_info *info, int argc, char **argv)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "c:i:e:a:n:t:r:v")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'i':
+            info->intf = optarg;
+            break;
+        case 'e':
+            info->eject_ctrl = optarg;
+            break;
+        case 'a':
+            info->attach_ctrl = optarg;
+            info->attach_value = strchr(optarg, '=');
+            if (!info->attach_value) {
+                return -EINVAL;
+            }
+            *info->attach_value++ = '\0';
+            break;
+        case 'n':
+            info->cycles = atoi(optarg);
+            break;
+        case 't':
+            info->timeout_ms = atoi(optarg);
+            break;
+        case 'r':
+            set_sysfs_root(optarg);
+            break;
+        case 'v':
+            info->verbose = 1;
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (!info->intf || !strchr(info->intf, '-') || info->cycles < 1 ||
+        info->timeout_ms < 1) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write a value to a control below the sysfs root
+ *
+ * @param ctrl Control path relative to the sysfs root
+ * @param value The value
+ * @return 0 on success, negative errno on failure
+ */
+static int write_ctrl(const char *ctrl, char *value)
+{
+    char path[PATH_MAX], *attr;
+
+    sysfs_path(path, sizeof(path), "%s", ctrl);
+    attr = strrchr(path, '/');
+    if (!attr) {
+        return -EINVAL;
+    }
+    *attr++ = '\0';
+
+    return debugfs_set_attr(path, attr, value, strlen(value));
+}
+
+/**
+ * @brief Collect everything the interface provides before the first release
+ *
+ * @param info The test parameters
+ * @return 0 on success, negative errno on failure
+ */
+static int collect_targets(struct release_info *info)
+{
+    const struct dev_entry *entry = NULL;
+    struct dev_index index;
+    size_t len = strlen(info->intf);
+    int ret;
+
+    ret = dev_index_build(&index);
+    if (ret) {
+        return ret;
+    }
+
+    sysfs_path(info->sys[info->nsys++], DEV_PATH_LEN, "%s/%s", GB_DEVICES,
+               info->intf);
+
+    while ((entry = dev_index_next(&index, NULL, entry)) != NULL) {
+        /* Bundles are named <interface>.<bundle id> */
+        if (strncmp(entry->bundle_name, info->intf, len) ||
+            entry->bundle_name[len] != '.') {
+            continue;
+        }
+
+        if (info->nsys < MAX_TARGETS) {
+            if (!info->io_sys && strcmp(entry->class, "greybus")) {
+                info->io_sys = info->nsys;
+            }
+            snprintf(info->sys[info->nsys++], DEV_PATH_LEN, "%s",
+                     entry->syspath);
+        }
+        if (entry->devnode[0] && !access(entry->devnode, F_OK) &&
+            info->ndev < MAX_TARGETS) {
+            snprintf(info->dev[info->ndev++], DEV_NODE_LEN, "%s",
+                     entry->devnode);
+        }
+    }
+
+    dev_index_free(&index);
+
+    return access(info->sys[0], F_OK) ? -ENODEV : 0;
+}
+
+/**
+ * @brief Watch the parent directory of every target
+ *
+ * Already watched directories are skipped, so this is called again while
+ * waiting to pick up directories that were removed and re-created.
+ *
+ * @param info The test parameters
+ * @param mon The event monitor
+ * @return Number of directories missing, negative errno on failure
+ */
+static int watch_targets(struct release_info *info, struct uevent_monitor *mon)
+{
+    char dir[DEV_PATH_LEN];
+    int i, ret, missing = 0;
+
+    for (i = 0; i < info->nsys + info->ndev; i++) {
+        snprintf(dir, sizeof(dir), "%s",
+                 i < info->nsys ? info->sys[i] : info->dev[i - info->nsys]);
+        ret = uevent_monitor_watch(mon, dirname(dir));
+        if (ret == -ENOENT) {
+            missing++;
+        } else if (ret) {
+            return ret;
+        }
+    }
+
+    return missing;
+}
+
+static int teardown_done(struct release_info *info)
+{
+    return access(info->sys[0], F_OK) != 0;
+}
+
+static int nodes_gone(struct release_info *info)
+{
+    int i;
+
+    for (i = 0; i < info->ndev; i++) {
+        if (!access(info->dev[i], F_OK)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int reenum_done(struct release_info *info)
+{
+    return !access(info->sys[0], F_OK);
+}
+
+static int bound_done(struct release_info *info)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    int i;
+
+    for (i = 1; i < info->nsys; i++) {
+        if (access(info->sys[i], F_OK)) {
+            return 0;
+        }
+    }
+    for (i = 0; i < info->ndev; i++) {
+        if (access(info->dev[i], F_OK)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Try the first I/O on the re-attached module
+ *
+ * Opens the first device node, or reads the uevent attribute of the first
+ * class device (else of the interface) when there is no device node.
+ *
+ * @param info The test parameters
+ * @return 1 on success, 0 if not ready yet
+ */
+static int first_io_done(struct release_info *info)
+{
+    char value[256];
+    int fd;
+
+    if (info->ndev) {
+        fd = open(info->dev[0], O_RDWR | O_NONBLOCK);
+        if (fd < 0) {
+            return 0;
+        }
+        close(fd);
+        return 1;
+    }
+
+    return !debugfs_get_attr(info->sys[info->io_sys], "uevent", value,
+                             sizeof(value));
+}
+
+/**
+ * @brief Wait until a phase is done, waking up on events only
+ *
+ * @param info The test parameters
+ * @param mon The event monitor
+ * @param done Phase completion check
+ * @param retry_ms Re-check period without events, -1 for none
+ * @param when Output completion time
+ * @return 0 on success, -ETIMEDOUT on timeout, negative errno on failure
+ */
+static int wait_phase(struct release_info *info, struct uevent_monitor *mon,
+                      int (*done)(struct release_info *), int retry_ms,
+                      uint64_t *when)
+{
+    uint64_t deadline = get_time_ns() + (uint64_t)info->timeout_ms * 1000000;
+    struct uevent event;
+    char buf[DEV_PATH_LEN + 64];
+    int ret, wait_ms;
+
+    while (!done(info)) {
+        *when = get_time_ns();
+        if (*when >= deadline) {
+            return -ETIMEDOUT;
+        }
+
+        /* a removed directory raises nothing once re-created, poll it */
+        ret = watch_targets(info, mon);
+        if (ret < 0) {
+            return ret;
+        }
+
+        wait_ms = (int)((deadline - *when) / 1000000) + 1;
+        if (retry_ms >= 0 && wait_ms > retry_ms) {
+            wait_ms = retry_ms;
+        }
+        if (ret > 0 && wait_ms > SYSFS_RETRY_MS) {
+            wait_ms = SYSFS_RETRY_MS;
+        }
+
+        ret = uevent_monitor_next(mon, &event, wait_ms);
+        if (ret && ret != -ETIMEDOUT) {
+            return ret;
+        }
+        if (!ret && info->verbose) {
+            snprintf(buf, sizeof(buf), "%s %s", event.action, event.path);
+            print_test_case_log(LOG_TAG, info->case_id, buf);
+        }
+    }
+
+    *when = get_time_ns();
+    return 0;
+}
+
+/**
+ * @brief Run one release and re-attach cycle
+ *
+ * Release phases are timed from the eject write. Re-attach phases are
+ * timed from the attach write, or from the end of the release when the
+ * module comes back by itself.
+ *
+ * @param info The test parameters
+ * @param mon The event monitor
+ * @param cycle The cycle number
+ * @return 0 on success, negative errno on failure
+ */
+static int run_cycle(struct release_info *info, struct uevent_monitor *mon,
+                     int cycle)
+{
+    static int (* const checks[])(struct release_info *) = {
+        teardown_done, nodes_gone, reenum_done, bound_done, first_io_done,
+    };
+    uint64_t t[PHASE_COUNT], start, attach;
+    char value[16], buf[256];
+    int i, ret, retry_ms;
+
+    snprintf(value, sizeof(value), "%s", strchr(info->intf, '-') + 1);
+
+    start = get_time_ns();
+    ret = write_ctrl(info->eject_ctrl, value);
+    if (ret) {
+        return ret;
+    }
+
+    attach = start;
+    for (i = PHASE_TEARDOWN; i < PHASE_CYCLE; i++) {
+        if (i == PHASE_REENUM) {
+            attach = get_time_ns();
+            if (info->attach_ctrl) {
+                ret = write_ctrl(info->attach_ctrl, info->attach_value);
+                if (ret) {
+                    return ret;
+                }
+            }
+        }
+
+        if (i == PHASE_FIRST_IO) {
+            retry_ms = IO_RETRY_MS;
+        } else {
+            retry_ms = uevent_monitor_sees_sysfs(mon) ? -1 : SYSFS_RETRY_MS;
+        }
+        ret = wait_phase(info, mon, checks[i], retry_ms, &t[i]);
+        if (ret) {
+            snprintf(buf, sizeof(buf), "cycle %d: %s: %s", cycle,
+                     phase_names[i], strerror(-ret));
+            print_test_case_log(LOG_TAG, info->case_id, buf);
+            return ret;
+        }
+        stats_add(&info->phase_us[i],
+                  (t[i] - (i < PHASE_REENUM ? start : attach)) / 1000);
+    }
+    stats_add(&info->phase_us[PHASE_CYCLE], (t[PHASE_FIRST_IO] - start) / 1000);
+
+    if (info->verbose) {
+        snprintf(buf, sizeof(buf), "cycle %d: teardown=%llu nodes_gone=%llu "
+                 "reenum=%llu bound=%llu first_io=%llu us", cycle,
+                 (unsigned long long)(t[PHASE_TEARDOWN] - start) / 1000,
+                 (unsigned long long)(t[PHASE_NODES_GONE] - start) / 1000,
+                 (unsigned long long)(t[PHASE_REENUM] - attach) / 1000,
+                 (unsigned long long)(t[PHASE_BOUND] - attach) / 1000,
+                 (unsigned long long)(t[PHASE_FIRST_IO] - attach) / 1000);
+        print_test_case_log(LOG_TAG, info->case_id, buf);
+    }
+
     return 0;
 }
+
+/**
+ * @brief Release and re-attach the module for all cycles
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int mod_release_run(struct release_info *info)
+{
+    struct uevent_monitor mon;
+    char stats[128], buf[256];
+    int i, ret;
+
+    ret = collect_targets(info);
+    if (ret) {
+        return ret;
+    }
+
+    ret = uevent_monitor_open(&mon);
+    if (ret) {
+        return ret;
+    }
+
+    ret = watch_targets(info, &mon);
+    if (ret < 0) {
+        goto out;
+    }
+    ret = 0;
+
+    snprintf(buf, sizeof(buf), "interface=%s sysfs_entries=%d dev_nodes=%d "
+             "events=%s", info->intf, info->nsys, info->ndev,
+             uevent_monitor_is_netlink(&mon) ? "uevent" :
+             uevent_monitor_sees_sysfs(&mon) ? "inotify" : "poll");
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+    for (i = 0; i < PHASE_COUNT; i++) {
+        stats_reset(&info->phase_us[i]);
+    }
+
+    for (i = 0; i < info->cycles && !ret; i++) {
+        ret = run_cycle(info, &mon, i);
+    }
+
+    for (i = 0; i < PHASE_COUNT; i++) {
+        stats_format(&info->phase_us[i], stats, sizeof(stats));
+        snprintf(buf, sizeof(buf), "phase=%s us(%s)", phase_names[i], stats);
+        print_test_case_perf(LOG_TAG, info->case_id, buf);
+    }
+
+out:
+    uevent_monitor_close(&mon);
+    return ret;
+}
+
+/**
+ * @brief The mod_release main function
+ *
+ * @param argc The mod_release main arguments count
+ * @param argv The mod_release main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    static struct release_info info;
+    int ret;
+
+    info.eject_ctrl = EJECT_CTRL_DEFAULT;
+    info.cycles = 100;
+    info.timeout_ms = 10000;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    ret = mod_release_run(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
@@ -1,16 +1,610 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "spi_transfer"
+#define LOG_TAG "SPI"
+
+#define MAX_CHAIN           16
+#define MAX_LENGTHS         128
+#define DEFAULT_BUFSIZ      4096
+
+struct spi_info {
+    int         case_id;
+    char        *devname;
+    uint32_t    speed;
+    int         mode;
+    int         bits;
+    int         min_len;
+    int         max_len;
+    int         iterations;
+    int         chain;
+    int         delay_us;
+    int         cs_change;
+    int         verify;
+};
+
+/** One TX/RX buffer pair, page aligned so the controller can DMA it */
+struct spi_buf {
+    uint8_t     *tx;
+    uint8_t     *rx;
+};
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct spi_pool {
+    int             size;
+    int             count;
+    struct spi_buf  buf[MAX_CHAIN * 2];
+};
 
-void usage()
+struct spi_point {
+    int                 len;
+    struct test_stats   msg_ns;
+    int                 errors;
+    int                 mismatches;
+};
+
+/**
+ * @brief Print usage of this SPI transfer test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] -d spidev [-s speed] [-m mode]"
+           " [-b bits]\n"
+           "          [-l min,max] [-n iterations] [-C chain] [-D delay-us]"
+           " [-x] [-k]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: spidev node, MOSI looped back to MISO.\n");
+    printf("    -s: clock in Hz (default: device setting).\n");
+    printf("    -m: SPI mode 0-3 (default: device setting).\n");
+    printf("    -b: bits per word (default 8).\n");
+    printf("    -l: transfer length range in bytes "
+           "(default 1 to the spidev bufsiz).\n");
+    printf("    -n: messages per length (default 100).\n");
+    printf("    -C: transfers chained in one message (default 1, max %d).\n",
+           MAX_CHAIN);
+    printf("    -D: delay in us after each transfer.\n");
+    printf("    -x: toggle chip select between chained transfers.\n");
+    printf("    -k: no loopback, skip the data check.\n");
+    printf("Example : 4 chained transfers, 10us apart, CS toggled\n");
+    printf("     ./%s -d /dev/spidev32766.0 -s 1000000 -C 4 -D 10 -x\n",
+           APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct spi_info *info, int argc, char **argv)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:s:m:b:l:n:C:D:xk")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'd':
+            info->devname = optarg;
+            break;
+        case 's':
+            info->speed = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            info->mode = atoi(optarg);
+            break;
+        case 'b':
+            info->bits = atoi(optarg);
+            break;
+        case 'l':
+            if (sscanf(optarg, "%d,%d", &info->min_len,
+                       &info->max_len) != 2) {
+                return -EINVAL;
+            }
+            break;
+        case 'n':
+            info->iterations = atoi(optarg);
+            break;
+        case 'C':
+            info->chain = atoi(optarg);
+            break;
+        case 'D':
+            info->delay_us = atoi(optarg);
+            break;
+        case 'x':
+            info->cs_change = 1;
+            break;
+        case 'k':
+            info->verify = 0;
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (!info->devname || info->mode > (int)SPI_MODE_3 || info->bits < 1 ||
+        info->bits > 32 || info->iterations < 1 || info->chain < 1 ||
+        info->chain > MAX_CHAIN || info->delay_us < 0 ||
+        info->delay_us > 0xffff) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read the spidev per-message buffer limit
+ *
+ * spidev rejects messages whose transfers add up to more than bufsiz.
+ *
+ * @return The limit in bytes
+ */
+static int spidev_bufsiz(void)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    char path[PATH_MAX];
+    int bufsiz = 0;
+    FILE *fp;
+
+    sysfs_path(path, sizeof(path), "/module/spidev/parameters/bufsiz");
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &bufsiz) != 1) {
+            bufsiz = 0;
+        }
+        fclose(fp);
+    }
+
+    return bufsiz > 0 ? bufsiz : DEFAULT_BUFSIZ;
+}
+
+/**
+ * @brief Allocate the TX/RX buffer pool once for the whole sweep
+ *
+ * Two buffer pairs per chained transfer so consecutive messages never
+ * reuse the buffers just handed to the controller.
+ *
+ * @param pool The pool
+ * @param chain Transfers per message
+ * @param size Bytes per buffer
+ * @return 0 on success, negative errno on error
+ */
+static int pool_alloc(struct spi_pool *pool, int chain, int size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    int i;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->size = (size + page - 1) / page * page;
+    for (i = 0; i < chain * 2; i++) {
+        if (posix_memalign((void **)&pool->buf[i].tx, page, pool->size) ||
+            posix_memalign((void **)&pool->buf[i].rx, page, pool->size)) {
+            return -ENOMEM;
+        }
+        pool->count++;
+        /* Fault the pages in before anything is timed */
+        memset(pool->buf[i].tx, 0, pool->size);
+        memset(pool->buf[i].rx, 0, pool->size);
+    }
+
     return 0;
 }
+
+static void pool_free(struct spi_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < MAX_CHAIN * 2; i++) {
+        free(pool->buf[i].tx);
+        free(pool->buf[i].rx);
+    }
+}
+
+/**
+ * @brief Fill a TX buffer with a pattern unique to this message
+ *
+ * @param buf The buffer
+ * @param len Number of bytes
+ * @param seed Pattern seed
+ * @return None
+ */
+static void fill_pattern(uint8_t *buf, int len, uint32_t seed)
+{
+    uint32_t x = seed * 2654435761U + 1;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[i] = (uint8_t)x;
+    }
+}
+
+/**
+ * @brief Compare a received buffer against the sent one
+ *
+ * memcmp is the vectorized fast path, the byte scan only runs to locate
+ * a mismatch.
+ *
+ * @param tx The sent data
+ * @param rx The received data
+ * @param len Number of bytes
+ * @return -1 if equal, otherwise offset of the first differing byte
+ */
+static int compare_buf(const uint8_t *tx, const uint8_t *rx, int len)
+{
+    int i;
+
+    if (!memcmp(tx, rx, len)) {
+        return -1;
+    }
+
+    for (i = 0; i < len && tx[i] == rx[i]; i++)
+        ;
+
+    return i;
+}
+
+/**
+ * @brief Run all messages for one transfer length
+ *
+ * @param info The test parameters
+ * @param fd The spidev file descriptor
+ * @param pool The buffer pool
+ * @param point The length to run, results are stored here
+ * @return None
+ */
+static void run_length(struct spi_info *info, int fd, struct spi_pool *pool,
+                       struct spi_point *point)
+{
+    struct spi_ioc_transfer xfer[MAX_CHAIN];
+    struct spi_buf *buf;
+    uint64_t start;
+    char msg[128];
+    int iter, i, off;
+
+    stats_reset(&point->msg_ns);
+    memset(xfer, 0, sizeof(xfer));
+
+    for (iter = 0; iter < info->iterations; iter++) {
+        /*
+         * command_parse() caps chain at MAX_CHAIN, the bound here is for
+         * gcc, which warns about xfer[] under -O3 -flto otherwise
+         */
+        for (i = 0; i < info->chain && i < MAX_CHAIN; i++) {
+            buf = &pool->buf[(iter & 1) * info->chain + i];
+            if (info->verify) {
+                fill_pattern(buf->tx, point->len,
+                             (iter * MAX_CHAIN + i) ^ point->len);
+                memset(buf->rx, 0, point->len);
+            }
+
+            xfer[i].tx_buf = (unsigned long)buf->tx;
+            xfer[i].rx_buf = (unsigned long)buf->rx;
+            xfer[i].len = point->len;
+            xfer[i].speed_hz = info->speed;
+            xfer[i].bits_per_word = info->bits;
+            xfer[i].delay_usecs = info->delay_us;
+            /* cs_change on the last transfer would keep CS asserted */
+            xfer[i].cs_change = info->cs_change && i < info->chain - 1;
+        }
+
+        start = get_time_ns();
+        if (ioctl(fd, SPI_IOC_MESSAGE(info->chain), xfer) < 0) {
+            if (!point->errors) {
+                snprintf(msg, sizeof(msg), "len %d: %s", point->len,
+                         strerror(errno));
+                print_test_case_log(LOG_TAG, info->case_id, msg);
+            }
+            point->errors++;
+            continue;
+        }
+        stats_add(&point->msg_ns, get_time_ns() - start);
+
+        for (i = 0; info->verify && i < info->chain; i++) {
+            buf = &pool->buf[(iter & 1) * info->chain + i];
+            off = compare_buf(buf->tx, buf->rx, point->len);
+            if (off < 0) {
+                continue;
+            }
+            if (!point->mismatches) {
+                snprintf(msg, sizeof(msg), "len %d msg %d xfer %d byte %d: "
+                         "sent 0x%02x got 0x%02x", point->len, iter, i, off,
+                         buf->tx[off], buf->rx[off]);
+                print_test_case_log(LOG_TAG, info->case_id, msg);
+            }
+            point->mismatches++;
+        }
+    }
+}
+
+/**
+ * @brief Least squares fit of y = a + b * x over points [from, to)
+ *
+ * @param x The lengths
+ * @param y The mean message times in ns
+ * @param from First point
+ * @param to One past the last point
+ * @param slope Output ns per byte
+ * @return Sum of squared residuals
+ */
+static double fit_line(const double *x, const double *y, int from, int to,
+                       double *slope)
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, a, b, r, sse = 0;
+    int i, n = to - from;
+
+    for (i = from; i < to; i++) {
+        sx += x[i];
+        sy += y[i];
+        sxx += x[i] * x[i];
+        sxy += x[i] * y[i];
+    }
+
+    b = (n * sxx - sx * sx) ? (n * sxy - sx * sy) / (n * sxx - sx * sx) : 0;
+    a = (sy - b * sx) / n;
+    for (i = from; i < to; i++) {
+        r = y[i] - a - b * x[i];
+        sse += r * r;
+    }
+
+    *slope = b;
+    return sse;
+}
+
+/**
+ * @brief Locate the length where the per-byte cost changes
+ *
+ * Two-segment regression: every split point is tried and the one with
+ * the smallest total residual wins. Below the knee small transfers are
+ * dominated by per-operation overhead, above it by the bulk data rate.
+ *
+ * @param info The test parameters
+ * @param points The measured lengths
+ * @param npoints Number of lengths
+ * @return None
+ */
+static void print_knee(struct spi_info *info, struct spi_point *points,
+                       int npoints)
+{
+    double x[MAX_LENGTHS], y[MAX_LENGTHS], left, right, sse, best = -1;
+    double best_left = 0, best_right = 0;
+    int i, n = 0, knee = -1;
+    char buf[256];
+
+    for (i = 0; i < npoints; i++) {
+        if (points[i].msg_ns.count) {
+            x[n] = (double)points[i].len * info->chain;
+            y[n] = (double)stats_mean(&points[i].msg_ns);
+            n++;
+        }
+    }
+
+    for (i = 2; i <= n - 2; i++) {
+        sse = fit_line(x, y, 0, i, &left) + fit_line(x, y, i, n, &right);
+        if (best < 0 || sse < best) {
+            best = sse;
+            best_left = left;
+            best_right = right;
+            knee = i;
+        }
+    }
+
+    if (knee < 0) {
+        print_test_case_log(LOG_TAG, info->case_id,
+                            "Too few lengths to locate the knee");
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "knee_len=%d below_ns_per_byte=%.2f "
+             "below_bytes_per_s=%.0f above_ns_per_byte=%.2f "
+             "above_bytes_per_s=%.0f", (int)(x[knee] / info->chain),
+             best_left, best_left > 0 ? 1e9 / best_left : 0,
+             best_right, best_right > 0 ? 1e9 / best_right : 0);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+}
+
+/**
+ * @brief Bytes per word in the spidev buffers
+ *
+ * spidev keeps words wider than 8 bits in 2 or 4 byte units and rejects
+ * transfers that are not a whole number of them.
+ *
+ * @param bits Bits per word
+ * @return 1, 2 or 4
+ */
+static int word_bytes(int bits)
+{
+    return bits > 16 ? 4 : bits > 8 ? 2 : 1;
+}
+
+/**
+ * @brief Build the list of lengths to sweep
+ *
+ * Geometric steps of roughly 1.25x, every length is tried once. Lengths
+ * are whole words, min_len and max_len already are.
+ *
+ * @param info The test parameters
+ * @param points Output lengths
+ * @return Number of lengths
+ */
+static int build_lengths(struct spi_info *info, struct spi_point *points)
+{
+    int word = word_bytes(info->bits);
+    int len = info->min_len, n = 0;
+
+    memset(points, 0, sizeof(*points) * MAX_LENGTHS);
+    while (n < MAX_LENGTHS) {
+        points[n++].len = len;
+        if (len >= info->max_len) {
+            break;
+        }
+        len += len / 4 > word ? len / 4 : word;
+        len = (len + word - 1) / word * word;
+        if (len > info->max_len) {
+            len = info->max_len;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * @brief Sweep transfer lengths and report latency and throughput
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int spi_transfer_sweep(struct spi_info *info)
+{
+    static struct spi_point points[MAX_LENGTHS];
+    struct spi_pool pool;
+    char stats[128], buf[320];
+    uint8_t mode;
+    uint32_t speed = 0;
+    int fd, bufsiz, npoints, word, i, ret = 0;
+    uint64_t mean;
+
+    bufsiz = spidev_bufsiz();
+    if (!info->max_len || info->max_len * info->chain > bufsiz) {
+        info->max_len = bufsiz / info->chain;
+    }
+    word = word_bytes(info->bits);
+    info->min_len = (info->min_len + word - 1) / word * word;
+    info->max_len = info->max_len / word * word;
+    if (info->min_len < 1 || info->min_len > info->max_len) {
+        return -EINVAL;
+    }
+
+    fd = open(info->devname, O_RDWR);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    if (info->mode >= 0) {
+        mode = info->mode;
+        if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0) {
+            ret = -errno;
+            goto err_close;
+        }
+    }
+    ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed);
+
+    ret = pool_alloc(&pool, info->chain, info->max_len);
+    if (ret) {
+        goto err_free;
+    }
+
+    snprintf(buf, sizeof(buf), "bufsiz=%d max_len=%d speed_hz=%u chain=%d "
+             "delay_us=%d cs_change=%d", bufsiz, info->max_len,
+             info->speed ? info->speed : speed, info->chain, info->delay_us,
+             info->cs_change);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+    npoints = build_lengths(info, points);
+    for (i = 0; i < npoints; i++) {
+        run_length(info, fd, &pool, &points[i]);
+
+        stats_format(&points[i].msg_ns, stats, sizeof(stats));
+        mean = stats_mean(&points[i].msg_ns);
+        snprintf(buf, sizeof(buf), "len=%d ok=%llu errors=%d mismatches=%d "
+                 "msg_ns(%s) bytes_per_s=%llu", points[i].len,
+                 (unsigned long long)points[i].msg_ns.count,
+                 points[i].errors, points[i].mismatches, stats,
+                 mean ? (unsigned long long)points[i].len * info->chain *
+                        1000000000ULL / mean : 0ULL);
+        print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+        if (points[i].mismatches) {
+            ret = -EBADMSG;
+        } else if (points[i].errors && !ret) {
+            ret = -EIO;
+        }
+    }
+
+    print_knee(info, points, npoints);
+
+err_free:
+    pool_free(&pool);
+err_close:
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief The spi_transfer main function
+ *
+ * @param argc The spi_transfer main arguments count
+ * @param argv The spi_transfer main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct spi_info info;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.mode = -1;
+    info.bits = 8;
+    info.min_len = 1;
+    info.iterations = 100;
+    info.chain = 1;
+    info.verify = 1;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    ret = spi_transfer_sweep(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
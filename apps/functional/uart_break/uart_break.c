@@ -1,16 +1,565 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "uart_break"
+#define LOG_TAG "UART"
+
+#define MAX_DURATIONS   16
+#define DETECT_RING     64
+#define RX_POLL_MS      100
+
+struct break_info {
+    int     case_id;
+    char    *txname;
+    char    *rxname;
+    int     baud;
+    int     ndurations;
+    int     durations[MAX_DURATIONS];
+    int     count;
+    int     gap_ms;
+    int     load;
+    int     max_missed;
+};
+
+/* State shared between the sender and the receive thread */
+struct break_rx {
+    int             fd;
+    volatile int    stop;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    /* detection timestamps, written by the receive thread */
+    uint64_t        detect_ns[DETECT_RING];
+    unsigned int    detected;
+    uint64_t        data_bytes;
+    uint64_t        errors;
+};
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct break_load {
+    int             fd;
+    volatile int    stop;
+    uint64_t        bytes;
+};
 
-void usage()
+/**
+ * @brief Print usage of this UART break test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] -d tx-device [-r rx-device] "
+           "[-s baud]\n"
+           "          [-b ms[,ms...]] [-n count] [-g gap-ms] [-l] "
+           "[-x max-missed]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: UART sending the breaks.\n");
+    printf("    -r: UART receiving them (default: same as -d, looped).\n");
+    printf("    -s: baud rate of both ports (default 115200).\n");
+    printf("    -b: break durations in ms (default 1,10,50,250).\n");
+    printf("    -n: breaks sent per duration (default 20).\n");
+    printf("    -g: idle time between breaks in ms (default 20).\n");
+    printf("    -l: keep sending data while the breaks are sent.\n");
+    printf("    -x: fail if more breaks are missed (default 0).\n");
+    printf("Example : breaks under load between two wired UARTs\n");
+    printf("     ./%s -d /dev/ttyGB0 -r /dev/ttyHS1 -l\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct break_info *info, int argc, char **argv)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    char *tok, *save = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:r:s:b:n:g:lx:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'd':
+            info->txname = optarg;
+            break;
+        case 'r':
+            info->rxname = optarg;
+            break;
+        case 's':
+            info->baud = atoi(optarg);
+            break;
+        case 'b':
+            info->ndurations = 0;
+            for (tok = strtok_r(optarg, ",", &save); tok;
+                 tok = strtok_r(NULL, ",", &save)) {
+                if (info->ndurations >= MAX_DURATIONS || atoi(tok) < 0) {
+                    return -EINVAL;
+                }
+                info->durations[info->ndurations++] = atoi(tok);
+            }
+            break;
+        case 'n':
+            info->count = atoi(optarg);
+            break;
+        case 'g':
+            info->gap_ms = atoi(optarg);
+            break;
+        case 'l':
+            info->load = 1;
+            break;
+        case 'x':
+            info->max_missed = atoi(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (!info->txname || info->count < 1 || info->gap_ms < 0) {
+        return -EINVAL;
+    }
+    if (!info->rxname) {
+        info->rxname = info->txname;
+    }
+
     return 0;
 }
+
+/**
+ * @brief Configure the receive side to report breaks in band
+ *
+ * With PARMRK set and IGNBRK/BRKINT clear, a break is read as the sequence
+ * 0xff 0x00 0x00, a character with a framing or parity error X as
+ * 0xff 0x00 X and a data byte 0xff as 0xff 0xff.
+ *
+ * @param fd The receive tty
+ * @return 0 on success, negative errno on failure
+ */
+static int set_break_marking(int fd)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio)) {
+        return -errno;
+    }
+
+    tio.c_iflag &= ~(IGNBRK | BRKINT | IGNPAR | ISTRIP);
+    tio.c_iflag |= PARMRK | INPCK;
+
+    return tcsetattr(fd, TCSANOW, &tio) ? -errno : 0;
+}
+
+static void rx_break_detected(struct break_rx *rx, uint64_t now)
+{
+    pthread_mutex_lock(&rx->lock);
+    rx->detect_ns[rx->detected % DETECT_RING] = now;
+    rx->detected++;
+    pthread_cond_signal(&rx->cond);
+    pthread_mutex_unlock(&rx->lock);
+}
+
+/**
+ * @brief Receive thread: timestamp breaks as soon as they are read
+ *
+ * The thread only blocks in poll(), so the detection time is not delayed
+ * by the sender sleeping through a break or by the load writer.
+ */
+static void *rx_thread(void *arg)
+{
+    struct break_rx *rx = arg;
+    struct pollfd pfd;
+    uint8_t buf[256];
+    uint64_t now;
+    ssize_t n, i;
+    int state = 0;
+
+    pfd.fd = rx->fd;
+    pfd.events = POLLIN;
+
+    while (!rx->stop) {
+        if (poll(&pfd, 1, RX_POLL_MS) <= 0) {
+            continue;
+        }
+
+        n = read(rx->fd, buf, sizeof(buf));
+        now = get_time_ns();
+
+        for (i = 0; i < n; i++) {
+            switch (state) {
+            case 0:
+                if (buf[i] == 0xff) {
+                    state = 1;
+                } else {
+                    rx->data_bytes++;
+                }
+                break;
+            case 1:
+                if (buf[i] == 0xff) {
+                    rx->data_bytes++;
+                    state = 0;
+                } else {
+                    state = 2;
+                }
+                break;
+            default:
+                if (buf[i] == 0x00) {
+                    rx_break_detected(rx, now);
+                } else {
+                    rx->errors++;
+                }
+                state = 0;
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Load thread: keep the transmitter busy with data
+ */
+static void *load_thread(void *arg)
+{
+    struct break_load *load = arg;
+    struct pollfd pfd;
+    uint8_t buf[64];
+    ssize_t n;
+    int i;
+
+    /* Avoid 0x00 and 0xff so the load never looks like a marker */
+    for (i = 0; i < (int)sizeof(buf); i++) {
+        buf[i] = 0x20 + (i % 0x5f);
+    }
+
+    pfd.fd = load->fd;
+    pfd.events = POLLOUT;
+
+    while (!load->stop) {
+        if (poll(&pfd, 1, RX_POLL_MS) <= 0) {
+            continue;
+        }
+        n = write(load->fd, buf, sizeof(buf));
+        if (n > 0) {
+            load->bytes += n;
+        }
+    }
+
+    return NULL;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+/**
+ * @brief Wait for the detection of the break sent at assert_ns
+ *
+ * Detections older than the break are stale (late detections of an earlier
+ * break that was already counted as missed) and are skipped.
+ *
+ * @param rx The receive state
+ * @param next Index of the next detection to consume, updated
+ * @param assert_ns Time the break was asserted
+ * @param timeout_ns How long to wait
+ * @param detect_ns Output detection time
+ * @param stale Incremented for every stale detection
+ * @return 0 if detected, -ETIMEDOUT if missed
+ */
+static int wait_detection(struct break_rx *rx, unsigned int *next,
+                          uint64_t assert_ns, uint64_t timeout_ns,
+                          uint64_t *detect_ns, int *stale)
+{
+    struct timespec deadline;
+    uint64_t abs_ns = get_time_ns() + timeout_ns;
+    int ret = -ETIMEDOUT;
+
+    deadline.tv_sec = abs_ns / 1000000000ULL;
+    deadline.tv_nsec = abs_ns % 1000000000ULL;
+
+    pthread_mutex_lock(&rx->lock);
+    for (;;) {
+        /* Detections that fell out of the ring are lost, skip them */
+        if (rx->detected - *next > DETECT_RING) {
+            *stale += rx->detected - DETECT_RING - *next;
+            *next = rx->detected - DETECT_RING;
+        }
+
+        while (*next < rx->detected) {
+            *detect_ns = rx->detect_ns[*next % DETECT_RING];
+            (*next)++;
+            if (*detect_ns >= assert_ns) {
+                ret = 0;
+                goto out;
+            }
+            (*stale)++;
+        }
+
+        if (pthread_cond_timedwait(&rx->cond, &rx->lock, &deadline) ==
+            ETIMEDOUT) {
+            break;
+        }
+    }
+
+out:
+    pthread_mutex_unlock(&rx->lock);
+    return ret;
+}
+
+/**
+ * @brief Send breaks of every duration and match their detections
+ *
+ * @param info The test parameters
+ * @param txfd The sending tty
+ * @param rx The receive state
+ * @return Total number of missed breaks, negative errno on failure
+ */
+static int send_breaks(struct break_info *info, int txfd,
+                       struct break_rx *rx)
+{
+    struct test_stats assert_us, release_us;
+    char buf[512], assert_str[128], release_str[128];
+    uint64_t assert_ns, release_ns, detect_ns;
+    unsigned int next = 0;
+    int d, i, missed, stale, total_missed = 0;
+
+    for (d = 0; d < info->ndurations; d++) {
+        stats_reset(&assert_us);
+        stats_reset(&release_us);
+        missed = 0;
+        stale = 0;
+
+        for (i = 0; i < info->count; i++) {
+            assert_ns = get_time_ns();
+            if (info->durations[d]) {
+                if (ioctl(txfd, TIOCSBRK) < 0) {
+                    return -errno;
+                }
+                sleep_ns((uint64_t)info->durations[d] * 1000000ULL);
+                ioctl(txfd, TIOCCBRK);
+            } else if (tcsendbreak(txfd, 0)) {
+                /* duration 0: the driver default, 0.25 to 0.5 s */
+                return -errno;
+            }
+            release_ns = get_time_ns();
+
+            if (wait_detection(rx, &next, assert_ns,
+                               release_ns - assert_ns + 200000000ULL,
+                               &detect_ns, &stale)) {
+                missed++;
+            } else {
+                stats_add(&assert_us, (detect_ns - assert_ns) / 1000);
+                if (detect_ns > release_ns) {
+                    stats_add(&release_us, (detect_ns - release_ns) / 1000);
+                } else {
+                    stats_add(&release_us, 0);
+                }
+            }
+
+            sleep_ns((uint64_t)info->gap_ms * 1000000ULL);
+        }
+
+        stats_format(&assert_us, assert_str, sizeof(assert_str));
+        stats_format(&release_us, release_str, sizeof(release_str));
+        snprintf(buf, sizeof(buf), "break_ms=%d sent=%d missed=%d stale=%d "
+                 "load=%s assert_to_detect_us(%s) release_to_detect_us(%s)",
+                 info->durations[d], info->count, missed, stale,
+                 info->load ? "on" : "off", assert_str, release_str);
+        print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+        total_missed += missed;
+    }
+
+    return total_missed;
+}
+
+/**
+ * @brief Run the whole break test
+ *
+ * @param info The test parameters
+ * @return 0 on success, error code on failure
+ */
+static int uart_break_test(struct break_info *info)
+{
+    struct serial_icounter_struct icount_start, icount_end;
+    struct break_load load;
+    struct break_rx rx;
+    pthread_condattr_t attr;
+    pthread_t rx_tid, load_tid;
+    char buf[256];
+    int txfd, have_icount, missed, ret;
+
+    txfd = uart_open(info->txname);
+    if (txfd < 0) {
+        return txfd;
+    }
+
+    memset(&rx, 0, sizeof(rx));
+    rx.fd = uart_open(info->rxname);
+    if (rx.fd < 0) {
+        close(txfd);
+        return rx.fd;
+    }
+
+    ret = uart_set_line(txfd, info->baud, 'N', 8, 1);
+    if (!ret) {
+        ret = uart_set_line(rx.fd, info->baud, 'N', 8, 1);
+    }
+    if (!ret) {
+        ret = set_break_marking(rx.fd);
+    }
+    if (ret) {
+        goto out_close;
+    }
+
+    have_icount = !ioctl(rx.fd, TIOCGICOUNT, &icount_start);
+
+    pthread_mutex_init(&rx.lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rx.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    tcflush(rx.fd, TCIOFLUSH);
+    ret = -pthread_create(&rx_tid, NULL, rx_thread, &rx);
+    if (ret) {
+        goto out_sync;
+    }
+
+    memset(&load, 0, sizeof(load));
+    load.fd = txfd;
+    if (info->load) {
+        ret = -pthread_create(&load_tid, NULL, load_thread, &load);
+        if (ret) {
+            rx.stop = 1;
+            pthread_join(rx_tid, NULL);
+            goto out_sync;
+        }
+    }
+
+    missed = send_breaks(info, txfd, &rx);
+
+    if (info->load) {
+        load.stop = 1;
+        pthread_join(load_tid, NULL);
+    }
+    rx.stop = 1;
+    pthread_join(rx_tid, NULL);
+
+    if (missed < 0) {
+        ret = missed;
+        goto out_sync;
+    }
+
+    snprintf(buf, sizeof(buf), "rx_data_bytes=%llu rx_errors=%llu "
+             "load_bytes=%llu", (unsigned long long)rx.data_bytes,
+             (unsigned long long)rx.errors, (unsigned long long)load.bytes);
+    print_test_case_log(LOG_TAG, info->case_id, buf);
+
+    /* Cross-check the in-band markers with the driver break counter */
+    if (have_icount && !ioctl(rx.fd, TIOCGICOUNT, &icount_end)) {
+        snprintf(buf, sizeof(buf), "driver brk=%d frame=%d parity=%d "
+                 "overrun=%d markers=%u", icount_end.brk - icount_start.brk,
+                 icount_end.frame - icount_start.frame,
+                 icount_end.parity - icount_start.parity,
+                 icount_end.overrun - icount_start.overrun, rx.detected);
+        print_test_case_log(LOG_TAG, info->case_id, buf);
+    }
+
+    ret = missed > info->max_missed ? -EIO : 0;
+
+out_sync:
+    pthread_cond_destroy(&rx.cond);
+    pthread_mutex_destroy(&rx.lock);
+out_close:
+    close(rx.fd);
+    close(txfd);
+    return ret;
+}
+
+/**
+ * @brief The uart_break main function
+ *
+ * @param argc The uart_break main arguments count
+ * @param argv The uart_break main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct break_info info;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.baud = 115200;
+    info.durations[0] = 1;
+    info.durations[1] = 10;
+    info.durations[2] = 50;
+    info.durations[3] = 250;
+    info.ndurations = 4;
+    info.count = 20;
+    info.gap_ms = 20;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    ret = uart_break_test(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
@@ -1,16 +1,411 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <libfwtest.h>
+
 #define APP_NAME "uart_linecfg"
+#define LOG_TAG "UART"
+
+#define MAX_BAUDS       32
+#define MAX_BURST       4096
 
-#include "stdio.h"
-#include "libfwtest.h"
+struct linecfg_info {
+    int     case_id;
+    char    *devname;
+    int     use_pty;
+    int     nbauds;
+    int     bauds[MAX_BAUDS];
+    char    *parities;
+    char    *data_bits;
+    char    *stop_bits;
+    int     burst;
+    int     timeout_ms;
+};
 
-void usage()
+struct linecfg_port {
+    int     txfd;
+    int     rxfd;
+};
+
+struct linecfg_totals {
+    int                 configs;
+    int                 unsupported;
+    int                 failed;
+    struct test_stats   reconfig_us;
+    struct test_stats   burst_us;
+};
+
+/**
+ * @brief Print usage of this UART line configuration test application
+ *
+ * @return None
+ */
+static void print_usage(void)
 {
-    fprintf(stdout,"Usage: %s\n", APP_NAME);
+    printf("\nUsage: %s [-c case-id] [-d device | -p] [-b baud[,baud...]]\n"
+           "          [-P parities] [-D data-bits] [-S stop-bits]\n"
+           "          [-l burst-bytes] [-t timeout-ms]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: UART device with TX looped back to RX.\n");
+    printf("    -p: use a pseudo terminal pair instead of a UART.\n");
+    printf("    -b: baud rates to test (default all termios rates).\n");
+    printf("    -P: parities to test, any of NEO (default NEO).\n");
+    printf("    -D: data bits to test, any of 5678 (default 5678).\n");
+    printf("    -S: stop bits to test, any of 12 (default 12).\n");
+    printf("    -l: bytes sent per configuration (default 64).\n");
+    printf("    -t: burst timeout in ms (default from the baud rate).\n");
+    printf("Example : sweep all 8-bit configurations on a pty pair\n");
+    printf("     ./%s -p -D 8\n", APP_NAME);
 }
 
-int main(int argc, char **argv)
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct linecfg_info *info, int argc, char **argv)
 {
-    fprintf(stdout,"%s\n", APP_NAME);
-    dumpargs(argc, argv);
+    char *tok, *save = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:pb:P:D:S:l:t:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'd':
+            info->devname = optarg;
+            break;
+        case 'p':
+            info->use_pty = 1;
+            break;
+        case 'b':
+            for (tok = strtok_r(optarg, ",", &save); tok;
+                 tok = strtok_r(NULL, ",", &save)) {
+                if (info->nbauds >= MAX_BAUDS) {
+                    return -EINVAL;
+                }
+                info->bauds[info->nbauds++] = atoi(tok);
+            }
+            break;
+        case 'P':
+            info->parities = optarg;
+            break;
+        case 'D':
+            info->data_bits = optarg;
+            break;
+        case 'S':
+            info->stop_bits = optarg;
+            break;
+        case 'l':
+            info->burst = atoi(optarg);
+            break;
+        case 't':
+            info->timeout_ms = atoi(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (!info->devname == !info->use_pty || info->burst < 1 ||
+        info->burst > MAX_BURST) {
+        return -EINVAL;
+    }
+
     return 0;
 }
+
+/**
+ * @brief Send a burst and wait until it is looped back
+ *
+ * @param port The UART or pty pair
+ * @param tx Data to send
+ * @param rx Receive buffer, same size as tx
+ * @param len Number of bytes
+ * @param timeout_ms Maximum time for the whole burst
+ * @param elapsed_ns Output time from the first write to the last byte read
+ * @return 0 on success, -ETIMEDOUT if data is missing, -EIO on mismatch
+ */
+static int run_burst(struct linecfg_port *port, const uint8_t *tx,
+                     uint8_t *rx, int len, int timeout_ms,
+                     uint64_t *elapsed_ns)
+{
+    struct pollfd pfd[2];
+    uint64_t start, deadline, now;
+    int sent = 0, recvd = 0, wait_ms;
+    ssize_t n;
+
+    tcflush(port->rxfd, TCIOFLUSH);
+    if (port->txfd != port->rxfd) {
+        tcflush(port->txfd, TCIOFLUSH);
+    }
+
+    start = get_time_ns();
+    deadline = start + (uint64_t)timeout_ms * 1000000ULL;
+    now = start;
+
+    while (recvd < len) {
+        if (now >= deadline) {
+            return -ETIMEDOUT;
+        }
+
+        pfd[0].fd = port->rxfd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = port->txfd;
+        pfd[1].events = sent < len ? POLLOUT : 0;
+
+        wait_ms = (int)((deadline - now + 999999) / 1000000);
+        if (poll(pfd, 2, wait_ms) < 0 && errno != EINTR) {
+            return -errno;
+        }
+
+        if (pfd[1].revents & POLLOUT) {
+            n = write(port->txfd, tx + sent, len - sent);
+            if (n > 0) {
+                sent += n;
+            }
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            n = read(port->rxfd, rx + recvd, len - recvd);
+            if (n > 0) {
+                recvd += n;
+            }
+        }
+
+        now = get_time_ns();
+    }
+
+    *elapsed_ns = now - start;
+
+    return memcmp(tx, rx, len) ? -EIO : 0;
+}
+
+/**
+ * @brief Reconfigure the port and run one loopback burst
+ *
+ * @param info The test parameters
+ * @param port The UART or pty pair
+ * @param baud Baud rate
+ * @param parity 'N', 'E' or 'O'
+ * @param data_bits 5 to 8
+ * @param stop_bits 1 or 2
+ * @param totals Sweep totals to update
+ * @return 0 on success, -EINVAL if unsupported, negative errno on failure
+ */
+static int run_config(struct linecfg_info *info, struct linecfg_port *port,
+                      int baud, char parity, int data_bits, int stop_bits,
+                      struct linecfg_totals *totals)
+{
+    uint8_t tx[MAX_BURST], rx[MAX_BURST];
+    uint64_t start, reconfig_ns, elapsed_ns = 0, bps = 0, max_cps;
+    char buf[256];
+    int frame_bits, timeout_ms, i, n, ret;
+
+    start = get_time_ns();
+    ret = uart_set_line(port->rxfd, baud, parity, data_bits, stop_bits);
+    if (!ret && port->txfd != port->rxfd) {
+        ret = uart_set_line(port->txfd, baud, parity, data_bits, stop_bits);
+    }
+    reconfig_ns = get_time_ns() - start;
+
+    /* A pty has no character framing, the sweep still times everything */
+    if (ret == -EOPNOTSUPP && info->use_pty) {
+        ret = 0;
+    }
+
+    if (ret == -EINVAL || ret == -EOPNOTSUPP) {
+        totals->unsupported++;
+        return ret;
+    }
+
+    totals->configs++;
+    if (ret) {
+        totals->failed++;
+        return ret;
+    }
+    stats_add(&totals->reconfig_us, reconfig_ns / 1000);
+
+    /* Characters only carry data_bits bits, keep the pattern within them */
+    for (i = 0; i < info->burst; i++) {
+        tx[i] = (uint8_t)((i * 37 + baud) & ((1 << data_bits) - 1));
+    }
+
+    frame_bits = 1 + data_bits + (parity != 'N') + stop_bits;
+    max_cps = (uint64_t)baud / frame_bits;
+
+    timeout_ms = info->timeout_ms;
+    if (!timeout_ms) {
+        timeout_ms = (int)(2000ULL * info->burst / max_cps) + 100;
+    }
+
+    ret = run_burst(port, tx, rx, info->burst, timeout_ms, &elapsed_ns);
+    if (ret) {
+        totals->failed++;
+    } else {
+        stats_add(&totals->burst_us, elapsed_ns / 1000);
+        bps = (uint64_t)info->burst * 1000000000ULL / elapsed_ns;
+    }
+
+    n = snprintf(buf, sizeof(buf), "baud=%d line=%d%c%d reconfig_us=%llu "
+                 "bytes=%d burst_us=%llu Bps=%llu", baud, data_bits, parity,
+                 stop_bits, (unsigned long long)(reconfig_ns / 1000),
+                 info->burst, (unsigned long long)(elapsed_ns / 1000),
+                 (unsigned long long)bps);
+    if (!info->use_pty) {
+        n += snprintf(buf + n, sizeof(buf) - n, " max_Bps=%llu eff=%llu%%",
+                      (unsigned long long)max_cps,
+                      (unsigned long long)(bps * 100 / max_cps));
+    }
+    snprintf(buf + n, sizeof(buf) - n, " %s", ret ? strerror(-ret) : "ok");
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+    return ret;
+}
+
+/**
+ * @brief Sweep every baud, parity, data bits and stop bits combination
+ *
+ * @param info The test parameters
+ * @param port The UART or pty pair
+ * @return 0 on success, error code on failure
+ */
+static int linecfg_sweep(struct linecfg_info *info, struct linecfg_port *port)
+{
+    struct linecfg_totals totals;
+    char buf[512], reconfig[128], burst[128];
+    const char *p, *d, *s;
+    uint64_t start;
+    int b;
+
+    memset(&totals, 0, sizeof(totals));
+    stats_reset(&totals.reconfig_us);
+    stats_reset(&totals.burst_us);
+
+    start = get_time_ns();
+    for (b = 0; b < info->nbauds; b++) {
+        for (p = info->parities; *p; p++) {
+            for (d = info->data_bits; *d; d++) {
+                for (s = info->stop_bits; *s; s++) {
+                    run_config(info, port, info->bauds[b], *p, *d - '0',
+                               *s - '0', &totals);
+                }
+            }
+        }
+    }
+
+    stats_format(&totals.reconfig_us, reconfig, sizeof(reconfig));
+    stats_format(&totals.burst_us, burst, sizeof(burst));
+    snprintf(buf, sizeof(buf), "configs=%d unsupported=%d failed=%d "
+             "sweep_ms=%llu reconfig_us(%s) burst_us(%s)", totals.configs,
+             totals.unsupported, totals.failed,
+             (unsigned long long)((get_time_ns() - start) / 1000000),
+             reconfig, burst);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+
+    if (!totals.configs) {
+        return -ENODEV;
+    }
+
+    return totals.failed ? -EIO : 0;
+}
+
+/**
+ * @brief The uart_linecfg main function
+ *
+ * @param argc The uart_linecfg main arguments count
+ * @param argv The uart_linecfg main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct linecfg_info info;
+    struct linecfg_port port;
+    const char *valid;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.parities = "NEO";
+    info.data_bits = "5678";
+    info.stop_bits = "12";
+    info.burst = 64;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    if (strspn(info.parities, "NEO") != strlen(info.parities) ||
+        strspn(info.data_bits, "5678") != strlen(info.data_bits) ||
+        strspn(info.stop_bits, "12") != strlen(info.stop_bits)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    if (!info.nbauds) {
+        while ((info.bauds[info.nbauds] = uart_baud_rate(info.nbauds)) &&
+               info.nbauds < MAX_BAUDS - 1) {
+            info.nbauds++;
+        }
+    }
+
+    if (info.use_pty) {
+        ret = uart_open_pty(&port.txfd, &port.rxfd);
+    } else {
+        ret = uart_open(info.devname);
+        port.txfd = port.rxfd = ret;
+        ret = ret < 0 ? ret : 0;
+    }
+    valid = ret ? strerror(-ret) : NULL;
+
+    if (!ret) {
+        ret = linecfg_sweep(&info, &port);
+        valid = ret ? strerror(-ret) : NULL;
+        if (port.txfd != port.rxfd) {
+            close(port.txfd);
+        }
+        close(port.rxfd);
+    }
+
+    print_test_case_result(LOG_TAG, info.case_id, ret, (char *)valid);
+    return ret;
+}
@@ -45,6 +45,8 @@
 #include <libfwtest.h>
 #include "commsteps.h"
 
+#define GPIO_CLASS  "/class/gpio"
+
 /**
  * @brief Read GPIO debugfs to get Greybus GPIO max count
  *
@@ -58,8 +60,8 @@ int get_greybus_gpio_count(int gpio_pin, char *gpio_max_count, int len)
     int ret = 0;
     char gpiostr[PATH_MAX];
 
-    snprintf(gpiostr, sizeof(gpiostr), "%s%d", "/sys/class/gpio/gpiochip",
-             gpio_pin);
+    sysfs_path(gpiostr, sizeof(gpiostr), "%s/gpiochip%d", GPIO_CLASS,
+               gpio_pin);
     ret = debugfs_get_attr(gpiostr, "ngpio", gpio_max_count, len);
     return ret;
 }
@@ -76,23 +78,24 @@ int check_greybus_gpio(int *gpio_pin, int *gpio_max_count)
     int ret = 0, i = 0;
     DIR *fdir;
     struct dirent *ptr;
-    char buf[PATH_MAX] ,gpiostr[PATH_MAX];
+    char buf[PATH_MAX] ,gpiostr[PATH_MAX], classpath[PATH_MAX];
 
     /* Scan debugfs, find Greybus GPIO sysfs */
-    fdir = opendir("/sys/class/gpio");
+    sysfs_path(classpath, sizeof(classpath), GPIO_CLASS);
+    fdir = opendir(classpath);
     if(fdir == NULL) {
         return -ENOENT;
     }
 
     while ((ptr = readdir(fdir)) != NULL) {
         if (ptr->d_type == DT_LNK) {
-            snprintf(gpiostr, sizeof(gpiostr), "%s%s", "/sys/class/gpio/",
+            snprintf(gpiostr, sizeof(gpiostr), "%s/%s", classpath,
                      ptr->d_name);
             if(debugfs_get_attr(gpiostr, "label", buf, sizeof(buf)) >= 0) {
                 if(strcmp(buf, "greybus_gpio") == 0) {
                     /* re-assign gpiostr string */
-                    snprintf(gpiostr, sizeof(gpiostr), "%s%s",
-                             "/sys/class/gpio/", ptr->d_name);
+                    snprintf(gpiostr, sizeof(gpiostr), "%s/%s",
+                             classpath, ptr->d_name);
                     ret = debugfs_get_attr(gpiostr, "base", buf, sizeof(buf));
                     *gpio_pin = atoi(buf);
                 }
@@ -116,10 +119,13 @@ int check_greybus_gpio(int *gpio_pin, int *gpio_max_count)
 int activate_gpio_pin(int case_id, int gpio_pin)
 {
     int ret = 0;
-    char gpiostr[PATH_MAX];
+    char gpiostr[PATH_MAX], classpath[PATH_MAX];
+    int step;
 
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(classpath, sizeof(classpath), GPIO_CLASS);
     snprintf(gpiostr, sizeof(gpiostr), "%d\n", gpio_pin);
-    ret = debugfs_set_attr("/sys/class/gpio", "export" , gpiostr,
+    ret = debugfs_set_attr(classpath, "export" , gpiostr,
                            sizeof(gpiostr));
     snprintf(gpiostr, sizeof(gpiostr), "%s%d", "Activate GPIO Pin: gpio",
              gpio_pin);
@@ -127,6 +133,7 @@ int activate_gpio_pin(int case_id, int gpio_pin)
         print_test_case_log(LOG_TAG, case_id, gpiostr);
     }
 
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -143,11 +150,14 @@ int activate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
                                int gpio_pin3)
 {
     int ret = 0, i = 0;
-    char gpiostr[PATH_MAX];
+    char gpiostr[PATH_MAX], classpath[PATH_MAX];
+    int step;
 
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(classpath, sizeof(classpath), GPIO_CLASS);
     /* export Greybus GPIO */
     snprintf(gpiostr, sizeof(gpiostr), "%d\n", gpio_pin1);
-    ret = debugfs_set_attr("/sys/class/gpio", "export" , gpiostr,
+    ret = debugfs_set_attr(classpath, "export" , gpiostr,
                            sizeof(gpiostr));
     snprintf(gpiostr, sizeof(gpiostr), "%s%i", "Activate GPIO Pin: gpio",
              gpio_pin1);
@@ -156,7 +166,7 @@ int activate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
     }
 
     snprintf(gpiostr, sizeof(gpiostr), "%d\n", gpio_pin2);
-    ret = debugfs_set_attr("/sys/class/gpio", "export" , gpiostr,
+    ret = debugfs_set_attr(classpath, "export" , gpiostr,
                            sizeof(gpiostr));
     snprintf(gpiostr, sizeof(gpiostr), "%s%i", "Activate GPIO Pin: gpio",
              gpio_pin2);
@@ -165,7 +175,7 @@ int activate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
     }
 
     snprintf(gpiostr, sizeof(gpiostr), "%d\n", gpio_pin3);
-    ret = debugfs_set_attr("/sys/class/gpio", "export" , gpiostr,
+    ret = debugfs_set_attr(classpath, "export" , gpiostr,
                            sizeof(gpiostr));
     snprintf(gpiostr, sizeof(gpiostr), "%s%i", "Activate GPIO Pin: gpio",
              gpio_pin3);
@@ -173,6 +183,7 @@ int activate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
         print_test_case_log(LOG_TAG, case_id, gpiostr);
     }
 
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -186,10 +197,13 @@ int activate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
 int deactivate_gpio_pin(int case_id, int gpio_pin)
 {
     int ret = 0;
-    char gpiostr[PATH_MAX];
+    char gpiostr[PATH_MAX], classpath[PATH_MAX];
+    int step;
 
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(classpath, sizeof(classpath), GPIO_CLASS);
     snprintf(gpiostr, sizeof(gpiostr), "%d\n", gpio_pin);
-    ret = debugfs_set_attr("/sys/class/gpio", "unexport" , gpiostr,
+    ret = debugfs_set_attr(classpath, "unexport" , gpiostr,
                            sizeof(gpiostr));
     snprintf(gpiostr, sizeof(gpiostr), "%s%i", "Deactivate GPIO Pin: gpio",
              gpio_pin);
@@ -197,6 +211,7 @@ int deactivate_gpio_pin(int case_id, int gpio_pin)
         print_test_case_log(LOG_TAG, case_id, gpiostr);
     }
 
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -213,11 +228,14 @@ int deactivate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
                                  int gpio_pin3)
 {
     int ret = 0, i = 0;
-    char gpiostr[PATH_MAX];
+    char gpiostr[PATH_MAX], classpath[PATH_MAX];
+    int step;
 
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(classpath, sizeof(classpath), GPIO_CLASS);
     /* unexport Greybus GPIO */
     snprintf(gpiostr, sizeof(gpiostr), "%d\n", gpio_pin1);
-    ret = debugfs_set_attr("/sys/class/gpio", "unexport" , gpiostr,
+    ret = debugfs_set_attr(classpath, "unexport" , gpiostr,
                            sizeof(gpiostr));
     snprintf(gpiostr, sizeof(gpiostr), "%s%i", "Deactivate GPIO Pin: gpio",
              gpio_pin1);
@@ -226,7 +244,7 @@ int deactivate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
     }
 
     snprintf(gpiostr, sizeof(gpiostr), "%d\n", gpio_pin2);
-    ret = debugfs_set_attr("/sys/class/gpio", "unexport" , gpiostr,
+    ret = debugfs_set_attr(classpath, "unexport" , gpiostr,
                            sizeof(gpiostr));
     snprintf(gpiostr, sizeof(gpiostr), "%s%i", "Deactivate GPIO Pin: gpio",
              gpio_pin2);
@@ -235,7 +253,7 @@ int deactivate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
     }
 
     snprintf(gpiostr, sizeof(gpiostr), "%d\n", gpio_pin3);
-    ret = debugfs_set_attr("/sys/class/gpio", "unexport" , gpiostr,
+    ret = debugfs_set_attr(classpath, "unexport" , gpiostr,
                            sizeof(gpiostr));
     snprintf(gpiostr, sizeof(gpiostr), "%s%i", "Deactivate GPIO Pin: gpio",
              gpio_pin3);
@@ -243,6 +261,7 @@ int deactivate_gpio_multiple_pin(int case_id, int gpio_pin1, int gpio_pin2,
         print_test_case_log(LOG_TAG, case_id, gpiostr);
     }
 
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -259,13 +278,15 @@ int set_gpio_direction(int case_id, int gpio_pin, char *gpio_direction, int len)
 {
     int ret = 0;
     char gpiostr[PATH_MAX];
+    int step;
 
-    snprintf(gpiostr, sizeof(gpiostr), "%s%i", "/sys/class/gpio/gpio", gpio_pin)
-             ;
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(gpiostr, sizeof(gpiostr), "%s/gpio%d", GPIO_CLASS, gpio_pin);
     ret = debugfs_set_attr(gpiostr, "direction", gpio_direction, len);
     snprintf(gpiostr, sizeof(gpiostr), "Set GPIO%d direction = %s",  gpio_pin,
              gpio_direction);
     print_test_case_log(LOG_TAG, case_id, gpiostr);
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -282,13 +303,79 @@ int get_gpio_direction(int case_id, int gpio_pin, char *gpio_direction, int len)
 {
     int ret = 0;
     char gpiostr[PATH_MAX];
+    int step;
 
-    snprintf(gpiostr, sizeof(gpiostr), "%s%i", "/sys/class/gpio/gpio",
-             gpio_pin);
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(gpiostr, sizeof(gpiostr), "%s/gpio%d", GPIO_CLASS, gpio_pin);
     ret = debugfs_get_attr(gpiostr, "direction", gpio_direction, len);
     snprintf(gpiostr, sizeof(gpiostr), "GPIO%d direction = %s", gpio_pin,
              gpio_direction);
     print_test_case_log(LOG_TAG, case_id, gpiostr);
+    trace_step_end(case_id, step, __func__, ret);
+    return ret;
+}
+
+/**
+ * @brief Get the direction of several GPIO pins in one batch
+ *
+ * @param case_id The GPIO test case number
+ * @param gpio_pins GPIO test pins
+ * @param count Number of pins
+ * @param gpio_directions One direction buffer per pin
+ * @param len Size of each gpio_directions buffer
+ * @return 0 on success, error code on failure
+ */
+int get_gpio_direction_multiple(int case_id, const int *gpio_pins, int count,
+                                char **gpio_directions, int len)
+{
+    int ret = 0;
+    char gpiostr[PATH_MAX];
+    char (*dirs)[PATH_MAX];
+    struct sysfs_read *reads;
+    int i, step;
+
+    if (count < 1) {
+        return -EINVAL;
+    }
+
+    /* too big for the stack of a step worker */
+    dirs = malloc(count * sizeof(*dirs));
+    reads = malloc(count * sizeof(*reads));
+    if (!dirs || !reads) {
+        free(dirs);
+        free(reads);
+        return -ENOMEM;
+    }
+
+    step = trace_step_begin(case_id, __func__);
+    for (i = 0; i < count; i++) {
+        sysfs_path(dirs[i], sizeof(dirs[i]), "%s/gpio%d", GPIO_CLASS,
+                   gpio_pins[i]);
+        reads[i].dir = dirs[i];
+        reads[i].attr = "direction";
+        reads[i].buf = gpio_directions[i];
+        reads[i].len = len;
+    }
+
+    ret = sysfs_batch_read(reads, count);
+    free(reads);
+    free(dirs);
+    if (ret == -EINVAL) {
+        trace_step_end(case_id, step, __func__, ret);
+        return ret;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(gpiostr, sizeof(gpiostr), "GPIO%d direction = %s",
+                 gpio_pins[i], gpio_directions[i]);
+        print_test_case_log(LOG_TAG, case_id, gpiostr);
+    }
+
+    /* same error as get_gpio_direction() */
+    if (ret) {
+        ret = -ENOENT;
+    }
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -305,14 +392,16 @@ int set_gpio_value(int case_id, int gpio_pin, char *gpio_value, int len)
 {
     int ret = 0;
     char gpiostr[PATH_MAX];
+    int step;
 
-    snprintf(gpiostr, sizeof(gpiostr), "%s%i", "/sys/class/gpio/gpio",
-             gpio_pin);
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(gpiostr, sizeof(gpiostr), "%s/gpio%d", GPIO_CLASS, gpio_pin);
     ret = debugfs_set_attr(gpiostr, "value", gpio_value, len);
     snprintf(gpiostr, sizeof(gpiostr), "Set GPIO%d value = %d", gpio_pin,
              atoi(gpio_value));
     print_test_case_log(LOG_TAG, case_id, gpiostr);
 
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -329,14 +418,16 @@ int get_gpio_value(int case_id, int gpio_pin, char *gpio_value, int len)
 {
     int ret = 0;
     char gpiostr[PATH_MAX];
+    int step;
 
-    snprintf(gpiostr, sizeof(gpiostr), "%s%i", "/sys/class/gpio/gpio",
-             gpio_pin);
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(gpiostr, sizeof(gpiostr), "%s/gpio%d", GPIO_CLASS, gpio_pin);
     ret = debugfs_get_attr(gpiostr, "value", gpio_value, len);
     snprintf(gpiostr, sizeof(gpiostr), "GPIO%d value = %d", gpio_pin,
              atoi(gpio_value));
     print_test_case_log(LOG_TAG, case_id, gpiostr);
 
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -353,14 +444,16 @@ int set_gpio_edge(int case_id, int gpio_pin, char *gpio_edge, int len)
 {
     int ret = 0;
     char gpiostr[PATH_MAX];
+    int step;
 
-    snprintf(gpiostr, sizeof(gpiostr), "%s%i", "/sys/class/gpio/gpio",
-             gpio_pin);
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(gpiostr, sizeof(gpiostr), "%s/gpio%d", GPIO_CLASS, gpio_pin);
     ret = debugfs_set_attr(gpiostr, "edge", gpio_edge, len);
     snprintf(gpiostr, sizeof(gpiostr), "Set GPIO%d edge = %s", gpio_pin,
              gpio_edge);
     print_test_case_log(LOG_TAG, case_id, gpiostr);
 
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -377,13 +470,15 @@ int get_gpio_edge(int case_id, int gpio_pin, char *gpio_edge, int len)
 {
     int ret = 0;
     char gpiostr[PATH_MAX];
+    int step;
 
-    snprintf(gpiostr, sizeof(gpiostr), "%s%i", "/sys/class/gpio/gpio", gpio_pin)
-             ;
+    step = trace_step_begin(case_id, __func__);
+    sysfs_path(gpiostr, sizeof(gpiostr), "%s/gpio%d", GPIO_CLASS, gpio_pin);
     ret = debugfs_get_attr(gpiostr, "edge", gpio_edge, len);
     snprintf(gpiostr, sizeof(gpiostr), "GPIO%d edge = %s", gpio_pin, gpio_edge);
     print_test_case_log(LOG_TAG, case_id, gpiostr);
 
+    trace_step_end(case_id, step, __func__, ret);
     return ret;
 }
 
@@ -50,6 +50,8 @@ int set_gpio_direction(int case_id, int gpio_pin, char *gpio_direction,
                        int len);
 int get_gpio_direction(int case_id, int gpio_pin, char *gpio_direction,
                        int len);
+int get_gpio_direction_multiple(int case_id, const int *gpio_pins, int count,
+                                char **gpio_directions, int len);
 int set_gpio_value(int case_id, int gpio_pin, char *gpio_value, int len);
 int get_gpio_value(int case_id, int gpio_pin, char *gpio_value, int len);
 int set_gpio_edge(int case_id, int gpio_pin, char *gpio_edge, int len);
@@ -53,6 +53,14 @@ struct gpio_app_info {
     char        num_type[2];
 };
 
+/* Greybus GPIO controller found by a daemon, see main() */
+static struct {
+    int         valid;
+    int         base_pin;
+    int         max_count;
+} gpio_cache;
+static int daemon_mode;
+
 /**
  * @brief Print usage of this GPIO test application
  *
@@ -70,6 +78,9 @@ static void print_usage()
     printf("Example : case C1031 use SDB board, GPIO had 3 pins can\n");
     printf("     test(GPIO0 GPIO8 GPIO9)\n");
     printf("     ./gpiotest -c 1031 -t m -1 0 -2 8 -3 9\n");
+    printf("       gpiotest -D socket\n");
+    printf("    -D: stay resident and run the cases sent by fwtest_client,\n");
+    printf("        e.g. fwtest_client socket -c 1031 -t m -1 0 -2 8 -3 9\n");
  }
 
 /**
@@ -138,6 +149,282 @@ static int command_parse(struct gpio_app_info *info, int argc, char **argv)
     return 0;
 }
 
+/*
+ * Pins of a multi-pin case, at most 3 phases of steps per pin. -t a runs
+ * the case on this many lines at a time.
+ */
+#define GPIO_MAX_STEP_PINS  (STEPS_MAX / 4)
+
+/* The argument of the steps for one pin */
+struct pin_step {
+    struct gpio_app_info    *info;
+    int                     pin;
+    /** direction to set and verify */
+    const char              *direction;
+    char                    buf[8];
+};
+
+/*
+ * Steps of a multi-pin case: phases of one step per pin, each waiting
+ * only for the same pin's previous step, so that the pins' sysfs round
+ * trips overlap. The output comes in phase order, as it did when the
+ * pins were done one after the other.
+ */
+struct pin_steps {
+    struct steps    steps;
+    int             npins;
+    struct pin_step pin[GPIO_MAX_STEP_PINS];
+    /** last step added for each pin */
+    int             last[GPIO_MAX_STEP_PINS];
+    /** first step and size of the phase that gives the test result */
+    int             result;
+    int             nresult;
+    /** first line of the next -t a chunk, 0 for the last chunk */
+    int             next;
+    /** test result of this and the previous chunks */
+    int             status;
+    int             error;
+};
+
+/**
+ * @brief Prepare the steps of a multi-pin case
+ *
+ * The pins are pin1 for -t s, pin1..pin3 for -t m, and for -t a up to
+ * GPIO_MAX_STEP_PINS lines of the controller from all_first on. The case
+ * then runs again from ps->next until it is 0, and only the last chunk
+ * prints the test result. A bad -t fails the case.
+ *
+ * @param ps The steps
+ * @param info The GPIO info from user
+ * @param all_first First line of the -t a chunk, -1 if -t a is not
+ *        supported
+ * @param direction Direction for the direction steps, or NULL
+ * @return 0 on success, error code on failure
+ */
+static int pin_steps_init(struct pin_steps *ps, struct gpio_app_info *info,
+                          int all_first, const char *direction)
+{
+    int i, ret = 0;
+
+    steps_init(&ps->steps, 0);
+    ps->npins = 0;
+    ps->next = 0;
+    ps->status = 0;
+    ps->error = 0;
+
+    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
+        ps->pin[ps->npins++].pin = info->base_pin + info->gpio_pin1;
+        ps->pin[ps->npins++].pin = info->base_pin + info->gpio_pin2;
+        ps->pin[ps->npins++].pin = info->base_pin + info->gpio_pin3;
+    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
+        ps->pin[ps->npins++].pin = info->base_pin + info->gpio_pin1;
+    } else if (all_first >= 0 &&
+               !(strncasecmp(info->num_type, "a", strlen("a") + 1))) {
+        for (i = all_first; i < info->max_count; i++) {
+            if (ps->npins == GPIO_MAX_STEP_PINS) {
+                ps->next = i;
+                break;
+            }
+            ps->pin[ps->npins++].pin = info->base_pin + i;
+        }
+    } else {
+        ret = -EINVAL;
+    }
+
+    if (ret) {
+        check_step_result(info->case_id, ret);
+        print_test_result(info->case_id, ret);
+        return ret;
+    }
+
+    for (i = 0; i < ps->npins; i++) {
+        ps->pin[i].info = info;
+        ps->pin[i].direction = direction;
+        ps->last[i] = STEP_NONE;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Add a phase, one step per pin
+ *
+ * @param ps The steps
+ * @param fn Step function, called with the pin's struct pin_step
+ * @return Index of the phase's first step
+ */
+static int pin_steps_phase(struct pin_steps *ps, step_fn fn)
+{
+    int i, first = ps->steps.count, ret;
+
+    for (i = 0; i < ps->npins && !ps->error; i++) {
+        ret = steps_add(&ps->steps, fn, &ps->pin[i], ps->last[i]);
+        if (ret < 0) {
+            ps->error = ret;
+        }
+        ps->last[i] = ret;
+    }
+
+    return first;
+}
+
+/**
+ * @brief Add a phase done by a single step for all the pins
+ *
+ * The step waits for all the steps added before it, and each pin's next
+ * step waits for it.
+ *
+ * @param ps The steps
+ * @param fn Step function, called with ps
+ * @return Index of the step
+ */
+static int pin_steps_batch(struct pin_steps *ps, step_fn fn)
+{
+    int i, ret;
+
+    if (ps->error) {
+        return ps->steps.count;
+    }
+
+    ret = steps_add(&ps->steps, fn, ps, STEP_ALL);
+    if (ret < 0) {
+        ps->error = ret;
+    }
+    for (i = 0; i < ps->npins; i++) {
+        ps->last[i] = ret;
+    }
+
+    return ret;
+}
+
+static int step_print_result(void *arg)
+{
+    struct pin_steps *ps = arg;
+
+    if (!ps->status) {
+        ps->status = steps_result(&ps->steps, ps->result, ps->nresult);
+    }
+    if (!ps->next) {
+        print_test_result(ps->pin[0].info->case_id, ps->status);
+    }
+    return 0;
+}
+
+/**
+ * @brief Print the test result once all steps added so far are done
+ *
+ * For a -t a chunk other than the last, only keep the result for the
+ * next chunk.
+ *
+ * @param ps The steps
+ * @param phase First step of the phase that gives the result, which must
+ *        be the last phase added
+ * @return None
+ */
+static void pin_steps_result(struct pin_steps *ps, int phase)
+{
+    int ret;
+
+    ps->result = phase;
+    ps->nresult = ps->steps.count - phase;
+    ret = steps_add(&ps->steps, step_print_result, ps, STEP_ALL);
+    if (ret < 0 && !ps->error) {
+        ps->error = ret;
+    }
+}
+
+/**
+ * @brief Run the steps
+ *
+ * @param ps The steps
+ * @param phase First step of the phase whose result is returned
+ * @return 0 on success, error code on failure
+ */
+static int pin_steps_run(struct pin_steps *ps, int phase)
+{
+    if (ps->error) {
+        check_step_result(ps->pin[0].info->case_id, ps->error);
+        return ps->error;
+    }
+
+    steps_run(&ps->steps);
+    return steps_result(&ps->steps, phase, ps->npins);
+}
+
+static int step_activate(void *arg)
+{
+    struct pin_step *p = arg;
+    int ret;
+
+    ret = activate_gpio_pin(p->info->case_id, p->pin);
+    check_step_result(p->info->case_id, ret);
+    return ret;
+}
+
+static int step_deactivate(void *arg)
+{
+    struct pin_step *p = arg;
+
+    return deactivate_gpio_pin(p->info->case_id, p->pin);
+}
+
+static int step_set_direction(void *arg)
+{
+    struct pin_step *p = arg;
+    int ret;
+
+    snprintf(p->buf, sizeof(p->buf), "%s", p->direction);
+    ret = set_gpio_direction(p->info->case_id, p->pin, p->buf,
+                             strlen(p->buf) + 1);
+    check_step_result(p->info->case_id, ret);
+    return ret;
+}
+
+static int step_get_direction(void *arg)
+{
+    struct pin_step *p = arg;
+
+    return get_gpio_direction(p->info->case_id, p->pin, p->buf,
+                              sizeof(p->buf));
+}
+
+static int step_get_directions(void *arg)
+{
+    struct pin_steps *ps = arg;
+    int pins[GPIO_MAX_STEP_PINS];
+    char *directions[GPIO_MAX_STEP_PINS];
+    int i;
+
+    for (i = 0; i < ps->npins; i++) {
+        pins[i] = ps->pin[i].pin;
+        directions[i] = ps->pin[i].buf;
+    }
+
+    return get_gpio_direction_multiple(ps->pin[0].info->case_id, pins,
+                                       ps->npins, directions,
+                                       sizeof(ps->pin[0].buf));
+}
+
+static int step_verify_direction(void *arg)
+{
+    struct pin_step *p = arg;
+    int ret;
+
+    ret = step_get_direction(arg);
+    if (!ret && strcmp(p->buf, p->direction)) {
+        ret = -EIO;
+    }
+    return ret;
+}
+
+static int step_get_value(void *arg)
+{
+    struct pin_step *p = arg;
+
+    return get_gpio_value(p->info->case_id, p->pin, p->buf,
+                          sizeof(p->buf));
+}
+
 /**
  * @brief Testrail test case C1028
  *
@@ -180,38 +467,21 @@ static int ARA_1028_get_count(struct gpio_app_info *info)
  */
 static int ARA_1029_multiple_activate(struct gpio_app_info *info)
 {
-    int ret = 0;
+    struct pin_steps ps;
+    int ret, deactivate;
 
-    /* Activate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = activate_gpio_multiple_pin(info->case_id,
-                                        (info->base_pin + info->gpio_pin1),
-                                        (info->base_pin + info->gpio_pin2),
-                                        (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = activate_gpio_pin(info->case_id,
-                               (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
+    ret = pin_steps_init(&ps, info, -1, NULL);
+    if (ret) {
+        return ret;
     }
 
-    print_test_result(info->case_id, ret);
+    /* Activate GPIO pins */
+    pin_steps_result(&ps, pin_steps_phase(&ps, step_activate));
 
     /* Post-condition: Recover pre-test status.*/
-    /* Deactivate GPIO multiple pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = deactivate_gpio_multiple_pin(info->case_id,
-                                          (info->base_pin + info->gpio_pin1),
-                                          (info->base_pin + info->gpio_pin2),
-                                          (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = deactivate_gpio_pin(info->case_id,
-                                 (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
+    deactivate = pin_steps_phase(&ps, step_deactivate);
 
-    return ret;
+    return pin_steps_run(&ps, deactivate);
 }
 
 /**
@@ -225,39 +495,20 @@ static int ARA_1029_multiple_activate(struct gpio_app_info *info)
  */
 static int ARA_1030_multiple_deactivate(struct gpio_app_info *info)
 {
-    int ret = 0;
-
-    /* Activate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = activate_gpio_multiple_pin(info->case_id,
-                                        (info->base_pin + info->gpio_pin1),
-                                        (info->base_pin + info->gpio_pin2),
-                                        (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = activate_gpio_pin(info->case_id,
-                               (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
-
-    check_step_result(info->case_id, ret);
+    struct pin_steps ps;
+    int ret, deactivate;
 
-    /* Deactivate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = deactivate_gpio_multiple_pin(info->case_id,
-                                          (info->base_pin + info->gpio_pin1),
-                                          (info->base_pin + info->gpio_pin2),
-                                          (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = deactivate_gpio_pin(info->case_id,
-                                 (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
+    ret = pin_steps_init(&ps, info, -1, NULL);
+    if (ret) {
+        return ret;
     }
 
-    print_test_result(info->case_id, ret);
+    /* Activate, then deactivate GPIO pins */
+    pin_steps_phase(&ps, step_activate);
+    deactivate = pin_steps_phase(&ps, step_deactivate);
+    pin_steps_result(&ps, deactivate);
 
-    return ret;
+    return pin_steps_run(&ps, deactivate);
 }
 
 /**
@@ -271,61 +522,22 @@ static int ARA_1030_multiple_deactivate(struct gpio_app_info *info)
  */
 static int ARA_1031_multiple_direction(struct gpio_app_info *info)
 {
-    int ret = 0;
-    /* Get GPIO direction buffer */
-    char directbuf[4];
-
-    /* Activate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = activate_gpio_multiple_pin(info->case_id,
-                                        (info->base_pin + info->gpio_pin1),
-                                        (info->base_pin + info->gpio_pin2),
-                                        (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = activate_gpio_pin(info->case_id,
-                               (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
+    struct pin_steps ps;
+    int ret, deactivate;
 
-    check_step_result(info->case_id, ret);
-
-    /* Get multiple GPIO direction */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = get_gpio_direction(info->case_id,
-                                (info->base_pin + info->gpio_pin1),
-                                 directbuf, sizeof(directbuf));
-        ret = get_gpio_direction(info->case_id,
-                                (info->base_pin + info->gpio_pin2),
-                                 directbuf, sizeof(directbuf));
-        ret = get_gpio_direction(info->case_id,
-                                (info->base_pin + info->gpio_pin3),
-                                 directbuf, sizeof(directbuf));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = get_gpio_direction(info->case_id,
-                                (info->base_pin + info->gpio_pin1),
-                                     directbuf, sizeof(directbuf));
-    } else {
-        ret = -EINVAL;
+    ret = pin_steps_init(&ps, info, -1, NULL);
+    if (ret) {
+        return ret;
     }
 
-    print_test_result(info->case_id, ret);
+    /* Activate GPIO pins, get their direction */
+    pin_steps_phase(&ps, step_activate);
+    pin_steps_result(&ps, pin_steps_phase(&ps, step_get_direction));
 
     /* Post-condition: Recover pre-test status.*/
-    /* Deactivate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = deactivate_gpio_multiple_pin(info->case_id,
-                                          (info->base_pin + info->gpio_pin1),
-                                          (info->base_pin + info->gpio_pin2),
-                                          (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = deactivate_gpio_pin(info->case_id,
-                                 (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
+    deactivate = pin_steps_phase(&ps, step_deactivate);
 
-    return ret;
+    return pin_steps_run(&ps, deactivate);
 }
 
 /**
@@ -393,72 +605,30 @@ static int ARA_1032_multiple_times_direction(struct gpio_app_info *info)
  */
 static int ARA_1033_all_direction(struct gpio_app_info *info)
 {
-    int ret = 0, i = 0;
-    /* Get GPIO direction buffer */
-    char directbuf[4];
+    struct pin_steps ps;
+    int ret, deactivate, first = 0, status = 0;
 
-    /* Activate all GPIO pins */
-    if (!(strncasecmp(info->num_type, "a", strlen("a") + 1))) {
-        for (i = 0; i < info->max_count; i++) {
-            ret = activate_gpio_pin(info->case_id, (info->base_pin + i));
+    do {
+        ret = pin_steps_init(&ps, info, first, NULL);
+        if (ret) {
+            return ret;
         }
-    } else if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = activate_gpio_multiple_pin(info->case_id,
-                                        (info->base_pin + info->gpio_pin1),
-                                        (info->base_pin + info->gpio_pin2),
-                                        (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = activate_gpio_pin(info->case_id,
-                               (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
-
-    check_step_result(info->case_id, ret);
+        ps.status = status;
 
-    /* Get GPIO direction */
-    if (!(strncasecmp(info->num_type, "a", strlen("a") + 1))) {
-        for (i = 0; i < info->max_count; i++) {
-            ret = get_gpio_direction(info->case_id, (info->base_pin + i),
-                                     directbuf, sizeof(directbuf));
-        }
-    } else if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), directbuf,
-                                 sizeof(directbuf));
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin2), directbuf,
-                                 sizeof(directbuf));
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin3), directbuf,
-                                 sizeof(directbuf));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), directbuf,
-                                 sizeof(directbuf));
-    } else {
-        ret = -EINVAL;
-    }
+        /* Activate GPIO pins, get their direction in one batch */
+        pin_steps_phase(&ps, step_activate);
+        pin_steps_result(&ps, pin_steps_batch(&ps, step_get_directions));
 
-    print_test_result(info->case_id, ret);
+        /* Post-condition: Recover pre-test status.*/
+        deactivate = pin_steps_phase(&ps, step_deactivate);
 
-    /* Post-condition: Recover pre-test status.*/
-    /* Deactivate all GPIO pins */
-    if (!(strncasecmp(info->num_type, "a", strlen("a") + 1))) {
-        for (i = 0; i < info->max_count; i++) {
-            ret = deactivate_gpio_pin(info->case_id, (info->base_pin + i));
+        ret = pin_steps_run(&ps, deactivate);
+        if (ps.error) {
+            return ret;
         }
-    } else if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = deactivate_gpio_multiple_pin(info->case_id,
-                                          (info->base_pin + info->gpio_pin1),
-                                          (info->base_pin + info->gpio_pin2),
-                                          (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = deactivate_gpio_pin(info->case_id, (info->base_pin +
-                                  info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
+        status = ps.status;
+        first = ps.next;
+    } while (first);
 
     return ret;
 }
@@ -475,92 +645,23 @@ static int ARA_1033_all_direction(struct gpio_app_info *info)
  */
 static int ARA_1034_multiple_input(struct gpio_app_info *info)
 {
-    int ret = 0;
-    /* GPIO debugfs buffer */
-    char buf[4];
-    /* Set GPIO direction string */
-    char directbuf[] = "in";
+    struct pin_steps ps;
+    int ret, deactivate;
 
-    /* Activate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = activate_gpio_multiple_pin(info->case_id,
-                                        (info->base_pin + info->gpio_pin1),
-                                        (info->base_pin + info->gpio_pin2),
-                                        (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = activate_gpio_pin(info->case_id,
-                               (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
+    ret = pin_steps_init(&ps, info, -1, "in");
+    if (ret) {
+        return ret;
     }
 
-    check_step_result(info->case_id, ret);
-
-    /* Set GPIO direction is input */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        strcpy(buf, directbuf);
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin2), buf, sizeof(buf));
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin3), buf, sizeof(buf));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        strcpy(buf, directbuf);
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-    } else {
-        ret = -EINVAL;
-    }
-
-    check_step_result(info->case_id, ret);
-
-    /* Get GPIO direction, and verify GPIO direction is input */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-        if (!ret) {
-            ret = strcmp(buf, directbuf);
-        }
-
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin2), buf, sizeof(buf));
-        if (!ret) {
-            ret = strcmp(buf, directbuf);
-        }
-
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin3), buf, sizeof(buf));
-        if (!ret) {
-            ret = strcmp(buf, directbuf);
-        }
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-        if (!ret) {
-            ret = strcmp(buf, directbuf);
-        }
-    } else {
-        ret = -EINVAL;
-    }
-
-    print_test_result(info->case_id, ret);
+    /* Set GPIO direction to input, and verify it */
+    pin_steps_phase(&ps, step_activate);
+    pin_steps_phase(&ps, step_set_direction);
+    pin_steps_result(&ps, pin_steps_phase(&ps, step_verify_direction));
 
     /* Post-condition: Recover pre-test status */
-    /* Deactivate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = deactivate_gpio_multiple_pin(info->case_id,
-                                          (info->base_pin + info->gpio_pin1),
-                                          (info->base_pin + info->gpio_pin2),
-                                          (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = deactivate_gpio_pin(info->case_id,
-                                 (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
+    deactivate = pin_steps_phase(&ps, step_deactivate);
 
-    return ret;
+    return pin_steps_run(&ps, deactivate);
 }
 
 /**
@@ -643,92 +744,23 @@ static int ARA_1035_multiple_times_input(struct gpio_app_info *info)
  */
 static int ARA_1036_multiple_output(struct gpio_app_info *info)
 {
-    int ret = 0, i = 0;
-    /* GPIO debugfs buffer */
-    char buf[4];
-    /* Set GPIO direction string */
-    char directbuf[] = "out";
-
-    /* Activate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = activate_gpio_multiple_pin(info->case_id,
-                                        (info->base_pin + info->gpio_pin1),
-                                        (info->base_pin + info->gpio_pin2),
-                                        (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = activate_gpio_pin(info->case_id,
-                               (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
+    struct pin_steps ps;
+    int ret, deactivate;
 
-    check_step_result(info->case_id, ret);
-
-    /* Set GPIO direction is output */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        strcpy(buf, directbuf);
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin2), buf, sizeof(buf));
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin3), buf, sizeof(buf));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        strcpy(buf, directbuf);
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-    } else {
-        ret = -EINVAL;
+    ret = pin_steps_init(&ps, info, -1, "out");
+    if (ret) {
+        return ret;
     }
 
-    check_step_result(info->case_id, ret);
-
-    /* Get GPIO direction, and verify GPIO direction is output */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-        if (!ret) {
-            ret = strcmp(buf, directbuf);
-        }
-
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin2), buf, sizeof(buf));
-        if (!ret) {
-            ret = strcmp(buf, directbuf);
-        }
-
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin3), buf, sizeof(buf));
-        if (!ret) {
-            ret = strcmp(buf, directbuf);
-        }
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = get_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-        if (!ret) {
-            ret = strcmp(buf, directbuf);
-        }
-    } else {
-        ret = -EINVAL;
-    }
-
-    print_test_result(info->case_id, ret);
+    /* Set GPIO direction to output, and verify it */
+    pin_steps_phase(&ps, step_activate);
+    pin_steps_phase(&ps, step_set_direction);
+    pin_steps_result(&ps, pin_steps_phase(&ps, step_verify_direction));
 
     /* Post-condition: Recover pre-test status */
-    /* Deactivate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = deactivate_gpio_multiple_pin(info->case_id,
-                                          (info->base_pin + info->gpio_pin1),
-                                          (info->base_pin + info->gpio_pin2),
-                                          (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = deactivate_gpio_pin(info->case_id,
-                                 (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
+    deactivate = pin_steps_phase(&ps, step_deactivate);
 
-    return ret;
+    return pin_steps_run(&ps, deactivate);
 }
 
 /**
@@ -811,78 +843,23 @@ static int ARA_1037_multiple_times_output(struct gpio_app_info *info)
  */
 static int ARA_1038_get_value(struct gpio_app_info *info)
 {
-    int ret = 0;
-    /* GPIO debugfs buffer */
-    char buf[4];
-    /* Set GPIO direction string */
-    char directbuf[] = "in";
-
-    /* activate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = activate_gpio_multiple_pin(info->case_id,
-                                        (info->base_pin + info->gpio_pin1),
-                                        (info->base_pin + info->gpio_pin2),
-                                        (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = activate_gpio_pin(info->case_id,
-                               (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
-
-    check_step_result(info->case_id, ret);
-
-    /* Set GPIO direction is input */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        strcpy(buf, directbuf);
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin2), buf, sizeof(buf));
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin3), buf, sizeof(buf));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        strcpy(buf, directbuf);
-        ret = set_gpio_direction(info->case_id, (info->base_pin +
-                                 info->gpio_pin1), buf, sizeof(buf));
-    } else {
-        ret = -EINVAL;
-    }
-
-    check_step_result(info->case_id, ret);
+    struct pin_steps ps;
+    int ret, deactivate;
 
-    /* Get GPIO value */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = get_gpio_value(info->case_id, (info->base_pin + info->gpio_pin1),
-                             buf, sizeof(buf));
-        ret = get_gpio_value(info->case_id, (info->base_pin + info->gpio_pin2),
-                             buf, sizeof(buf));
-        ret = get_gpio_value(info->case_id, (info->base_pin + info->gpio_pin3),
-                             buf, sizeof(buf));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = get_gpio_value(info->case_id, (info->base_pin + info->gpio_pin1),
-                             buf, sizeof(buf));
-    } else {
-        ret = -EINVAL;
+    ret = pin_steps_init(&ps, info, -1, "in");
+    if (ret) {
+        return ret;
     }
 
-    print_test_result(info->case_id, ret);
+    /* Set GPIO direction to input, get the value */
+    pin_steps_phase(&ps, step_activate);
+    pin_steps_phase(&ps, step_set_direction);
+    pin_steps_result(&ps, pin_steps_phase(&ps, step_get_value));
 
     /* Post-condition: Recover pre-test status */
-    /* Deactivate multiple GPIO pins */
-    if (!(strncasecmp(info->num_type, "m", strlen("m") + 1))) {
-        ret = deactivate_gpio_multiple_pin(info->case_id,
-                                          (info->base_pin + info->gpio_pin1),
-                                          (info->base_pin + info->gpio_pin2),
-                                          (info->base_pin + info->gpio_pin3));
-    } else if (!(strncasecmp(info->num_type, "s", strlen("s") + 1))) {
-        ret = deactivate_gpio_pin(info->case_id,
-                                 (info->base_pin + info->gpio_pin1));
-    } else {
-        ret = -EINVAL;
-    }
+    deactivate = pin_steps_phase(&ps, step_deactivate);
 
-    return ret;
+    return pin_steps_run(&ps, deactivate);
 }
 
 /**
@@ -2200,15 +2177,16 @@ static int switch_case_number(struct gpio_app_info *info)
 }
 
 /**
- * @brief The gpiotest main function
+ * @brief Run one gpiotest case
  *
- * @param argc The gpiotest main arguments count
- * @param argv The gpiotest main arguments data
+ * @param argc The gpiotest arguments count
+ * @param argv The gpiotest arguments data
  * @return 0 on success, error code on failure
  */
-int main(int argc, char **argv)
+static int gpiotest_run(int argc, char **argv)
 {
     struct gpio_app_info info;
+    struct perf_counters counters;
     int ret = 0, base_pin = 0, max_count;
 
     if (argc < 3) {
@@ -2224,19 +2202,56 @@ int main(int argc, char **argv)
         }
     }
 
-    /* 1. Check Greybus GPIO controller */
-    if (!ret) {
+    /* 1. Check Greybus GPIO controller, once per daemon */
+    if (!ret && gpio_cache.valid) {
+        info.base_pin = gpio_cache.base_pin;
+        info.max_count = gpio_cache.max_count;
+    } else if (!ret) {
         ret = check_greybus_gpio(&base_pin, &max_count);
         info.base_pin = base_pin;
         info.max_count = max_count;
         check_step_result(info.case_id, ret);
+        if (!ret && daemon_mode) {
+            gpio_cache.base_pin = base_pin;
+            gpio_cache.max_count = max_count;
+            gpio_cache.valid = 1;
+        }
     }
 
     /* 2. Switch test case */
     if (!ret) {
+        fwio_reset();
+        perf_counters_start(&counters);
         ret = switch_case_number(&info);
+        perf_counters_stop(&counters);
+        perf_counters_report(&counters, LOG_TAG, info.case_id);
+        fwio_report(LOG_TAG, info.case_id);
         check_step_result(info.case_id, ret);
+        /* the controller may have gone with its module */
+        if (ret == -ENOENT) {
+            gpio_cache.valid = 0;
+        }
     }
 
     return ret;
 }
+
+/**
+ * @brief The gpiotest main function
+ *
+ * With -D, stay resident and run the cases requested by fwtest_client
+ * on the given socket.
+ *
+ * @param argc The gpiotest main arguments count
+ * @param argv The gpiotest main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    if (argc == 3 && !strcmp(argv[1], "-D")) {
+        daemon_mode = 1;
+        return daemon_serve(argv[2], argv[0], gpiotest_run);
+    }
+
+    return gpiotest_run(argc, argv);
+}
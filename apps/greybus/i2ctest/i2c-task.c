@@ -30,36 +30,14 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
 #include "i2c-task.h"
-
-/**
- * @brief open I2C devices.
- *
- * @param i2cbus HW I2C bus.
- *
- * @return file The new file descriptor, or -1 if an error occurred.
- */
-int open_i2c_dev(int i2cbus)
-{
-    int file;
-    char devname[MAXLENGTH];
-    size_t size = sizeof(devname);
-
-    snprintf(devname, size, "/dev/i2c-%d", i2cbus);
-    file = open(devname, O_RDWR);
-
-    if (file < 0 && (errno == ENOENT || errno == ENOTDIR))
-    {
-        sprintf(devname, "/dev/i2c/%d", i2cbus);
-        file = open(devname, O_RDWR);
-    }
-
-    return file;
-}
+#include <libfwtest.h>
 
 /**
  * @brief set I2C devuce as slave.
@@ -72,7 +50,7 @@ int open_i2c_dev(int i2cbus)
  */
 int force_set_slave_addr(int file, int address)
 {
-    if (ioctl(file, I2C_SLAVE_FORCE, address) < 0) {
+    if (fwio_ioctl(file, I2C_SLAVE_FORCE, address) < 0) {
         return -errno;
     }
 
@@ -91,6 +69,7 @@ int ARA_1001_i2cgetfunsupport(struct gb_i2c_info *info)
     unsigned long funcs;
     int file;
     int ret = 0;
+    int step;
     char function[MAXLENGTH];
     size_t size = sizeof(function);
 
@@ -105,8 +84,11 @@ int ARA_1001_i2cgetfunsupport(struct gb_i2c_info *info)
         return -1;
     }
 
-    if (ioctl(file, I2C_FUNCS, &funcs) < 0) {
-        close(file);
+    step = trace_step_begin(1001, "I2C_FUNCS");
+    ret = fwio_ioctl(file, I2C_FUNCS, &funcs);
+    trace_step_end(1001, step, "I2C_FUNCS", ret < 0 ? -errno : 0);
+    if (ret < 0) {
+        fwio_close(file);
         return -1;
     }
 
@@ -114,7 +96,7 @@ int ARA_1001_i2cgetfunsupport(struct gb_i2c_info *info)
 
     ret = strcmp(info->functionality ,function);
 
-    close(file);
+    fwio_close(file);
     return ret;
 }
 
@@ -130,6 +112,7 @@ int ARA_1002_i2creaddata(struct gb_i2c_info *info)
     int file;
     int ret ;
     int size = 1;
+    int step;
     uint8_t buf[2];
 
     /* check input value. */
@@ -147,17 +130,21 @@ int ARA_1002_i2creaddata(struct gb_i2c_info *info)
     }
 
     if (force_set_slave_addr(file, info->devaddress) < 0) {
-        close(file);
+        fwio_close(file);
         return ret;
     }
 
     buf[0] = (uint8_t)info->addr;
-    write(file, buf,size);
+    step = trace_step_begin(1002, "i2c_write");
+    ret = fwio_write(file, buf,size);
+    trace_step_end(1002, step, "i2c_write", ret < 0 ? -errno : 0);
 
-    read(file, buf, size);
+    step = trace_step_begin(1002, "i2c_read");
+    ret = fwio_read(file, buf, size);
+    trace_step_end(1002, step, "i2c_read", ret < 0 ? -errno : 0);
 
     ret = (buf[0] == (uint8_t)info->buf) ? 0 : -1 ;
 
-    close(file);
+    fwio_close(file);
     return ret;
 }
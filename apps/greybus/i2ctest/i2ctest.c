@@ -58,19 +58,22 @@ void print_usage(void)
 
     printf("For case 1001, i2ctest -c 1001 [-b bus_id][-d data] \n");
     printf("For case 1002, i2ctest -c 1002 [-b bus_id] [-a device_address] "
-           "[-i index] [-d data] \n\n");
+           "[-i index] [-d data] \n");
+    printf("To serve the cases sent by fwtest_client, i2ctest -D socket"
+           "\n\n");
 }
 
 /**
- * main function.
+ * run one test case.
  */
-int main(int argc, char *argv[])
+static int i2ctest_run(int argc, char *argv[])
 {
     int ret = 0;
     int caseid = 0;
     struct gb_i2c_info i2c_info;
     char *data = NULL;
     int options = 0;
+    struct perf_counters counters;
 
     /* init param. */
     i2c_info.busid = -EINVAL;
@@ -105,6 +108,8 @@ int main(int argc, char *argv[])
         }
     }
 
+    fwio_reset();
+    perf_counters_start(&counters);
     switch (caseid)
     {
         case 1001:
@@ -121,14 +126,31 @@ int main(int argc, char *argv[])
             ret = -ENOINPUT;
             break;
     }
+    perf_counters_stop(&counters);
 
     if (-ENOINPUT == ret) {
         print_usage();
     } else if(OPSUCCESS == ret ) {
+        perf_counters_report(&counters, APP_NAME, caseid);
+        fwio_report(APP_NAME, caseid);
         print_test_case_result_only(caseid, ret);
     } else {
-       print_test_case_result(APP_NAME, caseid, ret, strerror(errno));
-   }
+        perf_counters_report(&counters, APP_NAME, caseid);
+        fwio_report(APP_NAME, caseid);
+        print_test_case_result(APP_NAME, caseid, ret, strerror(errno));
+    }
 
     return 0;
 }
+
+/**
+ * main function, -D socket stays resident for fwtest_client.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && !strcmp(argv[1], "-D")) {
+        return daemon_serve(argv[2], argv[0], i2ctest_run);
+    }
+
+    return i2ctest_run(argc, argv);
+}
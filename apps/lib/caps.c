@@ -0,0 +1,661 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <linux/limits.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <linux/spi/spidev.h>
+#include <linux/videodev2.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Capability probes are cached in small text files, one per device:
+ *
+ *   ident=<device identity>
+ *   <key>=<value>
+ *   ...
+ *
+ * The identity combines the device node (or sysfs directory) inode and
+ * change time with the kernel boot id, so a cache entry is reused by every
+ * app of a run but invalidated as soon as the device is re-enumerated or the
+ * target is rebooted.
+ */
+#define CAPS_CACHE_DIR      "/data/local/tmp/fwtest-caps"
+#define CAPS_CACHE_ENV      "FWTEST_CACHE_DIR"
+#define MMC_HOST_PATH       "/class/mmc_host"
+#define MMC_DEBUGFS_PATH    "/kernel/debug"
+
+static const char *caps_type_name[] = {
+    [CAPS_V4L2] = "v4l2",
+    [CAPS_I2C]  = "i2c",
+    [CAPS_SPI]  = "spi",
+    [CAPS_MMC]  = "mmc",
+};
+
+/**
+ * @brief Set a capability value, replacing any previous value of the key
+ *
+ * @param caps The capability set
+ * @param key The capability name
+ * @param fmt printf style format of the value
+ * @return 0 on success, -ENOSPC if the capability set is full
+ */
+int caps_set(struct dev_caps *caps, const char *key, const char *fmt, ...)
+{
+    struct caps_entry *entry = NULL;
+    va_list ap;
+    int i;
+
+    for (i = 0; i < caps->count; i++) {
+        if (!strcmp(caps->entry[i].key, key)) {
+            entry = &caps->entry[i];
+            break;
+        }
+    }
+
+    if (!entry) {
+        if (caps->count >= CAPS_MAX_ENTRIES) {
+            return -ENOSPC;
+        }
+        entry = &caps->entry[caps->count++];
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(entry->value, sizeof(entry->value), fmt, ap);
+    va_end(ap);
+
+    return 0;
+}
+
+/**
+ * @brief Look up a capability value
+ *
+ * @param caps The capability set
+ * @param key The capability name
+ * @return The value string, NULL if the key is not present
+ */
+const char *caps_lookup(const struct dev_caps *caps, const char *key)
+{
+    int i;
+
+    for (i = 0; i < caps->count; i++) {
+        if (!strcmp(caps->entry[i].key, key)) {
+            return caps->entry[i].value;
+        }
+    }
+
+    return NULL;
+}
+
+#define CAPS_MORE           ",..."
+#define CAPS_MAX_FORMATS    32
+#define CAPS_MAX_SIZES      64
+
+/*
+ * Append an item to a comma separated list, only if it fits whole. When it
+ * doesn't, the list is ended with CAPS_MORE, for which room is always left.
+ */
+static int append_item(char *list, size_t len, const char *item)
+{
+    size_t used = strlen(list);
+    size_t need = used + (used ? 1 : 0) + strlen(item);
+
+    if (need + strlen(CAPS_MORE) >= len) {
+        snprintf(list + used, len - used, "%s", CAPS_MORE);
+        return -ENOSPC;
+    }
+
+    snprintf(list + used, len - used, "%s%s", used ? "," : "", item);
+    return 0;
+}
+
+static int caps_probe_v4l2(const char *devname, struct dev_caps *caps)
+{
+    struct v4l2_capability cap;
+    struct v4l2_stream stream;
+    uint32_t fourccs[CAPS_MAX_FORMATS];
+    uint32_t width[CAPS_MAX_SIZES], height[CAPS_MAX_SIZES];
+    char fourcc[5], item[32], formats[CAPS_VALUE_LEN] = "";
+    char sizes[CAPS_VALUE_LEN], key[CAPS_KEY_LEN];
+    int nformats, nsizes, f, i, ret;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.fd = open(devname, O_RDWR | O_NONBLOCK);
+    if (stream.fd < 0) {
+        return -errno;
+    }
+
+    if (ioctl(stream.fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        ret = -errno;
+        goto out;
+    }
+
+    if ((ret = caps_set(caps, "driver", "%s", (char *)cap.driver)) ||
+        (ret = caps_set(caps, "card", "%s", (char *)cap.card)) ||
+        (ret = caps_set(caps, "bus_info", "%s", (char *)cap.bus_info)) ||
+        (ret = caps_set(caps, "capabilities", "0x%08x", cap.capabilities))) {
+        goto out;
+    }
+
+    nformats = v4l2_enum_formats(&stream, fourccs, CAPS_MAX_FORMATS);
+    for (f = 0; f < nformats; f++) {
+        v4l2_fourcc_str(fourccs[f], fourcc);
+        if (append_item(formats, sizeof(formats), fourcc)) {
+            break;
+        }
+    }
+    ret = caps_set(caps, "formats", "%s", formats);
+    if (ret) {
+        goto out;
+    }
+
+    /*
+     * One sizes.<fourcc> key per listed format, as long as the set has
+     * room; a format without one has unknown sizes. A size range is
+     * listed as its minimum and maximum.
+     */
+    for (f = 0; f < nformats; f++) {
+        v4l2_fourcc_str(fourccs[f], fourcc);
+        nsizes = v4l2_enum_sizes(&stream, fourccs[f], width, height,
+                                 CAPS_MAX_SIZES);
+        sizes[0] = '\0';
+        for (i = 0; i < nsizes; i++) {
+            snprintf(item, sizeof(item), "%ux%u", width[i], height[i]);
+            if (append_item(sizes, sizeof(sizes), item)) {
+                break;
+            }
+        }
+
+        snprintf(key, sizeof(key), "sizes.%s", fourcc);
+        if (caps_set(caps, key, "%s", sizes)) {
+            break;
+        }
+    }
+    ret = 0;
+
+out:
+    close(stream.fd);
+    return ret;
+}
+
+static int caps_probe_i2c(const char *devname, struct dev_caps *caps)
+{
+    unsigned long funcs;
+    int fd;
+
+    fd = open(devname, O_RDWR);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    if (ioctl(fd, I2C_FUNCS, &funcs) < 0) {
+        close(fd);
+        return -errno;
+    }
+    close(fd);
+
+    caps_set(caps, "funcs", "%lx", funcs);
+    caps_set(caps, "i2c", "%d", !!(funcs & I2C_FUNC_I2C));
+    caps_set(caps, "10bit_addr", "%d", !!(funcs & I2C_FUNC_10BIT_ADDR));
+    caps_set(caps, "protocol_mangling", "%d",
+             !!(funcs & I2C_FUNC_PROTOCOL_MANGLING));
+    caps_set(caps, "nostart", "%d", !!(funcs & I2C_FUNC_NOSTART));
+    caps_set(caps, "smbus_pec", "%d", !!(funcs & I2C_FUNC_SMBUS_PEC));
+    caps_set(caps, "smbus_quick", "%d", !!(funcs & I2C_FUNC_SMBUS_QUICK));
+    caps_set(caps, "smbus_byte", "%d", !!(funcs & I2C_FUNC_SMBUS_BYTE));
+    caps_set(caps, "smbus_byte_data", "%d",
+             !!(funcs & I2C_FUNC_SMBUS_BYTE_DATA));
+    caps_set(caps, "smbus_word_data", "%d",
+             !!(funcs & I2C_FUNC_SMBUS_WORD_DATA));
+    caps_set(caps, "smbus_block_data", "%d",
+             !!(funcs & I2C_FUNC_SMBUS_BLOCK_DATA));
+    caps_set(caps, "smbus_i2c_block", "%d",
+             !!(funcs & I2C_FUNC_SMBUS_I2C_BLOCK));
+
+    return 0;
+}
+
+static int caps_probe_spi(const char *devname, struct dev_caps *caps)
+{
+    uint8_t mode, probe, bits, lsb;
+    uint32_t speed;
+    char modes[CAPS_VALUE_LEN] = "", item[8];
+    int fd, i;
+
+    fd = open(devname, O_RDWR);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    if (ioctl(fd, SPI_IOC_RD_MODE, &mode) < 0 ||
+        ioctl(fd, SPI_IOC_RD_BITS_PER_WORD, &bits) < 0 ||
+        ioctl(fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed) < 0 ||
+        ioctl(fd, SPI_IOC_RD_LSB_FIRST, &lsb) < 0) {
+        close(fd);
+        return -errno;
+    }
+
+    /* Try every clock mode the controller accepts, then restore */
+    for (i = SPI_MODE_0; i <= SPI_MODE_3; i++) {
+        probe = (mode & ~(SPI_CPHA | SPI_CPOL)) | i;
+        if (ioctl(fd, SPI_IOC_WR_MODE, &probe) < 0) {
+            continue;
+        }
+        if (!ioctl(fd, SPI_IOC_RD_MODE, &probe) &&
+            (probe & (SPI_CPHA | SPI_CPOL)) == i) {
+            snprintf(item, sizeof(item), "%d", i);
+            append_item(modes, sizeof(modes), item);
+        }
+    }
+    ioctl(fd, SPI_IOC_WR_MODE, &mode);
+    close(fd);
+
+    caps_set(caps, "mode", "0x%02x", mode);
+    caps_set(caps, "modes", "%s", modes);
+    caps_set(caps, "bits_per_word", "%u", bits ? bits : 8);
+    caps_set(caps, "max_speed_hz", "%u", speed);
+    caps_set(caps, "lsb_first", "%u", lsb);
+
+    return 0;
+}
+
+static int mmc_card_dir(const char *host, char *card, int len)
+{
+    char path[PATH_MAX];
+    struct dirent *ptr;
+    DIR *fdir;
+    size_t hlen = strlen(host);
+
+    sysfs_path(path, sizeof(path), "%s/%s", MMC_HOST_PATH, host);
+    fdir = opendir(path);
+    if (!fdir) {
+        return -ENOENT;
+    }
+
+    snprintf(card, len, "none");
+    while ((ptr = readdir(fdir)) != NULL) {
+        if (!strncmp(ptr->d_name, host, hlen) && ptr->d_name[hlen] == ':') {
+            snprintf(card, len, "%s", ptr->d_name);
+            break;
+        }
+    }
+    closedir(fdir);
+
+    return 0;
+}
+
+static int caps_probe_mmc(const char *host, struct dev_caps *caps)
+{
+    char path[PATH_MAX], line[256], key[CAPS_KEY_LEN], card[64];
+    char *colon, *value;
+    FILE *fp;
+    int i;
+
+    sysfs_path(path, sizeof(path), "%s/%s/ios", MMC_DEBUGFS_PATH, host);
+    fp = fopen(path, "r");
+    if (!fp) {
+        return -errno;
+    }
+
+    /* ios lines look like "bus width:\t2 (4 bits)" */
+    while (fgets(line, sizeof(line), fp)) {
+        colon = strchr(line, ':');
+        if (!colon) {
+            continue;
+        }
+        *colon = '\0';
+        for (value = colon + 1; *value == ' ' || *value == '\t'; value++)
+            ;
+        value[strcspn(value, "\r\n")] = '\0';
+
+        snprintf(key, sizeof(key), "%.*s", (int)sizeof(key) - 1, line);
+        for (i = 0; key[i]; i++) {
+            if (key[i] == ' ') {
+                key[i] = '_';
+            }
+        }
+        caps_set(caps, key, "%s", value);
+    }
+    fclose(fp);
+
+    if (!mmc_card_dir(host, card, sizeof(card))) {
+        caps_set(caps, "card", "%s", card);
+        if (strcmp(card, "none")) {
+            sysfs_path(path, sizeof(path), "%s/%s/%s", MMC_HOST_PATH, host,
+                       card);
+            if (!debugfs_get_attr(path, "type", line, sizeof(line))) {
+                caps_set(caps, "card_type", "%s", line);
+            }
+            if (!debugfs_get_attr(path, "name", line, sizeof(line))) {
+                caps_set(caps, "card_name", "%s", line);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int caps_identity(enum caps_type type, const char *devname,
+                         struct dev_caps *caps)
+{
+    char path[PATH_MAX], boot_id[64], card[64];
+    struct stat st;
+
+    if (debugfs_get_attr("/proc/sys/kernel/random", "boot_id", boot_id,
+                         sizeof(boot_id))) {
+        snprintf(boot_id, sizeof(boot_id), "unknown");
+    }
+
+    if (type == CAPS_MMC) {
+        sysfs_path(path, sizeof(path), "%s/%s", MMC_HOST_PATH, devname);
+        if (stat(path, &st) || mmc_card_dir(devname, card, sizeof(card))) {
+            return -ENODEV;
+        }
+        snprintf(caps->ident, sizeof(caps->ident),
+                 "%s %s ino=%lu card=%s boot=%s", caps_type_name[type],
+                 devname, (unsigned long)st.st_ino, card, boot_id);
+        return 0;
+    }
+
+    if (stat(devname, &st)) {
+        return -errno;
+    }
+    if (!S_ISCHR(st.st_mode)) {
+        return -ENODEV;
+    }
+
+    snprintf(caps->ident, sizeof(caps->ident),
+             "%s %s %u:%u ino=%lu ctime=%ld boot=%s", caps_type_name[type],
+             devname, major(st.st_rdev), minor(st.st_rdev),
+             (unsigned long)st.st_ino, (long)st.st_ctime, boot_id);
+    return 0;
+}
+
+static void caps_cache_path(enum caps_type type, const char *devname,
+                            char *path, int len)
+{
+    const char *dir = getenv(CAPS_CACHE_ENV);
+    char name[NAME_MAX];
+    int i;
+
+    if (!dir || !*dir) {
+        dir = CAPS_CACHE_DIR;
+    }
+
+    snprintf(name, sizeof(name), "%s", devname);
+    for (i = 0; name[i]; i++) {
+        if (name[i] == '/') {
+            name[i] = '_';
+        }
+    }
+
+    snprintf(path, len, "%s/%s-%s.caps", dir, caps_type_name[type], name);
+}
+
+static int caps_load(const char *path, struct dev_caps *caps)
+{
+    char line[CAPS_KEY_LEN + CAPS_VALUE_LEN + 8];
+    char *sep;
+    FILE *fp;
+    int ret = -ESTALE;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        return -ENOENT;
+    }
+
+    if (!fgets(line, sizeof(line), fp)) {
+        goto out;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strncmp(line, "ident=", 6) || strcmp(line + 6, caps->ident)) {
+        goto out;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        sep = strchr(line, '=');
+        if (!sep) {
+            continue;
+        }
+        *sep = '\0';
+        caps_set(caps, line, "%s", sep + 1);
+    }
+    ret = 0;
+
+out:
+    fclose(fp);
+    return ret;
+}
+
+static int caps_save(const char *path, const struct dev_caps *caps)
+{
+    char tmp[PATH_MAX], dir[PATH_MAX];
+    char *slash;
+    FILE *fp;
+    int i;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    slash = strrchr(dir, '/');
+    if (slash) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+
+    /* Write aside and rename so concurrent apps never see a partial file */
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        return -errno;
+    }
+
+    fprintf(fp, "ident=%s\n", caps->ident);
+    for (i = 0; i < caps->count; i++) {
+        fprintf(fp, "%s=%s\n", caps->entry[i].key, caps->entry[i].value);
+    }
+
+    if (fclose(fp) || rename(tmp, path)) {
+        unlink(tmp);
+        return -errno;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Get the capabilities of a device, probing it only if needed
+ *
+ * The capabilities are read from the cache when the cached device identity
+ * matches the current one; otherwise the device is probed and the result
+ * stored for the next app of the run. The cache directory defaults to
+ * CAPS_CACHE_DIR and can be changed with the FWTEST_CACHE_DIR environment
+ * variable.
+ *
+ * @param type The kind of device to probe
+ * @param devname Device node (V4L2, I2C, SPI) or MMC host name (mmc0)
+ * @param caps Output capability set
+ * @param flags CAPS_REFRESH to ignore the cached result
+ * @return 0 on success, negative errno on failure
+ */
+int caps_get(enum caps_type type, const char *devname, struct dev_caps *caps,
+             int flags)
+{
+    char path[PATH_MAX];
+    int ret;
+
+    memset(caps, 0, sizeof(*caps));
+
+    ret = caps_identity(type, devname, caps);
+    if (ret) {
+        return ret;
+    }
+
+    caps_cache_path(type, devname, path, sizeof(path));
+    if (!(flags & CAPS_REFRESH) && !caps_load(path, caps)) {
+        caps->cached = 1;
+        return 0;
+    }
+    caps->count = 0;
+
+    switch (type) {
+    case CAPS_V4L2:
+        ret = caps_probe_v4l2(devname, caps);
+        break;
+    case CAPS_I2C:
+        ret = caps_probe_i2c(devname, caps);
+        break;
+    case CAPS_SPI:
+        ret = caps_probe_spi(devname, caps);
+        break;
+    case CAPS_MMC:
+        ret = caps_probe_mmc(devname, caps);
+        break;
+    default:
+        ret = -EINVAL;
+        break;
+    }
+
+    if (!ret) {
+        /* A cache that cannot be written only costs a probe next time */
+        caps_save(path, caps);
+    }
+
+    return ret;
+}
+
+static void caps_app_usage(const struct caps_app *app)
+{
+    printf("\nUsage: %s [-c case-id] [-d %s] [-r] [-k key -v value]\n",
+           app->name, app->type == CAPS_MMC ? "host" : "device");
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: %s (default %s).\n", app->dev_help, app->default_dev);
+    printf("    -r: probe the device even if a cached result exists.\n");
+    printf("    -k: capability to verify.\n");
+    printf("    -v: expected value of the capability given with -k.\n");
+    printf("Example : verify %s of %s\n", app->example_key,
+           app->default_dev);
+    printf("     ./%s -d %s -k %s -v %s\n", app->name, app->default_dev,
+           app->example_key, app->example_value);
+}
+
+/**
+ * @brief main() of the *_caps apps
+ *
+ * Prints the capabilities of a device and optionally verifies one of them.
+ *
+ * @param app The app description
+ * @param argc The main arguments count
+ * @param argv The main arguments data
+ * @return 0 on success, error code on failure
+ */
+int caps_app_main(const struct caps_app *app, int argc, char **argv)
+{
+    struct dev_caps caps;
+    const char *devname = app->default_dev;
+    char *key = NULL, *expected = NULL;
+    char *tag = (char *)app->tag;
+    char buf[CAPS_KEY_LEN + CAPS_VALUE_LEN + 64];
+    const char *value;
+    uint64_t start;
+    int case_id = 0, flags = 0, option, ret, i;
+
+    while ((option = getopt(argc, argv, "c:d:rk:v:")) != -1) {
+        switch (option) {
+        case 'c':
+            case_id = atoi(optarg);
+            break;
+        case 'd':
+            devname = optarg;
+            break;
+        case 'r':
+            flags |= CAPS_REFRESH;
+            break;
+        case 'k':
+            key = optarg;
+            break;
+        case 'v':
+            expected = optarg;
+            break;
+        default:
+            caps_app_usage(app);
+            return -EINVAL;
+        }
+    }
+
+    if (!key != !expected) {
+        caps_app_usage(app);
+        return -EINVAL;
+    }
+
+    start = get_time_ns();
+    ret = caps_get(app->type, devname, &caps, flags);
+    if (ret) {
+        print_test_case_result(tag, case_id, ret, strerror(-ret));
+        return ret;
+    }
+
+    snprintf(buf, sizeof(buf), "device=%s source=%s time_us=%llu", devname,
+             caps.cached ? "cache" : "probe",
+             (unsigned long long)((get_time_ns() - start) / 1000));
+    print_test_case_perf(tag, case_id, buf);
+
+    for (i = 0; i < caps.count; i++) {
+        snprintf(buf, sizeof(buf), "%s=%s", caps.entry[i].key,
+                 caps.entry[i].value);
+        print_test_case_log(tag, case_id, buf);
+    }
+
+    if (key) {
+        value = caps_lookup(&caps, key);
+        if (!value || strcmp(value, expected)) {
+            snprintf(buf, sizeof(buf), "%s is '%s', expected '%s'", key,
+                     value ? value : "missing", expected);
+            print_test_case_result(tag, case_id, -EINVAL, buf);
+            return -EINVAL;
+        }
+    }
+
+    print_test_case_result(tag, case_id, 0, NULL);
+    return 0;
+}
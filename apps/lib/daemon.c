@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Resident test app. The daemon runs the app's case function for each
+ * request on a Unix socket, in its own process, so that whatever the
+ * app keeps in static storage (discovered controllers and the like)
+ * stays warm between cases.
+ *
+ * A request is a header, the NUL-separated arguments after argv[0], and
+ * the client's stdout and stderr passed as SCM_RIGHTS; the case prints
+ * straight to them. The reply is the case function's return value.
+ * A request with no arguments stops the daemon.
+ */
+#define DAEMON_MAGIC        0x66777464  /* "fwtd" */
+#define DAEMON_MAX_ARGS     64
+#define DAEMON_MAX_PAYLOAD  4096
+#define DAEMON_CONNECT_MS   2000
+
+struct daemon_msg {
+    uint32_t    magic;
+    uint32_t    argc;
+    uint32_t    len;
+};
+
+static int daemon_addr(struct sockaddr_un *addr, const char *sockpath)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(sockpath) >= sizeof(addr->sun_path)) {
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr->sun_path, sockpath);
+
+    return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+    size_t done = 0;
+
+    while (done < len) {
+        n = read(fd, (char *)buf + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n ? -errno : -EPIPE;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+static int daemon_listen(const char *sockpath)
+{
+    struct sockaddr_un addr;
+    int fd, probe, ret;
+
+    ret = daemon_addr(&addr, sockpath);
+    if (ret) {
+        return ret;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ret = -errno;
+        if (ret != -EADDRINUSE) {
+            goto err;
+        }
+        /* replace a socket left behind by a daemon that was killed */
+        probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe < 0) {
+            goto err;
+        }
+        if (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+            errno == ECONNREFUSED) {
+            unlink(sockpath);
+            ret = 0;
+        }
+        close(probe);
+        if (ret || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            ret = ret ? ret : -errno;
+            goto err;
+        }
+    }
+
+    if (listen(fd, 4) < 0) {
+        ret = -errno;
+        unlink(sockpath);
+        goto err;
+    }
+
+    return fd;
+
+err:
+    close(fd);
+    return ret;
+}
+
+/* returns 1 on a stop request, 0 once the case ran, negative errno */
+static int daemon_handle(int cfd, char *argv0, daemon_case_fn run)
+{
+    struct daemon_msg msg;
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(2 * sizeof(int))];
+    char payload[DAEMON_MAX_PAYLOAD];
+    char *argv[DAEMON_MAX_ARGS + 2];
+    int fds[2] = { -1, -1 };
+    int saved[2] = { -1, -1 };
+    int32_t result;
+    uint32_t i, argc = 0;
+    char *p;
+    int ret = 0;
+
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+
+    if (recvmsg(cfd, &mh, MSG_CMSG_CLOEXEC) != sizeof(msg)) {
+        return -EPROTO;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        }
+    }
+
+    if (msg.magic != DAEMON_MAGIC || msg.argc > DAEMON_MAX_ARGS ||
+        msg.len > sizeof(payload)) {
+        ret = -EPROTO;
+        goto out;
+    }
+
+    if (!msg.argc) {
+        /* stop request, acknowledged like a case */
+        result = 0;
+        ret = 1;
+        goto reply;
+    }
+
+    if (fds[0] < 0 || !msg.len) {
+        ret = -EPROTO;
+        goto out;
+    }
+
+    ret = read_full(cfd, payload, msg.len);
+    if (ret) {
+        goto out;
+    }
+    if (payload[msg.len - 1]) {
+        ret = -EPROTO;
+        goto out;
+    }
+
+    argv[argc++] = argv0;
+    for (p = payload; p < payload + msg.len; p += strlen(p) + 1) {
+        if (argc > msg.argc) {
+            ret = -EPROTO;
+            goto out;
+        }
+        argv[argc++] = p;
+    }
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+    saved[0] = dup(STDOUT_FILENO);
+    saved[1] = dup(STDERR_FILENO);
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+
+    /* full getopt() reset, for both glibc and bionic */
+    optind = 0;
+    result = run(argc, argv);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved[0], STDOUT_FILENO);
+    dup2(saved[1], STDERR_FILENO);
+    close(saved[0]);
+    close(saved[1]);
+
+reply:
+    if (write(cfd, &result, sizeof(result)) != sizeof(result) && !ret) {
+        ret = -EPIPE;
+    }
+
+out:
+    for (i = 0; i < 2; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Serve test cases on a Unix socket until asked to stop
+ *
+ * Each request runs run() in this process with the client's arguments,
+ * stdout and stderr. A broken request is dropped without stopping the
+ * daemon.
+ *
+ * @param sockpath Socket path, a stale socket there is replaced
+ * @param argv0 argv[0] passed to run()
+ * @param run The app's case function, e.g. its former main()
+ * @return 0 once stopped, negative errno if the socket can't be set up
+ */
+int daemon_serve(const char *sockpath, char *argv0, daemon_case_fn run)
+{
+    int lfd, cfd, ret = 0;
+
+    lfd = daemon_listen(sockpath);
+    if (lfd < 0) {
+        return lfd;
+    }
+
+    /* a client going away must not kill the daemon */
+    signal(SIGPIPE, SIG_IGN);
+
+    while (ret != 1) {
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            ret = -errno;
+            break;
+        }
+        ret = daemon_handle(cfd, argv0, run);
+        close(cfd);
+    }
+
+    unlink(sockpath);
+    close(lfd);
+
+    return ret == 1 ? 0 : ret;
+}
+
+/**
+ * @brief Run a test case in a daemon
+ *
+ * The case prints to the caller's stdout and stderr. Waits up to
+ * DAEMON_CONNECT_MS for the daemon to come up.
+ *
+ * @param sockpath Daemon socket path
+ * @param argc Argument count, 0 to stop the daemon
+ * @param argv Arguments, without argv[0]
+ * @param result The case function's return value
+ * @return 0 on success, negative errno on failure to talk to the daemon
+ */
+int daemon_request(const char *sockpath, int argc, char **argv, int *result)
+{
+    struct sockaddr_un addr;
+    struct daemon_msg msg;
+    struct msghdr mh;
+    struct iovec iov;
+    struct timespec ts = { 0, 10 * 1000000 };
+    char cbuf[CMSG_SPACE(2 * sizeof(int))];
+    char payload[DAEMON_MAX_PAYLOAD];
+    struct cmsghdr *cmsg;
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    int fd, i, n, waited, ret;
+    int32_t reply;
+
+    ret = daemon_addr(&addr, sockpath);
+    if (ret) {
+        return ret;
+    }
+    if (argc > DAEMON_MAX_ARGS) {
+        return -E2BIG;
+    }
+
+    msg.magic = DAEMON_MAGIC;
+    msg.argc = argc;
+    msg.len = 0;
+    for (i = 0; i < argc; i++) {
+        n = strlen(argv[i]) + 1;
+        if (msg.len + n > sizeof(payload)) {
+            return -E2BIG;
+        }
+        memcpy(payload + msg.len, argv[i], n);
+        msg.len += n;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    for (waited = 0; connect(fd, (struct sockaddr *)&addr,
+                             sizeof(addr)) < 0; waited += 10) {
+        ret = -errno;
+        if ((ret != -ENOENT && ret != -ECONNREFUSED) ||
+            waited >= DAEMON_CONNECT_MS) {
+            goto out;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    memset(&mh, 0, sizeof(mh));
+    iov.iov_base = &msg;
+    iov.iov_len = sizeof(msg);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cbuf;
+    mh.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    /* header with the fds first, the daemon reads it on its own */
+    if (sendmsg(fd, &mh, 0) != sizeof(msg) ||
+        (msg.len && write(fd, payload, msg.len) != (ssize_t)msg.len)) {
+        ret = -EPIPE;
+        goto out;
+    }
+
+    ret = read_full(fd, &reply, sizeof(reply));
+    if (!ret) {
+        *result = reply;
+    }
+
+out:
+    close(fd);
+    return ret;
+}
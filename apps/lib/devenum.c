@@ -0,0 +1,640 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * The device index is built by walking the Greybus bus directory and every
+ * device class directory the test apps care about. Each subtree is walked
+ * by its own thread: on target every sysfs read of a Greybus device can
+ * cost a round trip, and the subtrees are independent.
+ */
+struct dev_subtree {
+    /** class name stored in the index */
+    const char  *class;
+    /** directory relative to the sysfs root */
+    const char  *path;
+    /** only keep entries starting with this prefix, NULL for all */
+    const char  *prefix;
+    /** Greybus protocol of entries owned by a bundle */
+    const char  *protocol;
+    /** only keep entries backed by a device, e.g. skip virtual ttys */
+    int         need_device;
+};
+
+static const struct dev_subtree dev_subtrees[] = {
+    { "greybus", "/bus/greybus/devices", NULL,       NULL,     0 },
+    { "gpio",    "/class/gpio",          "gpiochip", "gpio",   0 },
+    { "i2c",     "/class/i2c-dev",       NULL,       "i2c",    0 },
+    { "spi",     "/class/spidev",        NULL,       "spi",    0 },
+    { "mmc",     "/class/mmc_host",      NULL,       "sdio",   0 },
+    { "uart",    "/class/tty",           NULL,       "uart",   1 },
+    { "pwm",     "/class/pwm",           NULL,       "pwm",    0 },
+    { "sound",   "/class/sound",         "pcmC",     "audio",  0 },
+    { "camera",  "/class/video4linux",   NULL,       "camera", 0 },
+};
+
+#define DEV_SUBTREES    (sizeof(dev_subtrees) / sizeof(dev_subtrees[0]))
+
+struct dev_walk {
+    const struct dev_subtree    *tree;
+    pthread_t                   thread;
+    int                         started;
+    struct dev_entry            *entry;
+    int                         count;
+    int                         capacity;
+    int                         ret;
+};
+
+/* Greybus protocol ids, from greybus_protocols.h */
+static const char *gb_protocol_names[] = {
+    [0x00] = "control",   [0x01] = "ap",        [0x02] = "gpio",
+    [0x03] = "i2c",       [0x04] = "uart",      [0x05] = "hid",
+    [0x06] = "usb",       [0x07] = "sdio",      [0x08] = "power_supply",
+    [0x09] = "pwm",       [0x0b] = "spi",       [0x0c] = "display",
+    [0x0d] = "camera",    [0x0e] = "sensor",    [0x0f] = "lights",
+    [0x10] = "vibrator",  [0x11] = "loopback",  [0x12] = "audio",
+    [0x13] = "audio",     [0x14] = "svc",       [0x15] = "firmware",
+    [0x16] = "camera",    [0x17] = "firmware",  [0x18] = "firmware",
+    [0x19] = "auth",      [0x1a] = "log",
+};
+
+/* Greybus bundle classes, from greybus_manifest.h */
+static const char *gb_bundle_class_names[] = {
+    [0x00] = "control",   [0x05] = "hid",       [0x08] = "power_supply",
+    [0x0a] = "bridged_phy", [0x0c] = "display", [0x0d] = "camera",
+    [0x0e] = "sensor",    [0x0f] = "lights",    [0x10] = "vibrator",
+    [0x11] = "loopback",  [0x12] = "audio",     [0x15] = "bootrom",
+    [0x16] = "firmware",  [0x17] = "log",
+};
+
+static const char *id_name(const char **names, int count, int id)
+{
+    if (id >= 0 && id < count && names[id]) {
+        return names[id];
+    }
+
+    return id == 0xfe ? "raw" : "vendor";
+}
+
+/**
+ * @brief Check whether a name is a Greybus bundle, e.g. 1-2.2
+ *
+ * @param name The sysfs entry name
+ * @param bundle Output bundle id
+ * @return 1 if the name is a bundle, 0 otherwise
+ */
+static int parse_bundle_name(const char *name, int *bundle)
+{
+    int hd, intf, id, n = 0;
+
+    if (sscanf(name, "%d-%d.%d%n", &hd, &intf, &id, &n) == 3 &&
+        name[n] == '\0') {
+        *bundle = id;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int read_int_attr(const char *path, const char *attr, int base,
+                         int *value)
+{
+    char buf[32];
+
+    if (debugfs_get_attr((char *)path, attr, buf, sizeof(buf))) {
+        return -ENOENT;
+    }
+
+    *value = (int)strtol(buf, NULL, base);
+    return 0;
+}
+
+static void read_devnode(struct dev_entry *entry)
+{
+    char buf[512], *line, *save = NULL;
+
+    if (debugfs_get_attr(entry->syspath, "uevent", buf, sizeof(buf))) {
+        return;
+    }
+
+    for (line = strtok_r(buf, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+        if (!strncmp(line, "DEVNAME=", 8)) {
+            dev_path(entry->devnode, sizeof(entry->devnode), "/%s",
+                     line + 8);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Find the Greybus bundle owning a class device
+ *
+ * Class entries are links into the device hierarchy; the bundle is the
+ * first path component that looks like a bundle name.
+ */
+static void find_owner_bundle(struct dev_entry *entry)
+{
+    char link[PATH_MAX], *comp, *save = NULL;
+    ssize_t len;
+    int bundle;
+
+    len = readlink(entry->syspath, link, sizeof(link) - 1);
+    if (len < 0) {
+        return;
+    }
+    link[len] = '\0';
+
+    for (comp = strtok_r(link, "/", &save); comp;
+         comp = strtok_r(NULL, "/", &save)) {
+        if (parse_bundle_name(comp, &bundle)) {
+            snprintf(entry->bundle_name, sizeof(entry->bundle_name), "%s",
+                     comp);
+            entry->bundle = bundle;
+        }
+    }
+}
+
+static void probe_greybus_entry(struct dev_entry *entry)
+{
+    int value;
+
+    if (parse_bundle_name(entry->name, &value)) {
+        snprintf(entry->bundle_name, sizeof(entry->bundle_name), "%s",
+                 entry->name);
+        entry->bundle = value;
+    }
+
+    if (!read_int_attr(entry->syspath, "bundle_id", 10, &value)) {
+        entry->bundle = value;
+    }
+
+    if (!read_int_attr(entry->syspath, "cport_id", 10, &value) ||
+        !read_int_attr(entry->syspath, "ap_cport_id", 10, &value)) {
+        entry->cport = value;
+    }
+
+    if (!debugfs_get_attr(entry->syspath, "protocol", entry->protocol,
+                          sizeof(entry->protocol))) {
+        return;
+    }
+
+    if (!read_int_attr(entry->syspath, "protocol_id", 16, &value)) {
+        snprintf(entry->protocol, sizeof(entry->protocol), "%s",
+                 id_name(gb_protocol_names, sizeof(gb_protocol_names) /
+                         sizeof(gb_protocol_names[0]), value));
+    } else if (!read_int_attr(entry->syspath, "bundle_class", 16, &value)) {
+        snprintf(entry->protocol, sizeof(entry->protocol), "%s",
+                 id_name(gb_bundle_class_names,
+                         sizeof(gb_bundle_class_names) /
+                         sizeof(gb_bundle_class_names[0]), value));
+    }
+}
+
+static struct dev_entry *walk_add(struct dev_walk *walk)
+{
+    struct dev_entry *entry;
+    int capacity;
+
+    if (walk->count == walk->capacity) {
+        capacity = walk->capacity ? walk->capacity * 2 : 64;
+        entry = realloc(walk->entry, capacity * sizeof(*entry));
+        if (!entry) {
+            return NULL;
+        }
+        walk->entry = entry;
+        walk->capacity = capacity;
+    }
+
+    entry = &walk->entry[walk->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->bundle = -1;
+    entry->cport = -1;
+
+    return entry;
+}
+
+static void *walk_subtree(void *arg)
+{
+    struct dev_walk *walk = arg;
+    const struct dev_subtree *tree = walk->tree;
+    char dir[PATH_MAX], path[PATH_MAX];
+    struct dev_entry *entry;
+    struct dirent *ptr;
+    struct stat st;
+    DIR *fdir;
+
+    sysfs_path(dir, sizeof(dir), "%s", tree->path);
+    fdir = opendir(dir);
+    if (!fdir) {
+        /* A missing class just means no such devices */
+        return NULL;
+    }
+
+    while ((ptr = readdir(fdir)) != NULL) {
+        if (ptr->d_name[0] == '.') {
+            continue;
+        }
+        if (tree->prefix &&
+            strncmp(ptr->d_name, tree->prefix, strlen(tree->prefix))) {
+            continue;
+        }
+        if (tree->need_device) {
+            snprintf(path, sizeof(path), "%s/%s/device", dir, ptr->d_name);
+            if (lstat(path, &st)) {
+                continue;
+            }
+        }
+
+        entry = walk_add(walk);
+        if (!entry) {
+            walk->ret = -ENOMEM;
+            break;
+        }
+
+        snprintf(entry->class, sizeof(entry->class), "%s", tree->class);
+        snprintf(entry->name, sizeof(entry->name), "%s", ptr->d_name);
+        snprintf(entry->syspath, sizeof(entry->syspath), "%s/%s", dir,
+                 ptr->d_name);
+
+        if (tree->protocol) {
+            find_owner_bundle(entry);
+            if (entry->bundle >= 0) {
+                snprintf(entry->protocol, sizeof(entry->protocol), "%s",
+                         tree->protocol);
+            }
+            read_devnode(entry);
+        } else {
+            probe_greybus_entry(entry);
+        }
+    }
+
+    closedir(fdir);
+    return NULL;
+}
+
+/**
+ * @brief Compare names so that embedded numbers sort numerically
+ */
+static int natural_cmp(const char *a, const char *b)
+{
+    unsigned long na, nb;
+    char *ea, *eb;
+
+    while (*a && *b) {
+        if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b)) {
+            na = strtoul(a, &ea, 10);
+            nb = strtoul(b, &eb, 10);
+            if (na != nb) {
+                return na < nb ? -1 : 1;
+            }
+            a = ea;
+            b = eb;
+            continue;
+        }
+        if (*a != *b) {
+            return (unsigned char)*a - (unsigned char)*b;
+        }
+        a++;
+        b++;
+    }
+
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static int entry_cmp(const void *pa, const void *pb)
+{
+    const struct dev_entry *a = pa, *b = pb;
+    int ret;
+
+    ret = strcmp(a->class, b->class);
+    return ret ? ret : natural_cmp(a->name, b->name);
+}
+
+/**
+ * @brief Build the device index
+ *
+ * Walks the Greybus bus and the device class directories below the sysfs
+ * root, one thread per subtree. The entries are sorted by class and name so
+ * the index content does not depend on thread scheduling.
+ *
+ * @param index Output device index, release with dev_index_free()
+ * @return 0 on success, negative errno on failure
+ */
+int dev_index_build(struct dev_index *index)
+{
+    struct dev_walk walk[DEV_SUBTREES];
+    const struct dev_entry *owner;
+    struct dev_entry *entry;
+    unsigned int i;
+    int n, ret = 0, total = 0;
+
+    memset(index, 0, sizeof(*index));
+    memset(walk, 0, sizeof(walk));
+
+    for (i = 0; i < DEV_SUBTREES; i++) {
+        walk[i].tree = &dev_subtrees[i];
+        if (!pthread_create(&walk[i].thread, NULL, walk_subtree, &walk[i])) {
+            walk[i].started = 1;
+        } else {
+            /* No thread left, walk this subtree inline */
+            walk_subtree(&walk[i]);
+        }
+    }
+
+    for (i = 0; i < DEV_SUBTREES; i++) {
+        if (walk[i].started) {
+            pthread_join(walk[i].thread, NULL);
+        }
+        if (walk[i].ret) {
+            ret = walk[i].ret;
+        }
+        total += walk[i].count;
+    }
+
+    if (!ret && total) {
+        index->entry = malloc(total * sizeof(*index->entry));
+        if (!index->entry) {
+            ret = -ENOMEM;
+        }
+    }
+
+    for (i = 0; i < DEV_SUBTREES; i++) {
+        if (!ret && walk[i].count) {
+            memcpy(&index->entry[index->count], walk[i].entry,
+                   walk[i].count * sizeof(*walk[i].entry));
+            index->count += walk[i].count;
+        }
+        free(walk[i].entry);
+    }
+
+    if (ret) {
+        dev_index_free(index);
+        return ret;
+    }
+
+    qsort(index->entry, index->count, sizeof(*index->entry), entry_cmp);
+
+    /* Class devices inherit the cport of their bundle when it has one */
+    for (n = 0; n < index->count; n++) {
+        entry = &index->entry[n];
+        if (!strcmp(entry->class, "greybus") || !entry->bundle_name[0]) {
+            continue;
+        }
+        owner = dev_index_find(index, "greybus", entry->bundle_name);
+        if (owner && entry->cport < 0) {
+            entry->cport = owner->cport;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Release a device index
+ *
+ * @param index The device index
+ * @return None
+ */
+void dev_index_free(struct dev_index *index)
+{
+    free(index->entry);
+    index->entry = NULL;
+    index->count = 0;
+}
+
+/**
+ * @brief Count the entries of a class
+ *
+ * @param index The device index
+ * @param class The class name, NULL for all entries
+ * @return Number of entries
+ */
+int dev_index_count(const struct dev_index *index, const char *class)
+{
+    const struct dev_entry *entry = NULL;
+    int count = 0;
+
+    while ((entry = dev_index_next(index, class, entry)) != NULL) {
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Iterate over the entries of a class
+ *
+ * @param index The device index
+ * @param class The class name, NULL for all entries
+ * @param prev The previous entry, NULL to start
+ * @return The next entry, NULL at the end
+ */
+const struct dev_entry *dev_index_next(const struct dev_index *index,
+                                       const char *class,
+                                       const struct dev_entry *prev)
+{
+    const struct dev_entry *entry = prev ? prev + 1 : index->entry;
+    const struct dev_entry *end = index->entry + index->count;
+
+    for (; entry && entry < end; entry++) {
+        if (!class || !strcmp(entry->class, class)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Look up one entry by class and name
+ *
+ * @param index The device index
+ * @param class The class name
+ * @param name The sysfs entry name
+ * @return The entry, NULL if not found
+ */
+const struct dev_entry *dev_index_find(const struct dev_index *index,
+                                       const char *class, const char *name)
+{
+    struct dev_entry key;
+
+    if (!index->count) {
+        return NULL;
+    }
+
+    memset(&key, 0, sizeof(key));
+    snprintf(key.class, sizeof(key.class), "%s", class);
+    snprintf(key.name, sizeof(key.name), "%s", name);
+
+    return bsearch(&key, index->entry, index->count, sizeof(key), entry_cmp);
+}
+
+static void devenum_app_usage(const struct devenum_app *app)
+{
+    printf("\nUsage: %s [-c case-id] [-r sysfs-root] [-n min-count] [-g]\n"
+           "          [-a attr[,attr...]]\n", app->name);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -r: sysfs root directory (default /sys).\n");
+    printf("    -n: fail if less than this many devices are found.\n");
+    printf("    -g: only count devices provided over Greybus.\n");
+    printf("    -a: sysfs attributes to print for every device.\n");
+    printf("Example : expect at least 1 Greybus %s device(s)\n",
+           app->dev_class);
+    if (app->example_attrs) {
+        printf("     ./%s -g -n 1 -a %s\n", app->name, app->example_attrs);
+    } else {
+        printf("     ./%s -g -n 1\n", app->name);
+    }
+}
+
+/**
+ * @brief Print one index entry and the requested attributes
+ *
+ * @param tag The log tag
+ * @param case_id The test case ID
+ * @param entry The device entry
+ * @param attrs Comma separated attribute names, or NULL
+ * @return None
+ */
+static void devenum_app_entry(char *tag, int case_id,
+                              const struct dev_entry *entry,
+                              const char *attrs)
+{
+    char buf[512], list[128], value[64], *attr, *save = NULL;
+    int n;
+
+    n = snprintf(buf, sizeof(buf), "%s bundle=%s protocol=%s cport=%d dev=%s",
+                 entry->name, entry->bundle_name[0] ? entry->bundle_name : "-",
+                 entry->protocol[0] ? entry->protocol : "-", entry->cport,
+                 entry->devnode[0] ? entry->devnode : "-");
+
+    if (attrs) {
+        snprintf(list, sizeof(list), "%s", attrs);
+        for (attr = strtok_r(list, ",", &save); attr && n < (int)sizeof(buf);
+             attr = strtok_r(NULL, ",", &save)) {
+            if (debugfs_get_attr((char *)entry->syspath, attr, value,
+                                 sizeof(value))) {
+                snprintf(value, sizeof(value), "-");
+            }
+            n += snprintf(buf + n, sizeof(buf) - n, " %s=%s", attr, value);
+        }
+    }
+
+    print_test_case_log(tag, case_id, buf);
+}
+
+/**
+ * @brief main() of the *_enum apps
+ *
+ * Lists the devices of one class and fails if fewer than asked are found.
+ *
+ * @param app The app description
+ * @param argc The main arguments count
+ * @param argv The main arguments data
+ * @return 0 on success, error code on failure
+ */
+int devenum_app_main(const struct devenum_app *app, int argc, char **argv)
+{
+    struct dev_index index;
+    const struct dev_entry *entry = NULL;
+    char *attrs = NULL, *tag = (char *)app->tag, buf[128];
+    uint64_t start;
+    int case_id = 0, min_count = 0, greybus_only = 0, count = 0;
+    int option, ret;
+
+    while ((option = getopt(argc, argv, "c:r:n:ga:")) != -1) {
+        switch (option) {
+        case 'c':
+            case_id = atoi(optarg);
+            break;
+        case 'r':
+            set_sysfs_root(optarg);
+            break;
+        case 'n':
+            min_count = atoi(optarg);
+            break;
+        case 'g':
+            greybus_only = 1;
+            break;
+        case 'a':
+            attrs = optarg;
+            break;
+        default:
+            devenum_app_usage(app);
+            return -EINVAL;
+        }
+    }
+
+    start = get_time_ns();
+    ret = dev_index_build(&index);
+    if (ret) {
+        print_test_case_result(tag, case_id, ret, strerror(-ret));
+        return ret;
+    }
+
+    snprintf(buf, sizeof(buf), "root=%s devices=%d time_us=%llu",
+             sysfs_root(), index.count,
+             (unsigned long long)((get_time_ns() - start) / 1000));
+    print_test_case_perf(tag, case_id, buf);
+
+    while ((entry = dev_index_next(&index, app->dev_class, entry)) != NULL) {
+        if (greybus_only && !entry->bundle_name[0]) {
+            continue;
+        }
+        devenum_app_entry(tag, case_id, entry, attrs);
+        count++;
+    }
+
+    dev_index_free(&index);
+
+    snprintf(buf, sizeof(buf), "Found %d %s device(s)", count,
+             app->dev_class);
+    if (count < min_count) {
+        print_test_case_result(tag, case_id, -ENODEV, buf);
+        return -ENODEV;
+    }
+
+    print_test_case_log(tag, case_id, buf);
+    print_test_case_result(tag, case_id, 0, NULL);
+    return 0;
+}
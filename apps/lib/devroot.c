@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * All sysfs paths are resolved below a root that defaults to /sys, and all
+ * device nodes below one that defaults to /dev. Host runs point them at a
+ * fake tree with FWTEST_SYSFS_ROOT and FWTEST_DEV_ROOT or with an app's
+ * command line option.
+ */
+#define SYSFS_ROOT_DEFAULT  "/sys"
+#define SYSFS_ROOT_ENV      "FWTEST_SYSFS_ROOT"
+#define DEV_ROOT_DEFAULT    "/dev"
+#define DEV_ROOT_ENV        "FWTEST_DEV_ROOT"
+
+static const char *sysfs_root_override;
+static const char *dev_root_override;
+
+static const char *resolve_root(const char *override, const char *env,
+                                const char *def)
+{
+    const char *root = override;
+
+    if (!root) {
+        root = getenv(env);
+    }
+
+    return (root && *root) ? root : def;
+}
+
+static int root_vpath(char *buf, int len, const char *root, const char *fmt,
+                      va_list ap)
+{
+    int n;
+
+    n = snprintf(buf, len, "%s", root);
+    if (n < 0 || n >= len) {
+        return n;
+    }
+
+    return n + vsnprintf(buf + n, len - n, fmt, ap);
+}
+
+/**
+ * @brief Get the sysfs root directory
+ *
+ * @return The root set by set_sysfs_root(), else FWTEST_SYSFS_ROOT, else /sys
+ */
+const char *sysfs_root(void)
+{
+    return resolve_root(sysfs_root_override, SYSFS_ROOT_ENV,
+                        SYSFS_ROOT_DEFAULT);
+}
+
+/**
+ * @brief Override the sysfs root directory
+ *
+ * @param root New root directory, NULL to go back to the default
+ * @return None
+ */
+void set_sysfs_root(const char *root)
+{
+    sysfs_root_override = root;
+}
+
+/**
+ * @brief Build a path below the sysfs root
+ *
+ * @param buf Output buffer
+ * @param len Output buffer size
+ * @param fmt printf style format of the path relative to the root, starting
+ *            with '/'
+ * @return Number of characters written, as snprintf
+ */
+int sysfs_path(char *buf, int len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = root_vpath(buf, len, sysfs_root(), fmt, ap);
+    va_end(ap);
+
+    return n;
+}
+
+/**
+ * @brief Get the device node root directory
+ *
+ * @return The root set by set_dev_root(), else FWTEST_DEV_ROOT, else /dev
+ */
+const char *dev_root(void)
+{
+    return resolve_root(dev_root_override, DEV_ROOT_ENV, DEV_ROOT_DEFAULT);
+}
+
+/**
+ * @brief Override the device node root directory
+ *
+ * @param root New root directory, NULL to go back to the default
+ * @return None
+ */
+void set_dev_root(const char *root)
+{
+    dev_root_override = root;
+}
+
+/**
+ * @brief Build a device node path below the device root
+ *
+ * @param buf Output buffer
+ * @param len Output buffer size
+ * @param fmt printf style format of the path relative to the root, starting
+ *            with '/'
+ * @return Number of characters written, as snprintf
+ */
+int dev_path(char *buf, int len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = root_vpath(buf, len, dev_root(), fmt, ap);
+    va_end(ap);
+
+    return n;
+}
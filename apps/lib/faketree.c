@@ -0,0 +1,552 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * A fake device tree mimics what the apps read on target: the Greybus bus
+ * with its SVC, interfaces and bridged PHY bundles, the gpio class with
+ * chips and already exported pins, the i2c-dev class and optionally
+ * loopback bundles, all as plain files and relative links the way sysfs
+ * lays them out. The APBridge shows up as USB device 1-1 with its runtime
+ * PM attributes. Device nodes are
+ * plain files, so opening them works and any ioctl fails with ENOTTY.
+ *
+ * root/sys is meant for FWTEST_SYSFS_ROOT and root/dev for FWTEST_DEV_ROOT.
+ */
+#define FAKE_GPIO_TOP       1024
+#define GB_BUNDLE_CLASS_BRIDGED_PHY 0x0a
+#define GB_BUNDLE_CLASS_LOOPBACK    0x11
+
+/* Control and result attributes of a gb_loopback device */
+static const char *loopback_attrs[] = {
+    "type", "size", "us_wait", "iteration_max", "iteration_count", "async",
+    "timeout", "outstanding_operations_max", "error", "timeout_min",
+    "timeout_max",
+    "requests_per_second_min", "requests_per_second_max",
+    "requests_per_second_avg", "latency_min", "latency_max", "latency_avg",
+    "throughput_min", "throughput_max", "throughput_avg",
+    "apbridge_unipro_latency_min", "apbridge_unipro_latency_max",
+    "apbridge_unipro_latency_avg", "gbphy_firmware_latency_min",
+    "gbphy_firmware_latency_max", "gbphy_firmware_latency_avg",
+};
+
+/**
+ * @brief Create a directory and its missing parents
+ *
+ * @param path The directory
+ * @return 0 on success, negative errno on failure
+ */
+static int make_dirs(const char *path)
+{
+    char buf[PATH_MAX], *p;
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (p = buf + 1; *p; p++) {
+        if (*p != '/') {
+            continue;
+        }
+        *p = '\0';
+        if (mkdir(buf, 0755) && errno != EEXIST) {
+            return -errno;
+        }
+        *p = '/';
+    }
+
+    if (mkdir(buf, 0755) && errno != EEXIST) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write a small attribute file
+ *
+ * @param dir Directory of the attribute
+ * @param attr Attribute name
+ * @param fmt printf style format of the content
+ * @return 0 on success, negative errno on failure
+ */
+static int write_attr(const char *dir, const char *attr, const char *fmt, ...)
+{
+    char path[PATH_MAX], buf[256];
+    va_list ap;
+    int fd, len, ret = 0;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    snprintf(path, sizeof(path), "%s/%s", dir, attr);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (write(fd, buf, len) != len) {
+        ret = -EIO;
+    }
+    close(fd);
+
+    return ret;
+}
+
+/**
+ * @brief Link a class or bus entry to its device directory
+ *
+ * @param root The tree root
+ * @param dir Directory holding the link, relative to root/sys
+ * @param name Link name
+ * @param device Device directory, relative to root/sys
+ * @return 0 on success, negative errno on failure
+ */
+static int link_device(const char *root, const char *dir, const char *name,
+                       const char *device)
+{
+    char path[PATH_MAX], target[PATH_MAX];
+    const char *p;
+    int n = 0, ret;
+
+    snprintf(path, sizeof(path), "%s/sys/%s", root, dir);
+    ret = make_dirs(path);
+    if (ret) {
+        return ret;
+    }
+
+    /* One "../" per component of dir, as sysfs uses relative links */
+    for (p = dir; *p; p++) {
+        if (p == dir || p[-1] == '/') {
+            n += snprintf(target + n, sizeof(target) - n, "../");
+        }
+    }
+    snprintf(target + n, sizeof(target) - n, "%s", device);
+
+    snprintf(path, sizeof(path), "%s/sys/%s/%s", root, dir, name);
+    if (symlink(target, path) && errno != EEXIST) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+static int add_gpio_chip(const char *root, const char *bundle, int base,
+                         int ngpio)
+{
+    char dev[PATH_MAX], path[PATH_MAX], name[32];
+    int pin, ret;
+
+    snprintf(name, sizeof(name), "gpiochip%d", base);
+    snprintf(dev, sizeof(dev), "%s/gpio/%s", bundle, name);
+    snprintf(path, sizeof(path), "%s/sys/%s", root, dev);
+    ret = make_dirs(path);
+    if (!ret) {
+        ret = write_attr(path, "base", "%d\n", base);
+    }
+    if (!ret) {
+        ret = write_attr(path, "ngpio", "%d\n", ngpio);
+    }
+    if (!ret) {
+        ret = write_attr(path, "label", "greybus_gpio\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "uevent", "");
+    }
+    if (!ret) {
+        ret = link_device(root, "class/gpio", name, dev);
+    }
+
+    /* The pins show up exported, writes to export are only recorded */
+    for (pin = base; !ret && pin < base + ngpio; pin++) {
+        snprintf(name, sizeof(name), "gpio%d", pin);
+        snprintf(dev, sizeof(dev), "%s/gpio/%s", bundle, name);
+        snprintf(path, sizeof(path), "%s/sys/%s", root, dev);
+        ret = make_dirs(path);
+        if (!ret) {
+            ret = write_attr(path, "direction", "in\n");
+        }
+        if (!ret) {
+            ret = write_attr(path, "value", "0\n");
+        }
+        if (!ret) {
+            ret = write_attr(path, "edge", "none\n");
+        }
+        if (!ret) {
+            ret = write_attr(path, "active_low", "0\n");
+        }
+        if (!ret) {
+            ret = link_device(root, "class/gpio", name, dev);
+        }
+    }
+
+    return ret;
+}
+
+static int add_i2c_adapter(const char *root, const char *bundle, int nr)
+{
+    char dev[PATH_MAX], path[PATH_MAX], name[32];
+    int ret;
+
+    snprintf(name, sizeof(name), "i2c-%d", nr);
+    snprintf(path, sizeof(path), "%s/sys/%s/%s", root, bundle, name);
+    ret = make_dirs(path);
+    if (!ret) {
+        ret = write_attr(path, "name", "Greybus i2c adapter\n");
+    }
+
+    snprintf(dev, sizeof(dev), "%s/%s/i2c-dev/%s", bundle, name, name);
+    snprintf(path, sizeof(path), "%s/sys/%s", root, dev);
+    if (!ret) {
+        ret = make_dirs(path);
+    }
+    if (!ret) {
+        ret = write_attr(path, "dev", "89:%d\n", nr);
+    }
+    if (!ret) {
+        ret = write_attr(path, "uevent", "MAJOR=89\nMINOR=%d\nDEVNAME=%s\n",
+                         nr, name);
+    }
+    if (!ret) {
+        ret = link_device(root, "class/i2c-dev", name, dev);
+    }
+
+    snprintf(path, sizeof(path), "%s/dev", root);
+    if (!ret) {
+        ret = write_attr(path, name, "");
+    }
+
+    return ret;
+}
+
+/* APBridge on the USB bus, runtime PM attributes as after enumeration */
+static int add_usb_bridge(const char *root)
+{
+    static const char dev[] = "devices/platform/ehci-hcd/usb1/1-1";
+    char path[PATH_MAX];
+    int ret;
+
+    snprintf(path, sizeof(path), "%s/sys/%s", root, dev);
+    ret = make_dirs(path);
+    if (!ret) {
+        ret = write_attr(path, "authorized", "1\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "idVendor", "18d1\n");
+    }
+    if (!ret) {
+        ret = link_device(root, "bus/usb/devices", "1-1", dev);
+    }
+
+    snprintf(path, sizeof(path), "%s/sys/%s/power", root, dev);
+    if (!ret) {
+        ret = make_dirs(path);
+    }
+    if (!ret) {
+        ret = write_attr(path, "control", "on\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "autosuspend_delay_ms", "2000\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "runtime_status", "active\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "runtime_active_time", "0\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "runtime_suspended_time", "0\n");
+    }
+
+    return ret;
+}
+
+static int add_loopback(const char *root, const char *hd, int hd_id,
+                        int intf, int id)
+{
+    char bundle[PATH_MAX], dev[PATH_MAX], path[PATH_MAX], name[32];
+    unsigned int i;
+    int ret;
+
+    snprintf(name, sizeof(name), "%d-%d.2", hd_id, intf);
+    snprintf(bundle, sizeof(bundle), "%s/%d-%d/%s", hd, hd_id, intf, name);
+    snprintf(path, sizeof(path), "%s/sys/%s", root, bundle);
+    ret = make_dirs(path);
+    if (!ret) {
+        ret = write_attr(path, "bundle_id", "2\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "bundle_class", "0x%02x\n",
+                         GB_BUNDLE_CLASS_LOOPBACK);
+    }
+    if (!ret) {
+        ret = link_device(root, "bus/greybus/devices", name, bundle);
+    }
+
+    snprintf(name, sizeof(name), "gb_loopback%d", id);
+    snprintf(dev, sizeof(dev), "%s/%s", bundle, name);
+    snprintf(path, sizeof(path), "%s/sys/%s", root, dev);
+    if (!ret) {
+        ret = make_dirs(path);
+    }
+    for (i = 0; !ret && i < sizeof(loopback_attrs) / sizeof(loopback_attrs[0]);
+         i++) {
+        ret = write_attr(path, loopback_attrs[i], "0\n");
+    }
+    if (!ret) {
+        ret = link_device(root, "class/gb_loopback", name, dev);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Fill in a fake tree configuration with the defaults
+ *
+ * @param cfg The configuration
+ * @return None
+ */
+void fake_tree_defaults(struct fake_tree_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->hd = 1;
+    cfg->interfaces = 2;
+    cfg->gpio_chips = 1;
+    cfg->gpio_pins = 32;
+    cfg->i2c_adapters = 1;
+    cfg->loopbacks = 0;
+}
+
+/**
+ * @brief Build a fake sysfs and device node tree
+ *
+ * Interfaces are numbered from 2, each with one bridged PHY bundle
+ * holding its GPIO chips and I2C adapters. The first interfaces also get
+ * a loopback bundle with a gb_loopback device, whose results stay zero
+ * unless something plays the driver. GPIO bases are allocated
+ * downwards from 1024 as the kernel does, I2C adapters are numbered
+ * from 0.
+ *
+ * @param root Directory to build the tree in, created if needed
+ * @param cfg The tree configuration
+ * @return Number of device entries created, negative errno on failure
+ */
+int fake_tree_build(const char *root, const struct fake_tree_config *cfg)
+{
+    char hd[64], dev[PATH_MAX], path[PATH_MAX], name[32];
+    int intf, chip, adapter, base = FAKE_GPIO_TOP, nr = 0, count = 0;
+    int ret;
+
+    if (cfg->hd < 0 || cfg->interfaces < 0 || cfg->gpio_chips < 0 ||
+        cfg->gpio_pins < 1 || cfg->i2c_adapters < 0 || cfg->loopbacks < 0 ||
+        cfg->loopbacks > cfg->interfaces ||
+        cfg->interfaces * cfg->gpio_chips * cfg->gpio_pins > FAKE_GPIO_TOP) {
+        return -EINVAL;
+    }
+
+    snprintf(path, sizeof(path), "%s/dev", root);
+    ret = make_dirs(path);
+    if (!ret) {
+        ret = write_attr(root, FAKE_TREE_MARKER, "%d\n", cfg->hd);
+    }
+
+    if (!ret) {
+        ret = add_usb_bridge(root);
+        count++;
+    }
+
+    /* Host device and SVC */
+    snprintf(hd, sizeof(hd), "devices/platform/apb/greybus%d", cfg->hd);
+    snprintf(path, sizeof(path), "%s/sys/%s", root, hd);
+    if (!ret) {
+        ret = make_dirs(path);
+    }
+    if (!ret) {
+        ret = write_attr(path, "bus_id", "%d\n", cfg->hd);
+    }
+    snprintf(name, sizeof(name), "greybus%d", cfg->hd);
+    if (!ret) {
+        ret = link_device(root, "bus/greybus/devices", name, hd);
+    }
+
+    snprintf(name, sizeof(name), "%d-svc", cfg->hd);
+    snprintf(dev, sizeof(dev), "%s/%s", hd, name);
+    snprintf(path, sizeof(path), "%s/sys/%s", root, dev);
+    if (!ret) {
+        ret = make_dirs(path);
+    }
+    if (!ret) {
+        ret = write_attr(path, "endo_id", "0x4755\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "ap_intf_id", "0\n");
+    }
+    if (!ret) {
+        ret = write_attr(path, "intf_eject", "");
+    }
+    if (!ret) {
+        ret = link_device(root, "bus/greybus/devices", name, dev);
+    }
+    count += 2;
+
+    for (intf = 2; !ret && intf < cfg->interfaces + 2; intf++) {
+        snprintf(name, sizeof(name), "%d-%d", cfg->hd, intf);
+        snprintf(dev, sizeof(dev), "%s/%s", hd, name);
+        snprintf(path, sizeof(path), "%s/sys/%s", root, dev);
+        ret = make_dirs(path);
+        if (!ret) {
+            ret = write_attr(path, "interface_id", "%d\n", intf);
+        }
+        if (!ret) {
+            ret = write_attr(path, "vendor_id", "0x00000126\n");
+        }
+        if (!ret) {
+            ret = write_attr(path, "product_id", "0x00001000\n");
+        }
+        if (!ret) {
+            ret = write_attr(path, "serial_number", "0x%016x\n", intf);
+        }
+        if (!ret) {
+            ret = link_device(root, "bus/greybus/devices", name, dev);
+        }
+
+        snprintf(name, sizeof(name), "%d-%d.1", cfg->hd, intf);
+        snprintf(dev, sizeof(dev), "%s/%d-%d/%s", hd, cfg->hd, intf, name);
+        snprintf(path, sizeof(path), "%s/sys/%s", root, dev);
+        if (!ret) {
+            ret = make_dirs(path);
+        }
+        if (!ret) {
+            ret = write_attr(path, "bundle_id", "1\n");
+        }
+        if (!ret) {
+            ret = write_attr(path, "bundle_class", "0x%02x\n",
+                             GB_BUNDLE_CLASS_BRIDGED_PHY);
+        }
+        if (!ret) {
+            ret = write_attr(path, "state", "\n");
+        }
+        if (!ret) {
+            ret = link_device(root, "bus/greybus/devices", name, dev);
+        }
+        count += 2;
+
+        for (chip = 0; !ret && chip < cfg->gpio_chips; chip++) {
+            base -= cfg->gpio_pins;
+            ret = add_gpio_chip(root, dev, base, cfg->gpio_pins);
+            count++;
+        }
+        for (adapter = 0; !ret && adapter < cfg->i2c_adapters; adapter++) {
+            ret = add_i2c_adapter(root, dev, nr++);
+            count++;
+        }
+        if (!ret && intf - 2 < cfg->loopbacks) {
+            ret = add_loopback(root, hd, cfg->hd, intf, intf - 2);
+            count += 2;
+        }
+    }
+
+    /* Writes are accepted and left in the file, nothing gets exported */
+    snprintf(path, sizeof(path), "%s/sys/class/gpio", root);
+    if (!ret) {
+        ret = make_dirs(path);
+    }
+    if (!ret) {
+        ret = write_attr(path, "export", "");
+    }
+    if (!ret) {
+        ret = write_attr(path, "unexport", "");
+    }
+
+    return ret ? ret : count;
+}
+
+static int remove_dir(const char *path)
+{
+    char child[PATH_MAX];
+    struct dirent *ptr;
+    struct stat st;
+    DIR *fdir;
+    int ret = 0;
+
+    fdir = opendir(path);
+    if (!fdir) {
+        return -errno;
+    }
+
+    while (!ret && (ptr = readdir(fdir)) != NULL) {
+        if (!strcmp(ptr->d_name, ".") || !strcmp(ptr->d_name, "..")) {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, ptr->d_name);
+        if (lstat(child, &st)) {
+            ret = -errno;
+        } else if (S_ISDIR(st.st_mode)) {
+            ret = remove_dir(child);
+        } else if (unlink(child)) {
+            ret = -errno;
+        }
+    }
+    closedir(fdir);
+
+    if (!ret && rmdir(path)) {
+        ret = -errno;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Remove a tree built by fake_tree_build()
+ *
+ * Refuses directories that do not carry the fake tree marker, so a wrong
+ * root cannot wipe anything else.
+ *
+ * @param root The tree root
+ * @return 0 on success, negative errno on failure
+ */
+int fake_tree_remove(const char *root)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", root, FAKE_TREE_MARKER);
+    if (access(path, F_OK)) {
+        return -EPERM;
+    }
+
+    return remove_dir(root);
+}
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef CONFIG_FWIO
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Device I/O accounting, built only with FWIO=1. Each call is counted
+ * and timed per syscall type and per path; descriptors are mapped back
+ * to the path they were opened with. Paths beyond the table size, and
+ * descriptors not opened through fwio_open(), are accounted as "other".
+ */
+#define FWIO_MAX_PATHS      256
+#define FWIO_PATH_LEN       128
+#define FWIO_MAX_FDS        1024
+#define FWIO_REPORT_PATHS   8
+
+enum fwio_op {
+    FWIO_OPEN,
+    FWIO_READ,
+    FWIO_WRITE,
+    FWIO_IOCTL,
+    FWIO_CLOSE,
+    FWIO_OPS,
+};
+
+static const char *fwio_op_names[FWIO_OPS] = {
+    "opens", "reads", "writes", "ioctls", "closes",
+};
+
+struct fwio_path {
+    char        path[FWIO_PATH_LEN];
+    uint32_t    calls[FWIO_OPS];
+    uint64_t    ns;
+};
+
+static pthread_mutex_t fwio_lock = PTHREAD_MUTEX_INITIALIZER;
+/* slot 0 is "other" */
+static struct fwio_path fwio_paths[FWIO_MAX_PATHS + 1] = {
+    { .path = "other" },
+};
+static int fwio_npaths;
+static uint16_t fwio_hash[2 * FWIO_MAX_PATHS];
+static uint16_t fwio_fd_path[FWIO_MAX_FDS];
+static uint32_t fwio_calls[FWIO_OPS];
+static uint64_t fwio_ns[FWIO_OPS];
+
+/* must be called with fwio_lock held */
+static int fwio_path_slot(const char *path)
+{
+    uint32_t h = 2166136261u;
+    const char *p;
+    int i, slot;
+
+    for (p = path; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+
+    for (i = h % (2 * FWIO_MAX_PATHS); fwio_hash[i];
+         i = (i + 1) % (2 * FWIO_MAX_PATHS)) {
+        if (!strncmp(fwio_paths[fwio_hash[i]].path, path,
+                     FWIO_PATH_LEN - 1)) {
+            return fwio_hash[i];
+        }
+    }
+
+    if (fwio_npaths == FWIO_MAX_PATHS) {
+        return 0;
+    }
+
+    slot = ++fwio_npaths;
+    snprintf(fwio_paths[slot].path, FWIO_PATH_LEN, "%s", path);
+    fwio_hash[i] = slot;
+    return slot;
+}
+
+static void fwio_account(enum fwio_op op, int fd, const char *path,
+                         uint64_t start)
+{
+    uint64_t ns = get_time_ns() - start;
+    int slot = 0;
+
+    pthread_mutex_lock(&fwio_lock);
+    if (path) {
+        slot = fwio_path_slot(path);
+        if (fd >= 0 && fd < FWIO_MAX_FDS) {
+            fwio_fd_path[fd] = slot;
+        }
+    } else if (fd >= 0 && fd < FWIO_MAX_FDS) {
+        slot = fwio_fd_path[fd];
+        if (op == FWIO_CLOSE) {
+            fwio_fd_path[fd] = 0;
+        }
+    }
+    fwio_calls[op]++;
+    fwio_ns[op] += ns;
+    fwio_paths[slot].calls[op]++;
+    fwio_paths[slot].ns += ns;
+    pthread_mutex_unlock(&fwio_lock);
+}
+
+/**
+ * @brief Counted open()
+ *
+ * @param path File path
+ * @param flags Open flags
+ * @return New file descriptor, or -1 with errno set
+ */
+int fwio_open(const char *path, int flags, ...)
+{
+    uint64_t start;
+    mode_t mode = 0;
+    va_list ap;
+    int fd, err;
+
+    if (flags & O_CREAT) {
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+
+    start = get_time_ns();
+    fd = open(path, flags, mode);
+    err = errno;
+    fwio_account(FWIO_OPEN, fd, path, start);
+    errno = err;
+
+    return fd;
+}
+
+/**
+ * @brief Counted read()
+ *
+ * @param fd File descriptor
+ * @param buf Destination buffer
+ * @param len Buffer size
+ * @return Bytes read, or -1 with errno set
+ */
+ssize_t fwio_read(int fd, void *buf, size_t len)
+{
+    uint64_t start = get_time_ns();
+    ssize_t ret;
+    int err;
+
+    ret = read(fd, buf, len);
+    err = errno;
+    fwio_account(FWIO_READ, fd, NULL, start);
+    errno = err;
+
+    return ret;
+}
+
+/**
+ * @brief Counted write()
+ *
+ * @param fd File descriptor
+ * @param buf Source buffer
+ * @param len Bytes to write
+ * @return Bytes written, or -1 with errno set
+ */
+ssize_t fwio_write(int fd, const void *buf, size_t len)
+{
+    uint64_t start = get_time_ns();
+    ssize_t ret;
+    int err;
+
+    ret = write(fd, buf, len);
+    err = errno;
+    fwio_account(FWIO_WRITE, fd, NULL, start);
+    errno = err;
+
+    return ret;
+}
+
+/**
+ * @brief Counted ioctl()
+ *
+ * @param fd File descriptor
+ * @param request ioctl request
+ * @return ioctl() result, -1 with errno set on failure
+ */
+int fwio_ioctl(int fd, unsigned long request, ...)
+{
+    uint64_t start;
+    va_list ap;
+    void *arg;
+    int ret, err;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    start = get_time_ns();
+    ret = ioctl(fd, request, arg);
+    err = errno;
+    fwio_account(FWIO_IOCTL, fd, NULL, start);
+    errno = err;
+
+    return ret;
+}
+
+/**
+ * @brief Counted close()
+ *
+ * @param fd File descriptor
+ * @return 0 on success, -1 with errno set on failure
+ */
+int fwio_close(int fd)
+{
+    uint64_t start = get_time_ns();
+    int ret, err;
+
+    ret = close(fd);
+    err = errno;
+    fwio_account(FWIO_CLOSE, fd, NULL, start);
+    errno = err;
+
+    return ret;
+}
+
+/**
+ * @brief Clear the counts, e.g. before a test case
+ *
+ * Descriptors that are still open keep their path.
+ *
+ * @return None
+ */
+void fwio_reset(void)
+{
+    int i;
+
+    pthread_mutex_lock(&fwio_lock);
+    memset(fwio_calls, 0, sizeof(fwio_calls));
+    memset(fwio_ns, 0, sizeof(fwio_ns));
+    for (i = 0; i <= fwio_npaths; i++) {
+        memset(fwio_paths[i].calls, 0, sizeof(fwio_paths[i].calls));
+        fwio_paths[i].ns = 0;
+    }
+    pthread_mutex_unlock(&fwio_lock);
+}
+
+/**
+ * @brief Print the counts since the last reset
+ *
+ * One perf line with calls and time per syscall type, then the paths
+ * that took the most time as debug lines.
+ *
+ * @param tag Log tag
+ * @param case_id Test case ID
+ * @return None
+ */
+void fwio_report(char *tag, int case_id)
+{
+    char buf[256];
+    int top[FWIO_REPORT_PATHS];
+    int i, j, k, n = 0, ntop = 0;
+    uint64_t ns = 0;
+    struct fwio_path *fp;
+
+    pthread_mutex_lock(&fwio_lock);
+
+    for (i = 0; i < FWIO_OPS; i++) {
+        ns += fwio_ns[i];
+        n += snprintf(buf + n, sizeof(buf) - n, "%s=%u %s_us=%llu ",
+                      fwio_op_names[i], fwio_calls[i], fwio_op_names[i],
+                      (unsigned long long)(fwio_ns[i] / 1000));
+    }
+    snprintf(buf + n, sizeof(buf) - n, "io_us=%llu",
+             (unsigned long long)(ns / 1000));
+    print_test_case_perf(tag, case_id, buf);
+
+    /* insertion sort of the few slowest paths */
+    for (i = 0; i <= fwio_npaths; i++) {
+        if (!fwio_paths[i].ns) {
+            continue;
+        }
+        for (j = 0; j < ntop && fwio_paths[top[j]].ns >= fwio_paths[i].ns;
+             j++)
+            ;
+        if (j == FWIO_REPORT_PATHS) {
+            continue;
+        }
+        if (ntop < FWIO_REPORT_PATHS) {
+            ntop++;
+        }
+        for (k = ntop - 1; k > j; k--) {
+            top[k] = top[k - 1];
+        }
+        top[j] = i;
+    }
+
+    for (i = 0; i < ntop; i++) {
+        fp = &fwio_paths[top[i]];
+        snprintf(buf, sizeof(buf), "io %s: %u/%u/%u/%u/%u %lluus",
+                 fp->path, fp->calls[FWIO_OPEN], fp->calls[FWIO_READ],
+                 fp->calls[FWIO_WRITE], fp->calls[FWIO_IOCTL],
+                 fp->calls[FWIO_CLOSE], (unsigned long long)(fp->ns / 1000));
+        print_test_case_log(tag, case_id, buf);
+    }
+
+    pthread_mutex_unlock(&fwio_lock);
+}
+
+#endif /* CONFIG_FWIO */
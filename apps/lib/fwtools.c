@@ -71,18 +71,18 @@ int debugfs_get_attr(char *class_path, const char *attr, char *value, int len)
     snprintf(sysbuf, sizeof(sysbuf), "%s/%s", class_path, attr);
     sysbuf[strlen(sysbuf) + 1] = null_byte;
 
-    fd = open(sysbuf, O_RDONLY);
+    fd = fwio_open(sysbuf, O_RDONLY);
     if (fd < 0) {
         return -ENOENT;
     }
 
-    if ((nread = read(fd, value, len)) < 0) {
-        close(fd);
+    if ((nread = fwio_read(fd, value, len - 1)) < 0) {
+        fwio_close(fd);
         return -ENOENT;
     }
 
     value[nread] = null_byte;
-    close(fd);
+    fwio_close(fd);
     valuelen = strlen(value);
 
     while (valuelen > 0 && (value[valuelen - 1] == new_line ||
@@ -100,7 +100,8 @@ int debugfs_get_attr(char *class_path, const char *attr, char *value, int len)
  * @param class_path Class path string
  * @param attr The class attribute
  * @param value The value is write to debugfs
- * @param len The value buffer size
+ * @param len The value buffer size, only the string up to the first NUL
+ *            is written
  * @return 0 on success, error code on failure
  */
 int debugfs_set_attr(char *class_path, const char *attr, char *value, int len)
@@ -116,16 +117,41 @@ int debugfs_set_attr(char *class_path, const char *attr, char *value, int len)
     snprintf(sysbuf, sizeof(sysbuf), "%s/%s", class_path, attr);
     sysbuf[sizeof(sysbuf) - 1] = null_byte;
 
-    fd = open(sysbuf, O_WRONLY);
+    fd = fwio_open(sysbuf, O_WRONLY | O_TRUNC);
     if (fd < 0) {
         return -ENOENT;
     }
 
-    if (write(fd, value, len) < 0) {
-        close(fd);
+    if (fwio_write(fd, value, strnlen(value, len)) < 0) {
+        fwio_close(fd);
         return -ENOENT;
     }
 
-    close(fd);
+    fwio_close(fd);
     return 0;
 }
+
+/**
+ * @brief open I2C devices.
+ *
+ * @param i2cbus HW I2C bus.
+ *
+ * @return file The new file descriptor, or -1 if an error occurred.
+ */
+int open_i2c_dev(int i2cbus)
+{
+    int file;
+    char devname[PATH_MAX];
+    size_t size = sizeof(devname);
+
+    dev_path(devname, size, "/i2c-%d", i2cbus);
+    file = fwio_open(devname, O_RDWR);
+
+    if (file < 0 && (errno == ENOENT || errno == ENOTDIR))
+    {
+        dev_path(devname, size, "/i2c/%d", i2cbus);
+        file = fwio_open(devname, O_RDWR);
+    }
+
+    return file;
+}
@@ -0,0 +1,946 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Greybus operations are followed through the greybus trace events:
+ *
+ *   gb_operation_create*    cport_id=.. id=.. type=..   operation allocated
+ *   gb_message_send         operation_id=.. type=..     request or response
+ *                                                       handed to the hd
+ *   gb_message_recv_*       operation_id=.. type=..     request or response
+ *                                                       back from the hd
+ *   gb_operation_destroy    cport_id=.. id=..           operation released
+ *
+ * Events of an operation are matched and turned into per-phase
+ * latencies, keyed by protocol and operation type. Operation ids are
+ * allocated per connection, so operation events are matched by cport and
+ * id. Message events carry no cport: they go to the one open operation
+ * with their id, and are counted as ambiguous rather than merged when
+ * several cports have that id open. Incoming requests show up as
+ * gb_message_recv_request before their gb_operation_create_incoming.
+ *
+ * Step markers written by trace_step_begin()/trace_step_end() show up as
+ * tracing_mark_write events. Every operation created inside a step window
+ * is also accounted to that step, so a slow step can be told apart from
+ * the Greybus round trips it caused.
+ *
+ * Live capture reads the per-CPU trace_pipe files. splice() moves what
+ * the tracer produced into a pipe without copying it through userspace,
+ * so the pipe is the ring that absorbs bursts while the parser catches
+ * up. The raw binary pages are not used: decoding them would need the
+ * event format files, and the text form is also what recorded traces
+ * look like, so one parser serves both.
+ */
+#define TRACEFS_PATH        "/kernel/tracing"
+#define TRACEFS_DEBUG_PATH  "/kernel/debug/tracing"
+#define GREYBUS_EVENTS      "events/greybus"
+#define SPLICE_LEN          65536
+/* An operation not seen destroyed for this long is accounted anyway */
+#define OP_STALE_US         2000000
+/* Operations are kept in buckets by id, one way per cport using the id */
+#define OP_WAYS             4
+#define OP_BUCKETS          (GBTRACE_MAX_OPS / OP_WAYS)
+
+#define GB_RESPONSE_FLAG    0x80
+
+enum op_event {
+    OP_CREATE,
+    OP_SEND,
+    OP_RECV,
+    OP_DONE,
+};
+
+static const char *phase_names[GBTRACE_PHASES] = {
+    [GBTRACE_SETUP]     = "setup",
+    [GBTRACE_RTT]       = "rtt",
+    [GBTRACE_COMPLETE]  = "complete",
+    [GBTRACE_HANDLE]    = "handle",
+    [GBTRACE_TOTAL]     = "total",
+};
+
+/**
+ * @brief Map connection cports to protocol names from the device index
+ */
+static void load_protocols(struct gbtrace *trace)
+{
+    struct dev_index index;
+    const struct dev_entry *entry = NULL;
+
+    if (dev_index_build(&index)) {
+        return;
+    }
+
+    while ((entry = dev_index_next(&index, "greybus", entry)) != NULL) {
+        if (entry->cport >= 0 && entry->cport < GBTRACE_MAX_CPORTS &&
+            entry->protocol[0]) {
+            snprintf(trace->protocol[entry->cport],
+                     sizeof(trace->protocol[0]), "%s", entry->protocol);
+        }
+    }
+
+    dev_index_free(&index);
+}
+
+/**
+ * @brief Prepare a trace context for parsing
+ *
+ * @param trace The trace context
+ * @return 0 on success, negative errno on failure
+ */
+int gbtrace_init(struct gbtrace *trace)
+{
+    int i;
+
+    memset(trace, 0, sizeof(*trace));
+    for (i = 0; i < GBTRACE_MAX_CPUS; i++) {
+        trace->cpu[i].fd = -1;
+        trace->cpu[i].pipe[0] = -1;
+        trace->cpu[i].pipe[1] = -1;
+    }
+    load_protocols(trace);
+
+    return 0;
+}
+
+/**
+ * @brief Release the parse results
+ *
+ * @param trace The trace context
+ * @return None
+ */
+void gbtrace_free(struct gbtrace *trace)
+{
+    free(trace->key);
+    trace->key = NULL;
+    trace->nkeys = 0;
+    trace->capacity = 0;
+    free(trace->step);
+    trace->step = NULL;
+    trace->nsteps = 0;
+    trace->step_capacity = 0;
+}
+
+static struct gbtrace_key *find_key(struct gbtrace *trace,
+                                    const struct gbtrace_op *op)
+{
+    struct gbtrace_key *key;
+    int i, capacity;
+
+    for (i = 0; i < trace->nkeys; i++) {
+        key = &trace->key[i];
+        if (key->cport == op->cport && key->type == op->type &&
+            key->incoming == op->incoming) {
+            return key;
+        }
+    }
+
+    if (trace->nkeys == trace->capacity) {
+        capacity = trace->capacity ? trace->capacity * 2 : 16;
+        key = realloc(trace->key, capacity * sizeof(*key));
+        if (!key) {
+            return NULL;
+        }
+        trace->key = key;
+        trace->capacity = capacity;
+    }
+
+    key = &trace->key[trace->nkeys++];
+    memset(key, 0, sizeof(*key));
+    key->cport = op->cport;
+    key->type = op->type;
+    key->incoming = op->incoming;
+    for (i = 0; i < GBTRACE_PHASES; i++) {
+        stats_reset(&key->phase_us[i]);
+    }
+
+    return key;
+}
+
+static void add_phase(struct gbtrace_key *key, int phase,
+                      const struct gbtrace_op *op, int from, int to)
+{
+    if ((op->seen & (1 << from)) && (op->seen & (1 << to)) &&
+        op->ts[to] >= op->ts[from]) {
+        stats_add(&key->phase_us[phase], op->ts[to] - op->ts[from]);
+    }
+}
+
+static struct gbtrace_step *find_step(struct gbtrace *trace, int case_id,
+                                      const char *name)
+{
+    struct gbtrace_step *step;
+    int i, capacity;
+
+    for (i = 0; i < trace->nsteps; i++) {
+        step = &trace->step[i];
+        if (step->case_id == case_id && !strcmp(step->name, name)) {
+            return step;
+        }
+    }
+
+    if (trace->nsteps == trace->step_capacity) {
+        capacity = trace->step_capacity ? trace->step_capacity * 2 : 16;
+        step = realloc(trace->step, capacity * sizeof(*step));
+        if (!step) {
+            return NULL;
+        }
+        trace->step = step;
+        trace->step_capacity = capacity;
+    }
+
+    step = &trace->step[trace->nsteps++];
+    memset(step, 0, sizeof(*step));
+    step->case_id = case_id;
+    snprintf(step->name, sizeof(step->name), "%s", name);
+    stats_reset(&step->step_us);
+    stats_reset(&step->rtt_us);
+    stats_reset(&step->op_us);
+
+    return step;
+}
+
+/**
+ * @brief Handle a "fwtest B|E case=.. step=.. name=.." marker
+ */
+static int parse_marker(struct gbtrace *trace, const char *text,
+                        uint64_t ts)
+{
+    struct gbtrace_window *win;
+    struct gbtrace_step *step;
+    char kind, name[GBTRACE_STEP_NAME_LEN];
+    unsigned int id;
+    int case_id, i;
+
+    if (sscanf(text, "fwtest %c case=%d step=%u name=%31s", &kind, &case_id,
+               &id, name) != 4) {
+        return 0;
+    }
+
+    if (kind == 'B') {
+        step = find_step(trace, case_id, name);
+        if (!step) {
+            return 0;
+        }
+        step->calls++;
+        win = &trace->window[trace->nwindows++ % GBTRACE_MAX_WINDOWS];
+        win->id = id;
+        win->step = step - trace->step;
+        win->begin_us = ts;
+        win->end_us = 0;
+        return 1;
+    }
+
+    for (i = 0; i < GBTRACE_MAX_WINDOWS; i++) {
+        win = &trace->window[i];
+        if (win->id == id && win->begin_us && !win->end_us) {
+            win->end_us = ts;
+            if (ts >= win->begin_us) {
+                stats_add(&trace->step[win->step].step_us,
+                          ts - win->begin_us);
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Account an operation to the step it was created in, if any
+ *
+ * Steps of one process do not overlap, but several processes could mark
+ * at once; the latest step begun before the operation wins.
+ */
+static void step_account(struct gbtrace *trace, const struct gbtrace_op *op)
+{
+    const struct gbtrace_window *win, *best = NULL;
+    struct gbtrace_step *step;
+    uint64_t created = op->ts[OP_CREATE];
+    int i;
+
+    for (i = 0; i < GBTRACE_MAX_WINDOWS; i++) {
+        win = &trace->window[i];
+        if (win->begin_us && win->begin_us <= created &&
+            (!win->end_us || created <= win->end_us) &&
+            (!best || win->begin_us > best->begin_us)) {
+            best = win;
+        }
+    }
+    if (!best) {
+        return;
+    }
+
+    step = &trace->step[best->step];
+    step->ops++;
+    if ((op->seen & (1 << OP_SEND)) && (op->seen & (1 << OP_RECV)) &&
+        op->ts[OP_RECV] >= op->ts[OP_SEND]) {
+        stats_add(&step->rtt_us, op->ts[OP_RECV] - op->ts[OP_SEND]);
+    }
+    if ((op->seen & (1 << OP_DONE)) && op->ts[OP_DONE] >= created) {
+        stats_add(&step->op_us, op->ts[OP_DONE] - created);
+    }
+}
+
+/**
+ * @brief Account a finished operation and free its slot
+ */
+static void finish_op(struct gbtrace *trace, struct gbtrace_op *op)
+{
+    struct gbtrace_key *key;
+
+    if (op->seen & (1 << OP_CREATE)) {
+        key = find_key(trace, op);
+        if (key) {
+            if (op->incoming) {
+                add_phase(key, GBTRACE_HANDLE, op, OP_RECV, OP_SEND);
+            } else {
+                add_phase(key, GBTRACE_SETUP, op, OP_CREATE, OP_SEND);
+                add_phase(key, GBTRACE_RTT, op, OP_SEND, OP_RECV);
+                add_phase(key, GBTRACE_COMPLETE, op, OP_RECV, OP_DONE);
+            }
+            add_phase(key, GBTRACE_TOTAL, op, OP_CREATE, OP_DONE);
+            trace->ops++;
+        }
+        if (trace->nwindows) {
+            step_account(trace, op);
+        }
+    } else {
+        /* Started before the capture */
+        trace->unmatched++;
+    }
+
+    memset(op, 0, sizeof(*op));
+}
+
+/**
+ * @brief Check whether all events expected for an operation were seen
+ *
+ * The per-CPU streams are not merged in time order, so the destroy event
+ * can be parsed before the response that preceded it. An operation is
+ * only finished once nothing else is expected.
+ */
+static int op_complete(const struct gbtrace_op *op)
+{
+    uint32_t want = (1 << OP_CREATE) | (1 << OP_DONE);
+
+    if (op->incoming) {
+        want |= 1 << OP_RECV;
+    } else {
+        /* Unidirectional requests get no response */
+        want |= 1 << OP_SEND;
+        want |= op->unidirectional ? 0 : 1 << OP_RECV;
+    }
+
+    return (op->seen & want) == want;
+}
+
+/**
+ * @brief Get the bucket of an operation id, accounting stale operations
+ */
+static struct gbtrace_op *op_bucket(struct gbtrace *trace, uint16_t id,
+                                    uint64_t ts)
+{
+    struct gbtrace_op *bucket = &trace->op[(id % OP_BUCKETS) * OP_WAYS];
+    int i;
+
+    for (i = 0; i < OP_WAYS; i++) {
+        if (bucket[i].seen && ts > bucket[i].last_us + OP_STALE_US) {
+            finish_op(trace, &bucket[i]);
+        }
+    }
+
+    return bucket;
+}
+
+/**
+ * @brief Start tracking an operation in a free way of its bucket
+ *
+ * With all ways taken the least recently seen operation is accounted as
+ * it is and its way reused.
+ */
+static struct gbtrace_op *alloc_op(struct gbtrace *trace,
+                                   struct gbtrace_op *bucket, uint16_t id,
+                                   int cport, uint64_t ts)
+{
+    struct gbtrace_op *op = NULL;
+    int i;
+
+    for (i = 0; i < OP_WAYS && (!op || op->seen); i++) {
+        if (!op || !bucket[i].seen || bucket[i].last_us < op->last_us) {
+            op = &bucket[i];
+        }
+    }
+    if (op->seen) {
+        trace->evicted++;
+        finish_op(trace, op);
+    }
+
+    op->id = id;
+    op->cport = cport;
+    op->last_us = ts;
+    return op;
+}
+
+/**
+ * @brief Find the operation of an operation event, by cport and id
+ *
+ * An incoming request seen so far only through its message has no cport
+ * yet, it is taken over by the first cport creating that id.
+ */
+static struct gbtrace_op *lookup_op(struct gbtrace *trace, uint16_t id,
+                                    int cport, uint64_t ts)
+{
+    struct gbtrace_op *bucket = op_bucket(trace, id, ts);
+    struct gbtrace_op *op = NULL;
+    int i;
+
+    for (i = 0; i < OP_WAYS; i++) {
+        if (bucket[i].seen && bucket[i].id == id) {
+            if (bucket[i].cport == cport) {
+                op = &bucket[i];
+                break;
+            }
+            if (bucket[i].cport < 0 && !(bucket[i].seen & (1 << OP_CREATE))) {
+                op = &bucket[i];
+            }
+        }
+    }
+    if (!op) {
+        return alloc_op(trace, bucket, id, cport, ts);
+    }
+
+    op->cport = cport;
+    op->last_us = ts;
+    return op;
+}
+
+/**
+ * @brief Find the operation of a message event, by id only
+ *
+ * Operations already destroyed are only taken when no other one has the
+ * id: the per-CPU streams can deliver a response after its destroy.
+ *
+ * @return The operation, NULL if several are open with this id
+ */
+static struct gbtrace_op *lookup_message(struct gbtrace *trace, uint16_t id,
+                                         uint64_t ts)
+{
+    struct gbtrace_op *bucket = op_bucket(trace, id, ts);
+    struct gbtrace_op *open = NULL, *done = NULL;
+    int i, nopen = 0, ndone = 0;
+
+    for (i = 0; i < OP_WAYS; i++) {
+        if (!bucket[i].seen || bucket[i].id != id) {
+            continue;
+        }
+        if (bucket[i].seen & (1 << OP_DONE)) {
+            done = &bucket[i];
+            ndone++;
+        } else {
+            open = &bucket[i];
+            nopen++;
+        }
+    }
+
+    if (nopen > 1 || (!nopen && ndone > 1)) {
+        trace->ambiguous++;
+        return NULL;
+    }
+    if (!nopen && !ndone) {
+        return alloc_op(trace, bucket, id, -1, ts);
+    }
+
+    open = nopen ? open : done;
+    open->last_us = ts;
+    return open;
+}
+
+/*
+ * Find "key=" as a whole word in the event fields and parse its value.
+ * The greybus events print every field in hex, some without the 0x.
+ */
+static int field_value(const char *fields, const char *key, long *value)
+{
+    size_t len = strlen(key);
+    const char *p = fields;
+
+    while ((p = strstr(p, key)) != NULL) {
+        if ((p == fields || p[-1] == ' ') && p[len] == '=') {
+            *value = strtol(p + len + 1, NULL, 16);
+            return 0;
+        }
+        p += len;
+    }
+
+    return -ENOENT;
+}
+
+/**
+ * @brief Parse one line of trace output
+ *
+ * Lines look like
+ *   kworker/0:1-42 [000] .... 1234.567890: gb_message_send: size=8 ...
+ * Anything that is not a greybus event, e.g. header comments, is skipped.
+ *
+ * @param trace The trace context
+ * @param line One line, without the newline
+ * @return 1 if a greybus event was used, 0 if skipped
+ */
+int gbtrace_parse_line(struct gbtrace *trace, const char *line)
+{
+    const char *event, *fields, *p;
+    char name[48];
+    unsigned long long sec;
+    uint64_t ts, frac;
+    long id, type = 0, cport = -1, flags = 0;
+    struct gbtrace_op *op;
+    int n, digits;
+
+    trace->lines++;
+    if (line[0] == '#') {
+        return 0;
+    }
+    event = strstr(line, ": gb_");
+    if (!event) {
+        event = strstr(line, ": tracing_mark_write: fwtest ");
+    }
+    if (!event) {
+        return 0;
+    }
+
+    /* The timestamp is the token right before the event name */
+    for (p = event; p > line && p[-1] != ' '; p--)
+        ;
+    if (sscanf(p, "%llu.%n", &sec, &n) != 1) {
+        return 0;
+    }
+    frac = 0;
+    for (digits = 0, p += n; *p >= '0' && *p <= '9'; p++) {
+        /* Microseconds: finer clocks are cut, coarser ones padded */
+        if (digits < 6) {
+            frac = frac * 10 + (*p - '0');
+            digits++;
+        }
+    }
+    for (; digits < 6; digits++) {
+        frac *= 10;
+    }
+    ts = sec * 1000000 + frac;
+
+    event += 2;
+    if (!strncmp(event, "tracing_mark_write: ", 20)) {
+        return parse_marker(trace, event + 20, ts);
+    }
+
+    fields = strchr(event, ':');
+    if (!fields || fields - event >= (int)sizeof(name)) {
+        return 0;
+    }
+    snprintf(name, sizeof(name), "%.*s", (int)(fields - event), event);
+    fields++;
+
+    if (field_value(fields, "operation_id", &id) &&
+        field_value(fields, "id", &id)) {
+        return 0;
+    }
+    field_value(fields, "type", &type);
+    field_value(fields, "cport_id", &cport);
+    field_value(fields, "flags", &flags);
+
+    trace->events++;
+    if (cport >= 0) {
+        op = lookup_op(trace, (uint16_t)id, (int)cport, ts);
+    } else {
+        op = lookup_message(trace, (uint16_t)id, ts);
+        if (!op) {
+            return 1;
+        }
+    }
+
+    if (!strncmp(name, "gb_operation_create", 19)) {
+        if (op->seen & (1 << OP_CREATE)) {
+            /* Id reused without a destroy in between */
+            finish_op(trace, op);
+            op->id = (uint16_t)id;
+            op->cport = cport;
+            op->last_us = ts;
+        }
+        op->incoming = !strcmp(name, "gb_operation_create_incoming");
+        op->type = type & ~GB_RESPONSE_FLAG;
+        op->cport = cport;
+        /* GB_OPERATION_FLAG_UNIDIRECTIONAL, id 0 has no response either */
+        op->unidirectional = (flags & 0x2) || id == 0;
+        op->ts[OP_CREATE] = ts;
+        op->seen |= 1 << OP_CREATE;
+    } else if (!strcmp(name, "gb_message_send")) {
+        op->ts[OP_SEND] = ts;
+        op->seen |= 1 << OP_SEND;
+    } else if (!strcmp(name, "gb_message_recv_request") ||
+               !strcmp(name, "gb_message_recv_response")) {
+        op->ts[OP_RECV] = ts;
+        op->seen |= 1 << OP_RECV;
+    } else if (!strcmp(name, "gb_operation_destroy")) {
+        op->ts[OP_DONE] = ts;
+        op->seen |= 1 << OP_DONE;
+    } else {
+        /* Other operation and message events only keep the slot fresh */
+        return 1;
+    }
+
+    if (op_complete(op)) {
+        finish_op(trace, op);
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Account the operations still waiting for events
+ *
+ * @param trace The trace context
+ * @return None
+ */
+void gbtrace_flush(struct gbtrace *trace)
+{
+    int i;
+
+    for (i = 0; i < GBTRACE_MAX_OPS; i++) {
+        if (trace->op[i].seen) {
+            finish_op(trace, &trace->op[i]);
+        }
+    }
+}
+
+/**
+ * @brief Feed raw trace text, keeping a partial last line for later
+ */
+static void parse_chunk(struct gbtrace *trace, struct gbtrace_cpu *cpu,
+                        const char *data, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            cpu->line[cpu->len] = '\0';
+            gbtrace_parse_line(trace, cpu->line);
+            cpu->len = 0;
+        } else if (cpu->len < GBTRACE_LINE_LEN - 1) {
+            cpu->line[cpu->len++] = data[i];
+        }
+    }
+}
+
+/**
+ * @brief Parse a recorded trace, e.g. a copy of tracefs/trace
+ *
+ * @param trace The trace context
+ * @param path The trace file
+ * @return 0 on success, negative errno on failure
+ */
+int gbtrace_parse_file(struct gbtrace *trace, const char *path)
+{
+    struct gbtrace_cpu *cpu = &trace->cpu[0];
+    char buf[SPLICE_LEN];
+    ssize_t len;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    cpu->len = 0;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        parse_chunk(trace, cpu, buf, len);
+    }
+    close(fd);
+
+    if (cpu->len) {
+        parse_chunk(trace, cpu, "\n", 1);
+    }
+    gbtrace_flush(trace);
+
+    return len < 0 ? -errno : 0;
+}
+
+static int tracefs_set(struct gbtrace *trace, const char *attr,
+                       const char *value, char *saved, int len)
+{
+    if (saved && debugfs_get_attr(trace->tracefs, attr, saved, len)) {
+        saved[0] = '\0';
+    }
+
+    return debugfs_set_attr(trace->tracefs, attr, (char *)value,
+                            strlen(value));
+}
+
+/**
+ * @brief Enable the greybus events and open the per-CPU pipes
+ *
+ * tracefs is looked up below the sysfs root, at kernel/tracing and then
+ * kernel/debug/tracing.
+ *
+ * @param trace The trace context, initialized by gbtrace_init()
+ * @return 0 on success, negative errno on failure
+ */
+int gbtrace_open(struct gbtrace *trace)
+{
+    char path[PATH_MAX];
+    struct gbtrace_cpu *cpu;
+    int i, ret;
+
+    sysfs_path(trace->tracefs, sizeof(trace->tracefs), TRACEFS_PATH);
+    snprintf(path, sizeof(path), "%s/%s", trace->tracefs, GREYBUS_EVENTS);
+    if (access(path, F_OK)) {
+        sysfs_path(trace->tracefs, sizeof(trace->tracefs),
+                   TRACEFS_DEBUG_PATH);
+        snprintf(path, sizeof(path), "%s/%s", trace->tracefs,
+                 GREYBUS_EVENTS);
+        if (access(path, F_OK)) {
+            return -ENOENT;
+        }
+    }
+
+    for (i = 0; i < GBTRACE_MAX_CPUS; i++) {
+        snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe",
+                 trace->tracefs, i);
+        if (access(path, F_OK)) {
+            break;
+        }
+        cpu = &trace->cpu[trace->ncpus];
+        cpu->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (cpu->fd < 0 ||
+            pipe2(cpu->pipe, O_NONBLOCK | O_CLOEXEC)) {
+            ret = -errno;
+            goto error;
+        }
+        fcntl(cpu->pipe[1], F_SETPIPE_SZ, SPLICE_LEN * 4);
+        trace->ncpus++;
+    }
+
+    if (!trace->ncpus) {
+        ret = -ENOENT;
+        goto error;
+    }
+
+    ret = tracefs_set(trace, GREYBUS_EVENTS "/enable", "1",
+                      trace->saved_enable, sizeof(trace->saved_enable));
+    if (!ret) {
+        ret = tracefs_set(trace, "tracing_on", "1", trace->saved_on,
+                          sizeof(trace->saved_on));
+    }
+    if (ret) {
+        goto error;
+    }
+
+    return 0;
+
+error:
+    gbtrace_close(trace);
+    return ret;
+}
+
+/**
+ * @brief Move pending trace data of every CPU through its pipe and parse it
+ *
+ * @param trace The trace context
+ * @param timeout_ms Time to wait for new data, 0 to only drain
+ * @return Bytes parsed, negative errno on failure
+ */
+int gbtrace_poll(struct gbtrace *trace, int timeout_ms)
+{
+    struct pollfd pfd[GBTRACE_MAX_CPUS];
+    struct gbtrace_cpu *cpu;
+    char buf[SPLICE_LEN];
+    ssize_t len, got;
+    int i, total = 0;
+
+    for (i = 0; i < trace->ncpus; i++) {
+        pfd[i].fd = trace->cpu[i].fd;
+        pfd[i].events = POLLIN;
+    }
+    if (timeout_ms && poll(pfd, trace->ncpus, timeout_ms) < 0 &&
+        errno != EINTR) {
+        return -errno;
+    }
+
+    for (i = 0; i < trace->ncpus; i++) {
+        cpu = &trace->cpu[i];
+        do {
+            len = splice(cpu->fd, NULL, cpu->pipe[1], NULL, SPLICE_LEN,
+                         SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            while ((got = read(cpu->pipe[0], buf, sizeof(buf))) > 0) {
+                parse_chunk(trace, cpu, buf, got);
+                total += got;
+            }
+        } while (len > 0);
+    }
+
+    return total;
+}
+
+/**
+ * @brief Drain, restore the tracing state and close the pipes
+ *
+ * The parse results stay available until gbtrace_free().
+ *
+ * @param trace The trace context
+ * @return None
+ */
+void gbtrace_close(struct gbtrace *trace)
+{
+    int i;
+
+    if (trace->ncpus) {
+        gbtrace_poll(trace, 0);
+    }
+    if (trace->saved_enable[0]) {
+        tracefs_set(trace, GREYBUS_EVENTS "/enable", trace->saved_enable,
+                    NULL, 0);
+        trace->saved_enable[0] = '\0';
+    }
+    if (trace->saved_on[0]) {
+        tracefs_set(trace, "tracing_on", trace->saved_on, NULL, 0);
+        trace->saved_on[0] = '\0';
+    }
+
+    for (i = 0; i < GBTRACE_MAX_CPUS; i++) {
+        if (trace->cpu[i].fd >= 0) {
+            close(trace->cpu[i].fd);
+        }
+        if (trace->cpu[i].pipe[0] >= 0) {
+            close(trace->cpu[i].pipe[0]);
+            close(trace->cpu[i].pipe[1]);
+        }
+        trace->cpu[i].fd = -1;
+        trace->cpu[i].pipe[0] = -1;
+        trace->cpu[i].pipe[1] = -1;
+    }
+    trace->ncpus = 0;
+
+    gbtrace_flush(trace);
+}
+
+/**
+ * @brief Print one perf line per protocol, operation type and phase
+ *
+ * Latencies are in microseconds, the histogram lists the non-empty
+ * octaves as upper-bound:count, e.g. 256:12 for 12 samples in 128..255.
+ *
+ * @param trace The trace context
+ * @param tag Log tag
+ * @param case_id Test case ID
+ * @return None
+ */
+void gbtrace_report(struct gbtrace *trace, char *tag, int case_id)
+{
+    const struct test_stats *stats;
+    struct gbtrace_key *key;
+    struct gbtrace_step *step;
+    char buf[768], summary[160], protocol[DEV_CLASS_LEN];
+    char rtt[160], op[160];
+    uint32_t count;
+    int i, phase, bucket, sub, n;
+
+    for (i = 0; i < trace->nkeys; i++) {
+        key = &trace->key[i];
+        if (key->cport >= 0 && key->cport < GBTRACE_MAX_CPORTS &&
+            trace->protocol[key->cport][0]) {
+            snprintf(protocol, sizeof(protocol), "%s",
+                     trace->protocol[key->cport]);
+        } else {
+            snprintf(protocol, sizeof(protocol), "cport%d", key->cport);
+        }
+
+        for (phase = 0; phase < GBTRACE_PHASES; phase++) {
+            stats = &key->phase_us[phase];
+            if (!stats->count) {
+                continue;
+            }
+            stats_format(stats, summary, sizeof(summary));
+            n = snprintf(buf, sizeof(buf), "protocol=%s cport=%d type=0x%02x "
+                         "dir=%s phase=%s latency_us(%s) hist=", protocol,
+                         key->cport, key->type, key->incoming ? "in" : "out",
+                         phase_names[phase], summary);
+
+            /* Fold the sub-buckets into octaves, labelled by upper bound */
+            for (bucket = 0; bucket < STATS_HIST_BUCKETS &&
+                 n < (int)sizeof(buf); bucket += STATS_SUB_BUCKETS) {
+                count = 0;
+                for (sub = 0; sub < STATS_SUB_BUCKETS; sub++) {
+                    count += stats->hist[bucket + sub];
+                }
+                if (count) {
+                    n += snprintf(buf + n, sizeof(buf) - n, "%llu:%u,",
+                                  1ULL << (bucket / STATS_SUB_BUCKETS + 3),
+                                  count);
+                }
+            }
+            if (buf[n - 1] == ',') {
+                buf[n - 1] = '\0';
+            }
+            print_test_case_perf(tag, case_id, buf);
+        }
+    }
+
+    for (i = 0; i < trace->nsteps; i++) {
+        step = &trace->step[i];
+        stats_format(&step->step_us, summary, sizeof(summary));
+        stats_format(&step->rtt_us, rtt, sizeof(rtt));
+        stats_format(&step->op_us, op, sizeof(op));
+        snprintf(buf, sizeof(buf), "step=%s case=%d calls=%llu ops=%llu "
+                 "step_us(%s) rtt_us(%s) op_us(%s)", step->name,
+                 step->case_id, (unsigned long long)step->calls,
+                 (unsigned long long)step->ops, summary, rtt, op);
+        print_test_case_perf(tag, case_id, buf);
+    }
+
+    snprintf(buf, sizeof(buf), "greybus trace: lines=%llu events=%llu "
+             "operations=%llu unmatched=%llu evicted=%llu ambiguous=%llu",
+             (unsigned long long)trace->lines,
+             (unsigned long long)trace->events,
+             (unsigned long long)trace->ops,
+             (unsigned long long)trace->unmatched,
+             (unsigned long long)trace->evicted,
+             (unsigned long long)trace->ambiguous);
+    print_test_case_log(tag, case_id, buf);
+}
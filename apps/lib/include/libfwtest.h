@@ -27,13 +27,526 @@
  */
 
 /* libfwtest.h */
+#ifndef __LIBFWTEST_H__
+#define __LIBFWTEST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void dumpargs(int argc, char **argv);
 
 /* implement in log.c */
 void print_test_case_result(char *TAG, int case_id, int result, char *data);
 void print_test_case_result_only(int case_id, int result);
 void print_test_case_log(char *TAG, int case_id, char *data);
+void print_test_case_perf(char *TAG, int case_id, char *data);
+int trace_marker_enable(int enable);
+int trace_step_begin(int case_id, const char *name);
+void trace_step_end(int case_id, int step, const char *name, int ret);
+
+struct log_buffer {
+    char        *data;
+    size_t      len;
+    size_t      size;
+};
+
+int log_capture_begin(struct log_buffer *buf);
+void log_capture_end(void);
+void log_buffer_flush(struct log_buffer *buf);
 
 /* fwtools */
 int debugfs_get_attr(char *class_path, const char *attr, char *value, int len);
 int debugfs_set_attr(char *class_path, const char *attr, char *value, int len);
+int open_i2c_dev(int i2cbus);
+
+/*
+ * implement in fwio.c
+ *
+ * Device I/O goes through fwio_*(). With FWIO=1 every call is counted
+ * and timed per syscall type and path, otherwise these are the plain
+ * syscalls.
+ */
+#ifdef CONFIG_FWIO
+#include <sys/types.h>
+
+int fwio_open(const char *path, int flags, ...);
+ssize_t fwio_read(int fd, void *buf, size_t len);
+ssize_t fwio_write(int fd, const void *buf, size_t len);
+int fwio_ioctl(int fd, unsigned long request, ...);
+int fwio_close(int fd);
+void fwio_reset(void);
+void fwio_report(char *tag, int case_id);
+#else
+#define fwio_open               open
+#define fwio_read               read
+#define fwio_write              write
+#define fwio_ioctl              ioctl
+#define fwio_close              close
+#define fwio_reset()            do { } while (0)
+#define fwio_report(tag, id)    do { } while (0)
+#endif
+
+/* implement in timing.c */
+uint64_t get_time_ns(void);
+uint64_t get_cpu_time_ns(void);
+
+/* implement in stats.c */
+/* 8 sub-buckets per power of two, enough for any 64-bit sample */
+#define STATS_SUB_BUCKETS   8
+#define STATS_HIST_BUCKETS  (62 * STATS_SUB_BUCKETS)
+
+struct test_stats {
+    uint64_t    count;
+    uint64_t    min;
+    uint64_t    max;
+    uint64_t    sum;
+    double      mean;
+    double      m2;
+    uint32_t    hist[STATS_HIST_BUCKETS];
+};
+
+void stats_reset(struct test_stats *stats);
+void stats_add(struct test_stats *stats, uint64_t value);
+uint64_t stats_mean(const struct test_stats *stats);
+uint64_t stats_stddev(const struct test_stats *stats);
+uint64_t stats_percentile(const struct test_stats *stats, int percent);
+int stats_format(const struct test_stats *stats, char *buf, int len);
+
+/* implement in v4l2.c */
+#define V4L2_MAX_BUFFERS    32
+
+struct v4l2_frame {
+    uint32_t    index;
+    uint32_t    sequence;
+    uint32_t    bytesused;
+    uint32_t    flags;
+    uint64_t    timestamp_ns;
+    void        *data;
+};
+
+struct v4l2_stream {
+    int         fd;
+    uint32_t    pixfmt;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    sizeimage;
+    uint32_t    nbufs;
+    /** V4L2_MEMORY_MMAP or V4L2_MEMORY_DMABUF */
+    uint32_t    memory;
+    void        *start[V4L2_MAX_BUFFERS];
+    uint32_t    length[V4L2_MAX_BUFFERS];
+    int         dmabuf[V4L2_MAX_BUFFERS];
+};
+
+int v4l2_open(struct v4l2_stream *stream, const char *devname);
+void v4l2_close(struct v4l2_stream *stream);
+int v4l2_enum_formats(struct v4l2_stream *stream, uint32_t *fourcc, int max);
+int v4l2_enum_sizes(struct v4l2_stream *stream, uint32_t fourcc,
+                    uint32_t *width, uint32_t *height, int max);
+int v4l2_set_format(struct v4l2_stream *stream, uint32_t fourcc,
+                    uint32_t width, uint32_t height);
+int v4l2_stream_start(struct v4l2_stream *stream, uint32_t nbufs);
+int v4l2_stream_start_dmabuf(struct v4l2_stream *stream, const int *fds,
+                             void * const *maps, uint32_t length,
+                             uint32_t nbufs);
+int v4l2_stream_dequeue(struct v4l2_stream *stream, struct v4l2_frame *frame,
+                        int timeout_ms);
+int v4l2_stream_queue(struct v4l2_stream *stream,
+                      const struct v4l2_frame *frame);
+void v4l2_stream_stop(struct v4l2_stream *stream);
+void v4l2_fourcc_str(uint32_t fourcc, char *buf);
+
+/* implement in caps.c */
+#define CAPS_MAX_ENTRIES    48
+#define CAPS_KEY_LEN        32
+#define CAPS_VALUE_LEN      96
+#define CAPS_IDENT_LEN      160
+
+/* caps_get() flags */
+#define CAPS_REFRESH        0x1
+
+enum caps_type {
+    CAPS_V4L2,
+    CAPS_I2C,
+    CAPS_SPI,
+    CAPS_MMC,
+};
+
+struct caps_entry {
+    char        key[CAPS_KEY_LEN];
+    char        value[CAPS_VALUE_LEN];
+};
+
+struct dev_caps {
+    char                ident[CAPS_IDENT_LEN];
+    int                 cached;
+    int                 count;
+    struct caps_entry   entry[CAPS_MAX_ENTRIES];
+};
+
+int caps_get(enum caps_type type, const char *devname, struct dev_caps *caps,
+             int flags);
+const char *caps_lookup(const struct dev_caps *caps, const char *key);
+int caps_set(struct dev_caps *caps, const char *key, const char *fmt, ...);
+
+/* description of a *_caps app, for caps_app_main() */
+struct caps_app {
+    const char      *name;
+    const char      *tag;
+    enum caps_type  type;
+    /** -d help text, default, and the usage example's -k/-v */
+    const char      *dev_help;
+    const char      *default_dev;
+    const char      *example_key;
+    const char      *example_value;
+};
+
+int caps_app_main(const struct caps_app *app, int argc, char **argv);
+
+/* implement in steps.c */
+#define STEPS_MAX           256
+#define STEPS_WORKERS       4
+#define STEPS_MAX_WORKERS   16
+
+/* steps_add() after */
+#define STEP_NONE           (-1)
+#define STEP_ALL            (-2)
+
+typedef int (*step_fn)(void *arg);
+
+struct step {
+    step_fn             fn;
+    void                *arg;
+    /** index of the step to wait for, STEP_NONE or STEP_ALL */
+    int                 after;
+    int                 state;
+    int                 ret;
+    struct log_buffer   log;
+};
+
+struct steps {
+    int         count;
+    int         workers;
+    struct step step[STEPS_MAX];
+};
+
+void steps_init(struct steps *steps, int workers);
+int steps_add(struct steps *steps, step_fn fn, void *arg, int after);
+int steps_run(struct steps *steps);
+int steps_result(struct steps *steps, int first, int count);
+
+/* implement in sysfs_batch.c */
+struct sysfs_read {
+    const char  *dir;
+    const char  *attr;
+    /** filled with the value, newlines stripped */
+    char        *buf;
+    int         len;
+    /** 0 or the read's error */
+    int         ret;
+};
+
+int sysfs_batch_read(struct sysfs_read *reads, int count);
+
+/* implement in perfcount.c */
+#define PERF_MAX_COUNTERS   5
+
+/* task_clock_us, context_switches, page_faults, cycles, instructions */
+struct perf_counters {
+    int         count;
+    int         fd[PERF_MAX_COUNTERS];
+    int         valid[PERF_MAX_COUNTERS];
+    uint64_t    value[PERF_MAX_COUNTERS];
+};
+
+int perf_counters_start(struct perf_counters *pc);
+void perf_counters_stop(struct perf_counters *pc);
+void perf_counters_report(struct perf_counters *pc, char *tag, int case_id);
+
+/* implement in daemon.c */
+typedef int (*daemon_case_fn)(int argc, char **argv);
+
+int daemon_serve(const char *sockpath, char *argv0, daemon_case_fn run);
+int daemon_request(const char *sockpath, int argc, char **argv, int *result);
+
+/* implement in devroot.c */
+const char *sysfs_root(void);
+void set_sysfs_root(const char *root);
+int sysfs_path(char *buf, int len, const char *fmt, ...);
+const char *dev_root(void);
+void set_dev_root(const char *root);
+int dev_path(char *buf, int len, const char *fmt, ...);
+
+/* implement in devenum.c */
+#define DEV_CLASS_LEN       16
+#define DEV_NAME_LEN        32
+#define DEV_NODE_LEN        128
+#define DEV_PATH_LEN        256
+
+struct dev_entry {
+    /** greybus, gpio, i2c, spi, mmc, uart, pwm, sound or camera */
+    char    class[DEV_CLASS_LEN];
+    /** sysfs name, e.g. gpiochip480 or 1-2.2 */
+    char    name[DEV_NAME_LEN];
+    /** owning Greybus bundle, e.g. 1-2.2, empty if not on Greybus */
+    char    bundle_name[DEV_NAME_LEN];
+    /** Greybus protocol or bundle class, empty if not on Greybus */
+    char    protocol[DEV_CLASS_LEN];
+    /** Greybus bundle id, -1 if unknown */
+    int     bundle;
+    /** Greybus cport id, -1 if unknown */
+    int     cport;
+    /** uevent DEVNAME below the device root, empty if none */
+    char    devnode[DEV_NODE_LEN];
+    /** sysfs directory of the entry, below the sysfs root */
+    char    syspath[DEV_PATH_LEN];
+};
+
+struct dev_index {
+    int                 count;
+    struct dev_entry    *entry;
+};
+
+int dev_index_build(struct dev_index *index);
+void dev_index_free(struct dev_index *index);
+
+/* description of a *_enum app, for devenum_app_main() */
+struct devenum_app {
+    const char  *name;
+    const char  *tag;
+    const char  *dev_class;
+    /** -a list of the usage example, or NULL */
+    const char  *example_attrs;
+};
+
+int devenum_app_main(const struct devenum_app *app, int argc, char **argv);
+int dev_index_count(const struct dev_index *index, const char *class);
+const struct dev_entry *dev_index_next(const struct dev_index *index,
+                                       const char *class,
+                                       const struct dev_entry *prev);
+const struct dev_entry *dev_index_find(const struct dev_index *index,
+                                       const char *class, const char *name);
+
+/* implement in uart.c */
+int uart_baud_rate(int index);
+int uart_open(const char *devname);
+int uart_open_pty(int *master, int *slave);
+int uart_set_line(int fd, int baud, char parity, int data_bits,
+                  int stop_bits);
+
+/* implement in kms.c */
+/* sizeof(struct drm_mode_modeinfo) */
+#define KMS_MODE_INFO_LEN   68
+
+struct kms_display {
+    int         fd;
+    uint32_t    crtc_id;
+    uint32_t    connector_id;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    htotal;
+    uint32_t    vtotal;
+    uint32_t    clock_khz;
+    uint32_t    refresh;
+    /** struct drm_mode_modeinfo of the mode in use */
+    uint8_t     mode[KMS_MODE_INFO_LEN];
+    /** CRTC state restored by kms_close(), saved_fb is 0 if none */
+    uint32_t    saved_fb;
+    uint8_t     saved_mode[KMS_MODE_INFO_LEN];
+};
+
+struct kms_buffer {
+    uint32_t    handle;
+    uint32_t    fb_id;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    pitch;
+    uint64_t    size;
+    void        *map;
+};
+
+int kms_open(struct kms_display *disp, const char *devname, uint32_t width,
+             uint32_t height);
+void kms_close(struct kms_display *disp);
+int kms_buffer_create(struct kms_display *disp, struct kms_buffer *buf,
+                      uint32_t width, uint32_t height, uint32_t bpp,
+                      int add_fb);
+void kms_buffer_destroy(struct kms_display *disp, struct kms_buffer *buf);
+int kms_buffer_export(struct kms_display *disp, struct kms_buffer *buf);
+int kms_set_crtc(struct kms_display *disp, struct kms_buffer *buf);
+int kms_page_flip(struct kms_display *disp, struct kms_buffer *buf);
+int kms_wait_flip(struct kms_display *disp, int timeout_ms,
+                  uint64_t *timestamp_ns, uint32_t *sequence);
+
+/* implement in faketree.c */
+#define FAKE_TREE_MARKER    ".fwtest_fake_tree"
+
+struct fake_tree_config {
+    /** host device number, the N of greybusN */
+    int     hd;
+    /** module interfaces, numbered from 2 */
+    int     interfaces;
+    /** GPIO chips per interface */
+    int     gpio_chips;
+    /** pins per GPIO chip */
+    int     gpio_pins;
+    /** I2C adapters per interface */
+    int     i2c_adapters;
+    /** interfaces also carrying a loopback bundle */
+    int     loopbacks;
+};
+
+void fake_tree_defaults(struct fake_tree_config *cfg);
+int fake_tree_build(const char *root, const struct fake_tree_config *cfg);
+int fake_tree_remove(const char *root);
+
+/* implement in gbtrace.c */
+#define GBTRACE_MAX_CPUS    64
+#define GBTRACE_MAX_OPS     1024
+#define GBTRACE_MAX_CPORTS  256
+#define GBTRACE_LINE_LEN    512
+#define GBTRACE_MAX_WINDOWS 64
+#define GBTRACE_STEP_NAME_LEN 32
+
+enum gbtrace_phase {
+    /** outgoing: operation created to request sent */
+    GBTRACE_SETUP,
+    /** outgoing: request sent to response received */
+    GBTRACE_RTT,
+    /** outgoing: response received to operation destroyed */
+    GBTRACE_COMPLETE,
+    /** incoming: request received to response sent */
+    GBTRACE_HANDLE,
+    /** operation created to operation destroyed */
+    GBTRACE_TOTAL,
+    GBTRACE_PHASES
+};
+
+/* Latencies of one protocol operation type in one direction */
+struct gbtrace_key {
+    int                 cport;
+    int                 type;
+    int                 incoming;
+    struct test_stats   phase_us[GBTRACE_PHASES];
+};
+
+/* An operation in flight, events seen so far */
+struct gbtrace_op {
+    uint16_t    id;
+    uint8_t     type;
+    uint8_t     incoming;
+    uint8_t     unidirectional;
+    int         cport;
+    uint32_t    seen;
+    uint64_t    last_us;
+    uint64_t    ts[4];
+};
+
+/* Test step from trace_step_begin() markers, and what ran inside it */
+struct gbtrace_step {
+    char                name[GBTRACE_STEP_NAME_LEN];
+    int                 case_id;
+    uint64_t            calls;
+    uint64_t            ops;
+    struct test_stats   step_us;
+    struct test_stats   rtt_us;
+    struct test_stats   op_us;
+};
+
+/* A step instance, begin to end in trace time */
+struct gbtrace_window {
+    unsigned int    id;
+    int             step;
+    uint64_t        begin_us;
+    uint64_t        end_us;
+};
+
+struct gbtrace_cpu {
+    int     fd;
+    int     pipe[2];
+    int     len;
+    char    line[GBTRACE_LINE_LEN];
+};
+
+struct gbtrace {
+    char                tracefs[DEV_PATH_LEN];
+    int                 ncpus;
+    struct gbtrace_cpu  cpu[GBTRACE_MAX_CPUS];
+    char                saved_enable[8];
+    char                saved_on[8];
+    /** protocol of each cport, from the device index */
+    char                protocol[GBTRACE_MAX_CPORTS][DEV_CLASS_LEN];
+    struct gbtrace_op   op[GBTRACE_MAX_OPS];
+    int                 nkeys;
+    int                 capacity;
+    struct gbtrace_key  *key;
+    uint64_t            lines;
+    uint64_t            events;
+    uint64_t            ops;
+    uint64_t            unmatched;
+    uint64_t            evicted;
+    /** message events matching open operations of several cports */
+    uint64_t            ambiguous;
+    int                 nsteps;
+    int                 step_capacity;
+    struct gbtrace_step *step;
+    /** most recent step windows, a ring */
+    unsigned int        nwindows;
+    struct gbtrace_window window[GBTRACE_MAX_WINDOWS];
+};
+
+int gbtrace_init(struct gbtrace *trace);
+void gbtrace_free(struct gbtrace *trace);
+int gbtrace_open(struct gbtrace *trace);
+int gbtrace_poll(struct gbtrace *trace, int timeout_ms);
+void gbtrace_close(struct gbtrace *trace);
+int gbtrace_parse_line(struct gbtrace *trace, const char *line);
+int gbtrace_parse_file(struct gbtrace *trace, const char *path);
+void gbtrace_flush(struct gbtrace *trace);
+void gbtrace_report(struct gbtrace *trace, char *tag, int case_id);
+
+/* implement in uevent.c */
+#define UEVENT_MAX_WATCH    32
+
+struct uevent {
+    /** add, remove, bind, unbind, change, ... */
+    char        action[16];
+    /** absolute sysfs path for uevents, watched path for inotify */
+    char        path[DEV_PATH_LEN];
+    /** SUBSYSTEM of a uevent, empty for inotify */
+    char        subsystem[DEV_CLASS_LEN];
+    /** DEVNAME of a uevent, empty if none */
+    char        devname[DEV_NODE_LEN];
+    /** CLOCK_MONOTONIC time the event was received */
+    uint64_t    timestamp_ns;
+};
+
+struct uevent_monitor {
+    int     netlink;
+    int     inotify;
+    int     nwatch;
+    int     wd[UEVENT_MAX_WATCH];
+    char    watch[UEVENT_MAX_WATCH][DEV_PATH_LEN];
+    /** inotify records read but not yet returned */
+    char    buf[4096];
+    int     len;
+    int     pos;
+};
+
+int uevent_monitor_open(struct uevent_monitor *mon);
+void uevent_monitor_close(struct uevent_monitor *mon);
+int uevent_monitor_watch(struct uevent_monitor *mon, const char *path);
+int uevent_monitor_is_netlink(const struct uevent_monitor *mon);
+int uevent_monitor_sees_sysfs(const struct uevent_monitor *mon);
+int uevent_monitor_next(struct uevent_monitor *mon, struct uevent *event,
+                        int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,672 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Minimal KMS support for the display tests: one connector, one CRTC,
+ * dumb buffers and page flips. The NDK does not ship the DRM uapi
+ * headers, so the few structures and ioctls used are defined here with
+ * the layout of include/uapi/drm/drm.h and drm_mode.h.
+ */
+struct drm_mode_modeinfo {
+    uint32_t    clock;
+    uint16_t    hdisplay;
+    uint16_t    hsync_start;
+    uint16_t    hsync_end;
+    uint16_t    htotal;
+    uint16_t    hskew;
+    uint16_t    vdisplay;
+    uint16_t    vsync_start;
+    uint16_t    vsync_end;
+    uint16_t    vtotal;
+    uint16_t    vscan;
+    uint32_t    vrefresh;
+    uint32_t    flags;
+    uint32_t    type;
+    char        name[32];
+};
+
+struct drm_mode_card_res {
+    uint64_t    fb_id_ptr;
+    uint64_t    crtc_id_ptr;
+    uint64_t    connector_id_ptr;
+    uint64_t    encoder_id_ptr;
+    uint32_t    count_fbs;
+    uint32_t    count_crtcs;
+    uint32_t    count_connectors;
+    uint32_t    count_encoders;
+    uint32_t    min_width;
+    uint32_t    max_width;
+    uint32_t    min_height;
+    uint32_t    max_height;
+};
+
+struct drm_mode_crtc {
+    uint64_t                    set_connectors_ptr;
+    uint32_t                    count_connectors;
+    uint32_t                    crtc_id;
+    uint32_t                    fb_id;
+    uint32_t                    x;
+    uint32_t                    y;
+    uint32_t                    gamma_size;
+    uint32_t                    mode_valid;
+    struct drm_mode_modeinfo    mode;
+};
+
+struct drm_mode_get_encoder {
+    uint32_t    encoder_id;
+    uint32_t    encoder_type;
+    uint32_t    crtc_id;
+    uint32_t    possible_crtcs;
+    uint32_t    possible_clones;
+};
+
+struct drm_mode_get_connector {
+    uint64_t    encoders_ptr;
+    uint64_t    modes_ptr;
+    uint64_t    props_ptr;
+    uint64_t    prop_values_ptr;
+    uint32_t    count_modes;
+    uint32_t    count_props;
+    uint32_t    count_encoders;
+    uint32_t    encoder_id;
+    uint32_t    connector_id;
+    uint32_t    connector_type;
+    uint32_t    connector_type_id;
+    uint32_t    connection;
+    uint32_t    mm_width;
+    uint32_t    mm_height;
+    uint32_t    subpixel;
+    uint32_t    pad;
+};
+
+struct drm_mode_fb_cmd {
+    uint32_t    fb_id;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    pitch;
+    uint32_t    bpp;
+    uint32_t    depth;
+    uint32_t    handle;
+};
+
+struct drm_mode_crtc_page_flip {
+    uint32_t    crtc_id;
+    uint32_t    fb_id;
+    uint32_t    flags;
+    uint32_t    reserved;
+    uint64_t    user_data;
+};
+
+struct drm_mode_create_dumb {
+    uint32_t    height;
+    uint32_t    width;
+    uint32_t    bpp;
+    uint32_t    flags;
+    uint32_t    handle;
+    uint32_t    pitch;
+    uint64_t    size;
+};
+
+struct drm_mode_map_dumb {
+    uint32_t    handle;
+    uint32_t    pad;
+    uint64_t    offset;
+};
+
+struct drm_mode_destroy_dumb {
+    uint32_t    handle;
+};
+
+struct drm_prime_handle {
+    uint32_t    handle;
+    uint32_t    flags;
+    int32_t     fd;
+};
+
+struct drm_event {
+    uint32_t    type;
+    uint32_t    length;
+};
+
+struct drm_event_vblank {
+    struct drm_event    base;
+    uint64_t            user_data;
+    uint32_t            tv_sec;
+    uint32_t            tv_usec;
+    uint32_t            sequence;
+    uint32_t            reserved;
+};
+
+#define DRM_IOCTL_PRIME_HANDLE_TO_FD    _IOWR('d', 0x2d, struct drm_prime_handle)
+#define DRM_IOCTL_MODE_GETRESOURCES     _IOWR('d', 0xa0, \
+                                              struct drm_mode_card_res)
+#define DRM_IOCTL_MODE_GETCRTC          _IOWR('d', 0xa1, struct drm_mode_crtc)
+#define DRM_IOCTL_MODE_SETCRTC          _IOWR('d', 0xa2, struct drm_mode_crtc)
+#define DRM_IOCTL_MODE_GETENCODER       _IOWR('d', 0xa6, \
+                                              struct drm_mode_get_encoder)
+#define DRM_IOCTL_MODE_GETCONNECTOR     _IOWR('d', 0xa7, \
+                                              struct drm_mode_get_connector)
+#define DRM_IOCTL_MODE_ADDFB            _IOWR('d', 0xae, struct drm_mode_fb_cmd)
+#define DRM_IOCTL_MODE_RMFB             _IOWR('d', 0xaf, unsigned int)
+#define DRM_IOCTL_MODE_PAGE_FLIP        _IOWR('d', 0xb0, \
+                                              struct drm_mode_crtc_page_flip)
+#define DRM_IOCTL_MODE_CREATE_DUMB      _IOWR('d', 0xb2, \
+                                              struct drm_mode_create_dumb)
+#define DRM_IOCTL_MODE_MAP_DUMB         _IOWR('d', 0xb3, \
+                                              struct drm_mode_map_dumb)
+#define DRM_IOCTL_MODE_DESTROY_DUMB     _IOWR('d', 0xb4, \
+                                              struct drm_mode_destroy_dumb)
+
+#define DRM_MODE_CONNECTED          1
+#define DRM_MODE_TYPE_PREFERRED     (1 << 3)
+#define DRM_MODE_PAGE_FLIP_EVENT    0x01
+#define DRM_EVENT_FLIP_COMPLETE     0x02
+
+#define KMS_MAX_OBJECTS     32
+
+/* The public struct carries the mode as opaque bytes */
+typedef char kms_mode_size_check[sizeof(struct drm_mode_modeinfo) ==
+                                 KMS_MODE_INFO_LEN ? 1 : -1];
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+    return ret < 0 ? -errno : 0;
+}
+
+/**
+ * @brief Pick a mode of a connector
+ *
+ * @param fd The DRM device
+ * @param conn_id The connector
+ * @param width Wanted width, 0 for the preferred mode
+ * @param height Wanted height, 0 for the preferred mode
+ * @param mode Output mode
+ * @param encoder_id Output current encoder of the connector
+ * @return 0 on success, -ENOENT if not connected or no mode matches
+ */
+static int pick_mode(int fd, uint32_t conn_id, uint32_t width,
+                     uint32_t height, struct drm_mode_modeinfo *mode,
+                     uint32_t *encoder_id)
+{
+    struct drm_mode_modeinfo *modes = NULL;
+    struct drm_mode_get_connector conn;
+    uint32_t i, count;
+    int ret, found = -1;
+
+    memset(&conn, 0, sizeof(conn));
+    conn.connector_id = conn_id;
+    ret = xioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn);
+
+    /*
+     * The kernel only copies the modes when the array holds all of them,
+     * so retry with the new count if it grew in between.
+     */
+    while (!ret && conn.connection == DRM_MODE_CONNECTED &&
+           conn.count_modes) {
+        count = conn.count_modes;
+        free(modes);
+        modes = calloc(count, sizeof(*modes));
+        if (!modes) {
+            return -ENOMEM;
+        }
+
+        conn.modes_ptr = (uintptr_t)modes;
+        conn.count_props = 0;
+        conn.count_encoders = 0;
+        ret = xioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn);
+        if (!ret && conn.count_modes <= count) {
+            break;
+        }
+    }
+    if (ret) {
+        free(modes);
+        return ret;
+    }
+    if (conn.connection != DRM_MODE_CONNECTED || !conn.count_modes) {
+        free(modes);
+        return -ENOENT;
+    }
+
+    for (i = 0; i < conn.count_modes; i++) {
+        if (width && height) {
+            if (modes[i].hdisplay == width && modes[i].vdisplay == height) {
+                found = i;
+                break;
+            }
+        } else if (found < 0 || (modes[i].type & DRM_MODE_TYPE_PREFERRED)) {
+            found = i;
+        }
+    }
+    if (found >= 0) {
+        *mode = modes[found];
+        *encoder_id = conn.encoder_id;
+    }
+    free(modes);
+
+    return found < 0 ? -ENOENT : 0;
+}
+
+/**
+ * @brief Find the CRTC driving an encoder, or the first one it can use
+ *
+ * @param fd The DRM device
+ * @param res The card resources with the CRTC ids filled
+ * @param crtcs The CRTC ids
+ * @param encoder_id The encoder, 0 if none is attached
+ * @return The CRTC id, 0 if none
+ */
+static uint32_t pick_crtc(int fd, struct drm_mode_card_res *res,
+                          const uint32_t *crtcs, uint32_t encoder_id)
+{
+    struct drm_mode_get_encoder enc;
+    uint32_t i;
+
+    if (!encoder_id) {
+        return res->count_crtcs ? crtcs[0] : 0;
+    }
+
+    memset(&enc, 0, sizeof(enc));
+    enc.encoder_id = encoder_id;
+    if (xioctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc)) {
+        return 0;
+    }
+    if (enc.crtc_id) {
+        return enc.crtc_id;
+    }
+
+    for (i = 0; i < res->count_crtcs && i < KMS_MAX_OBJECTS; i++) {
+        if (enc.possible_crtcs & (1 << i)) {
+            return crtcs[i];
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Open a DRM device and pick a connected display
+ *
+ * The first connected connector is used, with the mode of the requested
+ * size or its preferred mode. The current CRTC state is saved so that
+ * kms_close() can restore it.
+ *
+ * @param disp The display state to initialize
+ * @param devname DRM card node, e.g. /dev/dri/card0
+ * @param width Wanted width, 0 for the preferred mode
+ * @param height Wanted height, 0 for the preferred mode
+ * @return 0 on success, negative errno on failure
+ */
+int kms_open(struct kms_display *disp, const char *devname, uint32_t width,
+             uint32_t height)
+{
+    uint32_t crtcs[KMS_MAX_OBJECTS], conns[KMS_MAX_OBJECTS], encoder_id = 0;
+    struct drm_mode_card_res res;
+    struct drm_mode_modeinfo mode;
+    struct drm_mode_crtc crtc;
+    uint32_t i;
+    int ret = -ENOENT;
+
+    memset(disp, 0, sizeof(*disp));
+    disp->fd = open(devname, O_RDWR | O_CLOEXEC);
+    if (disp->fd < 0) {
+        return -errno;
+    }
+
+    memset(&res, 0, sizeof(res));
+    if (xioctl(disp->fd, DRM_IOCTL_MODE_GETRESOURCES, &res) ||
+        !res.count_crtcs || !res.count_connectors) {
+        ret = -ENODEV;
+        goto error;
+    }
+
+    /* Only ask for the CRTCs and connectors, capped to the arrays */
+    if (res.count_crtcs > KMS_MAX_OBJECTS) {
+        res.count_crtcs = KMS_MAX_OBJECTS;
+    }
+    if (res.count_connectors > KMS_MAX_OBJECTS) {
+        res.count_connectors = KMS_MAX_OBJECTS;
+    }
+    res.count_fbs = 0;
+    res.count_encoders = 0;
+    res.crtc_id_ptr = (uintptr_t)crtcs;
+    res.connector_id_ptr = (uintptr_t)conns;
+    ret = xioctl(disp->fd, DRM_IOCTL_MODE_GETRESOURCES, &res);
+    if (ret) {
+        goto error;
+    }
+
+    ret = -ENOENT;
+    for (i = 0; i < res.count_connectors && i < KMS_MAX_OBJECTS; i++) {
+        ret = pick_mode(disp->fd, conns[i], width, height, &mode,
+                        &encoder_id);
+        if (!ret) {
+            disp->connector_id = conns[i];
+            break;
+        }
+    }
+    if (ret) {
+        goto error;
+    }
+
+    disp->crtc_id = pick_crtc(disp->fd, &res, crtcs, encoder_id);
+    if (!disp->crtc_id) {
+        ret = -ENODEV;
+        goto error;
+    }
+
+    memcpy(disp->mode, &mode, sizeof(mode));
+    disp->width = mode.hdisplay;
+    disp->height = mode.vdisplay;
+    disp->htotal = mode.htotal;
+    disp->vtotal = mode.vtotal;
+    disp->clock_khz = mode.clock;
+    disp->refresh = mode.vrefresh;
+
+    memset(&crtc, 0, sizeof(crtc));
+    crtc.crtc_id = disp->crtc_id;
+    if (!xioctl(disp->fd, DRM_IOCTL_MODE_GETCRTC, &crtc) && crtc.mode_valid) {
+        disp->saved_fb = crtc.fb_id;
+        memcpy(disp->saved_mode, &crtc.mode, sizeof(crtc.mode));
+    }
+
+    return 0;
+
+error:
+    close(disp->fd);
+    disp->fd = -1;
+    return ret;
+}
+
+/**
+ * @brief Restore the saved CRTC state and close the device
+ *
+ * @param disp The display
+ * @return None
+ */
+void kms_close(struct kms_display *disp)
+{
+    struct drm_mode_crtc crtc;
+
+    if (disp->fd < 0) {
+        return;
+    }
+
+    if (disp->saved_fb) {
+        memset(&crtc, 0, sizeof(crtc));
+        crtc.crtc_id = disp->crtc_id;
+        crtc.fb_id = disp->saved_fb;
+        crtc.set_connectors_ptr = (uintptr_t)&disp->connector_id;
+        crtc.count_connectors = 1;
+        crtc.mode_valid = 1;
+        memcpy(&crtc.mode, disp->saved_mode, sizeof(crtc.mode));
+        xioctl(disp->fd, DRM_IOCTL_MODE_SETCRTC, &crtc);
+    }
+
+    close(disp->fd);
+    disp->fd = -1;
+}
+
+/**
+ * @brief Create, map and wrap a dumb buffer in a framebuffer
+ *
+ * @param disp The display
+ * @param buf The buffer to initialize
+ * @param width Width in pixels
+ * @param height Height in lines
+ * @param bpp Bits per pixel, 32 for XRGB8888
+ * @param add_fb Also create a framebuffer so the buffer can be shown
+ * @return 0 on success, negative errno on failure
+ */
+int kms_buffer_create(struct kms_display *disp, struct kms_buffer *buf,
+                      uint32_t width, uint32_t height, uint32_t bpp,
+                      int add_fb)
+{
+    struct drm_mode_create_dumb create;
+    struct drm_mode_map_dumb map;
+    struct drm_mode_fb_cmd fb;
+    int ret;
+
+    memset(buf, 0, sizeof(*buf));
+    memset(&create, 0, sizeof(create));
+    create.width = width;
+    create.height = height;
+    create.bpp = bpp;
+    ret = xioctl(disp->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create);
+    if (ret) {
+        return ret;
+    }
+
+    buf->handle = create.handle;
+    buf->width = width;
+    buf->height = height;
+    buf->pitch = create.pitch;
+    buf->size = create.size;
+
+    if (add_fb) {
+        memset(&fb, 0, sizeof(fb));
+        fb.width = width;
+        fb.height = height;
+        fb.pitch = create.pitch;
+        fb.bpp = bpp;
+        fb.depth = bpp == 32 ? 24 : bpp;
+        fb.handle = create.handle;
+        ret = xioctl(disp->fd, DRM_IOCTL_MODE_ADDFB, &fb);
+        if (ret) {
+            goto error;
+        }
+        buf->fb_id = fb.fb_id;
+    }
+
+    memset(&map, 0, sizeof(map));
+    map.handle = create.handle;
+    ret = xioctl(disp->fd, DRM_IOCTL_MODE_MAP_DUMB, &map);
+    if (ret) {
+        goto error;
+    }
+
+    buf->map = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    disp->fd, map.offset);
+    if (buf->map == MAP_FAILED) {
+        buf->map = NULL;
+        ret = -errno;
+        goto error;
+    }
+
+    return 0;
+
+error:
+    kms_buffer_destroy(disp, buf);
+    return ret;
+}
+
+/**
+ * @brief Release a dumb buffer and its framebuffer
+ *
+ * @param disp The display
+ * @param buf The buffer
+ * @return None
+ */
+void kms_buffer_destroy(struct kms_display *disp, struct kms_buffer *buf)
+{
+    struct drm_mode_destroy_dumb destroy;
+
+    if (buf->map) {
+        munmap(buf->map, buf->size);
+    }
+    if (buf->fb_id) {
+        xioctl(disp->fd, DRM_IOCTL_MODE_RMFB, &buf->fb_id);
+    }
+    if (buf->handle) {
+        destroy.handle = buf->handle;
+        xioctl(disp->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+    memset(buf, 0, sizeof(*buf));
+}
+
+/**
+ * @brief Export a dumb buffer as a dma-buf
+ *
+ * @param disp The display
+ * @param buf The buffer
+ * @return The dma-buf file descriptor, negative errno on failure
+ */
+int kms_buffer_export(struct kms_display *disp, struct kms_buffer *buf)
+{
+    struct drm_prime_handle prime;
+    int ret;
+
+    memset(&prime, 0, sizeof(prime));
+    prime.handle = buf->handle;
+    prime.flags = O_CLOEXEC | O_RDWR;
+    ret = xioctl(disp->fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime);
+
+    return ret ? ret : prime.fd;
+}
+
+/**
+ * @brief Show a buffer with a full mode set
+ *
+ * @param disp The display
+ * @param buf The buffer, with a framebuffer
+ * @return 0 on success, negative errno on failure
+ */
+int kms_set_crtc(struct kms_display *disp, struct kms_buffer *buf)
+{
+    struct drm_mode_crtc crtc;
+
+    memset(&crtc, 0, sizeof(crtc));
+    crtc.crtc_id = disp->crtc_id;
+    crtc.fb_id = buf->fb_id;
+    crtc.set_connectors_ptr = (uintptr_t)&disp->connector_id;
+    crtc.count_connectors = 1;
+    crtc.mode_valid = 1;
+    memcpy(&crtc.mode, disp->mode, sizeof(crtc.mode));
+
+    return xioctl(disp->fd, DRM_IOCTL_MODE_SETCRTC, &crtc);
+}
+
+/**
+ * @brief Queue a page flip to a buffer at the next vblank
+ *
+ * Only one flip can be pending per CRTC; wait for its completion with
+ * kms_wait_flip() before queueing the next.
+ *
+ * @param disp The display
+ * @param buf The buffer, with a framebuffer
+ * @return 0 on success, negative errno on failure
+ */
+int kms_page_flip(struct kms_display *disp, struct kms_buffer *buf)
+{
+    struct drm_mode_crtc_page_flip flip;
+
+    memset(&flip, 0, sizeof(flip));
+    flip.crtc_id = disp->crtc_id;
+    flip.fb_id = buf->fb_id;
+    flip.flags = DRM_MODE_PAGE_FLIP_EVENT;
+    flip.user_data = buf->fb_id;
+
+    return xioctl(disp->fd, DRM_IOCTL_MODE_PAGE_FLIP, &flip);
+}
+
+/**
+ * @brief Wait for a page flip to complete
+ *
+ * @param disp The display
+ * @param timeout_ms Maximum time to wait
+ * @param timestamp_ns Output vblank time, CLOCK_MONOTONIC
+ * @param sequence Output vblank counter
+ * @return 0 on success, -ETIMEDOUT on timeout, negative errno on failure
+ */
+int kms_wait_flip(struct kms_display *disp, int timeout_ms,
+                  uint64_t *timestamp_ns, uint32_t *sequence)
+{
+    char buf[1024];
+    struct drm_event_vblank *vbl;
+    struct drm_event *event;
+    struct pollfd pfd;
+    ssize_t len, pos;
+    int ret;
+
+    pfd.fd = disp->fd;
+    pfd.events = POLLIN;
+
+    for (;;) {
+        ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (!ret) {
+            return -ETIMEDOUT;
+        }
+
+        len = read(disp->fd, buf, sizeof(buf));
+        if (len < 0) {
+            return -errno;
+        }
+
+        for (pos = 0; pos + (ssize_t)sizeof(*event) <= len;
+             pos += event->length) {
+            event = (struct drm_event *)(buf + pos);
+            if (event->length < sizeof(*event)) {
+                break;
+            }
+            if (event->type != DRM_EVENT_FLIP_COMPLETE ||
+                event->length < sizeof(*vbl)) {
+                continue;
+            }
+
+            vbl = (struct drm_event_vblank *)event;
+            *timestamp_ns = (uint64_t)vbl->tv_sec * 1000000000ULL +
+                            (uint64_t)vbl->tv_usec * 1000ULL;
+            *sequence = vbl->sequence;
+            return 0;
+        }
+    }
+}
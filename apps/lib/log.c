@@ -27,8 +27,143 @@
  */
 
 #include "stdio.h"
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/limits.h>
 #include "./include/libfwtest.h"
 
+/*
+ * Step markers are written to tracefs trace_marker so that test steps can
+ * be lined up with kernel trace events, e.g. the Greybus operations a
+ * step caused. They are off unless FWTEST_TRACE_MARKER=1 is set or
+ * trace_marker_enable() is called. The marker file is opened once and
+ * kept open, so a marker costs one snprintf() and one write().
+ *
+ *   fwtest B case=1031 step=7 name=set_gpio_edge t=123456789
+ *   fwtest E case=1031 step=7 name=set_gpio_edge ret=0 t=123460123
+ *
+ * t is CLOCK_MONOTONIC in ns, as get_time_ns().
+ */
+#define TRACE_MARKER_ENV    "FWTEST_TRACE_MARKER"
+#define TRACE_MARKER_PATH   "/kernel/tracing/trace_marker"
+#define TRACE_MARKER_DEBUG  "/kernel/debug/tracing/trace_marker"
+#define TRACE_MARKER_LEN    128
+
+/* -2 not decided yet, -1 off or unavailable */
+static int marker_fd = -2;
+static unsigned int marker_step;
+static pthread_once_t marker_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Output of a thread can be captured into a log_buffer instead of going
+ * to stdout, so that test steps running concurrently (steps.c) print in
+ * a fixed order once they are done.
+ */
+static pthread_key_t capture_key;
+static pthread_once_t capture_once = PTHREAD_ONCE_INIT;
+static int capture_used;
+
+static void capture_key_create(void)
+{
+    if (!pthread_key_create(&capture_key, NULL)) {
+        capture_used = 1;
+    }
+}
+
+static void log_printf(const char *fmt, ...)
+{
+    struct log_buffer *lb = NULL;
+    va_list ap;
+    size_t size;
+    char *data;
+    int n;
+
+    if (capture_used) {
+        lb = pthread_getspecific(capture_key);
+    }
+
+    va_start(ap, fmt);
+    if (!lb) {
+        vprintf(fmt, ap);
+        va_end(ap);
+        return;
+    }
+    n = vsnprintf(lb->data ? lb->data + lb->len : NULL,
+                  lb->data ? lb->size - lb->len : 0, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || lb->len + n < lb->size) {
+        lb->len += n < 0 ? 0 : n;
+        return;
+    }
+
+    size = lb->size ? lb->size : 256;
+    while (size <= lb->len + n) {
+        size *= 2;
+    }
+    data = realloc(lb->data, size);
+    if (!data) {
+        return;
+    }
+    lb->data = data;
+    lb->size = size;
+
+    va_start(ap, fmt);
+    lb->len += vsnprintf(lb->data + lb->len, lb->size - lb->len, fmt, ap);
+    va_end(ap);
+}
+
+/**
+ * @brief Capture this thread's test output
+ *
+ * Until log_capture_end(), what the print_test_case_*() functions print
+ * from the calling thread is appended to buf.
+ *
+ * @param buf The buffer, zeroed before first use
+ * @return 0 on success, negative errno if capturing is unavailable
+ */
+int log_capture_begin(struct log_buffer *buf)
+{
+    pthread_once(&capture_once, capture_key_create);
+    if (!capture_used) {
+        return -ENOMEM;
+    }
+
+    return -pthread_setspecific(capture_key, buf);
+}
+
+/**
+ * @brief Stop capturing this thread's test output
+ *
+ * @return None
+ */
+void log_capture_end(void)
+{
+    if (capture_used) {
+        pthread_setspecific(capture_key, NULL);
+    }
+}
+
+/**
+ * @brief Print captured output to stdout and release the buffer
+ *
+ * @param buf The buffer
+ * @return None
+ */
+void log_buffer_flush(struct log_buffer *buf)
+{
+    if (buf->len) {
+        fwrite(buf->data, 1, buf->len, stdout);
+    }
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
 /**
  * @brief print test case result.
  *
@@ -46,7 +181,7 @@ void print_test_case_result(char *TAG, int case_id, int result, char *data)
         return print_test_case_result_only(case_id, result);
     else
     {
-        printf("\n[I][%s-%d][fail][%s]\n", TAG, case_id, data);
+        log_printf("\n[I][%s-%d][fail][%s]\n", TAG, case_id, data);
         print_test_case_result_only(case_id, result);
      }
 }
@@ -59,7 +194,7 @@ void print_test_case_result(char *TAG, int case_id, int result, char *data)
  */
 void print_test_case_result_only(int case_id, int result)
 {
-    printf("\n[A][ARA-%d][%s]\n", case_id, result? "fail": "pass");
+    log_printf("\n[A][ARA-%d][%s]\n", case_id, result? "fail": "pass");
 }
 
 /**
@@ -77,5 +212,130 @@ void print_test_case_log(char *TAG, int case_id, char *data)
     if (!data)
         data = "NONE";
 
-    printf("\n[D][%s-%d][%s]\n", TAG, case_id, data);
+    log_printf("\n[D][%s-%d][%s]\n", TAG, case_id, data);
+}
+
+/**
+ * @brief print performance measurement.
+ *
+ * @param TAG The test module name.
+ * @param case_id The testlink id for test case.
+ * @param data The measured values.
+ */
+void print_test_case_perf(char *TAG, int case_id, char *data)
+{
+    if (!TAG)
+        TAG = "NONE";
+
+    if (!data)
+        data = "NONE";
+
+    log_printf("\n[P][%s-%d][%s]\n", TAG, case_id, data);
+}
+
+static void trace_marker_init(void)
+{
+    const char *env;
+
+    if (marker_fd == -2) {
+        env = getenv(TRACE_MARKER_ENV);
+        marker_fd = -1;
+        if (env && atoi(env) > 0) {
+            trace_marker_enable(1);
+        }
+    }
+}
+
+static int trace_marker_fd(void)
+{
+    /* steps may start on several threads at once */
+    pthread_once(&marker_once, trace_marker_init);
+
+    return marker_fd;
+}
+
+/**
+ * @brief Turn step markers on or off
+ *
+ * @param enable Non-zero to open trace_marker, 0 to close it
+ * @return 0 on success, negative errno if trace_marker cannot be opened
+ */
+int trace_marker_enable(int enable)
+{
+    char path[PATH_MAX];
+
+    if (marker_fd >= 0) {
+        close(marker_fd);
+    }
+    marker_fd = -1;
+
+    if (!enable) {
+        return 0;
+    }
+
+    sysfs_path(path, sizeof(path), TRACE_MARKER_PATH);
+    marker_fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (marker_fd < 0) {
+        sysfs_path(path, sizeof(path), TRACE_MARKER_DEBUG);
+        marker_fd = open(path, O_WRONLY | O_CLOEXEC);
+    }
+
+    return marker_fd < 0 ? -errno : 0;
+}
+
+/**
+ * @brief Mark the beginning of a test step in the kernel trace
+ *
+ * @param case_id The testlink id for test case.
+ * @param name Step name, e.g. the commsteps function.
+ * @return Step id to pass to trace_step_end(), 0 when markers are off.
+ */
+int trace_step_begin(int case_id, const char *name)
+{
+    char buf[TRACE_MARKER_LEN];
+    unsigned int step;
+    int fd = trace_marker_fd(), len;
+
+    if (fd < 0) {
+        return 0;
+    }
+
+    step = __sync_add_and_fetch(&marker_step, 1);
+    len = snprintf(buf, sizeof(buf), "fwtest B case=%d step=%u name=%s "
+                   "t=%llu\n", case_id, step, name,
+                   (unsigned long long)get_time_ns());
+    if (write(fd, buf, len > (int)sizeof(buf) - 1 ?
+              (int)sizeof(buf) - 1 : len) < 0) {
+        return 0;
+    }
+
+    return (int)step;
+}
+
+/**
+ * @brief Mark the end of a test step in the kernel trace
+ *
+ * @param case_id The testlink id for test case.
+ * @param step Step id returned by trace_step_begin(), nothing is written
+ *             for 0.
+ * @param name Step name, as given to trace_step_begin().
+ * @param ret Step result.
+ */
+void trace_step_end(int case_id, int step, const char *name, int ret)
+{
+    char buf[TRACE_MARKER_LEN];
+    int len;
+
+    if (!step || marker_fd < 0) {
+        return;
+    }
+
+    len = snprintf(buf, sizeof(buf), "fwtest E case=%d step=%d name=%s "
+                   "ret=%d t=%llu\n", case_id, step, name, ret,
+                   (unsigned long long)get_time_ns());
+    if (write(marker_fd, buf, len > (int)sizeof(buf) - 1 ?
+              (int)sizeof(buf) - 1 : len) < 0) {
+        /* A marker lost is not worth failing the test for */
+        return;
+    }
 }
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * CPU cost of a test case, counted with perf events on the calling
+ * process and the threads it creates afterwards. The software counters
+ * form one group and work on any kernel with perf events; cycles and
+ * instructions form a second group so that a CPU without a usable PMU
+ * only loses those two.
+ *
+ * Counting is user and kernel when perf_event_paranoid allows it, user
+ * only otherwise. Multiplexed hardware counts are scaled by
+ * enabled/running time.
+ */
+struct perf_counter_desc {
+    const char  *name;
+    uint32_t    type;
+    uint64_t    config;
+    /** index of the group leader, own index for a leader */
+    int         leader;
+};
+
+static const struct perf_counter_desc perf_counter_descs[PERF_MAX_COUNTERS] = {
+    { "task_clock_us",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,    0 },
+    { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,
+      0 },
+    { "page_faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,   0 },
+    { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,    3 },
+    { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,  3 },
+};
+
+static int perf_event_open(struct perf_event_attr *attr, int group_fd)
+{
+    return (int)syscall(__NR_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+static int open_counter(const struct perf_counter_desc *desc, int group_fd)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = desc->type;
+    attr.config = desc->config;
+    attr.disabled = group_fd < 0;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    fd = perf_event_open(&attr, group_fd);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        fd = perf_event_open(&attr, group_fd);
+    }
+
+    return fd < 0 ? -errno : fd;
+}
+
+/**
+ * @brief Open and start the counters
+ *
+ * Counters that cannot be opened are left out, so this only fails when
+ * perf events are not usable at all.
+ *
+ * @param pc The counters
+ * @return 0 on success, negative errno if no counter could be opened
+ */
+int perf_counters_start(struct perf_counters *pc)
+{
+    const struct perf_counter_desc *desc;
+    int i, fd, leader, ret = -ENOENT;
+
+    memset(pc, 0, sizeof(*pc));
+    for (i = 0; i < PERF_MAX_COUNTERS; i++) {
+        pc->fd[i] = -1;
+    }
+
+    for (i = 0; i < PERF_MAX_COUNTERS; i++) {
+        desc = &perf_counter_descs[i];
+        leader = desc->leader == i ? -1 : pc->fd[desc->leader];
+        if (desc->leader != i && leader < 0) {
+            continue;
+        }
+        fd = open_counter(desc, leader);
+        if (fd < 0) {
+            ret = fd;
+            continue;
+        }
+        pc->fd[i] = fd;
+        pc->count++;
+    }
+
+    if (!pc->count) {
+        return ret;
+    }
+
+    for (i = 0; i < PERF_MAX_COUNTERS; i++) {
+        if (perf_counter_descs[i].leader == i && pc->fd[i] >= 0) {
+            ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stop the counters, read them and close them
+ *
+ * @param pc The counters
+ * @return None
+ */
+void perf_counters_stop(struct perf_counters *pc)
+{
+    uint64_t data[3];
+    int i;
+
+    for (i = 0; i < PERF_MAX_COUNTERS; i++) {
+        if (perf_counter_descs[i].leader == i && pc->fd[i] >= 0) {
+            ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    for (i = 0; i < PERF_MAX_COUNTERS; i++) {
+        if (pc->fd[i] < 0) {
+            continue;
+        }
+        /* value, time enabled, time running */
+        if (read(pc->fd[i], data, sizeof(data)) == sizeof(data) && data[2]) {
+            pc->valid[i] = 1;
+            pc->value[i] = data[2] < data[1] ?
+                (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+        }
+    }
+
+    /* task-clock counts ns */
+    if (pc->valid[0]) {
+        pc->value[0] /= 1000;
+    }
+
+    for (i = PERF_MAX_COUNTERS - 1; i >= 0; i--) {
+        if (pc->fd[i] >= 0) {
+            close(pc->fd[i]);
+            pc->fd[i] = -1;
+        }
+    }
+}
+
+/**
+ * @brief Print the counts on a perf line
+ *
+ * Nothing is printed if no counter was available.
+ *
+ * @param pc The counters
+ * @param tag Log tag
+ * @param case_id Test case ID
+ * @return None
+ */
+void perf_counters_report(struct perf_counters *pc, char *tag, int case_id)
+{
+    char buf[256];
+    int i, n = 0;
+
+    if (!pc->count) {
+        return;
+    }
+
+    for (i = 0; i < PERF_MAX_COUNTERS; i++) {
+        if (pc->valid[i]) {
+            n += snprintf(buf + n, sizeof(buf) - n, "%s%s=%llu",
+                          n ? " " : "", perf_counter_descs[i].name,
+                          (unsigned long long)pc->value[i]);
+        } else {
+            n += snprintf(buf + n, sizeof(buf) - n, "%s%s=-",
+                          n ? " " : "", perf_counter_descs[i].name);
+        }
+    }
+
+    /* instructions per cycle, x100 */
+    if (pc->valid[3] && pc->valid[4] && pc->value[3]) {
+        snprintf(buf + n, sizeof(buf) - n, " ipc=%llu.%02llu",
+                 (unsigned long long)(pc->value[4] / pc->value[3]),
+                 (unsigned long long)(pc->value[4] * 100 / pc->value[3] %
+                                      100));
+    }
+
+    print_test_case_perf(tag, case_id, buf);
+}
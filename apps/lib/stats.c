@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Samples are kept in a fixed log-linear histogram: values below
+ * STATS_SUB_BUCKETS are exact, above that every power of two is split into
+ * STATS_SUB_BUCKETS linear buckets. That bounds percentile error to 12.5%
+ * while keeping the memory use constant no matter how long a test runs.
+ */
+#define STATS_SUB_SHIFT 3
+
+static int stats_bucket(uint64_t value)
+{
+    int msb;
+
+    if (value < STATS_SUB_BUCKETS) {
+        return (int)value;
+    }
+
+    msb = 63 - __builtin_clzll(value);
+    return (msb - STATS_SUB_SHIFT + 1) * STATS_SUB_BUCKETS +
+           (int)((value >> (msb - STATS_SUB_SHIFT)) & (STATS_SUB_BUCKETS - 1));
+}
+
+static uint64_t stats_bucket_mid(int bucket)
+{
+    int shift;
+    uint64_t low;
+
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    shift = bucket / STATS_SUB_BUCKETS - 1;
+    low = (uint64_t)(STATS_SUB_BUCKETS + bucket % STATS_SUB_BUCKETS) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+static uint64_t isqrt(uint64_t value)
+{
+    uint64_t root = 0, bit = 1ULL << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+/**
+ * @brief Clear all samples
+ *
+ * @param stats The statistics to reset
+ * @return None
+ */
+void stats_reset(struct test_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min = UINT64_MAX;
+}
+
+/**
+ * @brief Add one sample
+ *
+ * @param stats The statistics to update
+ * @param value The sample value, in whatever unit the caller reports
+ * @return None
+ */
+void stats_add(struct test_stats *stats, uint64_t value)
+{
+    double delta;
+
+    stats->count++;
+    stats->sum += value;
+    if (value < stats->min) {
+        stats->min = value;
+    }
+    if (value > stats->max) {
+        stats->max = value;
+    }
+
+    /* Welford's running variance, stable over very long runs */
+    delta = (double)value - stats->mean;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * ((double)value - stats->mean);
+
+    stats->hist[stats_bucket(value)]++;
+}
+
+/**
+ * @brief Get the mean of all samples
+ *
+ * @param stats The statistics
+ * @return Mean value, 0 if there are no samples
+ */
+uint64_t stats_mean(const struct test_stats *stats)
+{
+    return stats->count ? (uint64_t)(stats->mean + 0.5) : 0;
+}
+
+/**
+ * @brief Get the sample standard deviation
+ *
+ * @param stats The statistics
+ * @return Standard deviation, 0 if there are less than two samples
+ */
+uint64_t stats_stddev(const struct test_stats *stats)
+{
+    if (stats->count < 2) {
+        return 0;
+    }
+
+    return isqrt((uint64_t)(stats->m2 / (stats->count - 1) + 0.5));
+}
+
+/**
+ * @brief Get an approximate percentile
+ *
+ * @param stats The statistics
+ * @param percent Percentile to look up (0 - 100)
+ * @return Percentile value, 0 if there are no samples
+ */
+uint64_t stats_percentile(const struct test_stats *stats, int percent)
+{
+    uint64_t rank, seen = 0, value;
+    int i;
+
+    if (!stats->count) {
+        return 0;
+    }
+
+    rank = (stats->count * percent + 99) / 100;
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+        seen += stats->hist[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    value = stats_bucket_mid(i);
+    if (value < stats->min) {
+        value = stats->min;
+    }
+    if (value > stats->max) {
+        value = stats->max;
+    }
+
+    return value;
+}
+
+/**
+ * @brief Format a one-line summary of the samples
+ *
+ * @param stats The statistics
+ * @param buf The output buffer
+ * @param len The output buffer size
+ * @return Number of characters written, as snprintf
+ */
+int stats_format(const struct test_stats *stats, char *buf, int len)
+{
+    return snprintf(buf, len,
+                    "n=%llu min=%llu avg=%llu p50=%llu p99=%llu max=%llu "
+                    "sd=%llu",
+                    (unsigned long long)stats->count,
+                    (unsigned long long)(stats->count ? stats->min : 0),
+                    (unsigned long long)stats_mean(stats),
+                    (unsigned long long)stats_percentile(stats, 50),
+                    (unsigned long long)stats_percentile(stats, 99),
+                    (unsigned long long)stats->max,
+                    (unsigned long long)stats_stddev(stats));
+}
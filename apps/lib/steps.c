@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Step engine. A test case adds its steps with the step each one has to
+ * wait for, then steps_run() runs them on a few threads, so that the
+ * sysfs round trips of independent steps, e.g. the same operation on
+ * three pins, are in flight together. Steps that block in the kernel
+ * are what we overlap, hence threads rather than coroutines.
+ *
+ * Steps are started lowest index first. Each step's output is captured
+ * and printed in index order after the run, so the output is the same
+ * as running the steps one after the other.
+ *
+ * FWTEST_STEP_WORKERS=1 runs the steps in order on the calling thread.
+ */
+#define STEPS_WORKERS_ENV   "FWTEST_STEP_WORKERS"
+
+enum {
+    STEP_PENDING,
+    STEP_RUNNING,
+    STEP_DONE,
+};
+
+struct steps_run {
+    struct steps    *steps;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    /** lowest index not yet started, and not yet done */
+    int             next;
+    int             done;
+};
+
+/**
+ * @brief Prepare an empty set of steps
+ *
+ * @param steps The steps
+ * @param workers Threads to run them on, 0 for STEPS_WORKERS or the
+ *                FWTEST_STEP_WORKERS environment variable
+ * @return None
+ */
+void steps_init(struct steps *steps, int workers)
+{
+    const char *env = getenv(STEPS_WORKERS_ENV);
+
+    steps->count = 0;
+    if (!workers) {
+        workers = env && atoi(env) > 0 ? atoi(env) : STEPS_WORKERS;
+    }
+    steps->workers = workers;
+}
+
+/**
+ * @brief Add a step
+ *
+ * @param steps The steps
+ * @param fn Step function, its return value is the step result
+ * @param arg Argument of fn
+ * @param after Index of the step to wait for, STEP_NONE, or STEP_ALL
+ *              to wait for all steps added before
+ * @return Index of the step, negative errno on failure
+ */
+int steps_add(struct steps *steps, step_fn fn, void *arg, int after)
+{
+    struct step *step;
+
+    if (steps->count == STEPS_MAX) {
+        return -ENOSPC;
+    }
+    if (after >= steps->count || after < STEP_ALL) {
+        return -EINVAL;
+    }
+
+    step = &steps->step[steps->count];
+    memset(step, 0, sizeof(*step));
+    step->fn = fn;
+    step->arg = arg;
+    step->after = after;
+
+    return steps->count++;
+}
+
+static int step_ready(struct steps_run *run, int i)
+{
+    int after = run->steps->step[i].after;
+
+    if (after == STEP_ALL) {
+        return run->done >= i;
+    }
+
+    return after == STEP_NONE ||
+           run->steps->step[after].state == STEP_DONE;
+}
+
+static void *steps_worker(void *arg)
+{
+    struct steps_run *run = arg;
+    struct steps *steps = run->steps;
+    struct step *step;
+    int i, ret;
+
+    pthread_mutex_lock(&run->lock);
+    while (run->next < steps->count) {
+        for (i = run->next; i < steps->count; i++) {
+            if (steps->step[i].state == STEP_PENDING && step_ready(run, i)) {
+                break;
+            }
+        }
+        if (i == steps->count) {
+            pthread_cond_wait(&run->cond, &run->lock);
+            continue;
+        }
+
+        step = &steps->step[i];
+        step->state = STEP_RUNNING;
+        while (run->next < steps->count &&
+               steps->step[run->next].state != STEP_PENDING) {
+            run->next++;
+        }
+        pthread_mutex_unlock(&run->lock);
+
+        log_capture_begin(&step->log);
+        ret = step->fn(step->arg);
+        log_capture_end();
+
+        pthread_mutex_lock(&run->lock);
+        step->ret = ret;
+        step->state = STEP_DONE;
+        while (run->done < steps->count &&
+               steps->step[run->done].state == STEP_DONE) {
+            run->done++;
+        }
+        pthread_cond_broadcast(&run->cond);
+    }
+    pthread_mutex_unlock(&run->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Run the steps and print their output in order
+ *
+ * All steps run whatever the result of the step they wait for; a step
+ * that depends on it checks it with steps_result().
+ *
+ * @param steps The steps
+ * @return 0 if all steps returned 0, else the first failed step's result
+ */
+int steps_run(struct steps *steps)
+{
+    struct steps_run run;
+    pthread_t thread[STEPS_MAX_WORKERS];
+    int i, nthreads = 0;
+
+    memset(&run, 0, sizeof(run));
+    run.steps = steps;
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.cond, NULL);
+
+    /* the calling thread is one of the workers */
+    for (i = 1; i < steps->workers && i < steps->count &&
+         nthreads < STEPS_MAX_WORKERS; i++) {
+        if (pthread_create(&thread[nthreads], NULL, steps_worker, &run)) {
+            break;
+        }
+        nthreads++;
+    }
+    steps_worker(&run);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(thread[i], NULL);
+    }
+
+    pthread_cond_destroy(&run.cond);
+    pthread_mutex_destroy(&run.lock);
+
+    for (i = 0; i < steps->count; i++) {
+        log_buffer_flush(&steps->step[i].log);
+    }
+    fflush(stdout);
+
+    return steps_result(steps, 0, steps->count);
+}
+
+/**
+ * @brief Result of a range of steps
+ *
+ * Only meaningful for steps that are done, e.g. from a step waiting for
+ * them.
+ *
+ * @param steps The steps
+ * @param first Index of the first step
+ * @param count Number of steps
+ * @return 0 if all of them returned 0, else the first failed one's result
+ */
+int steps_result(struct steps *steps, int first, int count)
+{
+    int i;
+
+    for (i = first; i < first + count && i < steps->count; i++) {
+        if (steps->step[i].ret) {
+            return steps->step[i].ret;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,551 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Batched sysfs reads. With io_uring (Linux 5.6 and later) the opens of
+ * a batch go in one submission, then the reads, each hard-linked to its
+ * close, in a second one; sysfs files can't be read without blocking,
+ * so the kernel runs them on its io-wq workers in parallel. Where
+ * io_uring is missing, too old, or blocked by seccomp, the reads are
+ * spread over a few threads instead. The ring is set up on first use
+ * and kept for the life of the process; a batch started while another
+ * thread holds it takes the thread path too.
+ *
+ * FWTEST_SYSFS_BATCH=threads forces the fallback, and so does FWIO=1:
+ * fwio only sees the syscalls the reads make themselves.
+ *
+ * The bionic headers predate io_uring, so the ABI bits used here are
+ * declared below.
+ */
+#define SYSFS_BATCH_ENV         "FWTEST_SYSFS_BATCH"
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup     425
+#define __NR_io_uring_enter     426
+#define __NR_io_uring_register  427
+#endif
+
+#define IORING_OFF_SQ_RING      0ULL
+#define IORING_OFF_CQ_RING      0x8000000ULL
+#define IORING_OFF_SQES         0x10000000ULL
+#define IORING_ENTER_GETEVENTS  (1U << 0)
+#define IORING_REGISTER_PROBE   8
+#define IO_URING_OP_SUPPORTED   (1U << 0)
+#define IOSQE_IO_HARDLINK       (1U << 3)
+#define IORING_OP_OPENAT        18
+#define IORING_OP_CLOSE         19
+#define IORING_OP_READ          22
+
+/* ring size, a batch is done in chunks of half of it */
+#define URING_ENTRIES           64
+#define URING_CHUNK             (URING_ENTRIES / 2)
+
+/* user_data is the entry index and the operation */
+#define URING_DATA(i, op)       (((uint64_t)(i) << 8) | (op))
+
+struct uring_sqring_offsets {
+    uint32_t    head;
+    uint32_t    tail;
+    uint32_t    ring_mask;
+    uint32_t    ring_entries;
+    uint32_t    flags;
+    uint32_t    dropped;
+    uint32_t    array;
+    uint32_t    resv1;
+    uint64_t    resv2;
+};
+
+struct uring_cqring_offsets {
+    uint32_t    head;
+    uint32_t    tail;
+    uint32_t    ring_mask;
+    uint32_t    ring_entries;
+    uint32_t    overflow;
+    uint32_t    cqes;
+    uint32_t    flags;
+    uint32_t    resv1;
+    uint64_t    resv2;
+};
+
+struct uring_params {
+    uint32_t                    sq_entries;
+    uint32_t                    cq_entries;
+    uint32_t                    flags;
+    uint32_t                    sq_thread_cpu;
+    uint32_t                    sq_thread_idle;
+    uint32_t                    features;
+    uint32_t                    wq_fd;
+    uint32_t                    resv[3];
+    struct uring_sqring_offsets sq_off;
+    struct uring_cqring_offsets cq_off;
+};
+
+struct uring_sqe {
+    uint8_t     opcode;
+    uint8_t     flags;
+    uint16_t    ioprio;
+    int32_t     fd;
+    uint64_t    off;
+    uint64_t    addr;
+    uint32_t    len;
+    uint32_t    op_flags;
+    uint64_t    user_data;
+    uint64_t    pad[3];
+};
+
+struct uring_cqe {
+    uint64_t    user_data;
+    int32_t     res;
+    uint32_t    flags;
+};
+
+struct uring_probe {
+    uint8_t     last_op;
+    uint8_t     ops_len;
+    uint16_t    resv;
+    uint32_t    resv2[3];
+    struct {
+        uint8_t     op;
+        uint8_t     resv;
+        uint16_t    flags;
+        uint32_t    resv2;
+    } ops[IORING_OP_READ + 1];
+};
+
+struct uring {
+    int                 fd;
+    void                *sq_ring;
+    size_t              sq_size;
+    void                *cq_ring;
+    size_t              cq_size;
+    struct uring_sqe    *sqes;
+    size_t              sqes_size;
+    uint32_t            *sq_tail;
+    uint32_t            sq_mask;
+    uint32_t            *sq_array;
+    uint32_t            *cq_head;
+    uint32_t            *cq_tail;
+    uint32_t            cq_mask;
+    struct uring_cqe    *cqes;
+    /** sqes filled but not submitted yet */
+    uint32_t            pending;
+    /** open paths of the chunk in flight */
+    char                (*paths)[PATH_MAX];
+};
+
+static struct uring sysfs_ring;
+static int sysfs_ring_ret;
+static pthread_once_t sysfs_ring_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sysfs_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void sysfs_batch_strip(struct sysfs_read *entry, int nread)
+{
+    entry->buf[nread] = '\0';
+    nread = strlen(entry->buf);
+    while (nread > 0 && (entry->buf[nread - 1] == '\n' ||
+           entry->buf[nread - 1] == '\r')) {
+        entry->buf[--nread] = '\0';
+    }
+}
+
+static void uring_exit(struct uring *ring)
+{
+    free(ring->paths);
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring) {
+        munmap(ring->cq_ring, ring->cq_size);
+    }
+    if (ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+static int uring_supported(int fd)
+{
+    struct uring_probe probe;
+    static const uint8_t ops[] = {
+        IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ,
+    };
+    unsigned int i;
+
+    memset(&probe, 0, sizeof(probe));
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, &probe,
+                IORING_OP_READ + 1) < 0) {
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(ops); i++) {
+        if (ops[i] > probe.last_op ||
+            !(probe.ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int uring_init(struct uring *ring)
+{
+    struct uring_params p;
+    void *ptr;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (ring->fd < 0) {
+        return -errno;
+    }
+    if (!uring_supported(ring->fd)) {
+        goto nosys;
+    }
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct uring_cqe);
+    ring->sqes_size = p.sq_entries * sizeof(struct uring_sqe);
+
+    ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        goto nosys;
+    }
+    ring->sq_ring = ptr;
+
+    ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ptr == MAP_FAILED) {
+        goto nosys;
+    }
+    ring->cq_ring = ptr;
+
+    ptr = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        goto nosys;
+    }
+    ring->sqes = ptr;
+
+    ring->sq_tail = (uint32_t *)((char *)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = *(uint32_t *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_array = (uint32_t *)((char *)ring->sq_ring + p.sq_off.array);
+    ring->cq_head = (uint32_t *)((char *)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (uint32_t *)((char *)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = *(uint32_t *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+
+    ring->paths = malloc(URING_CHUNK * sizeof(*ring->paths));
+    if (!ring->paths) {
+        uring_exit(ring);
+        return -ENOMEM;
+    }
+
+    return 0;
+
+nosys:
+    uring_exit(ring);
+    return -ENOSYS;
+}
+
+static struct uring_sqe *uring_sqe(struct uring *ring, uint8_t opcode,
+                                   int fd, uint64_t user_data)
+{
+    uint32_t tail = *ring->sq_tail + ring->pending;
+    uint32_t index = tail & ring->sq_mask;
+    struct uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    ring->pending++;
+
+    return sqe;
+}
+
+/* submit the pending sqes and wait for as many completions */
+static int uring_run(struct uring *ring, struct sysfs_read *reads,
+                     int *fds)
+{
+    uint32_t head, wanted = ring->pending, got = 0;
+    struct uring_cqe *cqe;
+    int i, ret, submit = wanted;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->pending,
+                     __ATOMIC_RELEASE);
+    ring->pending = 0;
+
+    while (got < wanted) {
+        ret = syscall(__NR_io_uring_enter, ring->fd, submit, 1,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            return -errno;
+        }
+        if (ret > 0) {
+            submit -= ret;
+        }
+
+        head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &ring->cqes[head & ring->cq_mask];
+            i = cqe->user_data >> 8;
+            switch (cqe->user_data & 0xff) {
+            case IORING_OP_OPENAT:
+                fds[i] = cqe->res;
+                if (cqe->res < 0) {
+                    reads[i].ret = cqe->res;
+                }
+                break;
+            case IORING_OP_READ:
+                if (cqe->res < 0) {
+                    reads[i].ret = cqe->res;
+                } else {
+                    sysfs_batch_strip(&reads[i], cqe->res);
+                }
+                break;
+            }
+            head++;
+            got++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+static void sysfs_ring_init(void)
+{
+    sysfs_ring_ret = uring_init(&sysfs_ring);
+}
+
+static int sysfs_batch_uring(struct sysfs_read *reads, int count)
+{
+    struct uring *ring = &sysfs_ring;
+    char (*paths)[PATH_MAX];
+    int fds[URING_CHUNK];
+    struct uring_sqe *sqe;
+    int first, n, i, ret;
+
+    pthread_once(&sysfs_ring_once, sysfs_ring_init);
+    if (pthread_mutex_trylock(&sysfs_ring_lock)) {
+        return -EBUSY;
+    }
+    ret = sysfs_ring_ret;
+    paths = ring->paths;
+
+    for (first = 0; !ret && first < count; first += URING_CHUNK) {
+        n = count - first < URING_CHUNK ? count - first : URING_CHUNK;
+
+        for (i = 0; i < n; i++) {
+            snprintf(paths[i], PATH_MAX, "%s/%s", reads[first + i].dir,
+                     reads[first + i].attr);
+            sqe = uring_sqe(ring, IORING_OP_OPENAT, AT_FDCWD,
+                            URING_DATA(i, IORING_OP_OPENAT));
+            sqe->addr = (uintptr_t)paths[i];
+            sqe->op_flags = O_RDONLY | O_CLOEXEC;
+        }
+        ret = uring_run(ring, reads + first, fds);
+
+        for (i = 0; !ret && i < n; i++) {
+            if (fds[i] < 0) {
+                continue;
+            }
+            sqe = uring_sqe(ring, IORING_OP_READ, fds[i],
+                            URING_DATA(i, IORING_OP_READ));
+            sqe->addr = (uintptr_t)reads[first + i].buf;
+            sqe->len = reads[first + i].len - 1;
+            /* the close runs even if the read fails */
+            sqe->flags = IOSQE_IO_HARDLINK;
+            uring_sqe(ring, IORING_OP_CLOSE, fds[i],
+                      URING_DATA(i, IORING_OP_CLOSE));
+        }
+        if (!ret) {
+            ret = uring_run(ring, reads + first, fds);
+        }
+    }
+
+    /* completions may still be queued, don't use the ring again */
+    if (ret) {
+        sysfs_ring_ret = ret;
+    }
+    pthread_mutex_unlock(&sysfs_ring_lock);
+
+    return ret;
+}
+
+static void sysfs_batch_read_one(struct sysfs_read *entry)
+{
+    char path[PATH_MAX];
+    int fd, nread;
+
+    snprintf(path, sizeof(path), "%s/%s", entry->dir, entry->attr);
+    fd = fwio_open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        entry->ret = -errno;
+        return;
+    }
+
+    nread = fwio_read(fd, entry->buf, entry->len - 1);
+    if (nread < 0) {
+        entry->ret = -errno;
+    } else {
+        sysfs_batch_strip(entry, nread);
+    }
+    fwio_close(fd);
+}
+
+struct sysfs_batch_pool {
+    struct sysfs_read   *reads;
+    int                 count;
+    /** next entry to read */
+    int                 next;
+};
+
+static void *sysfs_batch_worker(void *arg)
+{
+    struct sysfs_batch_pool *pool = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) <
+           pool->count) {
+        sysfs_batch_read_one(&pool->reads[i]);
+    }
+
+    return NULL;
+}
+
+/*
+ * Plain threads rather than the step engine: the batch is usually read
+ * from a step, and steps don't nest.
+ */
+static void sysfs_batch_threads(struct sysfs_read *reads, int count)
+{
+    pthread_t thread[STEPS_MAX_WORKERS];
+    struct sysfs_batch_pool pool;
+    struct steps steps;
+    int i, n, nthreads = 0;
+
+    pool.reads = reads;
+    pool.count = count;
+    pool.next = 0;
+
+    /* same number of threads as the step engine, the caller included */
+    steps_init(&steps, 0);
+    n = steps.workers < STEPS_MAX_WORKERS ? steps.workers :
+        STEPS_MAX_WORKERS;
+    if (n > count) {
+        n = count;
+    }
+    for (i = 1; i < n; i++) {
+        if (pthread_create(&thread[nthreads], NULL, sysfs_batch_worker,
+                           &pool)) {
+            break;
+        }
+        nthreads++;
+    }
+
+    sysfs_batch_worker(&pool);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(thread[i], NULL);
+    }
+}
+
+static int sysfs_batch_use_uring(void)
+{
+#ifdef CONFIG_FWIO
+    return 0;
+#else
+    const char *env = getenv(SYSFS_BATCH_ENV);
+
+    return !env || strcmp(env, "threads");
+#endif
+}
+
+/**
+ * @brief Read many sysfs attributes at once
+ *
+ * Each attribute is read like debugfs_get_attr() does, into the entry's
+ * buffer with trailing newlines stripped. The reads are done through
+ * io_uring where available, on a few threads otherwise, in any order.
+ *
+ * @param reads The attributes, dir, attr, buf and len set by the caller
+ * @param count Number of attributes
+ * @return 0 if all were read, else the first failed entry's error, which
+ *         is also in its ret
+ */
+int sysfs_batch_read(struct sysfs_read *reads, int count)
+{
+    int i, ret = -ENOSYS;
+
+    for (i = 0; i < count; i++) {
+        if (!reads[i].dir || !reads[i].attr || !reads[i].buf ||
+            reads[i].len < 2) {
+            return -EINVAL;
+        }
+        reads[i].ret = 0;
+        reads[i].buf[0] = '\0';
+    }
+
+    if (sysfs_batch_use_uring()) {
+        ret = sysfs_batch_uring(reads, count);
+    }
+    if (ret) {
+        for (i = 0; i < count; i++) {
+            reads[i].ret = 0;
+            reads[i].buf[0] = '\0';
+        }
+        sysfs_batch_threads(reads, count);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (reads[i].ret) {
+            return reads[i].ret;
+        }
+    }
+
+    return 0;
+}
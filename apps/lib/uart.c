@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "./include/libfwtest.h"
+
+struct uart_baud {
+    int     baud;
+    speed_t speed;
+};
+
+static const struct uart_baud uart_bauds[] = {
+    { 1200, B1200 },        { 2400, B2400 },        { 4800, B4800 },
+    { 9600, B9600 },        { 19200, B19200 },      { 38400, B38400 },
+    { 57600, B57600 },      { 115200, B115200 },    { 230400, B230400 },
+#ifdef B460800
+    { 460800, B460800 },
+#endif
+#ifdef B500000
+    { 500000, B500000 },
+#endif
+#ifdef B576000
+    { 576000, B576000 },
+#endif
+#ifdef B921600
+    { 921600, B921600 },
+#endif
+#ifdef B1000000
+    { 1000000, B1000000 },
+#endif
+#ifdef B1152000
+    { 1152000, B1152000 },
+#endif
+#ifdef B1500000
+    { 1500000, B1500000 },
+#endif
+#ifdef B2000000
+    { 2000000, B2000000 },
+#endif
+#ifdef B2500000
+    { 2500000, B2500000 },
+#endif
+#ifdef B3000000
+    { 3000000, B3000000 },
+#endif
+#ifdef B3500000
+    { 3500000, B3500000 },
+#endif
+#ifdef B4000000
+    { 4000000, B4000000 },
+#endif
+};
+
+#define UART_NBAUDS (sizeof(uart_bauds) / sizeof(uart_bauds[0]))
+
+/**
+ * @brief Get a baud rate known to termios
+ *
+ * @param index Index in the baud table, starting at 0
+ * @return The baud rate, 0 past the end of the table
+ */
+int uart_baud_rate(int index)
+{
+    if (index < 0 || index >= (int)UART_NBAUDS) {
+        return 0;
+    }
+
+    return uart_bauds[index].baud;
+}
+
+static int set_raw(int fd)
+{
+    struct termios tio;
+
+    if (tcgetattr(fd, &tio)) {
+        return -errno;
+    }
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    return tcsetattr(fd, TCSANOW, &tio) ? -errno : 0;
+}
+
+/**
+ * @brief Open a UART in raw, non-blocking mode
+ *
+ * @param devname The tty device node
+ * @return File descriptor on success, negative errno on failure
+ */
+int uart_open(const char *devname)
+{
+    int fd, ret;
+
+    fd = open(devname, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    ret = set_raw(fd);
+    if (ret) {
+        close(fd);
+        return ret;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Open a pseudo terminal pair standing in for a UART loopback
+ *
+ * Data written to the master is received on the slave and the other way
+ * around. Both sides are raw and non-blocking.
+ *
+ * @param master Output master file descriptor
+ * @param slave Output slave file descriptor
+ * @return 0 on success, negative errno on failure
+ */
+int uart_open_pty(int *master, int *slave)
+{
+    char *name;
+    int ret;
+
+    *master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (*master < 0) {
+        return -errno;
+    }
+
+    if (grantpt(*master) || unlockpt(*master) ||
+        (name = ptsname(*master)) == NULL) {
+        ret = -errno;
+        close(*master);
+        return ret;
+    }
+
+    *slave = uart_open(name);
+    if (*slave < 0) {
+        ret = *slave;
+        close(*master);
+        return ret;
+    }
+
+    ret = set_raw(*master);
+    if (ret) {
+        close(*slave);
+        close(*master);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Apply a line configuration and check the driver accepted it
+ *
+ * @param fd The tty file descriptor
+ * @param baud Baud rate, one of the uart_baud_rate() values
+ * @param parity 'N', 'E' or 'O'
+ * @param data_bits 5 to 8
+ * @param stop_bits 1 or 2
+ * @return 0 on success, -EINVAL if the baud rate is not supported,
+ *         -EOPNOTSUPP if the driver kept its own character framing (ptys
+ *         always do), negative errno on other failures
+ */
+int uart_set_line(int fd, int baud, char parity, int data_bits,
+                  int stop_bits)
+{
+    static const tcflag_t csize[] = { CS5, CS6, CS7, CS8 };
+    struct termios tio, check;
+    speed_t speed = B0;
+    unsigned int i;
+
+    for (i = 0; i < UART_NBAUDS; i++) {
+        if (uart_bauds[i].baud == baud) {
+            speed = uart_bauds[i].speed;
+        }
+    }
+
+    if (speed == B0 || data_bits < 5 || data_bits > 8 ||
+        stop_bits < 1 || stop_bits > 2) {
+        return -EINVAL;
+    }
+
+    if (tcgetattr(fd, &tio)) {
+        return -errno;
+    }
+
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+
+    tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+    tio.c_cflag |= csize[data_bits - 5];
+    if (stop_bits == 2) {
+        tio.c_cflag |= CSTOPB;
+    }
+
+    switch (parity) {
+    case 'N':
+        break;
+    case 'O':
+        tio.c_cflag |= PARODD;
+        /* fall through */
+    case 'E':
+        tio.c_cflag |= PARENB;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if (tcsetattr(fd, TCSANOW, &tio) || tcgetattr(fd, &check)) {
+        return -errno;
+    }
+
+    /* tcsetattr succeeds if any change was applied, so verify all of them */
+    if (cfgetospeed(&check) != speed) {
+        return -EINVAL;
+    }
+
+    if ((check.c_cflag & (CSIZE | PARENB | PARODD | CSTOPB)) !=
+        (tio.c_cflag & (CSIZE | PARENB | PARODD | CSTOPB))) {
+        return -EOPNOTSUPP;
+    }
+
+    return 0;
+}
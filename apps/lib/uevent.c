@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+#include <linux/limits.h>
+
+#include "./include/libfwtest.h"
+
+/*
+ * Hotplug waits are event driven. On target the kernel uevent netlink
+ * socket reports every add/remove/bind below /sys. When the sysfs root is
+ * overridden for a host run nothing emits uevents, so the directories of
+ * interest are watched with inotify instead. Directories outside sysfs,
+ * e.g. /dev where ueventd creates the nodes, are watched with inotify in
+ * both modes.
+ *
+ * Events are wake-ups: callers re-check the state they wait for after
+ * each one rather than trusting that a specific event arrives.
+ *
+ * Where the uevent socket can't be opened on target (SELinux), sysfs
+ * changes raise no wake-up at all: sysfs emits no inotify events for
+ * entries the kernel adds or removes. uevent_monitor_sees_sysfs() tells
+ * callers to re-check sysfs state periodically then.
+ */
+#define UEVENT_BUF_LEN      8192
+#define INOTIFY_MASK        (IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                             IN_MOVED_TO | IN_DELETE_SELF | IN_ATTRIB)
+
+/**
+ * @brief Open an event monitor
+ *
+ * @param mon The monitor
+ * @return 0 on success, negative errno on failure
+ */
+int uevent_monitor_open(struct uevent_monitor *mon)
+{
+    struct sockaddr_nl addr;
+    int size = 1024 * 1024;
+
+    memset(mon, 0, sizeof(*mon));
+    mon->netlink = -1;
+
+    mon->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (mon->inotify < 0) {
+        return -errno;
+    }
+
+    if (strcmp(sysfs_root(), "/sys")) {
+        return 0;
+    }
+
+    mon->netlink = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK |
+                          SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (mon->netlink < 0) {
+        /* Not allowed to listen, callers have to poll sysfs */
+        return 0;
+    }
+
+    /* Hotplug storms easily overflow the default socket buffer */
+    if (setsockopt(mon->netlink, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+                   sizeof(size)) < 0) {
+        setsockopt(mon->netlink, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    if (bind(mon->netlink, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(mon->netlink);
+        mon->netlink = -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Close an event monitor
+ *
+ * @param mon The monitor
+ * @return None
+ */
+void uevent_monitor_close(struct uevent_monitor *mon)
+{
+    if (mon->netlink >= 0) {
+        close(mon->netlink);
+    }
+    if (mon->inotify >= 0) {
+        close(mon->inotify);
+    }
+    mon->netlink = -1;
+    mon->inotify = -1;
+}
+
+/**
+ * @brief Watch a directory for entries coming and going
+ *
+ * Directories below the sysfs root are only watched when no uevent socket
+ * is available, other directories are always watched. A watched directory
+ * that is deleted is dropped, call again to watch it once re-created.
+ *
+ * @param mon The monitor
+ * @param path Absolute directory path
+ * @return 0 on success, negative errno on failure
+ */
+int uevent_monitor_watch(struct uevent_monitor *mon, const char *path)
+{
+    const char *root = sysfs_root();
+    size_t len = strlen(root);
+    int i, wd;
+
+    if (mon->netlink >= 0 && !strncmp(path, root, len) &&
+        (path[len] == '/' || !path[len])) {
+        return 0;
+    }
+
+    for (i = 0; i < mon->nwatch; i++) {
+        if (!strcmp(mon->watch[i], path)) {
+            return 0;
+        }
+    }
+    if (mon->nwatch >= UEVENT_MAX_WATCH) {
+        return -ENOSPC;
+    }
+
+    wd = inotify_add_watch(mon->inotify, path, INOTIFY_MASK);
+    if (wd < 0) {
+        return -errno;
+    }
+
+    mon->wd[mon->nwatch] = wd;
+    snprintf(mon->watch[mon->nwatch], sizeof(mon->watch[0]), "%s", path);
+    mon->nwatch++;
+
+    return 0;
+}
+
+/**
+ * @brief Tell whether events come from the kernel uevent socket
+ *
+ * @param mon The monitor
+ * @return 1 for netlink uevents, 0 for inotify only
+ */
+int uevent_monitor_is_netlink(const struct uevent_monitor *mon)
+{
+    return mon->netlink >= 0;
+}
+
+/**
+ * @brief Tell whether sysfs changes wake the monitor up
+ *
+ * @param mon The monitor
+ * @return 1 with a uevent socket or a host tree watched with inotify, 0 on
+ *         target without a uevent socket, where sysfs has to be polled
+ */
+int uevent_monitor_sees_sysfs(const struct uevent_monitor *mon)
+{
+    return mon->netlink >= 0 || strcmp(sysfs_root(), "/sys");
+}
+
+/**
+ * @brief Parse one netlink message into an event
+ *
+ * @param buf The message, "action@devpath" followed by KEY=value strings
+ * @param len Message length
+ * @param event Output event
+ * @return 0 on success, -EAGAIN for messages to ignore
+ */
+static int parse_uevent(char *buf, int len, struct uevent *event)
+{
+    char *p = buf, *end = buf + len, *at;
+
+    at = memchr(buf, '@', len);
+    if (!at || !memchr(buf, '\0', len)) {
+        return -EAGAIN;
+    }
+
+    *at = '\0';
+    snprintf(event->action, sizeof(event->action), "%s", buf);
+    snprintf(event->path, sizeof(event->path), "%s%s", sysfs_root(),
+             at + 1);
+
+    for (p += strlen(p) + 1; p < end && *p; p += strlen(p) + 1) {
+        if (!strncmp(p, "SUBSYSTEM=", 10)) {
+            snprintf(event->subsystem, sizeof(event->subsystem), "%s",
+                     p + 10);
+        } else if (!strncmp(p, "DEVNAME=", 8)) {
+            snprintf(event->devname, sizeof(event->devname), "%s", p + 8);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Read the next event from the netlink socket
+ *
+ * @param mon The monitor
+ * @param event Output event
+ * @return 0 on success, -EAGAIN if nothing usable was pending
+ */
+static int read_netlink(struct uevent_monitor *mon, struct uevent *event)
+{
+    char buf[UEVENT_BUF_LEN];
+    ssize_t len;
+
+    len = recv(mon->netlink, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+        return -EAGAIN;
+    }
+    buf[len] = '\0';
+
+    return parse_uevent(buf, len, event);
+}
+
+/**
+ * @brief Drop a watch the kernel removed
+ *
+ * The directory was deleted or unmounted, dropping it lets
+ * uevent_monitor_watch() add it again once it is back.
+ *
+ * @param mon The monitor
+ * @param wd The removed watch descriptor
+ * @return None
+ */
+static void drop_watch(struct uevent_monitor *mon, int wd)
+{
+    int i;
+
+    for (i = 0; i < mon->nwatch; i++) {
+        if (mon->wd[i] == wd) {
+            mon->nwatch--;
+            mon->wd[i] = mon->wd[mon->nwatch];
+            memcpy(mon->watch[i], mon->watch[mon->nwatch],
+                   sizeof(mon->watch[0]));
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Take the next event from the buffered inotify records
+ *
+ * @param mon The monitor
+ * @param event Output event
+ * @return 0 on success, -EAGAIN if nothing usable was pending
+ */
+static int read_inotify(struct uevent_monitor *mon, struct uevent *event)
+{
+    struct inotify_event *ie;
+    const char *dir = "";
+    ssize_t len;
+    int i;
+
+    do {
+        if (mon->pos >= mon->len) {
+            len = read(mon->inotify, mon->buf, sizeof(mon->buf));
+            if (len <= 0) {
+                return -EAGAIN;
+            }
+            mon->len = len;
+            mon->pos = 0;
+        }
+
+        ie = (struct inotify_event *)(mon->buf + mon->pos);
+        mon->pos += sizeof(*ie) + ie->len;
+        if (ie->mask & IN_IGNORED) {
+            drop_watch(mon, ie->wd);
+        }
+    } while (ie->mask & IN_IGNORED);
+
+    for (i = 0; i < mon->nwatch; i++) {
+        if (mon->wd[i] == ie->wd) {
+            dir = mon->watch[i];
+            break;
+        }
+    }
+
+    if (ie->mask & (IN_CREATE | IN_MOVED_TO)) {
+        snprintf(event->action, sizeof(event->action), "add");
+    } else if (ie->mask & (IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF)) {
+        snprintf(event->action, sizeof(event->action), "remove");
+    } else {
+        snprintf(event->action, sizeof(event->action), "change");
+    }
+
+    if (ie->len) {
+        snprintf(event->path, sizeof(event->path), "%s/%s", dir, ie->name);
+    } else {
+        snprintf(event->path, sizeof(event->path), "%s", dir);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Wait for the next event
+ *
+ * @param mon The monitor
+ * @param event Output event, the path is absolute
+ * @param timeout_ms Maximum time to wait, -1 forever
+ * @return 0 on success, -ETIMEDOUT on timeout, negative errno on failure
+ */
+int uevent_monitor_next(struct uevent_monitor *mon, struct uevent *event,
+                        int timeout_ms)
+{
+    struct pollfd fds[2];
+    uint64_t deadline = 0, now;
+    int nfds, ret, wait_ms = timeout_ms;
+
+    if (timeout_ms >= 0) {
+        deadline = get_time_ns() + (uint64_t)timeout_ms * 1000000;
+    }
+
+    for (;;) {
+        memset(event, 0, sizeof(*event));
+
+        /* Drain records already read before polling again */
+        if (mon->pos < mon->len && !read_inotify(mon, event)) {
+            event->timestamp_ns = get_time_ns();
+            return 0;
+        }
+
+        nfds = 0;
+        fds[nfds].fd = mon->inotify;
+        fds[nfds++].events = POLLIN;
+        if (mon->netlink >= 0) {
+            fds[nfds].fd = mon->netlink;
+            fds[nfds++].events = POLLIN;
+        }
+
+        ret = poll(fds, nfds, wait_ms);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+
+        now = get_time_ns();
+        if (nfds > 1 && (fds[1].revents & POLLIN) &&
+            !read_netlink(mon, event)) {
+            event->timestamp_ns = now;
+            return 0;
+        }
+        if ((fds[0].revents & POLLIN) && !read_inotify(mon, event)) {
+            event->timestamp_ns = now;
+            return 0;
+        }
+
+        if (timeout_ms >= 0) {
+            if (now >= deadline) {
+                return -ETIMEDOUT;
+            }
+            wait_ms = (int)((deadline - now + 999999) / 1000000);
+        }
+    }
+}
@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+#include "./include/libfwtest.h"
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : 0;
+}
+
+/**
+ * @brief Open a V4L2 capture device
+ *
+ * @param stream The stream state to initialize
+ * @param devname Video device node, e.g. /dev/video0
+ * @return 0 on success, negative errno on failure
+ */
+int v4l2_open(struct v4l2_stream *stream, const char *devname)
+{
+    struct v4l2_capability cap;
+    int ret;
+
+    memset(stream, 0, sizeof(*stream));
+
+    stream->fd = open(devname, O_RDWR | O_NONBLOCK);
+    if (stream->fd < 0) {
+        return -errno;
+    }
+
+    ret = xioctl(stream->fd, VIDIOC_QUERYCAP, &cap);
+    if (!ret && (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+                 !(cap.capabilities & V4L2_CAP_STREAMING))) {
+        ret = -ENODEV;
+    }
+
+    if (ret) {
+        close(stream->fd);
+        stream->fd = -1;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Close a V4L2 device, stopping the stream if needed
+ *
+ * @param stream The stream state
+ * @return None
+ */
+void v4l2_close(struct v4l2_stream *stream)
+{
+    if (stream->fd < 0) {
+        return;
+    }
+
+    v4l2_stream_stop(stream);
+    close(stream->fd);
+    stream->fd = -1;
+}
+
+/**
+ * @brief Enumerate capture pixel formats
+ *
+ * @param stream The opened stream
+ * @param fourcc Output array of pixel format codes
+ * @param max Size of the fourcc array
+ * @return Number of formats found, negative errno on failure
+ */
+int v4l2_enum_formats(struct v4l2_stream *stream, uint32_t *fourcc, int max)
+{
+    struct v4l2_fmtdesc desc;
+    int n = 0;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    for (desc.index = 0; n < max; desc.index++) {
+        if (xioctl(stream->fd, VIDIOC_ENUM_FMT, &desc)) {
+            break;
+        }
+        fourcc[n++] = desc.pixelformat;
+    }
+
+    return n;
+}
+
+/**
+ * @brief Enumerate frame sizes of a pixel format
+ *
+ * Discrete sizes are returned as-is. For stepwise and continuous ranges only
+ * the minimum and maximum sizes are returned.
+ *
+ * @param stream The opened stream
+ * @param fourcc The pixel format
+ * @param width Output array of frame widths
+ * @param height Output array of frame heights
+ * @param max Size of the width and height arrays
+ * @return Number of sizes found, negative errno on failure
+ */
+int v4l2_enum_sizes(struct v4l2_stream *stream, uint32_t fourcc,
+                    uint32_t *width, uint32_t *height, int max)
+{
+    struct v4l2_frmsizeenum size;
+    int n = 0;
+
+    memset(&size, 0, sizeof(size));
+    size.pixel_format = fourcc;
+
+    for (size.index = 0; n < max; size.index++) {
+        if (xioctl(stream->fd, VIDIOC_ENUM_FRAMESIZES, &size)) {
+            break;
+        }
+
+        if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            width[n] = size.discrete.width;
+            height[n++] = size.discrete.height;
+            continue;
+        }
+
+        width[n] = size.stepwise.min_width;
+        height[n++] = size.stepwise.min_height;
+        if (n < max) {
+            width[n] = size.stepwise.max_width;
+            height[n++] = size.stepwise.max_height;
+        }
+        break;
+    }
+
+    return n;
+}
+
+/**
+ * @brief Set the capture format
+ *
+ * The driver may adjust the requested size; the stream is updated with the
+ * format actually applied.
+ *
+ * @param stream The opened stream
+ * @param fourcc The pixel format
+ * @param width Requested frame width
+ * @param height Requested frame height
+ * @return 0 on success, negative errno on failure
+ */
+int v4l2_set_format(struct v4l2_stream *stream, uint32_t fourcc,
+                    uint32_t width, uint32_t height)
+{
+    struct v4l2_format fmt;
+    int ret;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.pixelformat = fourcc;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+
+    ret = xioctl(stream->fd, VIDIOC_S_FMT, &fmt);
+    if (ret) {
+        return ret;
+    }
+
+    stream->pixfmt = fmt.fmt.pix.pixelformat;
+    stream->width = fmt.fmt.pix.width;
+    stream->height = fmt.fmt.pix.height;
+    stream->sizeimage = fmt.fmt.pix.sizeimage;
+
+    return 0;
+}
+
+/**
+ * @brief Request buffers of a memory type, bounded by V4L2_MAX_BUFFERS
+ *
+ * @param stream The opened stream with its format set
+ * @param memory V4L2_MEMORY_MMAP or V4L2_MEMORY_DMABUF
+ * @param nbufs Number of buffers requested, the driver may change it
+ * @return 0 on success, negative errno on failure
+ */
+static int request_buffers(struct v4l2_stream *stream, uint32_t memory,
+                           uint32_t nbufs)
+{
+    struct v4l2_requestbuffers req;
+    int ret;
+
+    if (nbufs > V4L2_MAX_BUFFERS) {
+        nbufs = V4L2_MAX_BUFFERS;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.count = nbufs;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = memory;
+
+    ret = xioctl(stream->fd, VIDIOC_REQBUFS, &req);
+    if (ret) {
+        return ret;
+    }
+
+    if (req.count < 1 || req.count > V4L2_MAX_BUFFERS) {
+        req.count = 0;
+        xioctl(stream->fd, VIDIOC_REQBUFS, &req);
+        return -ENOMEM;
+    }
+
+    stream->memory = memory;
+    stream->nbufs = req.count;
+
+    return 0;
+}
+
+/**
+ * @brief Allocate and map MMAP buffers, queue them all and start streaming
+ *
+ * @param stream The opened stream with its format set
+ * @param nbufs Number of buffers requested, the driver may change it
+ * @return 0 on success, negative errno on failure
+ */
+int v4l2_stream_start(struct v4l2_stream *stream, uint32_t nbufs)
+{
+    struct v4l2_buffer buf;
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    uint32_t i;
+    int ret;
+
+    ret = request_buffers(stream, V4L2_MEMORY_MMAP, nbufs);
+    if (ret) {
+        return ret;
+    }
+
+    for (i = 0; i < stream->nbufs; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+
+        ret = xioctl(stream->fd, VIDIOC_QUERYBUF, &buf);
+        if (ret) {
+            goto error;
+        }
+
+        stream->start[i] = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, stream->fd, buf.m.offset);
+        if (stream->start[i] == MAP_FAILED) {
+            stream->start[i] = NULL;
+            ret = -errno;
+            goto error;
+        }
+        stream->length[i] = buf.length;
+
+        ret = xioctl(stream->fd, VIDIOC_QBUF, &buf);
+        if (ret) {
+            goto error;
+        }
+    }
+
+    ret = xioctl(stream->fd, VIDIOC_STREAMON, &type);
+    if (ret) {
+        goto error;
+    }
+
+    return 0;
+
+error:
+    v4l2_stream_stop(stream);
+    return ret;
+}
+
+/**
+ * @brief Import dma-buf buffers, queue them all and start streaming
+ *
+ * The buffers stay owned by the caller, e.g. dumb buffers of a display,
+ * so the capture lands where it is consumed without a copy.
+ *
+ * @param stream The opened stream with its format set
+ * @param fds The dma-buf file descriptors
+ * @param maps CPU mappings of the buffers returned in frames, may be NULL
+ * @param length Size of every buffer, at least the image size
+ * @param nbufs Number of buffers
+ * @return 0 on success, negative errno on failure
+ */
+int v4l2_stream_start_dmabuf(struct v4l2_stream *stream, const int *fds,
+                             void * const *maps, uint32_t length,
+                             uint32_t nbufs)
+{
+    struct v4l2_buffer buf;
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    uint32_t i;
+    int ret;
+
+    if (length < stream->sizeimage) {
+        return -EINVAL;
+    }
+
+    ret = request_buffers(stream, V4L2_MEMORY_DMABUF, nbufs);
+    if (ret) {
+        return ret;
+    }
+    if (stream->nbufs > nbufs) {
+        ret = -ENOMEM;
+        goto error;
+    }
+
+    for (i = 0; i < stream->nbufs; i++) {
+        stream->dmabuf[i] = fds[i];
+        stream->length[i] = length;
+
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_DMABUF;
+        buf.index = i;
+        buf.m.fd = fds[i];
+        buf.length = length;
+
+        ret = xioctl(stream->fd, VIDIOC_QBUF, &buf);
+        if (ret) {
+            goto error;
+        }
+    }
+
+    ret = xioctl(stream->fd, VIDIOC_STREAMON, &type);
+    if (ret) {
+        goto error;
+    }
+
+    /* Set last so v4l2_stream_stop() never unmaps caller memory */
+    for (i = 0; maps && i < stream->nbufs; i++) {
+        stream->start[i] = maps[i];
+    }
+
+    return 0;
+
+error:
+    v4l2_stream_stop(stream);
+    return ret;
+}
+
+/**
+ * @brief Wait for and dequeue the next filled buffer
+ *
+ * @param stream The streaming stream
+ * @param frame Output frame description
+ * @param timeout_ms Maximum time to wait for a frame
+ * @return 0 on success, -ETIMEDOUT on timeout, negative errno on failure
+ */
+int v4l2_stream_dequeue(struct v4l2_stream *stream, struct v4l2_frame *frame,
+                        int timeout_ms)
+{
+    struct v4l2_buffer buf;
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = stream->fd;
+    pfd.events = POLLIN;
+
+    for (;;) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = stream->memory;
+
+        ret = xioctl(stream->fd, VIDIOC_DQBUF, &buf);
+        if (ret != -EAGAIN) {
+            break;
+        }
+
+        ret = poll(&pfd, 1, timeout_ms);
+        if (ret == 0) {
+            return -ETIMEDOUT;
+        }
+        if (ret < 0 && errno != EINTR) {
+            return -errno;
+        }
+    }
+
+    if (ret) {
+        return ret;
+    }
+
+    frame->index = buf.index;
+    frame->sequence = buf.sequence;
+    frame->bytesused = buf.bytesused;
+    frame->flags = buf.flags;
+    frame->timestamp_ns = (uint64_t)buf.timestamp.tv_sec * 1000000000ULL +
+                          (uint64_t)buf.timestamp.tv_usec * 1000ULL;
+    frame->data = stream->start[buf.index];
+
+    return 0;
+}
+
+/**
+ * @brief Give a dequeued buffer back to the driver
+ *
+ * @param stream The streaming stream
+ * @param frame Frame returned by v4l2_stream_dequeue
+ * @return 0 on success, negative errno on failure
+ */
+int v4l2_stream_queue(struct v4l2_stream *stream,
+                      const struct v4l2_frame *frame)
+{
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = stream->memory;
+    buf.index = frame->index;
+    if (stream->memory == V4L2_MEMORY_DMABUF) {
+        buf.m.fd = stream->dmabuf[frame->index];
+        buf.length = stream->length[frame->index];
+    }
+
+    return xioctl(stream->fd, VIDIOC_QBUF, &buf);
+}
+
+/**
+ * @brief Stop streaming and release all buffers
+ *
+ * @param stream The stream
+ * @return None
+ */
+void v4l2_stream_stop(struct v4l2_stream *stream)
+{
+    struct v4l2_requestbuffers req;
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    uint32_t i;
+
+    if (!stream->nbufs) {
+        return;
+    }
+
+    xioctl(stream->fd, VIDIOC_STREAMOFF, &type);
+
+    /* dma-buf memory belongs to the caller */
+    for (i = 0; i < stream->nbufs; i++) {
+        if (stream->start[i] && stream->memory == V4L2_MEMORY_MMAP) {
+            munmap(stream->start[i], stream->length[i]);
+        }
+        stream->start[i] = NULL;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = stream->memory;
+    xioctl(stream->fd, VIDIOC_REQBUFS, &req);
+
+    stream->nbufs = 0;
+}
+
+/**
+ * @brief Convert a fourcc code to a printable string
+ *
+ * @param fourcc The pixel format code
+ * @param buf Output buffer, at least 5 bytes
+ * @return None
+ */
+void v4l2_fourcc_str(uint32_t fourcc, char *buf)
+{
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        buf[i] = (char)((fourcc >> (8 * i)) & 0xff);
+        if (buf[i] < ' ' || buf[i] > '~') {
+            buf[i] = '.';
+        }
+    }
+    buf[4] = '\0';
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/* applets.h is generated by the Makefile, one APPLET(name) per app */
+#define APPLET(name) int name##_main(int argc, char **argv);
+#include "applets.h"
+#undef APPLET
+
+struct applet {
+    const char  *name;
+    int         (*main)(int argc, char **argv);
+};
+
+static const struct applet applets[] = {
+#define APPLET(name) { #name, name##_main },
+#include "applets.h"
+#undef APPLET
+};
+
+/**
+ * @brief Print usage and the applets of this binary
+ *
+ * @return None
+ */
+static void print_usage(void)
+{
+    unsigned int i;
+
+    printf("\nUsage: %s app [app-options]\n", MULTICALL_BIN);
+    printf("   or: app [app-options], with app a link to %s\n",
+           MULTICALL_BIN);
+    printf("Apps:");
+    for (i = 0; i < sizeof(applets) / sizeof(applets[0]); i++) {
+        printf("%s%s", i % 6 ? " " : "\n    ", applets[i].name);
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Find an applet by name
+ *
+ * @param name The app name
+ * @return The applet, NULL if there is none by that name
+ */
+static const struct applet *find_applet(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(applets) / sizeof(applets[0]); i++) {
+        if (!strcmp(applets[i].name, name)) {
+            return &applets[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief The multicall main function
+ *
+ * Runs the app named by argv[0], or by argv[1] when called by the
+ * binary's own name.
+ *
+ * @param argc The main arguments count
+ * @param argv The main arguments data
+ * @return The app's return value, -EINVAL for an unknown app
+ */
+int main(int argc, char **argv)
+{
+    const struct applet *applet;
+    const char *name;
+
+    name = strrchr(argv[0], '/');
+    name = name ? name + 1 : argv[0];
+
+    if (!strcmp(name, MULTICALL_BIN)) {
+        if (argc < 2) {
+            print_usage();
+            return -EINVAL;
+        }
+        argc--;
+        argv++;
+        name = argv[0];
+    }
+
+    applet = find_applet(name);
+    if (!applet) {
+        fprintf(stderr, "%s: no app %s\n", MULTICALL_BIN, name);
+        print_usage();
+        return -EINVAL;
+    }
+
+    return applet->main(argc, argv);
+}
@@ -0,0 +1,533 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <linux/limits.h>
+
+#include <libfwtest.h>
+
+#define APP_NAME "fake_sysfs"
+
+/* tmpfs on target and on most hosts, so the tree never touches a disk */
+#define TMPFS_DIR   "/dev/shm"
+#define TMP_DIR     "/tmp"
+
+#define SIM_MAX_LOOPBACKS   16
+
+/*
+ * Loopback model: an operation costs a fixed round trip plus its bytes at
+ * the link rate. Sync requests are serialized, async ones overlap up to
+ * the outstanding limit until the link or the AP per-operation cost is
+ * the bottleneck. Rough numbers of an APBridge over HSIC.
+ */
+#define SIM_OP_US           120
+#define SIM_CPU_US          25
+#define SIM_LINK_BPS        (20 * 1024 * 1024)
+#define SIM_HDR_BYTES       8
+#define SIM_MAX_SIZE        2032
+/* Simulated runs take this fraction of the modelled time, up to a cap */
+#define SIM_TIME_SCALE      50
+#define SIM_MAX_WAIT_MS     100
+
+#define GB_LOOPBACK_TYPE_PING       2
+#define GB_LOOPBACK_TYPE_TRANSFER   3
+#define GB_LOOPBACK_TYPE_SINK       4
+
+/*
+ * Runtime PM model of the APBridge (USB device 1-1): with power/control
+ * at auto it suspends autosuspend_delay_ms after the last activity, and
+ * any open or read of a node in the fake /dev wakes it up after
+ * SIM_RESUME_US. An I/O keeps it busy for SIM_IO_BUSY_MS, as the driver
+ * holds a usage count while the transfer runs.
+ */
+#define SIM_BRIDGE_POWER    "sys/bus/usb/devices/1-1/power"
+#define SIM_RESUME_US       2000
+#define SIM_IO_BUSY_MS      5
+
+struct sim_loopback {
+    int     wd;
+    char    path[PATH_MAX];
+};
+
+struct sim_power {
+    char        path[PATH_MAX];
+    int         control_wd;
+    int         delay_wd;
+    int         dev_wd;
+    int         automatic;
+    long        delay_ms;
+    int         active;
+    /** last activity and last status change */
+    uint64_t    last_io;
+    uint64_t    since;
+    uint64_t    active_ms;
+    uint64_t    suspended_ms;
+};
+
+/**
+ * @brief Print usage of this fake tree tool
+ *
+ * @return None
+ */
+static void print_usage(void)
+{
+    printf("\nUsage: %s [-o dir] [-H hd] [-i interfaces] [-g chips]"
+           " [-p pins] [-a adapters]\n"
+           "          [-L loopbacks] [-S]\n"
+           "       %s -x dir\n", APP_NAME, APP_NAME);
+    printf("    -o: directory to build the tree in (default a new directory "
+           "in %s,\n        or %s without it).\n", TMPFS_DIR, TMP_DIR);
+    printf("    -H: host device number (default 1).\n");
+    printf("    -i: module interfaces (default 2).\n");
+    printf("    -g: GPIO chips per interface (default 1).\n");
+    printf("    -p: pins per GPIO chip (default 32).\n");
+    printf("    -a: I2C adapters per interface (default 1).\n");
+    printf("    -L: interfaces with a gb_loopback device (default 0).\n");
+    printf("    -S: leave a process in the background playing the loopback\n"
+           "        driver and the bridge runtime PM until the tree is "
+           "removed.\n");
+    printf("    -x: remove a tree built by this tool.\n");
+    printf("The environment for the apps is printed on stdout, e.g.\n");
+    printf("     eval \"$(./%s -i 4 -p 64)\" && ./gpio_enum -g -n 4\n",
+           APP_NAME);
+}
+
+static long sim_get(const char *dir, const char *attr)
+{
+    char value[32];
+
+    if (debugfs_get_attr((char *)dir, attr, value, sizeof(value))) {
+        return 0;
+    }
+
+    return atol(value);
+}
+
+static void sim_set(const char *dir, const char *attr, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void sim_set(const char *dir, const char *attr, const char *fmt, ...)
+{
+    char value[64];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(value, sizeof(value), fmt, ap);
+    va_end(ap);
+
+    debugfs_set_attr((char *)dir, attr, value, strlen(value));
+}
+
+/**
+ * @brief Play one loopback run the way gb-loopback reports it
+ *
+ * @param dir The gb_loopback device directory
+ * @return None
+ */
+static void sim_run(const char *dir)
+{
+    long type = sim_get(dir, "type"), size = sim_get(dir, "size");
+    long iterations = sim_get(dir, "iteration_max");
+    long depth = sim_get(dir, "outstanding_operations_max");
+    long async = sim_get(dir, "async"), timeout = sim_get(dir, "timeout");
+    long us_wait = sim_get(dir, "us_wait"), bytes, errors = 0;
+    double lat_us, rps, floor_us, wait_ms;
+
+    if (type < GB_LOOPBACK_TYPE_PING || type > GB_LOOPBACK_TYPE_SINK ||
+        iterations <= 0) {
+        return;
+    }
+
+    /* The driver clamps the size to what fits in an operation */
+    if (size > SIM_MAX_SIZE) {
+        size = SIM_MAX_SIZE;
+        sim_set(dir, "size", "%ld\n", size);
+    }
+
+    switch (type) {
+    case GB_LOOPBACK_TYPE_PING:
+        bytes = 2 * SIM_HDR_BYTES;
+        break;
+    case GB_LOOPBACK_TYPE_TRANSFER:
+        bytes = 2 * (SIM_HDR_BYTES + size);
+        break;
+    default:
+        bytes = 2 * SIM_HDR_BYTES + size;
+        break;
+    }
+
+    lat_us = SIM_OP_US + bytes * 1000000.0 / SIM_LINK_BPS;
+    if (!async || depth < 1) {
+        rps = 1000000.0 / (lat_us + us_wait);
+    } else {
+        floor_us = bytes * 1000000.0 / SIM_LINK_BPS;
+        if (floor_us < SIM_CPU_US) {
+            floor_us = SIM_CPU_US;
+        }
+        rps = depth * 1000000.0 / lat_us;
+        if (rps > 1000000.0 / floor_us) {
+            rps = 1000000.0 / floor_us;
+        }
+        /* Little's law: queued requests wait for the ones ahead */
+        if (depth * 1000000.0 / rps > lat_us) {
+            lat_us = depth * 1000000.0 / rps;
+        }
+        if (timeout && lat_us > timeout) {
+            errors = iterations;
+        }
+    }
+
+    sim_set(dir, "iteration_count", "0\n");
+    wait_ms = iterations * 1000.0 / rps / SIM_TIME_SCALE;
+    usleep((useconds_t)((wait_ms < SIM_MAX_WAIT_MS ? wait_ms :
+                         SIM_MAX_WAIT_MS) * 1000));
+
+    sim_set(dir, "error", "%ld\n", errors);
+    sim_set(dir, "requests_per_second_min", "%u\n", (unsigned)(rps * 0.8));
+    sim_set(dir, "requests_per_second_max", "%u\n", (unsigned)(rps * 1.1));
+    sim_set(dir, "requests_per_second_avg", "%.6f\n", rps);
+    sim_set(dir, "latency_min", "%u\n", (unsigned)(lat_us * 0.9));
+    sim_set(dir, "latency_max", "%u\n", (unsigned)(lat_us * 1.3));
+    sim_set(dir, "latency_avg", "%.6f\n", lat_us);
+    sim_set(dir, "throughput_min", "%u\n", (unsigned)(rps * bytes * 0.8));
+    sim_set(dir, "throughput_max", "%u\n", (unsigned)(rps * bytes * 1.1));
+    sim_set(dir, "throughput_avg", "%.6f\n", rps * bytes);
+    sim_set(dir, "iteration_count", "%ld\n", iterations);
+    /* Like the driver, the run is over once type is back to 0 */
+    sim_set(dir, "type", "0\n");
+}
+
+static void sim_power_status(struct sim_power *pm, int active)
+{
+    uint64_t now = get_time_ns(), ms = (now - pm->since) / 1000000;
+
+    if (pm->active) {
+        pm->active_ms += ms;
+    } else {
+        pm->suspended_ms += ms;
+    }
+    pm->since = now;
+    pm->active = active;
+
+    sim_set(pm->path, "runtime_active_time", "%llu\n",
+            (unsigned long long)pm->active_ms);
+    sim_set(pm->path, "runtime_suspended_time", "%llu\n",
+            (unsigned long long)pm->suspended_ms);
+    sim_set(pm->path, "runtime_status", "%s\n",
+            active ? "active" : "suspended");
+}
+
+/* Activity on the bridge: resume it if needed */
+static void sim_power_io(struct sim_power *pm)
+{
+    if (!pm->active) {
+        usleep(SIM_RESUME_US);
+        sim_power_status(pm, 1);
+    }
+    pm->last_io = get_time_ns();
+}
+
+static void sim_power_settings(struct sim_power *pm)
+{
+    char value[16];
+
+    if (debugfs_get_attr(pm->path, "control", value, sizeof(value))) {
+        return;
+    }
+    pm->automatic = !strcmp(value, "auto");
+    pm->delay_ms = sim_get(pm->path, "autosuspend_delay_ms");
+
+    /* Writing control counts as activity, "on" resumes */
+    sim_power_io(pm);
+}
+
+/* Time until the bridge autosuspends, -1 if it doesn't */
+static int sim_power_timeout(struct sim_power *pm)
+{
+    uint64_t due, now;
+
+    if (pm->control_wd < 0 || !pm->automatic || !pm->active ||
+        pm->delay_ms < 0) {
+        return -1;
+    }
+
+    due = pm->last_io + (uint64_t)(SIM_IO_BUSY_MS + pm->delay_ms) * 1000000;
+    now = get_time_ns();
+    if (now >= due) {
+        sim_power_status(pm, 0);
+        return -1;
+    }
+
+    return (int)((due - now + 999999) / 1000000);
+}
+
+static void sim_power_init(struct sim_power *pm, const char *root, int fd)
+{
+    char path[PATH_MAX];
+
+    memset(pm, 0, sizeof(*pm));
+    snprintf(pm->path, sizeof(pm->path), "%s/%s", root, SIM_BRIDGE_POWER);
+    snprintf(path, sizeof(path), "%s/control", pm->path);
+    pm->control_wd = inotify_add_watch(fd, path, IN_CLOSE_WRITE);
+    snprintf(path, sizeof(path), "%s/autosuspend_delay_ms", pm->path);
+    pm->delay_wd = inotify_add_watch(fd, path, IN_CLOSE_WRITE);
+    snprintf(path, sizeof(path), "%s/dev", root);
+    pm->dev_wd = inotify_add_watch(fd, path, IN_OPEN | IN_ACCESS);
+
+    if (pm->control_wd >= 0) {
+        pm->active = 1;
+        pm->since = get_time_ns();
+        sim_power_settings(pm);
+    }
+}
+
+/**
+ * @brief Serve loopback runs and bridge runtime PM until the tree is
+ *        removed
+ *
+ * Every write of a non-zero type starts a run, as with the driver. The
+ * simulator's own write of type on completion is seen as a stop.
+ *
+ * @param root The tree root
+ * @return 0 once the tree is gone, negative errno on failure
+ */
+static int sim_serve(const char *root)
+{
+    struct sim_loopback lb[SIM_MAX_LOOPBACKS];
+    struct sim_power pm;
+    char path[PATH_MAX], buf[4096] __attribute__((aligned(8)));
+    struct inotify_event *ev;
+    struct pollfd pfd;
+    struct dirent *ptr;
+    int fd, n = 0, i, marker;
+    ssize_t len, pos;
+    DIR *fdir;
+
+    fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", root, FAKE_TREE_MARKER);
+    marker = inotify_add_watch(fd, path, IN_DELETE_SELF);
+
+    snprintf(path, sizeof(path), "%s/sys/class/gb_loopback", root);
+    fdir = opendir(path);
+    while (fdir && n < SIM_MAX_LOOPBACKS && (ptr = readdir(fdir)) != NULL) {
+        if (ptr->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(lb[n].path, sizeof(lb[n].path), "%s/%s", path, ptr->d_name);
+        snprintf(buf, sizeof(buf), "%s/type", lb[n].path);
+        lb[n].wd = inotify_add_watch(fd, buf, IN_CLOSE_WRITE);
+        if (lb[n].wd >= 0) {
+            n++;
+        }
+    }
+    if (fdir) {
+        closedir(fdir);
+    }
+
+    sim_power_init(&pm, root, fd);
+
+    if (marker < 0 || (!n && pm.control_wd < 0)) {
+        close(fd);
+        return -ENOENT;
+    }
+
+    for (;;) {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, sim_power_timeout(&pm)) < 0 && errno != EINTR) {
+            break;
+        }
+
+        len = read(fd, buf, sizeof(buf));
+        if (len < 0 && errno != EAGAIN && errno != EINTR) {
+            break;
+        }
+        for (pos = 0; pos < len; pos += sizeof(*ev) + ev->len) {
+            ev = (struct inotify_event *)(buf + pos);
+            if (ev->wd == marker) {
+                close(fd);
+                return 0;
+            }
+            if (ev->wd == pm.control_wd || ev->wd == pm.delay_wd) {
+                sim_power_settings(&pm);
+            } else if (ev->wd == pm.dev_wd) {
+                sim_power_io(&pm);
+            }
+            for (i = 0; i < n; i++) {
+                if (ev->wd == lb[i].wd) {
+                    sim_run(lb[i].path);
+                }
+            }
+        }
+    }
+
+    close(fd);
+    return -errno;
+}
+
+/**
+ * @brief Move the simulator to the background
+ *
+ * The child lets go of stdout so that eval "$(...)" does not wait for it.
+ *
+ * @param root The tree root
+ * @return 0 in the parent, negative errno on failure
+ */
+static int sim_start(const char *root)
+{
+    pid_t pid;
+    int fd;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        return -errno;
+    }
+    if (pid > 0) {
+        return 0;
+    }
+
+    setsid();
+    fd = open("/dev/null", O_RDWR);
+    if (fd >= 0) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    _exit(sim_serve(root) ? 1 : 0);
+}
+
+/**
+ * @brief The fake_sysfs main function
+ *
+ * @param argc The fake_sysfs main arguments count
+ * @param argv The fake_sysfs main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct fake_tree_config cfg;
+    char dir[PATH_MAX], *root = NULL, *remove = NULL;
+    uint64_t start;
+    int option, simulate = 0, ret;
+
+    fake_tree_defaults(&cfg);
+
+    while ((option = getopt(argc, argv, "o:H:i:g:p:a:L:Sx:")) != -1) {
+        switch (option) {
+        case 'o':
+            root = optarg;
+            break;
+        case 'H':
+            cfg.hd = atoi(optarg);
+            break;
+        case 'i':
+            cfg.interfaces = atoi(optarg);
+            break;
+        case 'g':
+            cfg.gpio_chips = atoi(optarg);
+            break;
+        case 'p':
+            cfg.gpio_pins = atoi(optarg);
+            break;
+        case 'a':
+            cfg.i2c_adapters = atoi(optarg);
+            break;
+        case 'L':
+            cfg.loopbacks = atoi(optarg);
+            break;
+        case 'S':
+            simulate = 1;
+            break;
+        case 'x':
+            remove = optarg;
+            break;
+        default:
+            print_usage();
+            return -EINVAL;
+        }
+    }
+
+    if (remove) {
+        ret = fake_tree_remove(remove);
+        if (ret) {
+            fprintf(stderr, "%s: %s: %s\n", APP_NAME, remove, strerror(-ret));
+        }
+        return ret;
+    }
+
+    if (!root) {
+        snprintf(dir, sizeof(dir), "%s/fwtest-XXXXXX",
+                 access(TMPFS_DIR, W_OK) ? TMP_DIR : TMPFS_DIR);
+        root = mkdtemp(dir);
+        if (!root) {
+            ret = -errno;
+            fprintf(stderr, "%s: %s: %s\n", APP_NAME, dir, strerror(-ret));
+            return ret;
+        }
+    }
+
+    start = get_time_ns();
+    ret = fake_tree_build(root, &cfg);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s: %s\n", APP_NAME, root, strerror(-ret));
+        return ret;
+    }
+
+    /* stdout is only the exports, eval $(...) runs it as one line */
+    fprintf(stderr, "# %d devices, %d pins, built in %llu us\n", ret,
+           cfg.interfaces * cfg.gpio_chips * cfg.gpio_pins,
+           (unsigned long long)((get_time_ns() - start) / 1000));
+    printf("export FWTEST_SYSFS_ROOT=%s/sys\n", root);
+    printf("export FWTEST_DEV_ROOT=%s/dev\n", root);
+
+    if (simulate) {
+        ret = sim_start(root);
+        if (ret) {
+            fprintf(stderr, "%s: simulator: %s\n", APP_NAME, strerror(-ret));
+        }
+    }
+
+    return ret < 0 ? ret : 0;
+}
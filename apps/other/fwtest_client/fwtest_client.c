@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <libfwtest.h>
+
+#define APP_NAME "fwtest_client"
+
+/**
+ * @brief Print usage of this test daemon client
+ *
+ * @return None
+ */
+static void print_usage(void)
+{
+    printf("\nUsage: %s socket [test-app-options]\n"
+           "       %s -q socket\n", APP_NAME, APP_NAME);
+    printf("    Run one case in a test app started with -D socket. The\n"
+           "    output and exit status are the test app's own.\n");
+    printf("    -q: stop the test app.\n");
+    printf("Example : case C1031 in a resident gpiotest\n");
+    printf("     ./gpiotest -D /data/local/tmp/gpiotest.sock &\n");
+    printf("     ./%s /data/local/tmp/gpiotest.sock -c 1031 -t m -1 0 "
+           "-2 8 -3 9\n", APP_NAME);
+}
+
+/**
+ * @brief The fwtest_client main function
+ *
+ * Options are not parsed past the socket, they all go to the test app.
+ *
+ * @param argc The fwtest_client main arguments count
+ * @param argv The fwtest_client main arguments data
+ * @return The test case result, or error code on failure to reach it
+ */
+int main(int argc, char **argv)
+{
+    int stop, ret, result = 0;
+
+    stop = argc > 1 && !strcmp(argv[1], "-q");
+    if (argc < 2 + stop || (stop && argc != 3) || argv[1 + stop][0] == '-') {
+        print_usage();
+        return -EINVAL;
+    }
+
+    if (stop) {
+        ret = daemon_request(argv[2], 0, NULL, &result);
+    } else {
+        ret = daemon_request(argv[1], argc - 2, argv + 2, &result);
+    }
+
+    if (ret) {
+        fprintf(stderr, "%s: %s: %s\n", APP_NAME, argv[1 + stop],
+                strerror(-ret));
+        return ret;
+    }
+
+    return result;
+}
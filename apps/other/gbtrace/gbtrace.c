@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <libfwtest.h>
+
+#define APP_NAME "gbtrace"
+#define LOG_TAG "GBTRACE"
+
+#define POLL_MS     100
+
+struct gbtrace_info {
+    int     case_id;
+    char    *file;
+    int     duration_ms;
+    char    **command;
+};
+
+/* Static, the operation table is too large for the stack */
+static struct gbtrace trace;
+
+/**
+ * @brief Print usage of this Greybus tracing application
+ *
+ * @return None
+ */
+static void print_usage(void)
+{
+    printf("\nUsage: %s [-c case-id] [-d duration-ms] [-r sysfs-root]"
+           " [-- command [args]]\n"
+           "       %s [-c case-id] -f trace-file\n", APP_NAME, APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: trace for this long when no command is given "
+           "(default 10000).\n");
+    printf("    -f: parse a recorded trace instead of tracing live.\n");
+    printf("    -r: sysfs root directory (default /sys).\n");
+    printf("Greybus operation latencies are traced while the command "
+           "runs.\n");
+    printf("Example : latencies of the i2c test 1033\n");
+    printf("     ./%s -c 1033 -- ./i2ctest -c 1033\n", APP_NAME);
+}
+
+/**
+ * @brief Command parser
+ *
+ * @param info The parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct gbtrace_info *info, int argc, char **argv)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:f:r:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'd':
+            info->duration_ms = atoi(optarg);
+            break;
+        case 'f':
+            info->file = optarg;
+            break;
+        case 'r':
+            set_sysfs_root(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (optind < argc) {
+        info->command = &argv[optind];
+    }
+
+    if (info->duration_ms <= 0 || (info->file && info->command)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Trace while the command runs, or for the duration without one
+ *
+ * @param info The parameters
+ * @return 0 on success, -ECHILD if the command failed, negative errno on
+ *         failure
+ */
+static int trace_live(struct gbtrace_info *info)
+{
+    uint64_t end;
+    pid_t pid = -1;
+    int status = 0, ret;
+    char buf[64];
+
+    ret = gbtrace_open(&trace);
+    if (ret) {
+        return ret;
+    }
+
+    if (info->command) {
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            execvp(info->command[0], info->command);
+            _exit(127);
+        }
+        if (pid < 0) {
+            ret = -errno;
+            gbtrace_close(&trace);
+            return ret;
+        }
+    }
+
+    end = get_time_ns() + (uint64_t)info->duration_ms * 1000000;
+    for (;;) {
+        ret = gbtrace_poll(&trace, POLL_MS);
+        if (ret < 0) {
+            break;
+        }
+        ret = 0;
+        if (pid > 0) {
+            if (waitpid(pid, &status, WNOHANG) == pid) {
+                break;
+            }
+        } else if (get_time_ns() >= end) {
+            break;
+        }
+    }
+
+    if (ret && pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, &status, 0);
+    }
+    gbtrace_close(&trace);
+
+    if (!ret && pid > 0 && !(WIFEXITED(status) && !WEXITSTATUS(status))) {
+        snprintf(buf, sizeof(buf), "%s exited with status 0x%x",
+                 info->command[0], status);
+        print_test_case_log(LOG_TAG, info->case_id, buf);
+        ret = -ECHILD;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief The gbtrace main function
+ *
+ * @param argc The gbtrace main arguments count
+ * @param argv The gbtrace main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct gbtrace_info info;
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.duration_ms = 10000;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    gbtrace_init(&trace);
+    if (info.file) {
+        ret = gbtrace_parse_file(&trace, info.file);
+    } else {
+        ret = trace_live(&info);
+    }
+
+    gbtrace_report(&trace, LOG_TAG, info.case_id);
+    gbtrace_free(&trace);
+
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}
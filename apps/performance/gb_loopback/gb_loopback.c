@@ -0,0 +1,572 @@
+/*
+ * Copyright (c) 2015 Google, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include <libfwtest.h>
+
+#define APP_NAME "gb_loopback"
+#define LOG_TAG "LOOPBACK"
+
+#define LOOPBACK_CLASS      "/class/gb_loopback"
+#define MAX_SIZES           16
+#define MAX_DEPTHS          16
+#define MAX_POINTS          (MAX_SIZES * (MAX_DEPTHS + 1))
+#define POLL_MS             5
+
+#define MODE_SYNC           0x1
+#define MODE_ASYNC          0x2
+
+/* Operation types of the gb-loopback driver */
+#define GB_LOOPBACK_TYPE_PING       2
+#define GB_LOOPBACK_TYPE_TRANSFER   3
+#define GB_LOOPBACK_TYPE_SINK       4
+
+static const char *type_names[] = {
+    [GB_LOOPBACK_TYPE_PING]     = "ping",
+    [GB_LOOPBACK_TYPE_TRANSFER] = "transfer",
+    [GB_LOOPBACK_TYPE_SINK]     = "sink",
+};
+
+struct loopback_info {
+    int         case_id;
+    char        *dev;
+    int         type;
+    int         nsizes;
+    int         sizes[MAX_SIZES];
+    int         modes;
+    int         ndepths;
+    int         depths[MAX_DEPTHS];
+    int         iterations;
+    int         us_wait;
+    int         op_timeout_us;
+    int         timeout_ms;
+    /** <sysfs root>/class/gb_loopback/<dev> */
+    char        path[PATH_MAX];
+};
+
+/* One point of the sweep, as reported by the driver */
+struct loopback_point {
+    int         size;
+    int         async;
+    int         depth;
+    long        error;
+    uint64_t    wall_ns;
+    double      rps_avg;
+    long        rps_min;
+    long        rps_max;
+    double      latency_avg;
+    long        latency_min;
+    long        latency_max;
+    double      throughput_avg;
+    long        throughput_min;
+    long        throughput_max;
+};
+
+/**
+ * @brief Print usage of this Greybus loopback performance application
+ *
+ * @return None
+ */
+static void print_usage(void)
+{
+    printf("\nUsage: %s [-c case-id] [-d device] [-T type] [-s sizes]"
+           " [-m modes]\n"
+           "          [-o depths] [-n iterations] [-w us-wait]"
+           " [-O op-timeout-us]\n"
+           "          [-t timeout-ms] [-r sysfs-root]\n", APP_NAME);
+    printf("    -c: Testrail test case ID.\n");
+    printf("    -d: gb_loopback device (default the first one).\n");
+    printf("    -T: ping, transfer or sink (default transfer).\n");
+    printf("    -s: payload sizes (default 16,64,256,1024,2000).\n");
+    printf("    -m: sync, async or sync,async (default both).\n");
+    printf("    -o: async outstanding operation depths (default 1,4,16).\n");
+    printf("    -n: operations per point (default 1000).\n");
+    printf("    -w: delay between sync operations in us (default 0).\n");
+    printf("    -O: async operation timeout in us (default 1000000).\n");
+    printf("    -t: timeout of every point in ms (default 60000).\n");
+    printf("    -r: sysfs root directory (default /sys).\n");
+    printf("Example : async transfers only, 5000 per point\n");
+    printf("     ./%s -m async -o 1,2,4,8 -n 5000\n", APP_NAME);
+}
+
+static int parse_list(char *str, int *out, int max)
+{
+    char *tok, *save = NULL;
+    int n = 0;
+
+    for (tok = strtok_r(str, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (n >= max || atoi(tok) < 0) {
+            return -EINVAL;
+        }
+        out[n++] = atoi(tok);
+    }
+
+    return n;
+}
+
+static int parse_type(const char *str)
+{
+    int i;
+
+    for (i = GB_LOOPBACK_TYPE_PING; i <= GB_LOOPBACK_TYPE_SINK; i++) {
+        if (!strcmp(str, type_names[i])) {
+            return i;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static int parse_modes(char *str)
+{
+    char *tok, *save = NULL;
+    int modes = 0;
+
+    for (tok = strtok_r(str, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (!strcmp(tok, "sync")) {
+            modes |= MODE_SYNC;
+        } else if (!strcmp(tok, "async")) {
+            modes |= MODE_ASYNC;
+        } else {
+            return -EINVAL;
+        }
+    }
+
+    return modes;
+}
+
+/**
+ * @brief Command parser
+ *
+ * @param info The test parameters
+ * @param argc Indicate how many input parameters
+ * @param argv Commands input from console
+ * @return 0 on success, negative errno on error
+ */
+static int command_parse(struct loopback_info *info, int argc, char **argv)
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "c:d:T:s:m:o:n:w:O:t:r:")) != -1) {
+        switch (option) {
+        case 'c':
+            info->case_id = atoi(optarg);
+            break;
+        case 'd':
+            info->dev = optarg;
+            break;
+        case 'T':
+            info->type = parse_type(optarg);
+            break;
+        case 's':
+            info->nsizes = parse_list(optarg, info->sizes, MAX_SIZES);
+            break;
+        case 'm':
+            info->modes = parse_modes(optarg);
+            break;
+        case 'o':
+            info->ndepths = parse_list(optarg, info->depths, MAX_DEPTHS);
+            break;
+        case 'n':
+            info->iterations = atoi(optarg);
+            break;
+        case 'w':
+            info->us_wait = atoi(optarg);
+            break;
+        case 'O':
+            info->op_timeout_us = atoi(optarg);
+            break;
+        case 't':
+            info->timeout_ms = atoi(optarg);
+            break;
+        case 'r':
+            set_sysfs_root(optarg);
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (info->type < 0 || info->nsizes <= 0 || info->modes <= 0 ||
+        info->ndepths <= 0 || info->iterations <= 0 ||
+        info->timeout_ms <= 0) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int loopback_set(struct loopback_info *info, const char *attr,
+                        const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static int loopback_set(struct loopback_info *info, const char *attr,
+                        const char *fmt, ...)
+{
+    char value[32];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(value, sizeof(value), fmt, ap);
+    va_end(ap);
+
+    return debugfs_set_attr(info->path, attr, value, strlen(value));
+}
+
+static double loopback_get(struct loopback_info *info, const char *attr)
+{
+    char value[32];
+
+    if (debugfs_get_attr(info->path, attr, value, sizeof(value))) {
+        return -1;
+    }
+
+    return strtod(value, NULL);
+}
+
+/**
+ * @brief Find the loopback device to drive
+ *
+ * @param info The test parameters, path is filled in
+ * @return 0 on success, -ENODEV if there is no loopback device
+ */
+static int find_loopback(struct loopback_info *info)
+{
+    char dir[PATH_MAX], name[64] = "";
+    struct dirent *ptr;
+    DIR *fdir;
+
+    if (info->dev) {
+        sysfs_path(info->path, sizeof(info->path), "%s/%s", LOOPBACK_CLASS,
+                   info->dev);
+        return access(info->path, F_OK) ? -ENODEV : 0;
+    }
+
+    sysfs_path(dir, sizeof(dir), "%s", LOOPBACK_CLASS);
+    fdir = opendir(dir);
+    if (!fdir) {
+        return -ENODEV;
+    }
+
+    /* Lowest name, readdir order is not stable */
+    while ((ptr = readdir(fdir)) != NULL) {
+        if (ptr->d_name[0] != '.' &&
+            (!name[0] || strcmp(ptr->d_name, name) < 0)) {
+            snprintf(name, sizeof(name), "%s", ptr->d_name);
+        }
+    }
+    closedir(fdir);
+
+    if (!name[0]) {
+        return -ENODEV;
+    }
+
+    snprintf(info->path, sizeof(info->path), "%s/%s", dir, name);
+    return 0;
+}
+
+/**
+ * @brief Wait for the driver to complete all operations of a run
+ *
+ * The driver clears type and calls sysfs_notify() on iteration_count when
+ * the run ends, which wakes poll() with POLLPRI. Checking type as well
+ * keeps the count left over from the previous run from passing for this
+ * one. Files that never notify, like those of a fake tree, are read again
+ * every POLL_MS.
+ *
+ * @param info The test parameters
+ * @return 0 on success, -ETIMEDOUT on timeout, negative errno on failure
+ */
+static int wait_iterations(struct loopback_info *info)
+{
+    char path[PATH_MAX], value[32];
+    uint64_t deadline;
+    struct pollfd pfd;
+    ssize_t len;
+    int ret = -ETIMEDOUT;
+
+    snprintf(path, sizeof(path), "%s/iteration_count", info->path);
+    pfd.fd = open(path, O_RDONLY);
+    if (pfd.fd < 0) {
+        return -errno;
+    }
+    pfd.events = POLLPRI | POLLERR;
+
+    deadline = get_time_ns() + (uint64_t)info->timeout_ms * 1000000;
+    while (get_time_ns() < deadline) {
+        len = pread(pfd.fd, value, sizeof(value) - 1, 0);
+        if (len < 0) {
+            ret = -errno;
+            break;
+        }
+        value[len] = '\0';
+        if (atoi(value) >= info->iterations &&
+            loopback_get(info, "type") == 0) {
+            ret = 0;
+            break;
+        }
+
+        if (poll(&pfd, 1, POLL_MS) > 0 &&
+            !(pfd.revents & (POLLPRI | POLLERR))) {
+            /* A plain file is always ready, do not spin on it */
+            usleep(POLL_MS * 1000);
+        }
+    }
+
+    close(pfd.fd);
+    return ret;
+}
+
+/**
+ * @brief Run one point of the sweep and collect the driver statistics
+ *
+ * @param info The test parameters
+ * @param point The point, size/async/depth set by the caller
+ * @return 0 on success, negative errno on failure
+ */
+static int run_point(struct loopback_info *info, struct loopback_point *point)
+{
+    uint64_t start;
+    int ret;
+
+    /* Stop anything still running before changing the settings */
+    ret = loopback_set(info, "type", "0\n");
+    if (!ret) {
+        ret = loopback_set(info, "size", "%d\n", point->size);
+    }
+    if (!ret) {
+        ret = loopback_set(info, "us_wait", "%d\n",
+                           point->async ? 0 : info->us_wait);
+    }
+    if (!ret) {
+        ret = loopback_set(info, "iteration_max", "%d\n", info->iterations);
+    }
+    if (!ret) {
+        ret = loopback_set(info, "async", "%d\n", point->async);
+    }
+    if (!ret && point->async) {
+        ret = loopback_set(info, "outstanding_operations_max", "%d\n",
+                           point->depth);
+        if (!ret) {
+            ret = loopback_set(info, "timeout", "%d\n", info->op_timeout_us);
+        }
+    }
+    if (ret) {
+        return ret;
+    }
+
+    start = get_time_ns();
+    ret = loopback_set(info, "type", "%d\n", info->type);
+    if (!ret) {
+        ret = wait_iterations(info);
+    }
+    point->wall_ns = get_time_ns() - start;
+    if (ret) {
+        loopback_set(info, "type", "0\n");
+        return ret;
+    }
+
+    /* The driver clamps the size to the largest payload it can send */
+    point->size = (int)loopback_get(info, "size");
+    point->error = (long)loopback_get(info, "error");
+    point->rps_avg = loopback_get(info, "requests_per_second_avg");
+    point->rps_min = (long)loopback_get(info, "requests_per_second_min");
+    point->rps_max = (long)loopback_get(info, "requests_per_second_max");
+    point->latency_avg = loopback_get(info, "latency_avg");
+    point->latency_min = (long)loopback_get(info, "latency_min");
+    point->latency_max = (long)loopback_get(info, "latency_max");
+    point->throughput_avg = loopback_get(info, "throughput_avg");
+    point->throughput_min = (long)loopback_get(info, "throughput_min");
+    point->throughput_max = (long)loopback_get(info, "throughput_max");
+
+    return 0;
+}
+
+static void print_point(struct loopback_info *info,
+                        const struct loopback_point *point)
+{
+    char buf[512];
+
+    snprintf(buf, sizeof(buf), "type=%s size=%d mode=%s depth=%d "
+             "iterations=%d error=%ld wall_ms=%llu rps(avg=%.1f min=%ld "
+             "max=%ld) latency_us(avg=%.1f min=%ld max=%ld) "
+             "throughput_bps(avg=%.0f min=%ld max=%ld)",
+             type_names[info->type], point->size,
+             point->async ? "async" : "sync", point->depth, info->iterations,
+             point->error, (unsigned long long)(point->wall_ns / 1000000),
+             point->rps_avg, point->rps_min, point->rps_max,
+             point->latency_avg, point->latency_min, point->latency_max,
+             point->throughput_avg, point->throughput_min,
+             point->throughput_max);
+    print_test_case_perf(LOG_TAG, info->case_id, buf);
+}
+
+/**
+ * @brief Print one metric of all points as a mode x size matrix
+ *
+ * @param info The test parameters
+ * @param points The sweep results, in sweep order
+ * @param count Number of points
+ * @param metric Name of the metric for the header
+ * @param offset Offset of the double metric in struct loopback_point
+ * @return None
+ */
+static void print_matrix(struct loopback_info *info,
+                         const struct loopback_point *points, int count,
+                         const char *metric, size_t offset)
+{
+    char buf[512];
+    int i, n = 0;
+
+    n += snprintf(buf + n, sizeof(buf) - n, "%-10s", metric);
+    for (i = 0; i < info->nsizes && n < (int)sizeof(buf); i++) {
+        n += snprintf(buf + n, sizeof(buf) - n, " %10d", points[i].size);
+    }
+    print_test_case_log(LOG_TAG, info->case_id, buf);
+
+    /* Points come in rows of nsizes, one row per mode and depth */
+    for (i = 0; i < count; i++) {
+        if (i % info->nsizes == 0) {
+            n = points[i].async ?
+                snprintf(buf, sizeof(buf), "async/%-4d", points[i].depth) :
+                snprintf(buf, sizeof(buf), "%-10s", "sync");
+        }
+        if (n < (int)sizeof(buf)) {
+            n += snprintf(buf + n, sizeof(buf) - n, " %10.1f",
+                          *(const double *)((const char *)&points[i] +
+                                            offset));
+        }
+        if (i % info->nsizes == info->nsizes - 1) {
+            print_test_case_log(LOG_TAG, info->case_id, buf);
+        }
+    }
+}
+
+/**
+ * @brief Sweep sizes for sync and every async depth
+ *
+ * @param info The test parameters
+ * @return 0 on success, -EIO if the driver counted errors, negative errno
+ *         on failure
+ */
+static int gb_loopback_sweep(struct loopback_info *info)
+{
+    struct loopback_point points[MAX_POINTS], *point;
+    int row, nrows, i, count = 0, ret = 0, errors = 0;
+
+    ret = find_loopback(info);
+    if (ret) {
+        return ret;
+    }
+
+    nrows = ((info->modes & MODE_SYNC) ? 1 : 0) +
+            ((info->modes & MODE_ASYNC) ? info->ndepths : 0);
+
+    for (row = 0; row < nrows && !ret; row++) {
+        for (i = 0; i < info->nsizes && !ret; i++) {
+            point = &points[count];
+            memset(point, 0, sizeof(*point));
+            point->size = info->sizes[i];
+            point->async = !(info->modes & MODE_SYNC) || row > 0;
+            point->depth = point->async ?
+                info->depths[row - ((info->modes & MODE_SYNC) ? 1 : 0)] : 1;
+
+            ret = run_point(info, point);
+            if (!ret) {
+                print_point(info, point);
+                errors += point->error > 0;
+                count++;
+            }
+        }
+    }
+
+    loopback_set(info, "type", "0\n");
+
+    if (count == nrows * info->nsizes) {
+        print_matrix(info, points, count, "bytes/s",
+                     offsetof(struct loopback_point, throughput_avg));
+        print_matrix(info, points, count, "req/s",
+                     offsetof(struct loopback_point, rps_avg));
+        print_matrix(info, points, count, "lat_us",
+                     offsetof(struct loopback_point, latency_avg));
+    }
+
+    return ret ? ret : (errors ? -EIO : 0);
+}
+
+/**
+ * @brief The gb_loopback main function
+ *
+ * @param argc The gb_loopback main arguments count
+ * @param argv The gb_loopback main arguments data
+ * @return 0 on success, error code on failure
+ */
+int main(int argc, char **argv)
+{
+    struct loopback_info info;
+    char sizes[] = "16,64,256,1024,2000", depths[] = "1,4,16";
+    int ret;
+
+    memset(&info, 0, sizeof(info));
+    info.type = GB_LOOPBACK_TYPE_TRANSFER;
+    info.nsizes = parse_list(sizes, info.sizes, MAX_SIZES);
+    info.modes = MODE_SYNC | MODE_ASYNC;
+    info.ndepths = parse_list(depths, info.depths, MAX_DEPTHS);
+    info.iterations = 1000;
+    info.op_timeout_us = 1000000;
+    info.timeout_ms = 60000;
+
+    if (command_parse(&info, argc, argv)) {
+        print_usage();
+        return -EINVAL;
+    }
+
+    ret = gb_loopback_sweep(&info);
+    if (ret) {
+        print_test_case_result(LOG_TAG, info.case_id, ret, strerror(-ret));
+    } else {
+        print_test_case_result(LOG_TAG, info.case_id, ret, NULL);
+    }
+
+    return ret;
+}